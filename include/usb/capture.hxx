@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_CAPTURE_HXX
+#define USB_CAPTURE_HXX
+
+#include <cstdint>
+#include <array>
+#include "usb/types.hxx"
+
+namespace usb::capture
+{
+	/*!
+	 * The layouts here are shared with tools/capture2pcap.py - if you change
+	 * them, update the converter to match.
+	 */
+	enum class kind_t : uint8_t
+	{
+		setup = 0,
+		controllerOut = 1,
+		controllerIn = 2
+	};
+
+	struct recordHeader_t final
+	{
+		uint32_t timestamp;
+		// Endpoint number, with bit 7 set for controller IN endpoints
+		uint8_t endpoint;
+		kind_t kind;
+		// Full length of the packet, the first min(length, prefixLength) bytes of which follow the header
+		// unless the kind has kindNoData set
+		uint16_t length;
+	};
+	static_assert(sizeof(recordHeader_t) == 8);
+
+	// Set in a record's kind when the packet data was not available to capture
+	constexpr static uint8_t kindNoData{0x80U};
+
+	constexpr static uint32_t bufferMagic{0x50414355U}; // 'UCAP'
+
+#ifdef USB_CAPTURE
+	constexpr static uint16_t bufferSize{USB_CAPTURE_BUFFER_SIZE};
+	constexpr static uint16_t prefixLength{USB_CAPTURE_PREFIX};
+
+	/*!
+	 * This is laid out so a debugger can dump it as a binary blob (`dump binary value capture.bin usb::capture::buffer`)
+	 * and have tools/capture2pcap.py turn it into a pcap without needing symbol information.
+	 */
+	struct buffer_t final
+	{
+		uint32_t magic;
+		uint16_t size;
+		uint16_t prefixLength;
+		// How many bytes of data hold complete records
+		volatile uint16_t used;
+		// How many packets didn't fit and were not captured
+		volatile uint16_t dropped;
+		std::array<uint8_t, bufferSize> data;
+	};
+
+	extern buffer_t buffer;
+
+	// Must only be called from the USB interrupt context.
+	extern void packet(kind_t kind, uint8_t endpoint, const void *data, uint16_t length) noexcept;
+	// Marks the packet just captured on EP0 as having been a SETUP packet.
+	extern void setup() noexcept;
+
+	extern void start() noexcept;
+	extern void stop() noexcept;
+	// Throws away everything captured so far - capture must be stopped first.
+	extern void clear() noexcept;
+#else
+	inline void packet(kind_t, uint8_t, const void *, uint16_t) noexcept { }
+	inline void setup() noexcept { }
+	inline void start() noexcept { }
+	inline void stop() noexcept { }
+	inline void clear() noexcept { }
+#endif
+
+	inline void packetOut(const uint8_t endpoint, const void *const data, const uint16_t length) noexcept
+		{ packet(kind_t::controllerOut, endpoint, data, length); }
+	inline void packetIn(const uint8_t endpoint, const void *const data, const uint16_t length) noexcept
+		{ packet(kind_t::controllerIn, uint8_t(endpoint | 0x80U), data, length); }
+} // namespace usb::capture
+
+#endif /*USB_CAPTURE_HXX*/
@@ -14,6 +14,14 @@ namespace usb::constants
 	constexpr static uint8_t interfaceDescriptorCount{USB_INTERFACE_DESCRIPTORS};
 	constexpr static uint8_t endpointDescriptorCount{USB_ENDPOINT_DESCRIPTORS};
 	constexpr static uint8_t stringCount{USB_STRINGS};
+
+#ifdef USB_LPM
+	// BESL (Best Effort Service Latency) values for LPM, 0 (125us) to 15 (10ms)
+	constexpr static uint8_t lpmBaselineBESL{USB_LPM_BASELINE_BESL};
+	constexpr static uint8_t lpmDeepBESL{USB_LPM_DEEP_BESL};
+	static_assert(lpmBaselineBESL <= lpmDeepBESL && lpmDeepBESL <= 15U,
+		"The deep BESL must be at least the baseline BESL, and both must fit in 4 bits");
+#endif
 } // namespace ubs::constants
 
 #endif /*USB_CONSTANTS_HXX*/
@@ -19,6 +19,16 @@ namespace usb::core
 	};
 
 	using sofHandler_t = void (*)();
+#ifdef USB_LPM
+	/*!
+	 * Called from the USB interrupt when the host puts the link into L1 sleep. besl is the host's BESL
+	 * for this sleep, which bounds how long the device may take to be ready again once resumed. deep is
+	 * true when that's at least lpmDeepBESL, so there's time to gate more than the core clocks.
+	 */
+	using lowPowerEntryHandler_t = void (*)(uint8_t besl, bool deep);
+	// Called from the USB interrupt when the link comes out of L1, before any traffic resumes
+	using lowPowerExitHandler_t = void (*)();
+#endif
 
 	extern void init() noexcept;
 	extern void handleIRQ() noexcept;
@@ -37,15 +47,101 @@ namespace usb::core
 	extern void stallEP(uint8_t endpoint) noexcept;
 	extern uint16_t readEPDataAvail(uint8_t endpoint) noexcept;
 	extern void flushWriteEP(uint8_t endpoint) noexcept;
+	/*!
+	 * Sets an endpoint's halt feature, so it answers the host with STALL until the host clears it
+	 * with CLEAR_FEATURE(ENDPOINT_HALT), or the application does with clearHaltEP().
+	 */
+	extern void haltEP(usb::types::usbEP_t endpoint) noexcept;
+	// Clears an endpoint's halt feature and resets its data toggle to DATA0
+	extern void clearHaltEP(usb::types::usbEP_t endpoint) noexcept;
+	[[nodiscard]] extern bool epHalted(usb::types::usbEP_t endpoint) noexcept;
+	/*!
+	 * Halts an endpoint such that CLEAR_FEATURE(ENDPOINT_HALT) still succeeds but leaves it halted, for
+	 * class protocols that need the host to go through their own reset first. unwedgeEP() then lets
+	 * the host's next CLEAR_FEATURE work as normal, while clearHaltEP() clears both straight away.
+	 */
+	extern void wedgeEP(usb::types::usbEP_t endpoint) noexcept;
+	extern void unwedgeEP(usb::types::usbEP_t endpoint) noexcept;
+	[[nodiscard]] extern bool epWedged(usb::types::usbEP_t endpoint) noexcept;
+
+	/*!
+	 * Masks and unmasks the USB interrupt so code running outside it can start a transfer without
+	 * racing the endpoint handlers. These nest, and are safe to use from inside the interrupt too.
+	 */
+	extern void maskIRQ() noexcept;
+	extern void unmaskIRQ() noexcept;
+
+	// Holds the USB interrupt masked for its lifetime
+	struct irqMask_t final
+	{
+		irqMask_t() noexcept { maskIRQ(); }
+		irqMask_t(const irqMask_t &) = delete;
+		irqMask_t(irqMask_t &&) = delete;
+		~irqMask_t() noexcept { unmaskIRQ(); }
+		irqMask_t &operator =(const irqMask_t &) = delete;
+		irqMask_t &operator =(irqMask_t &&) = delete;
+	};
 
 	extern void registerHandler(usb::types::usbEP_t ep, uint8_t config, usb::types::handler_t handler) noexcept;
 	extern void unregisterHandler(usb::types::usbEP_t ep, uint8_t config) noexcept;
 	extern void initHandlers() noexcept;
 	extern void deinitHandlers() noexcept;
+	// Runs the init or deinit of the handler registered on a single endpoint in the active configuration
+	extern void initHandler(usb::types::usbEP_t ep) noexcept;
+	extern void deinitHandler(usb::types::usbEP_t ep) noexcept;
 	extern usb::types::handler_t handlerFor(usb::types::usbEP_t ep, uint8_t config) noexcept;
+#ifdef USB_STATIC_HANDLERS
+	/*!
+	 * Defined by the application, indexed [config - 1][endpoint - 1], when built with staticHandlers. The
+	 * complete set of endpoint handlers is then fixed at build time: the tables stay in Flash rather than
+	 * RAM, and with LTO the calls made through them can be resolved to the handlers directly.
+	 * registerHandler() and unregisterHandler() do nothing, but are kept so the drivers' registerHandlers()
+	 * still set the drivers up - the tables must hold the handlers the drivers export for this.
+	 */
+	extern const std::array<std::array<usb::types::handler_t, endpointCount - 1U>,
+		usb::constants::configsCount> inHandlers;
+	extern const std::array<std::array<usb::types::handler_t, endpointCount - 1U>,
+		usb::constants::configsCount> outHandlers;
+#endif
 
 	extern void registerSOFHandler(uint16_t interface, sofHandler_t handler) noexcept;
 	extern void unregsiterSOFHandler(uint16_t interface) noexcept;
+	/*!
+	 * @returns the 11-bit frame number, counted in software from the SOFs seen. This advances in step
+	 * with the host's frame number but is not aligned to it, so is only good for measuring intervals.
+	 */
+	[[nodiscard]] extern uint16_t frameNumber() noexcept;
+
+#ifdef USB_LPM
+	/*!
+	 * Registers the hooks the application uses to gate and ungate its clocks around L1 sleep. Exit from
+	 * L1 must complete within the BESL the host gave, which is as little as 125us.
+	 */
+	extern void registerLowPowerHandlers(lowPowerEntryHandler_t entry, lowPowerExitHandler_t exit) noexcept;
+	// @returns true while the host has the link in L1 sleep.
+	[[nodiscard]] extern bool linkSleeping() noexcept;
+#endif
+
+#ifdef USB_REMOTE_WAKEUP
+	/*!
+	 * Wakes the host from suspend, if it has enabled remote wakeup, so the first event after a spell of
+	 * idle isn't lost. On platforms where resume signalling is timed in software this blocks for the
+	 * 10ms it takes with the USB interrupt masked, so must not be called from the USB interrupt.
+	 * @returns false if the bus isn't suspended, has been suspended for under 5ms (in which case try
+	 * again later), or the host hasn't enabled remote wakeup.
+	 */
+	extern bool remoteWakeup() noexcept;
+	/*!
+	 * @returns how long, in microseconds, the last remote wakeup took from remoteWakeup() being called
+	 * to the first SOF after the host resumed the bus, or 0 if that hasn't happened yet.
+	 */
+	[[nodiscard]] extern uint32_t wakeupTime() noexcept;
+#endif
+
+	// This must be defined by the user firmware when any of the instrumentation or remote wakeup is
+	// enabled, or DFU has a Flash time budget set.
+	// Returns a free-running microsecond timestamp, which is allowed to wrap.
+	extern uint32_t timestamp() noexcept;
 } // namespace usb::core
 
 #endif /*USB_CORE_HXX*/
@@ -27,6 +27,7 @@ namespace usb::descriptors
 		security = 0x0CU,
 		key = 0x0DU,
 		encryptionType = 0x0EU,
+		bos = 0x0FU,
 		deviceCapability = 0x10U,
 		wirelessEndpoint = 0x11U,
 		hid = 0x21U,
@@ -165,6 +166,51 @@ namespace usb::descriptors
 #pragma GCC diagnostic pop
 #endif
 
+	enum class usbDeviceCapability_t : uint8_t
+	{
+		wirelessUSB = 0x01U,
+		usb2Extension = 0x02U,
+		superSpeed = 0x03U,
+		containerID = 0x04U,
+		platform = 0x05U
+	};
+
+	// USB 2.0 extension capability attributes (USB 2.0 LPM ECN)
+	constexpr static const uint32_t usb2ExtensionLPM{1U << 1U};
+	constexpr static const uint32_t usb2ExtensionBESL{1U << 2U};
+	constexpr static const uint32_t usb2ExtensionBaselineBESLValid{1U << 3U};
+	constexpr static const uint32_t usb2ExtensionDeepBESLValid{1U << 4U};
+	constexpr inline uint32_t usb2ExtensionBaselineBESL(const uint8_t besl) noexcept
+		{ return uint32_t(besl & 0x0FU) << 8U; }
+	constexpr inline uint32_t usb2ExtensionDeepBESL(const uint8_t besl) noexcept
+		{ return uint32_t(besl & 0x0FU) << 12U; }
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wattributes"
+#pragma GCC diagnostic ignored "-Wpacked"
+#endif
+	struct [[gnu::packed]] usbBOSDescriptor_t
+	{
+		uint8_t length;
+		usbDescriptor_t descriptorType;
+		uint16_t totalLength;
+		uint8_t numDeviceCaps;
+	};
+
+	struct [[gnu::packed]] usbUSB2ExtensionDescriptor_t
+	{
+		uint8_t length;
+		usbDescriptor_t descriptorType;
+		usbDeviceCapability_t capabilityType;
+		uint32_t attributes;
+	};
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+	static_assert(sizeof(usbBOSDescriptor_t) == 5U);
+	static_assert(sizeof(usbUSB2ExtensionDescriptor_t) == 7U);
+
 	namespace subclasses
 	{
 		enum class device_t : uint8_t
@@ -183,6 +229,35 @@ namespace usb::descriptors
 			dfu = 1
 		};
 
+		enum class cdc_t : uint8_t
+		{
+			none = 0x00U,
+			directLine = 0x01U,
+			abstractControl = 0x02U,
+			telephone = 0x03U,
+			multiChannel = 0x04U,
+			capi = 0x05U,
+			ethernet = 0x06U,
+			atm = 0x07U,
+			ncm = 0x0DU
+		};
+
+		enum class audio_t : uint8_t
+		{
+			undefined = 0x00U,
+			audioControl = 0x01U,
+			audioStreaming = 0x02U,
+			midiStreaming = 0x03U
+		};
+
+		enum class video_t : uint8_t
+		{
+			undefined = 0x00U,
+			videoControl = 0x01U,
+			videoStreaming = 0x02U,
+			interfaceCollection = 0x03U
+		};
+
 		enum class vendor_t : uint8_t
 		{
 			none = 0
@@ -209,6 +284,20 @@ namespace usb::descriptors
 			dfu = 2
 		};
 
+		enum class cdc_t : uint8_t
+		{
+			none = 0x00U,
+			at = 0x01U,
+			ntb = 0x01U,
+			vendor = 0xFFU
+		};
+
+		enum class video_t : uint8_t
+		{
+			undefined = 0x00U,
+			protocol15 = 0x01U
+		};
+
 		enum class vendor_t : uint8_t
 		{
 			none = 0,
@@ -621,6 +710,209 @@ namespace usb::descriptors
 			uint16_t dfuVersion;
 		};
 	} // namespace dfu
+
+	namespace cdc
+	{
+		enum class descriptor_t : uint8_t
+		{
+			interface = 0x24U,
+			endpoint = 0x25U
+		};
+
+		enum class subtype_t : uint8_t
+		{
+			header = 0x00U,
+			callManagement = 0x01U,
+			abstractControlManagement = 0x02U,
+			union_ = 0x06U,
+			ethernetNetworking = 0x0FU,
+			ncm = 0x1AU
+		};
+
+		enum class callManagement_t : uint8_t
+		{
+			none = 0x00U,
+			handlesCalls = 0x01U,
+			callsOverDataInterface = 0x02U
+		};
+
+		enum class acmCapabilities_t : uint8_t
+		{
+			none = 0x00U,
+			commFeature = 0x01U,
+			lineCoding = 0x02U,
+			sendBreak = 0x04U,
+			networkConnection = 0x08U
+		};
+
+		constexpr inline acmCapabilities_t operator |(const acmCapabilities_t a, const acmCapabilities_t b) noexcept
+			{ return static_cast<acmCapabilities_t>(uint8_t(a) | uint8_t(b)); }
+
+		enum class ncmCapabilities_t : uint8_t
+		{
+			none = 0x00U,
+			packetFilter = 0x01U,
+			netAddress = 0x02U,
+			encapsulatedCommand = 0x04U,
+			maxDatagramSize = 0x08U,
+			crcMode = 0x10U,
+			ntbInputSize8Byte = 0x20U
+		};
+
+		constexpr inline ncmCapabilities_t operator |(const ncmCapabilities_t a, const ncmCapabilities_t b) noexcept
+			{ return static_cast<ncmCapabilities_t>(uint8_t(a) | uint8_t(b)); }
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wattributes"
+#pragma GCC diagnostic ignored "-Wpacked"
+#endif
+		struct [[gnu::packed]] headerDescriptor_t final
+		{
+			uint8_t length;
+			descriptor_t descriptorType;
+			subtype_t descriptorSubtype;
+			uint16_t cdcVersion;
+		};
+
+		struct [[gnu::packed]] callManagementDescriptor_t final
+		{
+			uint8_t length;
+			descriptor_t descriptorType;
+			subtype_t descriptorSubtype;
+			callManagement_t capabilities;
+			uint8_t dataInterface;
+		};
+
+		struct [[gnu::packed]] acmDescriptor_t final
+		{
+			uint8_t length;
+			descriptor_t descriptorType;
+			subtype_t descriptorSubtype;
+			acmCapabilities_t capabilities;
+		};
+
+		struct [[gnu::packed]] unionDescriptor_t final
+		{
+			uint8_t length;
+			descriptor_t descriptorType;
+			subtype_t descriptorSubtype;
+			uint8_t controlInterface;
+			uint8_t subordinateInterface;
+		};
+
+		struct [[gnu::packed]] ethernetNetworkingDescriptor_t final
+		{
+			uint8_t length;
+			descriptor_t descriptorType;
+			subtype_t descriptorSubtype;
+			// String index of the MAC address, as 12 hex digits
+			uint8_t macAddress;
+			uint32_t ethernetStatistics;
+			uint16_t maxSegmentSize;
+			uint16_t numberMCFilters;
+			uint8_t numberPowerFilters;
+		};
+
+		struct [[gnu::packed]] ncmDescriptor_t final
+		{
+			uint8_t length;
+			descriptor_t descriptorType;
+			subtype_t descriptorSubtype;
+			uint16_t ncmVersion;
+			ncmCapabilities_t networkCapabilities;
+		};
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+		static_assert(sizeof(headerDescriptor_t) == 5);
+		static_assert(sizeof(callManagementDescriptor_t) == 5);
+		static_assert(sizeof(acmDescriptor_t) == 4);
+		static_assert(sizeof(unionDescriptor_t) == 5);
+		static_assert(sizeof(ethernetNetworkingDescriptor_t) == 13);
+		static_assert(sizeof(ncmDescriptor_t) == 6);
+	} // namespace cdc
+
+	namespace midi
+	{
+		enum class descriptor_t : uint8_t
+		{
+			interface = 0x24U,
+			endpoint = 0x25U
+		};
+
+		enum class subtype_t : uint8_t
+		{
+			header = 0x01U,
+			inJack = 0x02U,
+			outJack = 0x03U,
+			element = 0x04U,
+			// The subtype of a class-specific endpoint descriptor
+			general = 0x01U
+		};
+
+		enum class jackType_t : uint8_t
+		{
+			embedded = 0x01U,
+			external = 0x02U
+		};
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wattributes"
+#pragma GCC diagnostic ignored "-Wpacked"
+#endif
+		struct [[gnu::packed]] headerDescriptor_t final
+		{
+			uint8_t length;
+			descriptor_t descriptorType;
+			subtype_t descriptorSubtype;
+			uint16_t mscVersion;
+			// Length of the class-specific descriptors, this one included
+			uint16_t totalLength;
+		};
+
+		struct [[gnu::packed]] inJackDescriptor_t final
+		{
+			uint8_t length;
+			descriptor_t descriptorType;
+			subtype_t descriptorSubtype;
+			jackType_t jackType;
+			uint8_t jackID;
+			uint8_t jackString;
+		};
+
+		// OUT jack with a single input pin
+		struct [[gnu::packed]] outJackDescriptor_t final
+		{
+			uint8_t length;
+			descriptor_t descriptorType;
+			subtype_t descriptorSubtype;
+			jackType_t jackType;
+			uint8_t jackID;
+			uint8_t inputPins;
+			uint8_t sourceID;
+			uint8_t sourcePin;
+			uint8_t jackString;
+		};
+
+		// Class-specific endpoint descriptor for an endpoint carrying a single embedded jack
+		struct [[gnu::packed]] endpointDescriptor_t final
+		{
+			uint8_t length;
+			descriptor_t descriptorType;
+			subtype_t descriptorSubtype;
+			uint8_t embeddedJacks;
+			uint8_t jackID;
+		};
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+		static_assert(sizeof(headerDescriptor_t) == 7);
+		static_assert(sizeof(inJackDescriptor_t) == 6);
+		static_assert(sizeof(outJackDescriptor_t) == 9);
+		static_assert(sizeof(endpointDescriptor_t) == 5);
+	} // namespace midi
 } // namespace usb::descriptors
 
 #include "usb/platforms/types.hxx"
@@ -25,6 +25,14 @@ namespace usb::types
 		syncFrame = 12
 	};
 
+	// Feature selectors for SET_FEATURE and CLEAR_FEATURE
+	enum class feature_t : uint16_t
+	{
+		endpointHalt = 0,
+		deviceRemoteWakeup = 1,
+		testMode = 2
+	};
+
 	namespace setupPacket
 	{
 		using usb::descriptors::usbDescriptor_t;
@@ -169,6 +177,17 @@ namespace usb::device
 	extern void unregisterHandler(uint8_t interface, uint8_t config) noexcept;
 	extern void registerAltModeHandler(uint8_t interface, uint8_t config, altModeHandler_t handler) noexcept;
 	extern void unregisterAltModeHandler(uint8_t interface, uint8_t config) noexcept;
+
+#ifdef USB_STATIC_HANDLERS
+	/*!
+	 * Defined by the application, indexed [config - 1][interface], in place of registering control and
+	 * alternate setting handlers when built with staticHandlers (see usb::core::inHandlers).
+	 */
+	extern const std::array<std::array<controlHandler_t, usb::constants::interfaceCount>,
+		usb::constants::configsCount> controlHandlers;
+	extern const std::array<std::array<altModeHandler_t, usb::constants::interfaceCount>,
+		usb::constants::configsCount> altModeHandlers;
+#endif
 } // namespace usb::device
 
 #endif /*USB_DEVICE_HXX*/
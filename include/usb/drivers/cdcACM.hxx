@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_DRIVERS_CDC_ACM__HXX
+#define USB_DRIVERS_CDC_ACM__HXX
+
+#include <cstdint>
+#include "usb/ring.hxx"
+#include "usb/drivers/cdcACMTypes.hxx"
+#include "usb/types.hxx"
+
+namespace usb::cdc::acm
+{
+	struct endpoints_t final
+	{
+		uint8_t notification;
+		uint8_t dataIn;
+		uint8_t dataOut;
+	};
+
+	// How many frames a short packet may wait in the TX ring for more data before it is sent anyway
+	constexpr static uint8_t flushDeadline{USB_CDC_FLUSH_DEADLINE};
+
+	/*!
+	 * Registers the driver against the communications interface given and the data interface that
+	 * follows it. Both rings are owned by the application and must outlive the driver: data received
+	 * from the host is placed directly into rxRing, and data is sent to the host directly out of txRing.
+	 * When rxRing has no room for another packet, OUT packets are NAKed till the application reads
+	 * some data back out.
+	 */
+	extern void registerHandlers(uint8_t interface, uint8_t config, endpoints_t endpoints,
+		ring_t &rxRing, ring_t &txRing) noexcept;
+
+#ifdef USB_STATIC_HANDLERS
+	/*!
+	 * The driver's handlers, for the application's tables when built with staticHandlers. They go against
+	 * the interface and endpoints handed to registerHandlers(), which must still be called.
+	 */
+	extern usb::types::answer_t handleACMRequest(std::size_t interface) noexcept;
+	extern void initNotification(uint8_t endpoint) noexcept;
+	extern void handleNotification(uint8_t endpoint) noexcept;
+	extern void initDataIn(uint8_t endpoint) noexcept;
+	extern void handleDataIn(uint8_t endpoint) noexcept;
+	extern void initDataOut(uint8_t endpoint) noexcept;
+	extern void deinitDataOut(uint8_t endpoint) noexcept;
+	extern void handleDataOut(uint8_t endpoint) noexcept;
+
+	constexpr inline usb::types::handler_t notificationHandler{initNotification, nullptr, handleNotification};
+	constexpr inline usb::types::handler_t dataInHandler{initDataIn, nullptr, handleDataIn};
+	constexpr inline usb::types::handler_t dataOutHandler{initDataOut, deinitDataOut, handleDataOut};
+#endif
+
+	// Asks for whatever is in the TX ring to be sent at the next frame without waiting for the deadline.
+	extern void flush() noexcept;
+	[[nodiscard]] extern bool connected() noexcept;
+	[[nodiscard]] extern types::lineCoding_t lineCoding() noexcept;
+	[[nodiscard]] extern uint16_t controlLineState() noexcept;
+	// Queues a SERIAL_STATE notification to the host with the types::serialState* bits given.
+	extern void serialState(uint16_t state) noexcept;
+} // namespace usb::cdc::acm
+
+#endif /*USB_DRIVERS_CDC_ACM__HXX*/
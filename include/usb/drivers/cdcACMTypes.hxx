@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_DRIVERS_CDC_ACM_TYPES__HXX
+#define USB_DRIVERS_CDC_ACM_TYPES__HXX
+
+#include <cstdint>
+
+namespace usb::cdc::acm::types
+{
+	enum class request_t : uint8_t
+	{
+		sendEncapsulatedCommand = 0x00U,
+		getEncapsulatedResponse = 0x01U,
+		setLineCoding = 0x20U,
+		getLineCoding = 0x21U,
+		setControlLineState = 0x22U,
+		sendBreak = 0x23U
+	};
+
+	enum class notification_t : uint8_t
+	{
+		networkConnection = 0x00U,
+		responseAvailable = 0x01U,
+		serialState = 0x20U
+	};
+
+	enum class stopBits_t : uint8_t
+	{
+		one = 0,
+		onePointFive = 1,
+		two = 2
+	};
+
+	enum class parity_t : uint8_t
+	{
+		none = 0,
+		odd = 1,
+		even = 2,
+		mark = 3,
+		space = 4
+	};
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wattributes"
+#pragma GCC diagnostic ignored "-Wpacked"
+#endif
+	struct [[gnu::packed]] lineCoding_t final
+	{
+		uint32_t baudRate;
+		stopBits_t stopBits;
+		parity_t parity;
+		uint8_t dataBits;
+	};
+
+	struct [[gnu::packed]] serialStateNotification_t final
+	{
+		uint8_t requestType;
+		notification_t notification;
+		uint16_t value;
+		uint16_t index;
+		uint16_t length;
+		uint16_t state;
+	};
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+	static_assert(sizeof(lineCoding_t) == 7);
+	static_assert(sizeof(serialStateNotification_t) == 10);
+
+	// Bits for SET_CONTROL_LINE_STATE's wValue
+	constexpr static uint16_t controlLineDTR{0x0001U};
+	constexpr static uint16_t controlLineRTS{0x0002U};
+
+	// Bits for the SERIAL_STATE notification's data
+	constexpr static uint16_t serialStateDCD{0x0001U};
+	constexpr static uint16_t serialStateDSR{0x0002U};
+	constexpr static uint16_t serialStateBreak{0x0004U};
+	constexpr static uint16_t serialStateRing{0x0008U};
+	constexpr static uint16_t serialStateFraming{0x0010U};
+	constexpr static uint16_t serialStateParity{0x0020U};
+	constexpr static uint16_t serialStateOverrun{0x0040U};
+} // namespace usb::cdc::acm::types
+
+#endif /*USB_DRIVERS_CDC_ACM_TYPES__HXX*/
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_DRIVERS_CDC_NCM__HXX
+#define USB_DRIVERS_CDC_NCM__HXX
+
+#include <cstdint>
+#include "usb/drivers/cdcNCMTypes.hxx"
+#include "usb/types.hxx"
+
+namespace usb::cdc::ncm
+{
+	// The largest NTB (NCM Transfer Block) handled in either direction
+	constexpr static uint16_t ntbSize{USB_NCM_NTB_SIZE};
+	// The most Ethernet frames packed into one NTB sent to the host
+	constexpr static uint8_t maxDatagrams{USB_NCM_MAX_DATAGRAMS};
+	// How many frames a queued Ethernet frame may wait for others to share its NTB before it is sent anyway
+	constexpr static uint8_t aggregationTimeout{USB_NCM_AGGREGATION_TIMEOUT};
+	// The largest Ethernet frame, without its FCS
+	constexpr static uint16_t maxFrameSize{1514U};
+	static_assert(maxDatagrams >= 1U && (maxDatagrams & (maxDatagrams - 1U)) == 0U,
+		"The CDC-NCM datagram count must be a power of 2");
+
+	struct endpoints_t final
+	{
+		uint8_t notification;
+		uint8_t dataIn;
+		uint8_t dataOut;
+	};
+
+	// One piece of an Ethernet frame to be sent
+	struct segment_t final
+	{
+		const void *data;
+		uint16_t length;
+	};
+
+	/*!
+	 * The network stack behind the driver. Both hooks are called from the USB interrupt.
+	 * receive() is handed each Ethernet frame the host sends, pointing into the NTB receive buffer,
+	 * so the frame is only valid for the duration of the call. transmitted() is handed back the
+	 * context given to transmit() once that frame has been sent and its segments may be reused.
+	 */
+	struct netif_t final
+	{
+		void (*receive)(const uint8_t *frame, uint16_t length);
+		void (*transmitted)(const void *context);
+	};
+
+	/*!
+	 * Registers the driver against the communications interface given and the data interface that
+	 * follows it, which must have an alternate setting 0 without endpoints and 1 with them as the
+	 * specification requires. Frames are packed into NTBs in both directions: frames to the host are
+	 * gathered into an NTB straight out of their segments, and frames from the host are handed to
+	 * netif in place.
+	 */
+	extern void registerHandlers(uint8_t interface, uint8_t config, endpoints_t endpoints,
+		const netif_t &netif) noexcept;
+
+#ifdef USB_STATIC_HANDLERS
+	/*!
+	 * The driver's handlers, for the application's tables when built with staticHandlers. handleSetInterface()
+	 * goes against the data interface (interface + 1), the rest against the interface and endpoints handed
+	 * to registerHandlers(), which must still be called.
+	 */
+	extern usb::types::answer_t handleNCMRequest(std::size_t interface) noexcept;
+	extern bool handleSetInterface() noexcept;
+	extern void initNotification(uint8_t endpoint) noexcept;
+	extern void handleNotification(uint8_t endpoint) noexcept;
+	extern void handleDataIn(uint8_t endpoint) noexcept;
+	extern void initDataOut(uint8_t endpoint) noexcept;
+	extern void deinitDataOut(uint8_t endpoint) noexcept;
+	extern void handleDataOut(uint8_t endpoint) noexcept;
+
+	constexpr inline usb::types::handler_t notificationHandler{initNotification, nullptr, handleNotification};
+	constexpr inline usb::types::handler_t dataInHandler{nullptr, nullptr, handleDataIn};
+	constexpr inline usb::types::handler_t dataOutHandler{initDataOut, deinitDataOut, handleDataOut};
+#endif
+
+	/*!
+	 * Queues an Ethernet frame made up of count segments to be sent to the host, returning false if it
+	 * can't be queued. Neither the segment list nor the data it points to is copied, and both must stay
+	 * valid till netif.transmitted() is called with context. Frames are held for up to
+	 * aggregationTimeout frames so more can be packed into the same NTB.
+	 */
+	extern bool transmit(const segment_t *segments, uint8_t count, const void *context) noexcept;
+	// Tells the host the link has gone up or down.
+	extern void linkState(bool up) noexcept;
+	// @returns true while the host has the data interface enabled.
+	[[nodiscard]] extern bool active() noexcept;
+	[[nodiscard]] extern uint16_t packetFilter() noexcept;
+} // namespace usb::cdc::ncm
+
+#endif /*USB_DRIVERS_CDC_NCM__HXX*/
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_DRIVERS_CDC_NCM_TYPES__HXX
+#define USB_DRIVERS_CDC_NCM_TYPES__HXX
+
+#include <cstdint>
+
+namespace usb::cdc::ncm::types
+{
+	enum class request_t : uint8_t
+	{
+		setEthernetMulticastFilters = 0x40U,
+		setEthernetPowerManagementPatternFilter = 0x41U,
+		getEthernetPowerManagementPatternFilter = 0x42U,
+		setEthernetPacketFilter = 0x43U,
+		getEthernetStatistic = 0x44U,
+		getNTBParameters = 0x80U,
+		getNetAddress = 0x81U,
+		setNetAddress = 0x82U,
+		getNTBFormat = 0x83U,
+		setNTBFormat = 0x84U,
+		getNTBInputSize = 0x85U,
+		setNTBInputSize = 0x86U,
+		getMaxDatagramSize = 0x87U,
+		setMaxDatagramSize = 0x88U,
+		getCRCMode = 0x89U,
+		setCRCMode = 0x8AU
+	};
+
+	enum class notification_t : uint8_t
+	{
+		networkConnection = 0x00U,
+		responseAvailable = 0x01U,
+		connectionSpeedChange = 0x2AU
+	};
+
+	enum class ntbFormat_t : uint16_t
+	{
+		ntb16 = 0x0000U,
+		ntb32 = 0x0001U
+	};
+
+	constexpr static uint16_t ntbFormatsSupported16{0x0001U};
+
+	constexpr static uint32_t nth16Signature{0x484D434EU}; // 'NCMH'
+	constexpr static uint32_t ndp16Signature{0x304D434EU}; // 'NCM0', no CRC
+	constexpr static uint32_t ndp16CRCSignature{0x314D434EU}; // 'NCM1'
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wattributes"
+#pragma GCC diagnostic ignored "-Wpacked"
+#endif
+	struct [[gnu::packed]] ntbParameters_t final
+	{
+		uint16_t length;
+		uint16_t ntbFormatsSupported;
+		uint32_t ntbInMaxSize;
+		uint16_t ndpInDivisor;
+		uint16_t ndpInPayloadRemainder;
+		uint16_t ndpInAlignment;
+		uint16_t reserved;
+		uint32_t ntbOutMaxSize;
+		uint16_t ndpOutDivisor;
+		uint16_t ndpOutPayloadRemainder;
+		uint16_t ndpOutAlignment;
+		uint16_t ntbOutMaxDatagrams;
+	};
+
+	// NCM Transfer Header, which starts every 16-bit NTB
+	struct [[gnu::packed]] nth16_t final
+	{
+		uint32_t signature;
+		uint16_t headerLength;
+		uint16_t sequence;
+		uint16_t blockLength;
+		uint16_t ndpIndex;
+	};
+
+	// NCM Datagram Pointer table header, followed by datagramPointer16_t's ending in a {0, 0} entry
+	struct [[gnu::packed]] ndp16_t final
+	{
+		uint32_t signature;
+		uint16_t length;
+		uint16_t nextNdpIndex;
+	};
+
+	struct [[gnu::packed]] datagramPointer16_t final
+	{
+		uint16_t index;
+		uint16_t length;
+	};
+
+	struct [[gnu::packed]] notificationHeader_t final
+	{
+		uint8_t requestType;
+		notification_t notification;
+		uint16_t value;
+		uint16_t index;
+		uint16_t length;
+	};
+
+	struct [[gnu::packed]] speedChangeNotification_t final
+	{
+		notificationHeader_t header;
+		uint32_t downstreamBitRate;
+		uint32_t upstreamBitRate;
+	};
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+	static_assert(sizeof(ntbParameters_t) == 28);
+	static_assert(sizeof(nth16_t) == 12);
+	static_assert(sizeof(ndp16_t) == 8);
+	static_assert(sizeof(datagramPointer16_t) == 4);
+	static_assert(sizeof(notificationHeader_t) == 8);
+	static_assert(sizeof(speedChangeNotification_t) == 16);
+} // namespace usb::cdc::ncm::types
+
+#endif /*USB_DRIVERS_CDC_NCM_TYPES__HXX*/
@@ -2,7 +2,9 @@
 #define USB_DRIVERS_DFU___HXX
 
 #include <cstdint>
+#include <array>
 #include <substrate/span>
+#include "usb/types.hxx"
 
 namespace usb::dfu
 {
@@ -15,10 +17,63 @@ namespace usb::dfu
 	constexpr static std::size_t flashPageSize{USB_DFU_FLASH_PAGE_SIZE};
 	constexpr static std::size_t flashBufferSize{USB_DFU_FLASH_BUFFER_SIZE};
 	constexpr static std::size_t flashEraseSize{USB_DFU_FLASH_ERASE_SIZE};
+	// How many flashPageSize buffers downloads are received into while earlier blocks are programmed
+	constexpr static uint8_t downloadBuffers{USB_DFU_DOWNLOAD_BUFFERS};
+	static_assert(downloadBuffers >= 1U, "The DFU driver needs at least one download buffer");
+	// How long, in microseconds, each pass of the Flash state machine may wait on Flash to issue more operations
+	constexpr static uint32_t flashBudget{USB_DFU_FLASH_BUDGET};
+#ifdef USB_DFU_COMPRESSED
+	// The heatshrink window and lookahead sizes (-w and -l) the download stream was compressed with
+	constexpr static uint8_t compressionWindowBits{USB_DFU_HEATSHRINK_WINDOW};
+	constexpr static uint8_t compressionLookaheadBits{USB_DFU_HEATSHRINK_LOOKAHEAD};
+	static_assert(compressionWindowBits >= 4U && compressionWindowBits <= 14U,
+		"The heatshrink window must be between 4 and 14 bits");
+	static_assert(compressionLookaheadBits >= 3U && compressionLookaheadBits < compressionWindowBits,
+		"The heatshrink lookahead must be at least 3 bits and smaller than the window");
+#endif
+
+#ifdef USB_DFU_VERIFY
+#ifdef USB_DFU_VERIFY_CRC32
+	// Images are verified against their CRC-32 (as zlib computes it), stored little endian
+	constexpr static std::size_t digestLength{4U};
+#else
+	// Images are verified against their SHA-256
+	constexpr static std::size_t digestLength{32U};
+#endif
+	using digest_t = std::array<uint8_t, digestLength>;
+#endif
 
 	extern void registerHandlers(substrate::span<const zone_t> flashZones,
 		uint8_t interface, uint8_t config) noexcept;
+
+#ifdef USB_STATIC_HANDLERS
+	// The driver's control and alternate setting handlers, for the application's tables with staticHandlers
+	extern usb::types::answer_t handleDFURequest(std::size_t interface) noexcept;
+	extern bool handleSetInterface();
+#endif
+
 	extern void detached(bool state) noexcept;
+	/*!
+	 * @returns how many erase units the current download has left untouched because Flash already held
+	 * their data. Always 0 unless delta flashing is enabled, which needs flashPageSize to be a whole
+	 * number of erase units as each unit is compared against a single block.
+	 */
+	[[nodiscard]] extern std::size_t eraseUnitsSkipped() noexcept;
+	/*!
+	 * Tells the driver the last erase or write has finished so the next can be issued straight away,
+	 * rather than at the next SOF. Call this from the Flash controller's completion interrupt if that
+	 * runs at the USB interrupt's priority, or otherwise from a main loop poll with the USB interrupt
+	 * masked. It is safe to call when nothing has finished.
+	 */
+	extern void flashReady() noexcept;
+#ifdef USB_DFU_VERIFY
+	/*!
+	 * Gives the digest the next download must match, for when the host sends it some other way than
+	 * as a trailer. Without one, the last digestLength bytes of the image are taken as the digest of
+	 * the rest. Downloads that fail verification are reported as dfuERROR with errVERIFY.
+	 */
+	extern void expectDigest(const digest_t &digest) noexcept;
+#endif
 
 	// These must be defined by the user firmware.
 	// Called by the DFU driver to reboot the device correctly
@@ -29,6 +84,16 @@ namespace usb::dfu
 	extern void write(std::uintptr_t address, std::size_t count, const uint8_t *buffer) noexcept;
 	// Tells the driver if Flash is currently busy as a result of one of the above.
 	extern bool flashBusy() noexcept;
+#ifdef USB_DFU_HARDWARE_CRC
+	// Called by the DFU driver to continue the CRC-32 crc over data, as zlib's crc32() does, using the CRC unit
+	extern uint32_t crc32(uint32_t crc, const uint8_t *data, std::size_t length) noexcept;
+#endif
+#ifdef USB_DFU_DFUSE
+	// Called by the DFU driver to erase the whole of a zone in one go, for the DfuSe mass erase command
+	extern void massErase(const zone_t &zone) noexcept;
+	// Called by the DFU driver to lift read protection (which on most parts mass erases Flash and resets)
+	extern void readUnprotect() noexcept;
+#endif
 } // namespace usb::dfu
 
 #endif /*USB_DRIVERS_DFU___HXX*/
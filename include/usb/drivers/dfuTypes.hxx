@@ -64,18 +64,57 @@ namespace usb::dfu::types
 	{
 		none,
 		erase,
+		massErase,
 		write
 	};
 
+	// What a queued download block asks for
+	enum class blockOp_t : uint8_t
+	{
+		// Sequential DFU data, erasing the zone ahead of it as it goes
+		write,
+		// DfuSe data, written to its address into Flash the host has already erased
+		program,
+		// DfuSe erase of the erase unit holding address
+		erase,
+		// DfuSe erase of the whole zone
+		massErase
+	};
+
+	struct block_t final
+	{
+		std::uintptr_t address;
+		std::size_t length;
+		blockOp_t op;
+	};
+
+	// The commands sent in DfuSe block 0 downloads
+	enum class dfuseCommand_t : uint8_t
+	{
+		getCommands = 0x00U,
+		setAddress = 0x21U,
+		erase = 0x41U,
+		readUnprotect = 0x92U
+	};
+
 	struct flashState_t final
 	{
+		std::uintptr_t startAddr;
 		std::uintptr_t readAddr;
 		std::uintptr_t eraseAddr;
 		std::uintptr_t writeAddr;
+		// Where the next block the host sends will be written
+		std::uintptr_t downloadAddr;
 		std::uintptr_t endAddr;
-		std::size_t byteCount;
+		// How far through programming the oldest pending block we are
 		std::size_t offset;
 		flashOp_t op;
+		// Whether the erase unit being written already held the data, so needs neither erasing nor writing
+		bool skipUnit;
+		// The frame the operation in progress was started in
+		uint16_t opStart;
+		// Which of the zones is selected
+		uint8_t zone;
 	};
 } // namespace usb::dfu::types
 
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_DRIVERS_HID__HXX
+#define USB_DRIVERS_HID__HXX
+
+#include <cstdint>
+#include "usb/types.hxx"
+
+namespace usb::hid
+{
+	enum class request_t : uint8_t
+	{
+		getReport = 0x01U,
+		getIdle = 0x02U,
+		getProtocol = 0x03U,
+		setReport = 0x09U,
+		setIdle = 0x0AU,
+		setProtocol = 0x0BU
+	};
+
+	enum class protocol_t : uint8_t
+	{
+		boot = 0,
+		report = 1
+	};
+
+	// Called with each output or feature report the host sends with SET_REPORT
+	using reportHandler_t = void (*)(usb::types::setupPacket::reportType_t type, uint8_t id,
+		const uint8_t *data, uint16_t length);
+
+	/*!
+	 * Registers the driver against the interface given, with its input reports sent on the interrupt IN
+	 * endpoint given. The report descriptor is served as-is, from Flash on parts with segmented memory.
+	 * Input reports are at most one packet (epBufferSize bytes) long, and if the descriptor uses
+	 * report IDs the first byte of each report is its ID. usb/drivers/hidReport.hxx can build the
+	 * descriptor and matching report layout at compile time.
+	 */
+	extern void registerHandlers(uint8_t interface, uint8_t config, uint8_t endpoint,
+		const void *reportDescriptor, uint16_t reportDescriptorLength, uint8_t reportLength,
+		reportHandler_t reportHandler = nullptr) noexcept;
+
+#ifdef USB_STATIC_HANDLERS
+	/*!
+	 * The driver's handlers, for the application's tables when built with staticHandlers. registerHandlers()
+	 * must still be called to give the driver its interface, endpoint and report descriptor.
+	 */
+	extern usb::types::answer_t handleHIDRequest(std::size_t interface) noexcept;
+	extern void initEndpoint(uint8_t endpoint) noexcept;
+	extern void deinitEndpoint(uint8_t endpoint) noexcept;
+	extern void handleReportSent(uint8_t endpoint) noexcept;
+
+	constexpr inline usb::types::handler_t endpointHandler{initEndpoint, deinitEndpoint, handleReportSent};
+#endif
+
+	/*!
+	 * Input reports are double buffered: fill in the buffer nextReport() returns, then publish it with
+	 * submitReport() which swaps it in as the latest report in one step. The buffer handed out holds
+	 * the report from two submissions ago, so every field must be rewritten.
+	 */
+	[[nodiscard]] extern uint8_t *nextReport() noexcept;
+	extern void submitReport() noexcept;
+	// Copies the report given into the next buffer and submits it.
+	extern void submitReport(const void *report) noexcept;
+
+	[[nodiscard]] extern protocol_t protocol() noexcept;
+	// The idle rate the host set, in units of 4ms, where 0 means only send reports when they change
+	[[nodiscard]] extern uint8_t idleRate() noexcept;
+} // namespace usb::hid
+
+#endif /*USB_DRIVERS_HID__HXX*/
@@ -0,0 +1,399 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_DRIVERS_HID_REPORT__HXX
+#define USB_DRIVERS_HID_REPORT__HXX
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <algorithm>
+#include <type_traits>
+#include "usb/descriptors.hxx"
+
+/*!
+ * Compile-time HID report descriptor builder. A report is described once as a tree of elements:
+ *
+ *   struct buttons; struct x; struct y;
+ *   using mouse_t = descriptor_t<usagePage<usagePage_t::genericDesktop>, usage<0x02U>,
+ *     collection<collectionType_t::application, usage<0x01U>,
+ *       collection<collectionType_t::physical,
+ *         usagePage<0x09U>, usageRange<1U, 3U>, input<buttons, 1, 3, 0, 1>, padding<5>,
+ *         usagePage<usagePage_t::genericDesktop>, usage<0x30U>, usage<0x31U>, input<x, 8, 2, -127, 127>
+ *       >
+ *     >
+ *   >;
+ *
+ * from which mouse_t::bytes is the report descriptor to hand the HID driver, and report_t<mouse_t> is
+ * the matching input report with each field's bit offset fixed at compile time - report.set<x>(0, dx)
+ * sets the first element of x, and is a plain store for byte-aligned fields. The descriptor bytes are
+ * re-parsed at compile time and checked against the layout the report types use, so the two can never
+ * disagree.
+ *
+ * Report IDs and push/pop are not supported by the builder.
+ */
+namespace usb::hid::report
+{
+	using usb::descriptors::hid::descriptorType_t;
+	using usb::descriptors::hid::collectionType_t;
+	using usb::descriptors::hid::usagePage_t;
+	using usb::descriptors::hid::main_t;
+	using kind_t = usb::descriptors::hid::items::main_t;
+	namespace items = usb::descriptors::hid::items;
+
+	namespace internal
+	{
+		template<typename... types> struct list_t final { };
+
+		template<typename... lists> struct concat_t;
+		template<> struct concat_t<> { using type = list_t<>; };
+		template<typename... a> struct concat_t<list_t<a...>> { using type = list_t<a...>; };
+		template<typename... a, typename... b, typename... rest> struct concat_t<list_t<a...>, list_t<b...>, rest...>
+			{ using type = typename concat_t<list_t<a..., b...>, rest...>::type; };
+
+		template<typename... lists> using concatLists = typename concat_t<lists...>::type;
+
+		template<size_t... sizes> constexpr auto concat(const std::array<uint8_t, sizes> &...arrays) noexcept
+		{
+			std::array<uint8_t, (sizes + ... + 0U)> result{};
+			size_t offset{};
+			([&](const auto &array) noexcept
+			{
+				for (const auto &value : array)
+					result[offset++] = value;
+			}(arrays), ...);
+			return result;
+		}
+
+		constexpr inline size_t unsignedSize(const uint32_t value) noexcept
+			{ return value <= UINT8_MAX ? 1U : value <= UINT16_MAX ? 2U : 4U; }
+		constexpr inline size_t signedSize(const int32_t value) noexcept
+			{ return value >= INT8_MIN && value <= INT8_MAX ? 1U : value >= INT16_MIN && value <= INT16_MAX ? 2U : 4U; }
+
+		template<size_t size> constexpr auto encode(const uint8_t prefix, const uint32_t value) noexcept
+		{
+			std::array<uint8_t, size + 1U> result{};
+			result[0] = uint8_t(prefix | usb::descriptors::hid::descriptorSize(size));
+			for (size_t i{}; i < size; ++i)
+				result[i + 1U] = uint8_t(value >> (i * 8U));
+			return result;
+		}
+
+		template<uint8_t prefix, uint32_t value> constexpr auto item() noexcept
+			{ return encode<unsignedSize(value)>(prefix, value); }
+		template<uint8_t prefix, int32_t value> constexpr auto signedItem() noexcept
+			{ return encode<signedSize(value)>(prefix, uint32_t(value)); }
+
+		constexpr inline uint8_t prefix(const items::global_t item) noexcept
+			{ return uint8_t(item) | uint8_t(descriptorType_t::global); }
+		constexpr inline uint8_t prefix(const items::local_t item) noexcept
+			{ return uint8_t(item) | uint8_t(descriptorType_t::local); }
+		constexpr inline uint8_t prefix(const items::main_t item) noexcept
+			{ return uint8_t(item) | uint8_t(descriptorType_t::main); }
+
+		template<kind_t kind_, typename tag_, uint8_t size_, uint8_t count_> struct field_t final
+		{
+			constexpr static kind_t kind{kind_};
+			using tag = tag_;
+			constexpr static uint8_t size{size_};
+			constexpr static uint8_t count{count_};
+		};
+
+		/*!
+		 * Walks a report descriptor the way a host does, checking each main item it finds has the same
+		 * kind and size as the next field in the list given.
+		 */
+		template<size_t length, size_t fieldCount> constexpr bool matches(const std::array<uint8_t, length> &bytes,
+			const std::array<kind_t, fieldCount> &kinds, const std::array<uint16_t, fieldCount> &bits) noexcept
+		{
+			uint32_t reportSize{};
+			uint32_t reportCount{};
+			size_t field{};
+			for (size_t offset{}; offset < length;)
+			{
+				const auto itemPrefix{bytes[offset]};
+				// Skip over long items
+				if (itemPrefix == 0xFEU)
+				{
+					if (offset + 1U >= length)
+						return false;
+					offset += 3U + bytes[offset + 1U];
+					continue;
+				}
+				const auto sizeCode{uint8_t(itemPrefix & 0x03U)};
+				const size_t size{sizeCode == 3U ? 4U : sizeCode};
+				if (offset + size >= length)
+					return false;
+				uint32_t value{};
+				for (size_t i{}; i < size; ++i)
+					value |= uint32_t(bytes[offset + 1U + i]) << (i * 8U);
+				offset += size + 1U;
+
+				const auto tag{uint8_t(itemPrefix & 0xFCU)};
+				if (tag == prefix(items::global_t::reportSize))
+					reportSize = value;
+				else if (tag == prefix(items::global_t::reportCount))
+					reportCount = value;
+				else if (tag == prefix(items::global_t::reportID) || tag == prefix(items::global_t::push) ||
+					tag == prefix(items::global_t::pop))
+					return false;
+				else if (tag == prefix(kind_t::input) || tag == prefix(kind_t::output) || tag == prefix(kind_t::feaure))
+				{
+					if (field == fieldCount || prefix(kinds[field]) != tag || bits[field] != reportSize * reportCount)
+						return false;
+					++field;
+				}
+			}
+			return field == fieldCount;
+		}
+	} // namespace internal
+
+	template<auto page> struct usagePage final
+	{
+		constexpr static auto bytes{internal::item<internal::prefix(items::global_t::usagePage), uint32_t(page)>()};
+		using fields = internal::list_t<>;
+	};
+
+	template<auto id> struct usage final
+	{
+		constexpr static auto bytes{internal::item<internal::prefix(items::local_t::usage), uint32_t(id)>()};
+		using fields = internal::list_t<>;
+	};
+
+	template<auto minimum, auto maximum> struct usageRange final
+	{
+		constexpr static auto bytes
+		{
+			internal::concat(
+				internal::item<internal::prefix(items::local_t::usageMinimum), uint32_t(minimum)>(),
+				internal::item<internal::prefix(items::local_t::usageMaximum), uint32_t(maximum)>()
+			)
+		};
+		using fields = internal::list_t<>;
+	};
+
+	template<collectionType_t type, typename... elements> struct collection final
+	{
+		constexpr static auto bytes
+		{
+			internal::concat(
+				internal::item<internal::prefix(kind_t::collection), uint32_t(type)>(),
+				elements::bytes...,
+				std::array<uint8_t, 1>{internal::prefix(kind_t::endCollection)}
+			)
+		};
+		using fields = internal::concatLists<typename elements::fields...>;
+	};
+
+	/*!
+	 * A data field of count elements, each size bits, within a report. tag is any type (it need not be
+	 * complete) used to name the field when filling in or reading back the report.
+	 */
+	template<kind_t kind, typename tag, uint8_t size, uint8_t count, int32_t minimum, int32_t maximum,
+		uint8_t flags = uint8_t(main_t::variable)> struct field final
+	{
+		static_assert(size > 0U && size <= 32U, "Report fields must be between 1 and 32 bits");
+		static_assert(count > 0U, "Report fields must have at least one element");
+
+		constexpr static auto bytes
+		{
+			internal::concat(
+				internal::signedItem<internal::prefix(items::global_t::logicalMinimum), minimum>(),
+				internal::signedItem<internal::prefix(items::global_t::logicalMaximum), maximum>(),
+				internal::item<internal::prefix(items::global_t::reportSize), size>(),
+				internal::item<internal::prefix(items::global_t::reportCount), count>(),
+				internal::item<internal::prefix(kind), flags>()
+			)
+		};
+		using fields = internal::list_t<internal::field_t<kind, tag, size, count>>;
+	};
+
+	template<typename tag, uint8_t size, uint8_t count, int32_t minimum, int32_t maximum,
+		uint8_t flags = uint8_t(main_t::variable)>
+		using input = field<kind_t::input, tag, size, count, minimum, maximum, flags>;
+	template<typename tag, uint8_t size, uint8_t count, int32_t minimum, int32_t maximum,
+		uint8_t flags = uint8_t(main_t::variable)>
+		using output = field<kind_t::output, tag, size, count, minimum, maximum, flags>;
+	template<typename tag, uint8_t size, uint8_t count, int32_t minimum, int32_t maximum,
+		uint8_t flags = uint8_t(main_t::variable)>
+		using feature = field<kind_t::feaure, tag, size, count, minimum, maximum, flags>;
+
+	// Constant bits that pad out the following field to a convenient alignment
+	template<uint8_t bits, kind_t kind = kind_t::input> struct padding final
+	{
+		constexpr static auto bytes
+		{
+			internal::concat(
+				internal::item<internal::prefix(items::global_t::reportSize), bits>(),
+				internal::item<internal::prefix(items::global_t::reportCount), 1U>(),
+				internal::item<internal::prefix(kind), uint8_t(main_t::constant)>()
+			)
+		};
+		using fields = internal::list_t<internal::field_t<kind, void, bits, 1U>>;
+	};
+
+	template<kind_t kind, typename fields> struct layout_t;
+	template<kind_t kind, typename... fields> struct layout_t<kind, internal::list_t<fields...>> final
+	{
+		constexpr static size_t fieldCount{sizeof...(fields)};
+		constexpr static std::array<bool, fieldCount> inReport{(fields::kind == kind)...};
+		constexpr static std::array<uint8_t, fieldCount> sizes{fields::size...};
+		constexpr static std::array<uint8_t, fieldCount> counts{fields::count...};
+
+		// @returns the bit offset of the field at index in the report
+		constexpr static uint16_t offset(const size_t index) noexcept
+		{
+			uint16_t result{};
+			for (size_t field{}; field < index; ++field)
+			{
+				if (inReport[field])
+					result = uint16_t(result + sizes[field] * counts[field]);
+			}
+			return result;
+		}
+
+		constexpr static uint16_t bits{offset(fieldCount)};
+		constexpr static uint16_t length{uint16_t((bits + 7U) / 8U)};
+
+		template<typename tag> constexpr static size_t index() noexcept
+		{
+			constexpr std::array<bool, fieldCount> sameTag{std::is_same_v<tag, typename fields::tag>...};
+			size_t result{fieldCount};
+			for (size_t field{}; field < fieldCount; ++field)
+			{
+				if (sameTag[field] && inReport[field])
+					result = field;
+			}
+			return result;
+		}
+	};
+
+	template<typename... elements> struct descriptor_t final
+	{
+		constexpr static auto bytes{internal::concat(elements::bytes...)};
+		using fields = internal::concatLists<typename elements::fields...>;
+
+	private:
+		template<typename... fieldList> constexpr static bool check(internal::list_t<fieldList...>) noexcept
+		{
+			return internal::matches(bytes, std::array<kind_t, sizeof...(fieldList)>{fieldList::kind...},
+				std::array<uint16_t, sizeof...(fieldList)>{uint16_t(fieldList::size * fieldList::count)...});
+		}
+
+	public:
+		static_assert(check(fields{}), "The generated report descriptor does not match the report layout");
+
+		// Checks that a hand-written report descriptor describes the same reports as this one.
+		template<size_t length> constexpr static bool matches(const std::array<uint8_t, length> &descriptor) noexcept
+			{ return matchesImpl(descriptor, fields{}); }
+
+	private:
+		template<size_t length, typename... fieldList> constexpr static bool matchesImpl(
+			const std::array<uint8_t, length> &descriptor, internal::list_t<fieldList...>) noexcept
+		{
+			return internal::matches(descriptor, std::array<kind_t, sizeof...(fieldList)>{fieldList::kind...},
+				std::array<uint16_t, sizeof...(fieldList)>{uint16_t(fieldList::size * fieldList::count)...});
+		}
+	};
+
+	/*!
+	 * The packed report of the given kind described by a descriptor_t. Fields are addressed by their tag,
+	 * and as every offset is a compile-time constant, setting a byte-aligned field compiles to plain stores.
+	 */
+	template<typename descriptor, kind_t kind = kind_t::input> struct report_t final
+	{
+		using layout = layout_t<kind, typename descriptor::fields>;
+		constexpr static uint16_t length{layout::length};
+
+		std::array<uint8_t, length> data{};
+
+		template<typename tag> constexpr static uint16_t offsetOf() noexcept
+		{
+			constexpr auto index{layout::template index<tag>()};
+			static_assert(index != layout::fieldCount, "No field with that tag in this report");
+			return layout::offset(index);
+		}
+
+		template<typename tag> constexpr static uint8_t sizeOf() noexcept
+			{ return layout::sizes[layout::template index<tag>()]; }
+
+		template<typename tag, typename value_t> void set(const size_t element, const value_t value) noexcept
+		{
+			constexpr auto index{layout::template index<tag>()};
+			static_assert(index != layout::fieldCount, "No field with that tag in this report");
+			constexpr auto size{layout::sizes[index]};
+			store(size_t(layout::offset(index) + element * size), size, uint32_t(value));
+		}
+
+		// Sets every element of the field at once, with element 0 in the least significant bits of value
+		template<typename tag, typename value_t> void set(const value_t value) noexcept
+		{
+			constexpr auto index{layout::template index<tag>()};
+			static_assert(index != layout::fieldCount, "No field with that tag in this report");
+			constexpr auto bits{layout::sizes[index] * layout::counts[index]};
+			static_assert(bits <= 32U, "Field is too big to set all at once");
+			store(layout::offset(index), uint8_t(bits), uint32_t(value));
+		}
+
+		template<typename tag> [[nodiscard]] uint32_t get(const size_t element) const noexcept
+		{
+			constexpr auto index{layout::template index<tag>()};
+			static_assert(index != layout::fieldCount, "No field with that tag in this report");
+			constexpr auto size{layout::sizes[index]};
+			return load(size_t(layout::offset(index) + element * size), size);
+		}
+
+		template<typename tag> [[nodiscard]] uint32_t get() const noexcept
+		{
+			constexpr auto index{layout::template index<tag>()};
+			static_assert(index != layout::fieldCount, "No field with that tag in this report");
+			constexpr auto bits{layout::sizes[index] * layout::counts[index]};
+			static_assert(bits <= 32U, "Field is too big to get all at once");
+			return load(layout::offset(index), uint8_t(bits));
+		}
+
+	private:
+		void store(const size_t offset, const uint8_t size, const uint32_t value) noexcept
+		{
+			// Whole, byte-aligned fields are straight little-endian stores
+			if (!(offset & 7U) && !(size & 7U))
+			{
+				for (size_t byte{}; byte < size / 8U; ++byte)
+					data[offset / 8U + byte] = uint8_t(value >> (byte * 8U));
+				return;
+			}
+			// Otherwise merge the value in a byte at a time
+			for (size_t bit{}; bit < size;)
+			{
+				const auto position{offset + bit};
+				const auto shift{position & 7U};
+				const auto chunk{std::min<size_t>(8U - shift, size - bit)};
+				const auto mask{uint8_t(((1U << chunk) - 1U) << shift)};
+				auto &byte{data[position / 8U]};
+				byte = uint8_t((byte & ~mask) | (((value >> bit) << shift) & mask));
+				bit += chunk;
+			}
+		}
+
+		[[nodiscard]] uint32_t load(const size_t offset, const uint8_t size) const noexcept
+		{
+			uint32_t value{};
+			if (!(offset & 7U) && !(size & 7U))
+			{
+				for (size_t byte{}; byte < size / 8U; ++byte)
+					value |= uint32_t(data[offset / 8U + byte]) << (byte * 8U);
+				return value;
+			}
+			for (size_t bit{}; bit < size;)
+			{
+				const auto position{offset + bit};
+				const auto shift{position & 7U};
+				const auto chunk{std::min<size_t>(8U - shift, size - bit)};
+				const auto mask{uint8_t((1U << chunk) - 1U)};
+				value |= uint32_t((data[position / 8U] >> shift) & mask) << bit;
+				bit += chunk;
+			}
+			return value;
+		}
+	};
+} // namespace usb::hid::report
+
+#endif /*USB_DRIVERS_HID_REPORT__HXX*/
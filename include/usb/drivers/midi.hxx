@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_DRIVERS_MIDI__HXX
+#define USB_DRIVERS_MIDI__HXX
+
+#include <cstdint>
+#include "usb/types.hxx"
+
+namespace usb::midi
+{
+	// How many events may wait to be sent, which must be a power of 2
+	constexpr static uint8_t queueDepth{USB_MIDI_QUEUE_DEPTH};
+	static_assert(queueDepth >= 16U && queueDepth <= 128U && (queueDepth & (queueDepth - 1U)) == 0U,
+		"The MIDI event queue depth must be a power of 2 between 16 and 128");
+
+	// Code Index Numbers, which say how many of an event's MIDI bytes are used
+	enum class codeIndex_t : uint8_t
+	{
+		misc = 0x0U,
+		cableEvent = 0x1U,
+		systemCommon2 = 0x2U,
+		systemCommon3 = 0x3U,
+		sysExStart = 0x4U,
+		sysExEnd1 = 0x5U,
+		sysExEnd2 = 0x6U,
+		sysExEnd3 = 0x7U,
+		noteOff = 0x8U,
+		noteOn = 0x9U,
+		polyKeyPress = 0xAU,
+		controlChange = 0xBU,
+		programChange = 0xCU,
+		channelPressure = 0xDU,
+		pitchBend = 0xEU,
+		singleByte = 0xFU
+	};
+
+	// A 4 byte USB-MIDI event packet: the cable number and code index, then up to 3 MIDI bytes
+	struct event_t final
+	{
+		uint8_t header;
+		uint8_t midi0;
+		uint8_t midi1;
+		uint8_t midi2;
+
+		[[nodiscard]] constexpr uint8_t cable() const noexcept { return header >> 4U; }
+		[[nodiscard]] constexpr codeIndex_t codeIndex() const noexcept
+			{ return static_cast<codeIndex_t>(header & 0x0FU); }
+	};
+	static_assert(sizeof(event_t) == 4);
+
+	// Builds the event for a channel voice or system message, picking the code index from the status byte.
+	[[nodiscard]] constexpr inline event_t event(const uint8_t cable, const uint8_t status,
+		const uint8_t data1 = 0U, const uint8_t data2 = 0U) noexcept
+	{
+		const auto codeIndex
+		{
+			[&]() noexcept -> uint8_t
+			{
+				if (status < 0xF0U)
+					return status >> 4U;
+				switch (status)
+				{
+					case 0xF1U: // MTC quarter frame
+					case 0xF3U: // Song select
+						return uint8_t(codeIndex_t::systemCommon2);
+					case 0xF2U: // Song position pointer
+						return uint8_t(codeIndex_t::systemCommon3);
+					case 0xF6U: // Tune request
+						return uint8_t(codeIndex_t::sysExEnd1);
+					default: // Real-time messages
+						return uint8_t(codeIndex_t::singleByte);
+				}
+			}()
+		};
+		return {uint8_t((cable << 4U) | codeIndex), status, data1, data2};
+	}
+
+	// Called from the USB interrupt with each event the host sends
+	using eventHandler_t = void (*)(const event_t &event);
+
+	/*!
+	 * Registers the driver against the MIDIStreaming interface given. Events queued by send() are
+	 * packed up to 16 to a packet: a full packet's worth goes straight out, and whatever is left is
+	 * flushed at the next SOF, so no event waits more than a frame.
+	 */
+	extern void registerHandlers(uint8_t interface, uint8_t config, uint8_t endpointIn, uint8_t endpointOut,
+		eventHandler_t eventHandler) noexcept;
+
+#ifdef USB_STATIC_HANDLERS
+	// The driver's endpoint handlers, for the application's tables when built with staticHandlers
+	extern void initDataIn(uint8_t endpoint) noexcept;
+	extern void deinitDataIn(uint8_t endpoint) noexcept;
+	extern void handleDataIn(uint8_t endpoint) noexcept;
+	extern void handleDataOut(uint8_t endpoint) noexcept;
+
+	constexpr inline usb::types::handler_t dataInHandler{initDataIn, deinitDataIn, handleDataIn};
+	constexpr inline usb::types::handler_t dataOutHandler{nullptr, nullptr, handleDataOut};
+#endif
+
+	// Queues an event to send, returning false if the queue is full.
+	extern bool send(const event_t &event) noexcept;
+	// Queues a complete System Exclusive message, F0 and F7 included, returning false if it won't all fit.
+	extern bool sendSysEx(uint8_t cable, const uint8_t *message, uint16_t length) noexcept;
+	// @returns how many events are still waiting to be sent.
+	[[nodiscard]] extern uint8_t pending() noexcept;
+} // namespace usb::midi
+
+#endif /*USB_DRIVERS_MIDI__HXX*/
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_DRIVERS_MSC__HXX
+#define USB_DRIVERS_MSC__HXX
+
+#include <cstdint>
+#include <array>
+#include "usb/types.hxx"
+
+namespace usb::msc
+{
+	constexpr static uint16_t blockSize{USB_MSC_BLOCK_SIZE};
+
+	struct endpoints_t final
+	{
+		uint8_t dataIn;
+		uint8_t dataOut;
+	};
+
+	/*!
+	 * The storage behind the driver. Reads and writes are started by the driver and may either finish
+	 * before returning or carry on in the background (eg, by DMA) with busy() returning true till they
+	 * complete - only one is ever in progress at a time. While one is in progress the driver keeps
+	 * moving data over USB using its other block buffer.
+	 *
+	 * These are called from the USB interrupt.
+	 */
+	struct blockDevice_t final
+	{
+		// Starts reading block into buffer, returning false if that can't be done
+		bool (*read)(uint32_t block, uint8_t *buffer);
+		// Starts writing buffer to block, returning false if that can't be done
+		bool (*write)(uint32_t block, const uint8_t *buffer);
+		// Returns true while the last read or write started is still in progress
+		bool (*busy)();
+		uint32_t blockCount;
+		bool writeProtected;
+	};
+
+	struct inquiry_t final
+	{
+		std::array<char, 8> vendor;
+		std::array<char, 16> product;
+		std::array<char, 4> revision;
+	};
+
+	/*!
+	 * Registers the driver against the interface given, presenting device as a single removable LUN.
+	 * The strings in inquiry are space padded, not NUL terminated.
+	 */
+	extern void registerHandlers(uint8_t interface, uint8_t config, endpoints_t endpoints,
+		const blockDevice_t &device, const inquiry_t &inquiry) noexcept;
+
+#ifdef USB_STATIC_HANDLERS
+	// The driver's handlers, for the application's tables when built with staticHandlers
+	extern usb::types::answer_t handleMSCRequest(std::size_t interface) noexcept;
+	extern void handleDataIn(uint8_t endpoint) noexcept;
+	extern void initEndpoint(uint8_t endpoint) noexcept;
+	extern void deinitEndpoint(uint8_t endpoint) noexcept;
+	extern void handleDataOut(uint8_t endpoint) noexcept;
+
+	constexpr inline usb::types::handler_t dataInHandler{nullptr, nullptr, handleDataIn};
+	constexpr inline usb::types::handler_t dataOutHandler{initEndpoint, deinitEndpoint, handleDataOut};
+#endif
+
+	// Marks the medium as (not) present, eg when the application wants the storage back.
+	extern void mediumPresent(bool present) noexcept;
+} // namespace usb::msc
+
+#endif /*USB_DRIVERS_MSC__HXX*/
@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_DRIVERS_MSC_TYPES__HXX
+#define USB_DRIVERS_MSC_TYPES__HXX
+
+#include <cstdint>
+#include <array>
+
+namespace usb::msc::types
+{
+	enum class request_t : uint8_t
+	{
+		getMaxLUN = 0xFEU,
+		reset = 0xFFU
+	};
+
+	enum class scsiCommand_t : uint8_t
+	{
+		testUnitReady = 0x00U,
+		requestSense = 0x03U,
+		inquiry = 0x12U,
+		modeSense6 = 0x1AU,
+		startStopUnit = 0x1BU,
+		preventAllowMediumRemoval = 0x1EU,
+		readFormatCapacities = 0x23U,
+		readCapacity10 = 0x25U,
+		read10 = 0x28U,
+		write10 = 0x2AU,
+		verify10 = 0x2FU,
+		synchronizeCache10 = 0x35U,
+		modeSense10 = 0x5AU
+	};
+
+	enum class senseKey_t : uint8_t
+	{
+		noSense = 0x00U,
+		notReady = 0x02U,
+		mediumError = 0x03U,
+		illegalRequest = 0x05U,
+		unitAttention = 0x06U,
+		dataProtect = 0x07U
+	};
+
+	// Additional sense codes, with the qualifier in the upper byte
+	enum class additionalSense_t : uint16_t
+	{
+		none = 0x0000U,
+		writeFault = 0x0003U,
+		unrecoveredReadError = 0x0011U,
+		invalidCommand = 0x0020U,
+		lbaOutOfRange = 0x0021U,
+		invalidFieldInCDB = 0x0024U,
+		writeProtected = 0x0027U,
+		mediumNotPresent = 0x003AU
+	};
+
+	enum class cswStatus_t : uint8_t
+	{
+		passed = 0x00U,
+		failed = 0x01U,
+		phaseError = 0x02U
+	};
+
+	constexpr static uint32_t cbwSignature{0x43425355U}; // 'USBC'
+	constexpr static uint32_t cswSignature{0x53425355U}; // 'USBS'
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wattributes"
+#pragma GCC diagnostic ignored "-Wpacked"
+#endif
+	struct [[gnu::packed]] commandBlockWrapper_t final
+	{
+		uint32_t signature;
+		uint32_t tag;
+		uint32_t dataTransferLength;
+		uint8_t flags;
+		uint8_t lun;
+		uint8_t commandLength;
+		std::array<uint8_t, 16> command;
+	};
+
+	struct [[gnu::packed]] commandStatusWrapper_t final
+	{
+		uint32_t signature;
+		uint32_t tag;
+		uint32_t dataResidue;
+		cswStatus_t status;
+	};
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+	static_assert(sizeof(commandBlockWrapper_t) == 31);
+	static_assert(sizeof(commandStatusWrapper_t) == 13);
+
+	// Set in a CBW's flags when the data phase is device to host
+	constexpr static uint8_t cbwDirectionIn{0x80U};
+} // namespace usb::msc::types
+
+#endif /*USB_DRIVERS_MSC_TYPES__HXX*/
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_DRIVERS_UVC__HXX
+#define USB_DRIVERS_UVC__HXX
+
+#include <cstdint>
+#include "usb/drivers/uvcTypes.hxx"
+#include "usb/types.hxx"
+
+namespace usb::uvc
+{
+	// The largest payload (one bulk transfer, header included) sent to the host
+	constexpr static uint16_t payloadSize{USB_UVC_PAYLOAD_SIZE};
+	constexpr static uint8_t frameQueueDepth{USB_UVC_FRAME_QUEUE_DEPTH};
+	static_assert(frameQueueDepth >= 2U && (frameQueueDepth & (frameQueueDepth - 1U)) == 0U,
+		"The UVC frame queue depth must be a power of 2");
+
+	// Which optional fields each payload header carries, giving a 2, 6 or 12 byte header
+	enum class headerFields_t : uint8_t
+	{
+		none,
+		presentationTime,
+		presentationAndSourceTime
+	};
+
+	/*!
+	 * The single format and frame the stream offers, which must match the VideoStreaming descriptors.
+	 * The frame interval is in 100ns units.
+	 */
+	struct format_t final
+	{
+		uint8_t formatIndex;
+		uint8_t frameIndex;
+		uint32_t frameInterval;
+		uint32_t maxFrameSize;
+	};
+
+	/*!
+	 * Registers the driver against the VideoStreaming interface given, streaming on the bulk IN endpoint
+	 * given. Streaming starts once the host commits the format with VS_COMMIT_CONTROL. Source times are
+	 * taken from usb::core::timestamp(), so the clock frequency reported is 1MHz.
+	 */
+	extern void registerHandlers(uint8_t interface, uint8_t config, uint8_t endpoint,
+		const format_t &format, headerFields_t headerFields = headerFields_t::none) noexcept;
+
+#ifdef USB_STATIC_HANDLERS
+	/*!
+	 * The driver's handlers, for the application's tables when built with staticHandlers. The control and
+	 * alternate setting handlers both go against the VideoStreaming interface.
+	 */
+	extern usb::types::answer_t handleUVCRequest(std::size_t interface) noexcept;
+	extern bool handleSetInterface() noexcept;
+	extern void initEndpoint(uint8_t endpoint) noexcept;
+	extern void deinitEndpoint(uint8_t endpoint) noexcept;
+	extern void handleDataIn(uint8_t endpoint) noexcept;
+
+	constexpr inline usb::types::handler_t dataInHandler{initEndpoint, deinitEndpoint, handleDataIn};
+#endif
+
+	/*!
+	 * Queues a frame to be streamed, returning false if the queue is full. The frame is sent in payloads
+	 * directly out of the buffer given, with each payload's header gathered in front of the frame data
+	 * rather than copied in with it, so the buffer must be left alone till pendingFrames() shows it's
+	 * been sent. presentationTime is sent in the header when it's enabled.
+	 */
+	extern bool submitFrame(const void *frame, uint32_t length, uint32_t presentationTime = 0U) noexcept;
+	// @returns how many of the frames given to submitFrame() have not yet been completely sent.
+	[[nodiscard]] extern uint8_t pendingFrames() noexcept;
+	// @returns true while the host has a committed stream running.
+	[[nodiscard]] extern bool streaming() noexcept;
+} // namespace usb::uvc
+
+#endif /*USB_DRIVERS_UVC__HXX*/
@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_DRIVERS_UVC_TYPES__HXX
+#define USB_DRIVERS_UVC_TYPES__HXX
+
+#include <cstdint>
+
+namespace usb::uvc::types
+{
+	enum class request_t : uint8_t
+	{
+		setCur = 0x01U,
+		getCur = 0x81U,
+		getMin = 0x82U,
+		getMax = 0x83U,
+		getRes = 0x84U,
+		getLen = 0x85U,
+		getInfo = 0x86U,
+		getDef = 0x87U
+	};
+
+	// VideoStreaming interface control selectors
+	enum class streamingControl_t : uint8_t
+	{
+		undefined = 0x00U,
+		probe = 0x01U,
+		commit = 0x02U,
+		stillProbe = 0x03U,
+		stillCommit = 0x04U,
+		stillImageTrigger = 0x05U,
+		streamErrorCode = 0x06U,
+		generateKeyFrame = 0x07U,
+		updateFrameSegment = 0x08U,
+		synchDelay = 0x09U
+	};
+
+	// GET_INFO bits
+	constexpr static uint8_t infoSupportsGet{0x01U};
+	constexpr static uint8_t infoSupportsSet{0x02U};
+
+	// Payload header bmHeaderInfo bits
+	constexpr static uint8_t headerFrameID{0x01U};
+	constexpr static uint8_t headerEndOfFrame{0x02U};
+	constexpr static uint8_t headerPTS{0x04U};
+	constexpr static uint8_t headerSCR{0x08U};
+	constexpr static uint8_t headerStillImage{0x20U};
+	constexpr static uint8_t headerError{0x40U};
+	constexpr static uint8_t headerEndOfHeader{0x80U};
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wattributes"
+#pragma GCC diagnostic ignored "-Wpacked"
+#endif
+	// Video probe and commit controls, as of UVC 1.1 - UVC 1.0 hosts only use the first 26 bytes
+	struct [[gnu::packed]] probeCommit_t final
+	{
+		uint16_t hint;
+		uint8_t formatIndex;
+		uint8_t frameIndex;
+		uint32_t frameInterval;
+		uint16_t keyFrameRate;
+		uint16_t pFrameRate;
+		uint16_t compQuality;
+		uint16_t compWindowSize;
+		uint16_t delay;
+		uint32_t maxVideoFrameSize;
+		uint32_t maxPayloadTransferSize;
+		uint32_t clockFrequency;
+		uint8_t framingInfo;
+		uint8_t preferedVersion;
+		uint8_t minVersion;
+		uint8_t maxVersion;
+	};
+
+	// The largest payload header, with both the PTS and SCR fields present
+	struct [[gnu::packed]] payloadHeader_t final
+	{
+		uint8_t length;
+		uint8_t info;
+		uint32_t presentationTime;
+		uint32_t sourceTime;
+		uint16_t sofCounter;
+	};
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+	static_assert(sizeof(probeCommit_t) == 34);
+	static_assert(sizeof(payloadHeader_t) == 12);
+} // namespace usb::uvc::types
+
+#endif /*USB_DRIVERS_UVC_TYPES__HXX*/
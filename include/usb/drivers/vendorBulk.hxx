@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_DRIVERS_VENDOR_BULK__HXX
+#define USB_DRIVERS_VENDOR_BULK__HXX
+
+#include <cstdint>
+#include "usb/types.hxx"
+
+namespace usb::vendor::bulk
+{
+	constexpr static uint8_t streamCount{USB_VENDOR_BULK_STREAMS};
+	constexpr static uint8_t queueDepth{USB_VENDOR_BULK_QUEUE_DEPTH};
+	static_assert(queueDepth >= 2U && (queueDepth & (queueDepth - 1U)) == 0U,
+		"The vendor-bulk queue depth must be a power of 2");
+
+	// Either endpoint may be 0 for a stream that only goes one way
+	struct endpoints_t final
+	{
+		uint8_t dataIn;
+		uint8_t dataOut;
+	};
+
+	struct buffer_t final
+	{
+		uint8_t *data;
+		uint16_t length;
+	};
+
+	// IN buffers are only ever read from
+	struct inBuffer_t final
+	{
+		const uint8_t *data;
+		uint16_t length;
+	};
+
+	struct stats_t final
+	{
+		// Free-running counts of the bytes moved in each direction
+		uint32_t bytesIn;
+		uint32_t bytesOut;
+		// Bytes moved in each direction over the last full second of frames
+		uint32_t rateIn;
+		uint32_t rateOut;
+	};
+
+	/*!
+	 * Registers stream number stream against the interface given. Each stream is fed by the application
+	 * through buffer queues: buffers queued with submitIn() are sent to the host in order directly out
+	 * of application memory, and empty buffers handed over with supplyOut() are filled directly by
+	 * OUT packets then handed back through receiveOut(). OUT packets are NAKed while there is no empty
+	 * buffer to receive them into.
+	 */
+	extern void registerHandlers(uint8_t stream, uint8_t interface, uint8_t config, endpoints_t endpoints) noexcept;
+
+#ifdef USB_STATIC_HANDLERS
+	/*!
+	 * The driver's endpoint handlers, for the application's tables when built with staticHandlers. The
+	 * same pair serves every stream, which registerHandlers() maps the endpoints to.
+	 */
+	extern void initIn(uint8_t endpoint) noexcept;
+	extern void deinitIn(uint8_t endpoint) noexcept;
+	extern void handleIn(uint8_t endpoint) noexcept;
+	extern void initOut(uint8_t endpoint) noexcept;
+	extern void deinitOut(uint8_t endpoint) noexcept;
+	extern void handleOut(uint8_t endpoint) noexcept;
+
+	constexpr inline usb::types::handler_t dataInHandler{initIn, deinitIn, handleIn};
+	constexpr inline usb::types::handler_t dataOutHandler{initOut, deinitOut, handleOut};
+#endif
+
+	/*!
+	 * Queues length bytes at data to be sent, returning false if the queue is full.
+	 * If the endpoint is idle the transfer is started straight away rather than at the next SOF.
+	 */
+	extern bool submitIn(uint8_t stream, const void *data, uint16_t length) noexcept;
+	// @returns how many of the buffers given to submitIn() have not yet been completely sent.
+	[[nodiscard]] extern uint8_t pendingIn(uint8_t stream) noexcept;
+	/*!
+	 * Hands over an empty buffer to receive into, returning false if the queue is full.
+	 * The size should be a multiple of the endpoint's packet size.
+	 */
+	extern bool supplyOut(uint8_t stream, void *data, uint16_t size) noexcept;
+	// Takes the oldest filled buffer, with its length set to how much was received, if there is one.
+	[[nodiscard]] extern bool receiveOut(uint8_t stream, buffer_t &buffer) noexcept;
+	[[nodiscard]] extern stats_t stats(uint8_t stream) noexcept;
+} // namespace usb::vendor::bulk
+
+#endif /*USB_DRIVERS_VENDOR_BULK__HXX*/
@@ -295,6 +295,37 @@ namespace usb::dwc2
 	constexpr static uint32_t globalCoreConfigPrimaryDetectEnable{1U << 19U};
 	constexpr static uint32_t globalCoreConfigSecondaryDetectEnable{1U << 20U};
 	constexpr static uint32_t globalCoreConfigVBusDetectEnable{1U << 21U};
+
+	// Global LPM configuration register constants
+	constexpr static uint32_t globalLPMConfigEnable{1U << 0U};
+	constexpr static uint32_t globalLPMConfigAck{1U << 1U};
+	constexpr static uint32_t globalLPMConfigBESLMask{0x0000003cU};
+	constexpr static size_t globalLPMConfigBESLShift{2U};
+	constexpr static uint32_t globalLPMConfigRemoteWake{1U << 6U};
+	constexpr static uint32_t globalLPMConfigL1ShallowSleepEnable{1U << 7U};
+	constexpr static uint32_t globalLPMConfigBESLThresholdMask{0x00000f00U};
+	constexpr static size_t globalLPMConfigBESLThresholdShift{8U};
+	constexpr static uint32_t globalLPMConfigL1DeepSleepEnable{1U << 12U};
+	constexpr static uint32_t globalLPMConfigResponseMask{0x00006000U};
+	constexpr static size_t globalLPMConfigResponseShift{13U};
+	constexpr static uint32_t globalLPMConfigSleepStatus{1U << 15U};
+	constexpr static uint32_t globalLPMConfigL1ResumeOK{1U << 16U};
+	constexpr static uint32_t globalLPMConfigBESLEnable{1U << 28U};
+
+	constexpr inline uint32_t globalLPMConfigBESLThreshold(const uint8_t besl) noexcept
+		{ return (uint32_t{besl} << globalLPMConfigBESLThresholdShift) & globalLPMConfigBESLThresholdMask; }
+
+	// Device control register constants
+	constexpr static uint32_t deviceCtrlRemoteWakeupSignal{1U << 0U};
+	constexpr static uint32_t deviceCtrlSoftDisconnect{1U << 1U};
+
+	// Device status register constants
+	constexpr static uint32_t deviceStatusFrameNumberMask{0x003fff00U};
+	constexpr static size_t deviceStatusFrameNumberShift{8U};
+
+	// Power and clock gating control register constants
+	constexpr static uint32_t powerClockGateCtrlStopPHYClock{1U << 0U};
+	constexpr static uint32_t powerClockGateCtrlGateHClock{1U << 1U};
 } // namespace usb::dwc2
 
 #endif /*USB_DWC2_OTG_HXX*/
@@ -9,6 +9,7 @@ namespace usb::core::internal
 	using usb::types::handler_t;
 	using usb::constants::configsCount;
 	using usb::constants::interfaceCount;
+	using usb::constants::epBufferSize;
 
 	extern usb::types::deviceState_t usbState;
 	extern usb::types::usbEP_t usbPacket;
@@ -16,14 +17,87 @@ namespace usb::core::internal
 	extern usb::types::ctrlState_t usbCtrlState;
 	extern uint8_t usbDeferalFlags;
 
+#ifndef USB_STATIC_HANDLERS
 	extern std::array<std::array<handler_t, endpointCount - 1U>, configsCount> inHandlers;
 	extern std::array<std::array<handler_t, endpointCount - 1U>, configsCount> outHandlers;
+#else
+	using usb::core::inHandlers;
+	using usb::core::outHandlers;
+#endif
 	extern std::array<sofHandler_t, interfaceCount> sofHandlers;
+	// Counts SOFs seen since power-up, wrapping freely
+	extern volatile uint16_t frameCounter;
+
+	// Called by the platform code for each SOF to advance the frame counter and run the SOF handlers
+	extern void handleSOF() noexcept;
+
+	// Provided by the platform code to start or stop an endpoint answering the host with STALL
+	extern void setEPStall(usb::types::usbEP_t endpoint, bool stall) noexcept;
+	// Provided by the platform code to put an endpoint's data toggle back to DATA0
+	extern void resetEPDataToggle(usb::types::usbEP_t endpoint) noexcept;
+	// Provided by the platform code to stop or let the controller raise the USB interrupt
+	extern void setIRQMasked(bool masked) noexcept;
+	/*!
+	 * Provided by the platform code to read the frame number from the last SOF the controller saw,
+	 * returning false when it can't be read
+	 */
+	[[nodiscard]] extern bool busFrameNumber(uint16_t &frame) noexcept;
+
+#ifdef USB_ISOCHRONOUS
+	/*!
+	 * The wMaxPacketSize of each isochronous IN endpoint, set by the platform code as it sets the
+	 * endpoint up, and 0 for every other endpoint. An isochronous packet has to go in one write, so
+	 * these may be bigger than epBufferSize.
+	 */
+	extern std::array<uint16_t, endpointCount> isoPacketSizes;
+#endif
+
+	// How much of a transfer writeEP() puts in each packet it sends on the endpoint given
+	[[nodiscard]] inline uint16_t packetSizeIn([[maybe_unused]] const uint8_t endpoint) noexcept
+	{
+#ifdef USB_ISOCHRONOUS
+		if (isoPacketSizes[endpoint])
+			return isoPacketSizes[endpoint];
+#endif
+		return epBufferSize;
+	}
+
+#ifdef USB_REMOTE_WAKEUP
+	// Whether the host has enabled remote wakeup with SET_FEATURE(DEVICE_REMOTE_WAKEUP)
+	extern bool remoteWakeupEnabled;
+	// Set by the platform code to timestamp() when it sees the bus suspend
+	extern uint32_t suspendTime;
+	// How long to drive resume signalling for where the platform leaves the timing to us (1 to 15ms)
+	constexpr static uint32_t resumeSignallingTime{10000U};
+	/*!
+	 * How long the bus has to have been idle for before resume signalling may start (at least 5ms,
+	 * USB 2.0 §7.1.7.7). This counts from the suspend interrupt, which only comes after 3ms of idle,
+	 * so errs on the side of waiting longer
+	 */
+	constexpr static uint32_t wakeupIdleTime{5000U};
+
+	// Provided by the platform code to drive resume signalling and bring the controller out of suspend
+	extern void signalResume() noexcept;
+	// Busy waits for resumeSignallingTime
+	extern void holdResume() noexcept;
+#endif
+
+#ifdef USB_LPM
+	// Set while the host has the link in L1 sleep
+	extern bool usbSleeping;
+
+	// Called by the platform code once the controller has accepted an LPM token and the link is in L1
+	extern void enterL1(uint8_t besl) noexcept;
+	// Called by the platform code when the link leaves L1, once the controller clocks are running again
+	extern void exitL1() noexcept;
+#endif
 } // namespace usb::core::internal
 
 namespace usb::core::common
 {
 	void resetEPs(epReset_t what) noexcept;
+	// Resets the transfer state of a single endpoint, as when SET_INTERFACE takes it away or brings it back
+	void resetEP(usb::types::usbEP_t ep) noexcept;
 } // namespace usb::core::common
 
 #endif /*USB_INTERNAL_CORE___HXX*/
@@ -12,9 +12,20 @@ namespace usb::device::internal
 	using usb::constants::interfaceCount;
 	using usb::types::answer_t;
 
+#ifndef USB_STATIC_HANDLERS
 	extern std::array<std::array<controlHandler_t, interfaceCount>, configsCount> controlHandlers;
+#else
+	using usb::device::controlHandlers;
+#endif
+	extern std::array<std::array<uint8_t, interfaceCount>, configsCount> alternateModes;
 
 	extern bool handleSetConfiguration() noexcept;
+	/*!
+	 * Provided by the platform code to tear down the endpoints of the interface's current alternate
+	 * setting and bring up those of the one requested, leaving every other interface's alone.
+	 * @returns false if the configuration has no such alternate setting.
+	 */
+	extern bool handleSetInterface() noexcept;
 	extern void handleControllerInPacket() noexcept;
 	extern void handleControllerOutPacket() noexcept;
 	extern void handleSetupPacket() noexcept;
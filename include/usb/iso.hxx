@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_ISO_HXX
+#define USB_ISO_HXX
+
+#include <cstdint>
+#include "usb/types.hxx"
+
+namespace usb::iso
+{
+	/*!
+	 * Called at SOF to fill the buffer that goes out at the next SOF. length holds how much room there
+	 * is on entry and must be set to how much was written, which can vary from frame to frame. Return
+	 * false if the data isn't ready, in which case the frame is sent empty and counted as late.
+	 */
+	using fillHandler_t = bool (*)(void *buffer, uint16_t &length);
+	// Called at SOF with the packet the host sent in the frame just gone.
+	using drainHandler_t = void (*)(const void *buffer, uint16_t length);
+
+	struct statistics_t final
+	{
+		// Packets moved over the endpoint
+		uint32_t frames;
+		// Frames where the host did not collect or did not send a packet
+		uint32_t missed;
+		// Frames where the data was not ready in time (IN) or was overwritten before it was used (OUT)
+		uint32_t late;
+	};
+
+	// Converts a rate in samples per second into the 10.14 samples per frame format feedback is sent in
+	[[nodiscard]] constexpr inline uint32_t feedbackFor(const uint32_t sampleRate) noexcept
+		{ return uint32_t((uint64_t{sampleRate} << 14U) / 1000U); }
+
+#ifdef USB_ISOCHRONOUS
+	constexpr static uint8_t streamCount{USB_ISO_STREAMS};
+	// The largest packet a stream can carry, which sizes each stream's buffers
+	constexpr static uint16_t packetSize{USB_ISO_PACKET_SIZE};
+
+	/*!
+	 * The engine owns the SOF and SET_INTERFACE handlers of the interfaces its streams are registered
+	 * against. A stream runs while its interface is on any alternate setting other than 0, which is the
+	 * zero bandwidth setting. Each stream moves one packet a frame, of at most maxPacketSize bytes, which
+	 * must be the endpoint descriptor's wMaxPacketSize and no more than packetSize.
+	 *
+	 * Each stream is double buffered: at SOF the buffer filled during the previous frame goes out and
+	 * the other is refilled, so what's sent never waits on the application. patternFrames is how many
+	 * frames the stream's packet size pattern repeats over (10 for 44.1kHz, for example), and sets the
+	 * frame number answered to SYNCH_FRAME.
+	 */
+	extern bool registerSource(uint8_t interface, uint8_t config, uint8_t endpoint, uint16_t maxPacketSize,
+		fillHandler_t fill, uint8_t patternFrames = 1U) noexcept;
+	extern bool registerSink(uint8_t interface, uint8_t config, uint8_t endpoint, uint16_t maxPacketSize,
+		drainHandler_t drain, uint8_t patternFrames = 1U) noexcept;
+
+	/*!
+	 * Registers an explicit feedback IN endpoint for an asynchronous OUT stream. The value is sent every
+	 * 2^refresh frames, which must match the endpoint's bRefresh and bInterval, and starts out as
+	 * feedbackFor(sampleRate).
+	 */
+	extern bool registerFeedback(uint8_t interface, uint8_t config, uint8_t endpoint, uint8_t refresh,
+		uint32_t sampleRate) noexcept;
+	/*!
+	 * Counts samples consumed by the application's audio clock. The engine totals these over each
+	 * refresh period, giving the measured rate in samples per frame to the precision the period allows.
+	 * Must be called from the USB interrupt or with it masked.
+	 */
+	extern void feedbackSamples(uint8_t endpoint, uint16_t samples) noexcept;
+	// Overrides the feedback value directly, in 10.14 samples per frame.
+	extern void feedbackValue(uint8_t endpoint, uint32_t value) noexcept;
+
+	[[nodiscard]] extern statistics_t statistics(usb::types::usbEP_t endpoint) noexcept;
+	extern void resetStatistics(usb::types::usbEP_t endpoint) noexcept;
+	// @returns true if the stream on the endpoint given is running.
+	[[nodiscard]] extern bool active(usb::types::usbEP_t endpoint) noexcept;
+
+#ifdef USB_STATIC_HANDLERS
+	/*!
+	 * The engine's handlers, for the application's tables when built with staticHandlers. Sources and
+	 * feedback endpoints take dataInHandler, sinks dataOutHandler, and each must still be registered
+	 * above, which ties the endpoint to its interface and fill or drain handler.
+	 */
+	extern bool handleSetInterface() noexcept;
+	extern void initEndpoint(uint8_t endpoint) noexcept;
+	extern void deinitEndpoint(uint8_t endpoint) noexcept;
+	extern void handleDataIn(uint8_t endpoint) noexcept;
+	extern void handleDataOut(uint8_t endpoint) noexcept;
+
+	constexpr inline usb::types::handler_t dataInHandler{initEndpoint, deinitEndpoint, handleDataIn};
+	constexpr inline usb::types::handler_t dataOutHandler{initEndpoint, deinitEndpoint, handleDataOut};
+#endif
+
+	namespace internal
+	{
+		// Answers SYNCH_FRAME for the engine's endpoints
+		extern usb::types::answer_t handleSyncFrame() noexcept;
+	} // namespace internal
+#endif
+} // namespace usb::iso
+
+#endif /*USB_ISO_HXX*/
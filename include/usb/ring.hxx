@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_RING_HXX
+#define USB_RING_HXX
+
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <algorithm>
+
+namespace usb
+{
+	/*!
+	 * Single producer, single consumer byte ring that hands out contiguous regions of its storage so
+	 * endpoints can transfer straight to and from it. One side runs in the USB interrupt, the other
+	 * in the application.
+	 *
+	 * When the producer needs more contiguous space than is left before the end of the storage, it
+	 * records where the valid data stops in wrap and starts again from the front. The consumer then
+	 * drains up to wrap before following it round. One byte is always kept free so head == tail can
+	 * only mean empty.
+	 */
+	struct ring_t final
+	{
+	private:
+		uint8_t *data_{nullptr};
+		uint16_t size_{};
+		volatile uint16_t head{};
+		volatile uint16_t tail{};
+		volatile uint16_t wrap{};
+
+		// The indices may be wider than the machine word, so re-read them till we get a stable value
+		[[nodiscard]] static uint16_t load(const volatile uint16_t &index) noexcept
+		{
+			uint16_t value{index};
+			while (true)
+			{
+				const uint16_t check{index};
+				if (check == value)
+					return value;
+				value = check;
+			}
+		}
+
+		static void publish(volatile uint16_t &index, const uint16_t value) noexcept
+		{
+			__atomic_signal_fence(__ATOMIC_RELEASE);
+			index = value;
+		}
+
+	public:
+		struct region_t final
+		{
+			uint8_t *data;
+			uint16_t length;
+		};
+
+		ring_t() = default;
+		ring_t(uint8_t *const data, const uint16_t size) noexcept : data_{data}, size_{size} { }
+		template<size_t N> ring_t(std::array<uint8_t, N> &storage) noexcept :
+			data_{storage.data()}, size_{uint16_t(N)} { static_assert(N > 1U && N <= UINT16_MAX); }
+
+		[[nodiscard]] uint16_t size() const noexcept { return size_; }
+
+		void clear() noexcept
+		{
+			head = 0U;
+			tail = 0U;
+			wrap = 0U;
+		}
+
+		// Producer side
+		/*!
+		 * @returns the largest contiguous free region, wrapping early to the front of the storage if
+		 * that is the only way to provide at least minimum bytes.
+		 */
+		[[nodiscard]] region_t writable(const uint16_t minimum = 1U) noexcept
+		{
+			const uint16_t begin{head};
+			const uint16_t end{load(tail)};
+			if (begin < end)
+				return {data_ + begin, uint16_t(end - begin - 1U)};
+			const auto toEnd{uint16_t(size_ - begin - (end == 0U ? 1U : 0U))};
+			if (toEnd >= minimum || end <= minimum)
+				return {data_ + begin, toEnd};
+			// Not enough room before the end but there is at the front, so mark the end of the data and wrap
+			wrap = begin;
+			publish(head, 0U);
+			return {data_, uint16_t(end - 1U)};
+		}
+
+		// Makes count bytes of the region last returned by writable() available to the consumer.
+		void commit(const uint16_t count) noexcept
+		{
+			if (!count)
+				return;
+			const auto next{uint16_t(head + count)};
+			if (next == size_)
+			{
+				wrap = size_;
+				publish(head, 0U);
+			}
+			else
+				publish(head, next);
+		}
+
+		uint16_t write(const void *const buffer, const uint16_t length) noexcept
+		{
+			const auto *const source{static_cast<const uint8_t *>(buffer)};
+			uint16_t written{};
+			while (written < length)
+			{
+				const auto region{writable()};
+				const auto amount{std::min(region.length, uint16_t(length - written))};
+				if (!amount)
+					break;
+				std::memcpy(region.data, source + written, amount);
+				commit(amount);
+				written = uint16_t(written + amount);
+			}
+			return written;
+		}
+
+		// Consumer side
+		// @returns the contiguous run of data at the front of the ring.
+		[[nodiscard]] region_t readable() noexcept
+		{
+			const uint16_t end{load(head)};
+			__atomic_signal_fence(__ATOMIC_ACQUIRE);
+			uint16_t begin{tail};
+			if (begin <= end)
+				return {data_ + begin, uint16_t(end - begin)};
+			const uint16_t limit{wrap};
+			if (begin < limit)
+				return {data_ + begin, uint16_t(limit - begin)};
+			// We've drained everything up to the wrap point, so follow the producer round to the front
+			begin = 0U;
+			publish(tail, begin);
+			return {data_, end};
+		}
+
+		// Releases count bytes of the region last returned by readable() back to the producer.
+		void consume(const uint16_t count) noexcept
+		{
+			if (count)
+				publish(tail, uint16_t(tail + count));
+		}
+
+		uint16_t read(void *const buffer, const uint16_t length) noexcept
+		{
+			auto *const dest{static_cast<uint8_t *>(buffer)};
+			uint16_t count{};
+			while (count < length)
+			{
+				const auto region{readable()};
+				const auto amount{std::min(region.length, uint16_t(length - count))};
+				if (!amount)
+					break;
+				std::memcpy(dest + count, region.data, amount);
+				consume(amount);
+				count = uint16_t(count + amount);
+			}
+			return count;
+		}
+
+		// @returns how many bytes are waiting to be consumed in total.
+		[[nodiscard]] uint16_t available() const noexcept
+		{
+			const uint16_t end{load(head)};
+			__atomic_signal_fence(__ATOMIC_ACQUIRE);
+			const uint16_t begin{load(tail)};
+			if (begin <= end)
+				return uint16_t(end - begin);
+			return uint16_t(wrap - begin + end);
+		}
+	};
+} // namespace usb
+
+#endif /*USB_RING_HXX*/
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#ifndef USB_TRACE_HXX
+#define USB_TRACE_HXX
+
+#include <cstdint>
+#include <array>
+#include "usb/types.hxx"
+
+namespace usb::trace
+{
+	/*!
+	 * The event IDs here are shared with tools/traceDecode.py - if you add to
+	 * or change this enumeration, update the decoder to match.
+	 */
+	enum class event_t : uint8_t
+	{
+		none = 0x00U,
+		deviceState = 0x01U, // payload = new usbState
+		ctrlState = 0x02U, // payload = new usbCtrlState
+		setupPacket = 0x03U, // payload = bmRequestType | (bRequest << 8)
+		needsArming = 0x04U, // payload = new needsArming() flag
+		stall = 0x05U, // payload = new stall() flag
+		setupCallback = 0x06U, // payload = 0
+		reset = 0x07U,
+		suspend = 0x08U,
+		resume = 0x09U,
+		setConfiguration = 0x0AU, // payload = new activeConfig
+		setInterface = 0x0BU, // payload = interface | (alternate << 8)
+		remoteWakeup = 0x0CU, // payload = time taken for the host to resume the bus, in 10us units
+		linkSleep = 0x0DU, // payload = host BESL for the L1 sleep
+		linkWake = 0x0EU,
+	};
+
+	struct record_t final
+	{
+		uint32_t timestamp;
+		event_t event;
+		// Endpoint number, with bit 7 set for controller IN endpoints
+		uint8_t endpoint;
+		uint16_t payload;
+	};
+	static_assert(sizeof(record_t) == 8);
+
+	constexpr static uint32_t ringMagic{0x43525455U}; // 'UTRC'
+
+	constexpr inline uint8_t endpoint(const uint8_t number, const usb::types::endpointDir_t dir) noexcept
+		{ return uint8_t(dir) | (number & 0x0FU); }
+
+#ifdef USB_TRACE
+	constexpr static uint16_t traceEntries{USB_TRACE_ENTRIES};
+	static_assert(traceEntries && !(traceEntries & (traceEntries - 1U)), "The trace ring size must be a power of 2");
+
+	/*!
+	 * This is laid out so a debugger can dump it as a binary blob (`dump binary value trace.bin usb::trace::ring`)
+	 * and have tools/traceDecode.py turn that into a timeline without needing symbol information.
+	 */
+	struct ring_t final
+	{
+		uint32_t magic;
+		uint16_t entries;
+		// Free-running count of records written, the next record goes into records[head % entries]
+		volatile uint16_t head;
+		std::array<record_t, traceEntries> records;
+	};
+
+	extern ring_t ring;
+
+	// Wait-free, must only be called from the USB interrupt context.
+	extern void record(event_t event, uint8_t endpoint, uint16_t payload) noexcept;
+	// Reads the next unread record, oldest first, returning false if there are none.
+	extern bool read(record_t &record) noexcept;
+	// How many records have been lost to the writer lapping the reader.
+	extern uint16_t dropped() noexcept;
+#else
+	inline void record(event_t, uint8_t, uint16_t) noexcept { }
+	inline bool read(record_t &) noexcept { return false; }
+	inline uint16_t dropped() noexcept { return 0U; }
+#endif
+
+	inline void deviceState(const usb::types::deviceState_t state) noexcept
+		{ record(event_t::deviceState, 0U, uint16_t(state)); }
+	inline void ctrlState(const usb::types::ctrlState_t state) noexcept
+		{ record(event_t::ctrlState, 0U, uint16_t(state)); }
+} // namespace usb::trace
+
+#endif /*USB_TRACE_HXX*/
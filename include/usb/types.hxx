@@ -134,6 +134,24 @@ namespace usb::types
 
 		[[nodiscard]] memory_t memoryType() const noexcept
 			{ return (value & 0x10U) ? memory_t::flash : memory_t::sram; }
+
+		// Tracks the endpoint's ENDPOINT_HALT feature, as distinct from the EP0 protocol stall above
+		void halted(const bool halt) noexcept
+		{
+			value &= 0xDFU;
+			value |= uint8_t(halt ? 0x20U : 0x00U);
+		}
+
+		[[nodiscard]] bool halted() const noexcept { return value & 0x20U; }
+
+		// Set when the halt must outlive CLEAR_FEATURE(ENDPOINT_HALT), until the endpoint's driver drops it
+		void wedged(const bool wedge) noexcept
+		{
+			value &= 0xBFU;
+			value |= uint8_t(wedge ? 0x40U : 0x00U);
+		}
+
+		[[nodiscard]] bool wedged() const noexcept { return value & 0x40U; }
 		void resetStatus() noexcept { value = 0; }
 	};
 
@@ -3,6 +3,8 @@
 #include "usb/internal/core.hxx"
 #include "usb/platforms/atxmega256a3u/core.hxx"
 #include "usb/device.hxx"
+#include "usb/trace.hxx"
+#include "usb/capture.hxx"
 #include <substrate/indexed_iterator>
 
 /*!
@@ -106,6 +108,10 @@ namespace usb::core
 		endpoints[0].controllerOut.CTRL &= uint8_t(~vals::usb::usbEPCtrlItrDisable);
 		endpoints[0].controllerIn.CTRL &= uint8_t(~vals::usb::usbEPCtrlItrDisable);
 		USB.INTFLAGSACLR = vals::usb::itrStatusReset;
+#ifdef USB_REMOTE_WAKEUP
+		remoteWakeupEnabled = false;
+#endif
+		trace::record(trace::event_t::reset, 0U, 0U);
 	}
 
 	void resetEPs(const epReset_t what) noexcept
@@ -147,12 +153,26 @@ namespace usb::core
 		usbSuspended = false;
 		//USB.CTRLB |= vals::usb::ctrlBRemoteWakeUp;
 		USB.INTFLAGSACLR = vals::usb::itrStatusResume;
+		trace::record(trace::event_t::resume, 0U, 0U);
 	}
 
+#ifdef USB_REMOTE_WAKEUP
+	void internal::signalResume() noexcept
+	{
+		// The controller times the resume signalling itself, clearing the bit once it's sent
+		USB.CTRLB |= vals::usb::ctrlBRemoteWakeUp;
+		usbSuspended = false;
+	}
+#endif
+
 	void suspend()
 	{
 		usbSuspended = true;
+#ifdef USB_REMOTE_WAKEUP
+		suspendTime = timestamp();
+#endif
 		USB.INTFLAGSACLR = vals::usb::itrStatusSuspend;
+		trace::record(trace::event_t::suspend, 0U, 0U);
 	}
 
 	const void *sendData(const uint8_t endpoint, const void *const bufferPtr, const uint8_t length,
@@ -212,6 +232,7 @@ namespace usb::core
 		};
 		epStatus.transferCount -= readCount;
 		epStatus.memBuffer = recvData(endpoint, epStatus.memBuffer, readCount);
+		capture::packetOut(endpoint, epBuffer[(endpoint << 1U)].data(), readCount);
 		// Mark the recv buffer contents as done with
 		epCtrl.CNT = 0;
 		epCtrl.STATUS &= (vals::usb::usbEPStatusNACK1 | vals::usb::usbEPStatusDTS);
@@ -271,6 +292,8 @@ namespace usb::core
 			if (!epStatus.transferCount)
 				epStatus.isMultiPart(false);
 		}
+		// The endpoint buffer always holds a SRAM copy of what we're sending, whatever memory it came from
+		capture::packetIn(endpoint, epBuffer[(endpoint << 1U) + 1U].data(), sendCount);
 		// Mark the buffer as ready to send
 		epCtrl.CNT = sendCount;
 		epCtrl.STATUS &= uint8_t(~(vals::usb::usbEPStatusNotReady | vals::usb::usbEPStatusNACK0));
@@ -295,6 +318,44 @@ namespace usb::core
 		epCtrl.CTRL |= vals::usb::usbEPCtrlStall;
 	}
 
+	static USB_EP_t &epCtrlFor(const usbEP_t endpoint) noexcept
+	{
+		auto &endpointCtrl{endpoints[endpoint.endpoint()]};
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+			return endpointCtrl.controllerIn;
+		return endpointCtrl.controllerOut;
+	}
+
+	void internal::setEPStall(const usbEP_t endpoint, const bool stall) noexcept
+	{
+		auto &epCtrl{epCtrlFor(endpoint)};
+		if (stall)
+			epCtrl.CTRL |= vals::usb::usbEPCtrlStall;
+		else
+		{
+			epCtrl.CTRL &= uint8_t(~vals::usb::usbEPCtrlStall);
+			epCtrl.STATUS &= uint8_t(~vals::usb::usbEPStatusStall);
+		}
+	}
+
+	void internal::resetEPDataToggle(const usbEP_t endpoint) noexcept
+		{ epCtrlFor(endpoint).STATUS &= uint8_t(~vals::usb::usbEPStatusDTS); }
+
+	// Dropping the interrupt level to off holds off the interrupt without losing which sources are enabled
+	void internal::setIRQMasked(const bool masked) noexcept
+	{
+		if (masked)
+			USB.INTCTRLA &= uint8_t(~USB_INTLVL_gm);
+		else
+			USB.INTCTRLA |= USB_INTLVL_LO_gc;
+	}
+
+	bool internal::busFrameNumber(uint16_t &frame) noexcept
+	{
+		frame = USB.FRAMENUM & 0x07FFU;
+		return true;
+	}
+
 	void flushWriteEP(const uint8_t endpoint) noexcept
 	{
 		auto &epCtrl{endpoints[endpoint].controllerIn};
@@ -344,7 +405,10 @@ namespace usb::core
 		const auto status{USB.INTFLAGSASET};
 
 		if (usbState == deviceState_t::attached)
+		{
 			usbState = deviceState_t::powered;
+			trace::deviceState(usbState);
+		}
 
 		if ((status & vals::usb::itrStatusResume) && (intCtrl & vals::usb::intCtrlAEnableBusEvent))
 			usb::core::wakeup();
@@ -355,6 +419,7 @@ namespace usb::core
 		{
 			usb::core::reset();
 			usbState = deviceState_t::waiting;
+			trace::deviceState(usbState);
 			return;
 		}
 		else if ((status & vals::usb::itrStatusSuspend) && (intCtrl & vals::usb::intCtrlAEnableBusEvent))
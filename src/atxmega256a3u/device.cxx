@@ -3,6 +3,7 @@
 #include "usb/internal/core.hxx"
 #include "usb/platforms/atxmega256a3u/core.hxx"
 #include "usb/internal/device.hxx"
+#include "usb/trace.hxx"
 
 using namespace usb::constants;
 using namespace usb::types;
@@ -44,28 +45,83 @@ namespace usb::device
 		}
 	} // namespace endpoint
 
-	void setupEndpoint(const usbEndpointDescriptor_t &endpoint)
+	// Calls function with each non-control endpoint in the active configuration, and the interface
+	// and alternate setting it belongs to
+	template<typename function_t> static void forEachEndpoint(const function_t &function) noexcept
 	{
-		if (endpoint.endpointType == usbEndpointType_t::control)
-			return;
-
-		const auto direction{static_cast<endpointDir_t>(endpoint.endpointAddress & ~usb::descriptors::endpointDirMask)};
-		const auto endpointNumber{uint8_t(endpoint.endpointAddress & usb::descriptors::endpointDirMask)};
-		auto &epCtrl
+		uint8_t interface{};
+		uint8_t alternate{};
+		const auto descriptors{*configDescriptors[activeConfig - 1U]};
+		for (const auto &part : descriptors)
 		{
-			[direction](endpointCtrl_t &endpointCtrl) -> USB_EP_t &
+			flash_t<char *> descriptor{static_cast<const char *>(part.descriptor)};
+			usbDescriptor_t type{static_cast<usbDescriptor_t>(descriptor[1])};
+			if (type == usbDescriptor_t::interface)
 			{
-				if (direction == endpointDir_t::controllerIn)
-					return endpointCtrl.controllerIn;
-				else
-					return endpointCtrl.controllerOut;
-			}(endpoints[endpointNumber])
+				// bInterfaceNumber and bAlternateSetting
+				interface = uint8_t(descriptor[2]);
+				alternate = uint8_t(descriptor[3]);
+			}
+			else if (type == usbDescriptor_t::endpoint)
+			{
+				const auto endpoint{*flash_t<usbEndpointDescriptor_t *>(part.descriptor)};
+				if (endpoint.endpointType != usbEndpointType_t::control)
+					function(endpoint, interface, alternate);
+			}
+		}
+	}
+
+	static bool hasAlternate(const uint8_t interface, const uint8_t alternate) noexcept
+	{
+		const auto descriptors{*configDescriptors[activeConfig - 1U]};
+		for (const auto &part : descriptors)
+		{
+			flash_t<char *> descriptor{static_cast<const char *>(part.descriptor)};
+			if (static_cast<usbDescriptor_t>(descriptor[1]) == usbDescriptor_t::interface &&
+				uint8_t(descriptor[2]) == interface && uint8_t(descriptor[3]) == alternate)
+				return true;
+		}
+		return false;
+	}
+
+	static usbEP_t endpointFor(const usbEndpointDescriptor_t &endpoint) noexcept
+	{
+		return
+		{
+			uint8_t(endpoint.endpointAddress & usb::descriptors::endpointDirMask),
+			static_cast<endpointDir_t>(endpoint.endpointAddress & ~usb::descriptors::endpointDirMask)
 		};
+	}
 
+	static USB_EP_t &epCtrlFor(const usbEP_t ep) noexcept
+	{
+		auto &endpointCtrl{endpoints[ep.endpoint()]};
+		if (ep.dir() == endpointDir_t::controllerIn)
+			return endpointCtrl.controllerIn;
+		return endpointCtrl.controllerOut;
+	}
+
+	// The endpoint buffers live wherever each transfer points them, so there's no packet memory to hand out
+	void setupEndpoint(const usbEndpointDescriptor_t &endpoint)
+	{
+		auto &epCtrl{epCtrlFor(endpointFor(endpoint))};
 		epCtrl.CNT = 0;
 		epCtrl.CTRL = endpoint::mapType(endpoint.endpointType) | endpoint::mapMaxSize(endpoint.maxPacketSize);
 	}
 
+	static void teardownEndpoint(const usbEndpointDescriptor_t &endpoint) noexcept
+	{
+		const auto ep{endpointFor(endpoint)};
+		usb::core::deinitHandler(ep);
+		auto &epCtrl{epCtrlFor(ep)};
+		// Clearing the type disables the endpoint
+		epCtrl.CTRL &= uint8_t(~(vals::usb::usbEPCtrlTypeMask | vals::usb::usbEPCtrlStall));
+		epCtrl.STATUS |= vals::usb::usbEPStatusNACK0 | vals::usb::usbEPStatusNACK1;
+		epCtrl.STATUS &= uint8_t(~(vals::usb::usbEPStatusNotReady | vals::usb::usbEPStatusStall |
+			vals::usb::usbEPStatusIOComplete | vals::usb::usbEPStatusSetupComplete));
+		usb::core::common::resetEP(ep);
+	}
+
 	namespace internal
 	{
 	bool handleSetConfiguration() noexcept
@@ -79,24 +135,48 @@ namespace usb::device
 		activeConfig = config;
 
 		if (activeConfig == 0)
+		{
 			usbState = deviceState_t::addressed;
+			trace::deviceState(usbState);
+		}
 		else
 		{
-			const auto descriptors{*configDescriptors[activeConfig - 1U]};
-			for (const auto &part : descriptors)
+			// Only the default alternate settings' endpoints come up, SET_INTERFACE handles the rest
+			forEachEndpoint([](const usbEndpointDescriptor_t &endpoint, const uint8_t, const uint8_t alternate)
 			{
-				flash_t<char *> descriptor{static_cast<const char *>(part.descriptor)};
-				usbDescriptor_t type{static_cast<usbDescriptor_t>(descriptor[1])};
-				if (type == usbDescriptor_t::endpoint)
-				{
-					const auto endpoint{*flash_t<usbEndpointDescriptor_t *>(part.descriptor)};
-					setupEndpoint(endpoint);
-				}
-			}
-			usb::core::initHandlers();
+				if (alternate != 0U)
+					return;
+				setupEndpoint(endpoint);
+				usb::core::initHandler(endpointFor(endpoint));
+			});
 		}
 		return true;
 	}
+
+	bool handleSetInterface() noexcept
+	{
+		const auto interface{uint8_t(packet.index)};
+		const auto current{alternateModes[activeConfig - 1U][interface]};
+		const auto requested{uint8_t(packet.value)};
+		if (!hasAlternate(interface, requested))
+			return false;
+
+		forEachEndpoint([&](const usbEndpointDescriptor_t &endpoint, const uint8_t owner, const uint8_t alternate)
+		{
+			if (owner == interface && alternate == current)
+				teardownEndpoint(endpoint);
+		});
+		forEachEndpoint([&](const usbEndpointDescriptor_t &endpoint, const uint8_t owner, const uint8_t alternate)
+		{
+			if (owner != interface || alternate != requested)
+				return;
+			const auto ep{endpointFor(endpoint)};
+			setupEndpoint(endpoint);
+			resetEPDataToggle(ep);
+			usb::core::initHandler(ep);
+		});
+		return true;
+	}
 	} // namespace internal
 
 	void handleControlPacket() noexcept
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include "usb/core.hxx"
+#include "usb/capture.hxx"
+
+namespace usb::capture
+{
+	buffer_t buffer{bufferMagic, bufferSize, prefixLength, 0U, 0U, {}};
+	static bool capturing{false};
+	// Offset of the most recently captured record, so setup() can find it again
+	static uint16_t lastRecord{};
+	static bool lastRecordValid{false};
+
+	void packet(const kind_t kind, const uint8_t endpoint, const void *const data, const uint16_t length) noexcept
+	{
+		if (!capturing)
+			return;
+		// If we don't have the packet data (eg, it was gathered from a multi-part table) just record its length
+		const auto captured{data ? std::min(length, prefixLength) : uint16_t(0U)};
+		const uint16_t offset{buffer.used};
+		if (sizeof(recordHeader_t) + captured > size_t(bufferSize - offset))
+		{
+			buffer.dropped = uint16_t(buffer.dropped + 1U);
+			lastRecordValid = false;
+			return;
+		}
+
+		const recordHeader_t header{usb::core::timestamp(), endpoint,
+			static_cast<kind_t>(uint8_t(kind) | (data ? 0U : kindNoData)), length};
+		std::memcpy(buffer.data.data() + offset, &header, sizeof(header));
+		if (captured)
+			std::memcpy(buffer.data.data() + offset + sizeof(header), data, captured);
+		lastRecord = offset;
+		lastRecordValid = true;
+		// Publish the record only once it's complete
+		__atomic_signal_fence(__ATOMIC_RELEASE);
+		buffer.used = uint16_t(offset + sizeof(header) + captured);
+	}
+
+	void setup() noexcept
+	{
+		if (!capturing || !lastRecordValid)
+			return;
+		auto &kind{buffer.data[lastRecord + offsetof(recordHeader_t, kind)]};
+		kind = uint8_t(kind_t::setup);
+	}
+
+	void start() noexcept { capturing = true; }
+	void stop() noexcept { capturing = false; }
+
+	void clear() noexcept
+	{
+		buffer.used = 0U;
+		buffer.dropped = 0U;
+		lastRecord = 0U;
+		lastRecordValid = false;
+	}
+} // namespace usb::capture
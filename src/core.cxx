@@ -1,7 +1,9 @@
 // SPDX-License-Identifier: BSD-3-Clause
+#include <algorithm>
 #include "usb/platform.hxx"
 #include "usb/internal/core.hxx"
 #include "usb/device.hxx"
+#include "usb/trace.hxx"
 #include <substrate/indexed_iterator>
 
 using namespace usb::constants;
@@ -18,14 +20,75 @@ namespace usb::core
 		ctrlState_t usbCtrlState;
 		uint8_t usbDeferalFlags;
 
+#ifndef USB_STATIC_HANDLERS
 		std::array<std::array<handler_t, endpointCount - 1U>, configsCount> inHandlers{};
 		std::array<std::array<handler_t, endpointCount - 1U>, configsCount> outHandlers{};
+#endif
 		std::array<sofHandler_t, interfaceCount> sofHandlers{};
+#ifdef USB_ISOCHRONOUS
+		std::array<uint16_t, endpointCount> isoPacketSizes{};
+#endif
+		volatile uint16_t frameCounter{};
+		// How many maskIRQ() calls are outstanding
+		static volatile uint8_t irqMaskDepth{};
+#ifdef USB_REMOTE_WAKEUP
+		bool remoteWakeupEnabled{false};
+		uint32_t suspendTime{};
+		static uint32_t wakeupStart{};
+		static volatile bool wakeupPending{false};
+		static volatile uint32_t lastWakeupTime{};
+#endif
+#ifdef USB_LPM
+		bool usbSleeping{false};
+		static lowPowerEntryHandler_t lowPowerEntryHandler{nullptr};
+		static lowPowerExitHandler_t lowPowerExitHandler{nullptr};
+
+		void enterL1(const uint8_t besl) noexcept
+		{
+			usbSleeping = true;
+			trace::record(trace::event_t::linkSleep, 0U, besl);
+			if (lowPowerEntryHandler)
+				lowPowerEntryHandler(besl, besl >= lpmDeepBESL);
+		}
+
+		void exitL1() noexcept
+		{
+			usbSleeping = false;
+			if (lowPowerExitHandler)
+				lowPowerExitHandler();
+			trace::record(trace::event_t::linkWake, 0U, 0U);
+		}
+#endif
+
+		void handleSOF() noexcept
+		{
+			frameCounter = uint16_t(frameCounter + 1U);
+#ifdef USB_REMOTE_WAKEUP
+			// The first SOF after a remote wakeup says the host has the bus running again
+			if (wakeupPending)
+			{
+				lastWakeupTime = timestamp() - wakeupStart;
+				wakeupPending = false;
+				trace::record(trace::event_t::remoteWakeup, 0U,
+					uint16_t(std::min<uint32_t>(lastWakeupTime / 10U, 0xFFFFU)));
+			}
+#endif
+			for (const auto &handler : sofHandlers)
+			{
+				if (handler)
+					handler();
+			}
+		}
 	} // namespace internal
 
 	std::array<usbEPStatus_t<const void>, endpointCount> epStatusControllerIn{};
 	std::array<usbEPStatus_t<void>, endpointCount> epStatusControllerOut{};
 
+#ifdef USB_STATIC_HANDLERS
+	// The handler tables are fixed at build time, so there's nothing to record
+	void registerHandler(usbEP_t, uint8_t, handler_t) noexcept { }
+	void unregisterHandler(usbEP_t, uint8_t) noexcept { }
+#else
 	void registerHandler(usbEP_t ep, const uint8_t config, handler_t handler) noexcept
 	{
 		const auto endpoint{ep.endpoint()};
@@ -49,6 +112,7 @@ namespace usb::core
 		else
 			outHandlers[config - 1U][endpoint - 1U] = {};
 	}
+#endif
 
 	void initHandlers() noexcept
 	{
@@ -84,6 +148,36 @@ namespace usb::core
 		}
 	}
 
+	void initHandler(const usbEP_t ep) noexcept
+	{
+		const auto endpoint{ep.endpoint()};
+		if (!usb::device::activeConfig || !endpoint || endpoint >= endpointCount)
+			return;
+		const auto config{usb::device::activeConfig - 1U};
+		const auto &handler
+		{
+			ep.dir() == endpointDir_t::controllerIn ? inHandlers[config][endpoint - 1U] :
+				outHandlers[config][endpoint - 1U]
+		};
+		if (handler.init)
+			handler.init(endpoint);
+	}
+
+	void deinitHandler(const usbEP_t ep) noexcept
+	{
+		const auto endpoint{ep.endpoint()};
+		if (!usb::device::activeConfig || !endpoint || endpoint >= endpointCount)
+			return;
+		const auto config{usb::device::activeConfig - 1U};
+		const auto &handler
+		{
+			ep.dir() == endpointDir_t::controllerIn ? inHandlers[config][endpoint - 1U] :
+				outHandlers[config][endpoint - 1U]
+		};
+		if (handler.deinit)
+			handler.deinit(endpoint);
+	}
+
 	usb::types::handler_t handlerFor(usb::types::usbEP_t ep, uint8_t config) noexcept
 	{
 		const auto endpoint{ep.endpoint()};
@@ -110,6 +204,114 @@ namespace usb::core
 		sofHandlers[interface] = nullptr;
 	}
 
+	uint16_t frameNumber() noexcept { return uint16_t(frameCounter & 0x07FFU); }
+
+	void haltEP(const usbEP_t endpoint) noexcept
+	{
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+			epStatusControllerIn[endpoint.endpoint()].halted(true);
+		else
+			epStatusControllerOut[endpoint.endpoint()].halted(true);
+		setEPStall(endpoint, true);
+	}
+
+	void clearHaltEP(const usbEP_t endpoint) noexcept
+	{
+		unwedgeEP(endpoint);
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+			epStatusControllerIn[endpoint.endpoint()].halted(false);
+		else
+			epStatusControllerOut[endpoint.endpoint()].halted(false);
+		// The toggle is reset even if the endpoint wasn't halted, which is how hosts resynchronise a pipe.
+		// Doing so first means a packet re-armed by unstalling goes out as DATA0.
+		resetEPDataToggle(endpoint);
+		setEPStall(endpoint, false);
+	}
+
+	bool epHalted(const usbEP_t endpoint) noexcept
+	{
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+			return epStatusControllerIn[endpoint.endpoint()].halted();
+		return epStatusControllerOut[endpoint.endpoint()].halted();
+	}
+
+	void wedgeEP(const usbEP_t endpoint) noexcept
+	{
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+			epStatusControllerIn[endpoint.endpoint()].wedged(true);
+		else
+			epStatusControllerOut[endpoint.endpoint()].wedged(true);
+		haltEP(endpoint);
+	}
+
+	void unwedgeEP(const usbEP_t endpoint) noexcept
+	{
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+			epStatusControllerIn[endpoint.endpoint()].wedged(false);
+		else
+			epStatusControllerOut[endpoint.endpoint()].wedged(false);
+	}
+
+	bool epWedged(const usbEP_t endpoint) noexcept
+	{
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+			return epStatusControllerIn[endpoint.endpoint()].wedged();
+		return epStatusControllerOut[endpoint.endpoint()].wedged();
+	}
+
+	// An interrupt taken part way through either of these leaves the depth as it found it
+	void maskIRQ() noexcept
+	{
+		const uint8_t depth{irqMaskDepth};
+		irqMaskDepth = uint8_t(depth + 1U);
+		if (!depth)
+			setIRQMasked(true);
+	}
+
+	void unmaskIRQ() noexcept
+	{
+		const uint8_t depth{irqMaskDepth};
+		if (!depth)
+			return;
+		irqMaskDepth = uint8_t(depth - 1U);
+		if (depth == 1U)
+			setIRQMasked(false);
+	}
+
+#ifdef USB_LPM
+	void registerLowPowerHandlers(const lowPowerEntryHandler_t entry, const lowPowerExitHandler_t exit) noexcept
+	{
+		lowPowerEntryHandler = entry;
+		lowPowerExitHandler = exit;
+	}
+
+	bool linkSleeping() noexcept { return usbSleeping; }
+#endif
+
+#ifdef USB_REMOTE_WAKEUP
+	void internal::holdResume() noexcept
+	{
+		const auto start{timestamp()};
+		while (timestamp() - start < resumeSignallingTime)
+			continue;
+	}
+
+	bool remoteWakeup() noexcept
+	{
+		// Keep the interrupt out for the whole of it, both so the bus can't change state under the checks
+		// and because signalResume() read-modify-writes registers the interrupt handler also writes
+		const irqMask_t mask{};
+		if (!usbSuspended || !remoteWakeupEnabled || timestamp() - suspendTime < wakeupIdleTime)
+			return false;
+		wakeupStart = timestamp();
+		wakeupPending = true;
+		signalResume();
+		return true;
+	}
+
+	uint32_t wakeupTime() noexcept { return wakeupPending ? 0U : lastWakeupTime; }
+#endif
+
 	namespace common
 	{
 		void resetEPs(const epReset_t what) noexcept
@@ -134,5 +336,20 @@ namespace usb::core
 				epStatus.ctrl.dir(endpointDir_t::controllerOut);
 			}
 		}
+
+		void resetEP(const usbEP_t ep) noexcept
+		{
+			const auto endpoint{ep.endpoint()};
+			if (ep.dir() == endpointDir_t::controllerIn)
+			{
+				epStatusControllerIn[endpoint].resetStatus();
+				epStatusControllerIn[endpoint].transferCount = 0;
+			}
+			else
+			{
+				epStatusControllerOut[endpoint].resetStatus();
+				epStatusControllerOut[endpoint].transferCount = 0;
+			}
+		}
 	} // namespace common
 } // namespace usb::core
@@ -1,6 +1,10 @@
 // SPDX-License-Identifier: BSD-3-Clause
 #include "usb/internal/core.hxx"
 #include "usb/internal/device.hxx"
+#include "usb/trace.hxx"
+#include "usb/capture.hxx"
+#include "usb/iso.hxx"
+#include <cstring>
 #include <substrate/indexed_iterator>
 
 using namespace usb::constants;
@@ -17,16 +21,69 @@ namespace usb::device
 	static std::array<uint8_t, 2> statusResponse{};
 	callback_t setupCallback{nullptr};
 
-	static std::array<std::array<uint8_t, interfaceCount>, configsCount> alternateModes{};
-
 	namespace internal
 	{
+#ifndef USB_STATIC_HANDLERS
 		std::array<std::array<controlHandler_t, interfaceCount>, configsCount> controlHandlers{};
+#endif
+		std::array<std::array<uint8_t, interfaceCount>, configsCount> alternateModes{};
 	}
+#ifndef USB_STATIC_HANDLERS
 	std::array<std::array<altModeHandler_t, interfaceCount>, configsCount> altModeHandlers{};
+#endif
 
 	static const usbStringLangDesc_t stringLangIDDescriptor{u'\x0904'};
 
+#ifdef USB_LPM
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wattributes"
+#pragma GCC diagnostic ignored "-Wpacked"
+#endif
+	struct [[gnu::packed]] lpmBOSDescriptor_t final
+	{
+		usbBOSDescriptor_t bos;
+		usbUSB2ExtensionDescriptor_t usb2Extension;
+	};
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+	// Hosts only ask for this if the device descriptor's usbVersion is at least 0x0201
+	static const lpmBOSDescriptor_t bosDescriptor
+	{
+		{
+			sizeof(usbBOSDescriptor_t),
+			usbDescriptor_t::bos,
+			sizeof(lpmBOSDescriptor_t),
+			1U
+		},
+		{
+			sizeof(usbUSB2ExtensionDescriptor_t),
+			usbDescriptor_t::deviceCapability,
+			usbDeviceCapability_t::usb2Extension,
+			usb2ExtensionLPM | usb2ExtensionBESL | usb2ExtensionBaselineBESLValid | usb2ExtensionDeepBESLValid |
+				usb2ExtensionBaselineBESL(lpmBaselineBESL) | usb2ExtensionDeepBESL(lpmDeepBESL)
+		}
+	};
+#endif
+
+	static void ctrlState(const ctrlState_t state) noexcept
+	{
+		usbCtrlState = state;
+		trace::ctrlState(state);
+	}
+
+	static void runSetupCallback() noexcept
+	{
+		if (setupCallback)
+		{
+			trace::record(trace::event_t::setupCallback, 0U, 0U);
+			setupCallback();
+			setupCallback = nullptr;
+		}
+	}
+
 	void address() noexcept
 	{
 		if (usbState == deviceState_t::addressing)
@@ -47,6 +104,7 @@ namespace usb::device
 				usb::core::address(address.addrL);
 				usbState = deviceState_t::addressed;
 			}
+			trace::deviceState(usbState);
 		}
 	}
 
@@ -66,6 +124,10 @@ namespace usb::device
 				return {response_t::data, &deviceDescriptor, sizeof(usbDeviceDescriptor_t), memory_t::flash};
 			case usbDescriptor_t::deviceQualifier:
 				return {response_t::stall, nullptr, 0};
+#ifdef USB_LPM
+			case usbDescriptor_t::bos:
+				return {response_t::data, &bosDescriptor, sizeof(lpmBOSDescriptor_t), memory_t::flash};
+#endif
 			// Handle configuration descriptor requests
 			case usbDescriptor_t::configuration:
 			{
@@ -115,6 +177,17 @@ namespace usb::device
 		return {response_t::unhandled, nullptr, 0};
 	}
 
+	// Decodes the endpoint address in wIndex, returning false if it's not one the host may address right now
+	static bool endpointFromIndex(usbEP_t &endpoint) noexcept
+	{
+		const auto address{uint8_t(packet.index)};
+		endpoint = {uint8_t(address & 0x0FU), static_cast<endpointDir_t>(address & 0x80U)};
+		if (endpoint.endpoint() >= endpointCount)
+			return false;
+		// Only EP0 exists until the device is configured
+		return endpoint.endpoint() == 0U || usbState == deviceState_t::configured;
+	}
+
 	answer_t handleGetStatus() noexcept
 	{
 		if (packet.requestType.dir() == endpointDir_t::controllerOut)
@@ -123,7 +196,12 @@ namespace usb::device
 		switch (packet.requestType.recipient())
 		{
 		case setupPacket::recipient_t::device:
-			statusResponse[0] = 0; // We are bus-powered and don't support remote wakeup
+			// We are bus-powered, and report whether the host has enabled remote wakeup
+#ifdef USB_REMOTE_WAKEUP
+			statusResponse[0] = remoteWakeupEnabled ? 0x02U : 0x00U;
+#else
+			statusResponse[0] = 0;
+#endif
 			statusResponse[1] = 0;
 			return {response_t::data, statusResponse.data(), statusResponse.size()};
 		case setupPacket::recipient_t::interface:
@@ -132,13 +210,64 @@ namespace usb::device
 			statusResponse[1] = 0;
 			return {response_t::data, statusResponse.data(), statusResponse.size()};
 		case setupPacket::recipient_t::endpoint:
-			// TODO: Figure out how to signal stalled/halted endpoints.
+		{
+			usbEP_t endpoint{};
+			if (!endpointFromIndex(endpoint))
+				return {response_t::stall, nullptr, 0};
+			statusResponse[0] = epHalted(endpoint) ? 0x01U : 0x00U;
+			statusResponse[1] = 0;
+			return {response_t::data, statusResponse.data(), statusResponse.size()};
+		}
 		default:
 			// Bad request? Stall.
 			return {response_t::stall, nullptr, 0};
 		}
 	}
 
+	// Handles SET_FEATURE (set is true) and CLEAR_FEATURE
+	answer_t handleFeature(const bool set) noexcept
+	{
+		if (packet.requestType.dir() == endpointDir_t::controllerIn || packet.length)
+			return {response_t::stall, nullptr, 0};
+
+		const auto feature{static_cast<feature_t>(uint16_t(packet.value))};
+		switch (packet.requestType.recipient())
+		{
+			case setupPacket::recipient_t::device:
+#ifdef USB_REMOTE_WAKEUP
+				if (feature == feature_t::deviceRemoteWakeup)
+				{
+					remoteWakeupEnabled = set;
+					return {response_t::zeroLength, nullptr, 0};
+				}
+#endif
+				break;
+			case setupPacket::recipient_t::endpoint:
+			{
+				usbEP_t endpoint{};
+				if (feature != feature_t::endpointHalt || !endpointFromIndex(endpoint))
+					break;
+				// EP0 can't be halted, but clearing it is harmless and hosts do so when recovering
+				else if (endpoint.endpoint() == 0U)
+				{
+					if (set)
+						break;
+					return {response_t::zeroLength, nullptr, 0};
+				}
+				if (set)
+					haltEP(endpoint);
+				// A wedged endpoint acknowledges the request but stays halted till its driver says otherwise
+				else if (!epWedged(endpoint))
+					clearHaltEP(endpoint);
+				return {response_t::zeroLength, nullptr, 0};
+			}
+			default:
+				break;
+		}
+		// Bad request or unsupported feature? Stall.
+		return {response_t::stall, nullptr, 0};
+	}
+
 	answer_t handleStandardRequest() noexcept
 	{
 		if (packet.requestType.type() != setupPacket::request_t::typeStandard)
@@ -151,6 +280,7 @@ namespace usb::device
 					packet.requestType.recipient() != setupPacket::recipient_t::device)
 					return {response_t::stall, nullptr, 0};
 				usbState = deviceState_t::addressing;
+				trace::deviceState(usbState);
 				setupCallback = address;
 				return {response_t::zeroLength, nullptr, 0};
 			case request_t::setDescriptor:
@@ -163,8 +293,14 @@ namespace usb::device
 					packet.requestType.recipient() != setupPacket::recipient_t::device)
 					return {response_t::stall, nullptr, 0};
 				else if (handleSetConfiguration())
+				{
+					// Every interface starts back out on its default alternate setting
+					if (activeConfig)
+						alternateModes[activeConfig - 1U].fill(0U);
+					trace::record(trace::event_t::setConfiguration, 0U, activeConfig);
 					// Acknowledge the request.
 					return {response_t::zeroLength, nullptr, 0};
+				}
 				// Bad request? Stall.
 				return {response_t::stall, nullptr, 0};
 			case request_t::getConfiguration:
@@ -188,7 +324,11 @@ namespace usb::device
 				// If the interface is valid and we're configured
 				else if (packet.index < interfaceCount && !packet.length && packet.value < 0x0100U && activeConfig)
 				{
+					// Reprogram the interface's endpoints before its driver gets told about the change
+					if (!handleSetInterface())
+						return {response_t::stall, nullptr, 0};
 					alternateModes[activeConfig - 1U][packet.index] = uint8_t(packet.value);
+					trace::record(trace::event_t::setInterface, 0U, uint16_t(packet.index | (packet.value << 8U)));
 					const auto handler{altModeHandlers[activeConfig - 1U][packet.index]};
 					if (handler && !handler()) // If the handler is valid and says things are bad, stall.
 						return {response_t::stall, nullptr, 0};
@@ -197,15 +337,29 @@ namespace usb::device
 				}
 				// Bad request? Stall.
 				return {response_t::stall, nullptr, 0};
-			case request_t::syncFrame: // Only used for isochronous stuff anyway.
-			case request_t::setFeature: // No special features are supported by this framework
-			case request_t::clearFeature: // No special features are supported by this framework
+			case request_t::syncFrame:
+#ifdef USB_ISOCHRONOUS
+				return usb::iso::internal::handleSyncFrame();
+#else
+				// Only used for isochronous stuff anyway.
 				return {response_t::stall, nullptr, 0};
+#endif
+			case request_t::setFeature:
+				return handleFeature(true);
+			case request_t::clearFeature:
+				return handleFeature(false);
 		}
 
 		return {response_t::unhandled, nullptr, 0};
 	}
 
+#ifdef USB_STATIC_HANDLERS
+	// The handler tables are fixed at build time, so there's nothing to record
+	void registerHandler(uint8_t, uint8_t, controlHandler_t) noexcept { }
+	void unregisterHandler(uint8_t, uint8_t) noexcept { }
+	void registerAltModeHandler(uint8_t, uint8_t, altModeHandler_t) noexcept { }
+	void unregisterAltModeHandler(uint8_t, uint8_t) noexcept { }
+#else
 	void registerHandler(const uint8_t interface, const uint8_t config, controlHandler_t handler) noexcept
 	{
 		if (interface >= interfaceCount || !config || config > configsCount)
@@ -233,6 +387,7 @@ namespace usb::device
 			return;
 		altModeHandlers[config - 1U][interface] = nullptr;
 	}
+#endif
 
 	void completeSetupPacket() noexcept
 	{
@@ -243,27 +398,27 @@ namespace usb::device
 			if (epStatusControllerOut[0].needsArming())
 			{
 				// <SETUP[0]><OUT[1]><OUT[0]>...<IN[1]>
-				usbCtrlState = ctrlState_t::dataRX;
+				ctrlState(ctrlState_t::dataRX);
 			}
 			// We need to stall in answer
 			else if (epStatusControllerIn[0].stall())
 			{
 				// <SETUP[0]><STALL>
 				usb::core::stallEP(0);
-				usbCtrlState = ctrlState_t::idle;
+				ctrlState(ctrlState_t::idle);
 			}
 		}
 		// We have a valid response
 		else
 		{
-			usbCtrlState = ctrlState_t::dataTX;
+			ctrlState(ctrlState_t::dataTX);
 			if (writeEP(0)/* || (!writeEPBusy(0) && writeEP(0))*/)
 			{
 				// Is this a quick answer? (eg, ZLP)
 				// <SETUP[0]><IN[1]>
 				// Or as part of an already-completed multi-part transaction?
 				// <SETUP[0]><IN[1]><IN[0]>...<OUT[1]>
-				usbCtrlState = ctrlState_t::statusRX;
+				ctrlState(ctrlState_t::statusRX);
 			}
 		}
 	}
@@ -282,10 +437,16 @@ namespace usb::device
 			usb::core::stallEP(0);
 			return;
 		}
+		capture::setup();
+
+		// Grab bmRequestType and bRequest for the trace
+		uint16_t request{};
+		std::memcpy(&request, &packet, sizeof(request));
+		trace::record(trace::event_t::setupPacket, 0U, request);
 
 		// Set up EP0 state for a reply of some kind
 		//usbDeferalFlags = 0;
-		usbCtrlState = ctrlState_t::wait;
+		ctrlState(ctrlState_t::wait);
 		epStatusControllerIn[0].needsArming(false);
 		epStatusControllerIn[0].stall(false);
 		epStatusControllerIn[0].transferCount = 0;
@@ -322,6 +483,12 @@ namespace usb::device
 		// If the response is whacko, don't do the stupid thing
 		if (response == response_t::data && !data && !epStatusControllerIn[0].isMultiPart())
 			epStatusControllerIn[0].needsArming(false);
+		trace::record(trace::event_t::needsArming, trace::endpoint(0U, endpointDir_t::controllerIn),
+			epStatusControllerIn[0].needsArming());
+		trace::record(trace::event_t::needsArming, trace::endpoint(0U, endpointDir_t::controllerOut),
+			epStatusControllerOut[0].needsArming());
+		trace::record(trace::event_t::stall, trace::endpoint(0U, endpointDir_t::controllerIn),
+			epStatusControllerIn[0].stall());
 		completeSetupPacket();
 	}
 
@@ -334,24 +501,16 @@ namespace usb::device
 			{
 				// If we now have all the data for the transaction..
 				epStatusControllerIn[0].needsArming(true);
-				usbCtrlState = ctrlState_t::statusTX;
+				ctrlState(ctrlState_t::statusTX);
 				writeEP(0);
-				if (setupCallback)
-				{
-					setupCallback();
-					setupCallback = nullptr;
-				}
+				runSetupCallback();
 			}
 		}
 		// If we're in the status phase
 		else
 		{
-			usbCtrlState = ctrlState_t::idle;
-			if (setupCallback)
-			{
-				setupCallback();
-				setupCallback = nullptr;
-			}
+			ctrlState(ctrlState_t::idle);
+			runSetupCallback();
 			handleSetupPacket();
 		}
 	}
@@ -363,17 +522,13 @@ namespace usb::device
 		{
 			if (writeEP(0))
 				// If we now have all the data for the transaction..
-				usbCtrlState = ctrlState_t::statusRX;
+				ctrlState(ctrlState_t::statusRX);
 		}
 		// Otherwise this was a status phase TX-complete interrupt
 		else
 		{
-			usbCtrlState = ctrlState_t::idle;
-			if (setupCallback)
-			{
-				setupCallback();
-				setupCallback = nullptr;
-			}
+			ctrlState(ctrlState_t::idle);
+			runSetupCallback();
 		}
 	}
 	} // namespace internal
@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include <algorithm>
+#include "usb/types.hxx"
+#include "usb/core.hxx"
+#include "usb/device.hxx"
+#include "usb/drivers/cdcACM.hxx"
+
+using namespace usb::constants;
+using namespace usb::core;
+using namespace usb::device;
+using namespace usb::types;
+using namespace usb::cdc::acm::types;
+using usb::device::packet;
+
+namespace usb::cdc::acm
+{
+	static uint8_t commInterface{};
+	static endpoints_t endpoints{};
+	static ring_t *rxRing{nullptr};
+	static ring_t *txRing{nullptr};
+
+	static lineCoding_t lineCoding_{115200U, stopBits_t::one, parity_t::none, 8U};
+	static lineCoding_t pendingLineCoding{};
+	static volatile uint16_t controlLineState_{};
+
+	// How many bytes the packet currently being sent from txRing holds
+	static uint16_t txInFlight{};
+	static bool txBusy{false};
+	// Whether the last packet sent was full, in which case the host needs a ZLP to end the transfer
+	static bool txNeedsZLP{false};
+	// How many frames the data in txRing has been waiting for a full packet's worth to accumulate
+	static uint8_t txAge{};
+	static volatile bool txFlush{false};
+	// Set when an OUT packet arrived with no room for it in rxRing, so it's being left to NAK
+	static bool rxBlocked{false};
+
+	static serialStateNotification_t notification
+	{
+		0xA1U, notification_t::serialState, 0U, 0U, sizeof(uint16_t), 0U
+	};
+	static volatile uint16_t pendingSerialState{};
+	static volatile bool notificationPending{false};
+	static bool notificationBusy{false};
+
+	static void receive() noexcept
+	{
+		// Only receive straight into the ring if a whole packet fits and there's still room left after,
+		// so the controller is always left ready for the next packet when we're not blocked
+		const auto region{rxRing->writable(uint16_t(epBufferSize + 1U))};
+		if (region.length <= epBufferSize)
+		{
+			// Leaving the packet in the endpoint makes the controller NAK the host till we pick it up
+			rxBlocked = true;
+			return;
+		}
+		auto &epStatus{epStatusControllerOut[endpoints.dataOut]};
+		epStatus.memBuffer = region.data;
+		epStatus.transferCount = region.length;
+		readEP(endpoints.dataOut);
+		rxRing->commit(uint16_t(region.length - epStatus.transferCount));
+		rxBlocked = false;
+	}
+
+	// Callers decide when a short packet has waited long enough, so this sends whatever is in the ring
+	static void transmit() noexcept
+	{
+		if (txBusy)
+			return;
+		auto &epStatus{epStatusControllerIn[endpoints.dataIn]};
+		const auto region{txRing->readable()};
+		if (!region.length && !txNeedsZLP)
+			return;
+
+		txInFlight = std::min(region.length, uint16_t(epBufferSize));
+		txBusy = true;
+		txAge = 0U;
+		epStatus.isMultiPart(false);
+		epStatus.memBuffer = region.data;
+		epStatus.transferCount = txInFlight;
+		writeEP(endpoints.dataIn);
+	}
+
+	static void sendNotification() noexcept
+	{
+		auto &epStatus{epStatusControllerIn[endpoints.notification]};
+		notificationPending = false;
+		notificationBusy = true;
+		notification.state = pendingSerialState;
+		epStatus.isMultiPart(false);
+		epStatus.memBuffer = &notification;
+		epStatus.transferCount = sizeof(notification);
+		writeEP(endpoints.notification);
+	}
+
+	static void tick() noexcept
+	{
+		if (rxBlocked)
+			receive();
+
+		if (!txBusy)
+		{
+			const auto pending{txRing->available()};
+			if (pending >= epBufferSize)
+				transmit();
+			else if (pending || txNeedsZLP)
+			{
+				// Let a short packet accumulate more data for up to the deadline before sending it anyway
+				if (txFlush || ++txAge >= flushDeadline)
+					transmit();
+			}
+			else
+				txFlush = false;
+		}
+
+		if (notificationPending && !notificationBusy)
+			sendNotification();
+	}
+
+	void handleDataOut(const uint8_t) noexcept { receive(); }
+
+	void handleDataIn(const uint8_t) noexcept
+	{
+		txRing->consume(txInFlight);
+		txNeedsZLP = txInFlight == epBufferSize;
+		txInFlight = 0U;
+		txBusy = false;
+		// Keep streaming while there are full packets to send, anything short waits for the next frame
+		if (txRing->available() >= epBufferSize)
+			transmit();
+	}
+
+	void handleNotification(const uint8_t endpoint) noexcept
+	{
+		if (epStatusControllerIn[endpoint].transferCount)
+			writeEP(endpoint);
+		else
+			notificationBusy = false;
+	}
+
+	void initDataOut(const uint8_t) noexcept
+	{
+		rxBlocked = false;
+		registerSOFHandler(commInterface, tick);
+	}
+
+	void initDataIn(const uint8_t) noexcept
+	{
+		txInFlight = 0U;
+		txBusy = false;
+		txNeedsZLP = false;
+		txAge = 0U;
+	}
+
+	void initNotification(const uint8_t) noexcept { notificationBusy = false; }
+	void deinitDataOut(const uint8_t) noexcept { unregsiterSOFHandler(commInterface); }
+
+	static void lineCodingReceived() noexcept { lineCoding_ = pendingLineCoding; }
+
+	answer_t handleACMRequest(const std::size_t interface) noexcept
+	{
+		const auto &requestType{packet.requestType};
+		if (requestType.recipient() != setupPacket::recipient_t::interface ||
+			requestType.type() != setupPacket::request_t::typeClass ||
+			packet.index != interface)
+			return {response_t::unhandled, nullptr, 0};
+
+		const auto request{static_cast<types::request_t>(packet.request)};
+		switch (request)
+		{
+			case types::request_t::setLineCoding:
+			{
+				if (packet.requestType.dir() == endpointDir_t::controllerIn ||
+					packet.length != sizeof(lineCoding_t))
+					return {response_t::stall, nullptr, 0};
+				auto &epStatus{epStatusControllerOut[0]};
+				epStatus.memBuffer = &pendingLineCoding;
+				epStatus.transferCount = sizeof(lineCoding_t);
+				epStatus.needsArming(true);
+				setupCallback = lineCodingReceived;
+				return {response_t::zeroLength, nullptr, 0};
+			}
+			case types::request_t::getLineCoding:
+				if (packet.requestType.dir() == endpointDir_t::controllerOut)
+					return {response_t::stall, nullptr, 0};
+				return {response_t::data, &lineCoding_, sizeof(lineCoding_t)};
+			case types::request_t::setControlLineState:
+				if (packet.requestType.dir() == endpointDir_t::controllerIn)
+					return {response_t::stall, nullptr, 0};
+				controlLineState_ = packet.value;
+				return {response_t::zeroLength, nullptr, 0};
+			case types::request_t::sendBreak:
+				if (packet.requestType.dir() == endpointDir_t::controllerIn)
+					return {response_t::stall, nullptr, 0};
+				return {response_t::zeroLength, nullptr, 0};
+			default:
+				break;
+		}
+
+		return {response_t::stall, nullptr, 0};
+	}
+
+	void flush() noexcept { txFlush = true; }
+	bool connected() noexcept { return controlLineState_ & controlLineDTR; }
+	uint16_t controlLineState() noexcept { return controlLineState_; }
+
+	lineCoding_t lineCoding() noexcept { return lineCoding_; }
+
+	void serialState(const uint16_t state) noexcept
+	{
+		pendingSerialState = state;
+		notificationPending = true;
+	}
+
+	void registerHandlers(const uint8_t interface, const uint8_t config, const endpoints_t eps,
+		ring_t &rx, ring_t &tx) noexcept
+	{
+		commInterface = interface;
+		endpoints = eps;
+		rxRing = &rx;
+		txRing = &tx;
+		notification.index = interface;
+		usb::device::registerHandler(interface, config, handleACMRequest);
+		usb::core::registerHandler({eps.notification, endpointDir_t::controllerIn}, config,
+			{initNotification, nullptr, handleNotification});
+		usb::core::registerHandler({eps.dataIn, endpointDir_t::controllerIn}, config,
+			{initDataIn, nullptr, handleDataIn});
+		usb::core::registerHandler({eps.dataOut, endpointDir_t::controllerOut}, config,
+			{initDataOut, deinitDataOut, handleDataOut});
+	}
+} // namespace usb::cdc::acm
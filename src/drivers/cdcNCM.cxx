@@ -0,0 +1,504 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include <array>
+#include <cstring>
+#include <algorithm>
+#include "usb/types.hxx"
+#include "usb/core.hxx"
+#include "usb/device.hxx"
+#include "usb/drivers/cdcNCM.hxx"
+
+using namespace usb::constants;
+using namespace usb::core;
+using namespace usb::device;
+using namespace usb::types;
+using namespace usb::cdc::ncm::types;
+using usb::descriptors::usbMultiPartDesc_t;
+using usb::device::packet;
+
+namespace usb::cdc::ncm
+{
+	static_assert(ntbSize % epBufferSize == 0, "The CDC-NCM NTB size must be a multiple of the endpoint buffer size");
+
+	// The specification's smallest allowed NTB input size, which the host may not set below
+	constexpr static uint32_t minimumNTBInSize{2048U};
+	// Full speed signalling rate reported to the host as the link speed
+	constexpr static uint32_t bitRate{12000000U};
+	// Datagrams sent to the host start on 4 byte boundaries
+	constexpr static uint16_t datagramAlignment{4U};
+	// Multi-part entries are at most 255 bytes long, so frames are split into this many parts at most
+	constexpr static uint8_t maxFrameParts{8U};
+	// The NTB header plus, for each datagram, its alignment padding and its parts
+	constexpr static std::size_t maxNTBParts{1U + maxDatagrams * (1U + maxFrameParts)};
+	static_assert(maxNTBParts <= 256U, "The NTB's multi-part table must be indexable by the 8-bit part number");
+	constexpr static uint8_t txQueueDepth{uint8_t(maxDatagrams * 2U)};
+
+	struct frame_t final
+	{
+		const segment_t *segments;
+		const void *context;
+		uint16_t length;
+		uint8_t count;
+		uint8_t parts;
+	};
+
+	// Single producer, single consumer queue of frames - the free-running 8-bit indices are always atomic
+	struct frameQueue_t final
+	{
+	private:
+		std::array<frame_t, txQueueDepth> frames{};
+		volatile uint8_t head{};
+		volatile uint8_t tail{};
+
+	public:
+		[[nodiscard]] uint8_t count() const noexcept { return uint8_t(head - tail); }
+		[[nodiscard]] bool full() const noexcept { return count() == txQueueDepth; }
+		[[nodiscard]] const frame_t &operator [](const uint8_t index) const noexcept
+			{ return frames[uint8_t(tail + index) & (txQueueDepth - 1U)]; }
+
+		bool push(const frame_t &frame) noexcept
+		{
+			if (full())
+				return false;
+			frames[head & (txQueueDepth - 1U)] = frame;
+			__atomic_signal_fence(__ATOMIC_RELEASE);
+			head = uint8_t(head + 1U);
+			return true;
+		}
+
+		void pop() noexcept
+		{
+			__atomic_signal_fence(__ATOMIC_ACQUIRE);
+			tail = uint8_t(tail + 1U);
+		}
+	};
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wattributes"
+#pragma GCC diagnostic ignored "-Wpacked"
+#endif
+	// The NTH with the NDP placed straight after it, both built fresh for each NTB sent
+	struct [[gnu::packed]] ntbHeader_t final
+	{
+		nth16_t nth;
+		ndp16_t ndp;
+		std::array<datagramPointer16_t, maxDatagrams + 1U> datagrams;
+	};
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+	static_assert(sizeof(ntbHeader_t) <= UINT8_MAX, "The NTB header must fit in a single multi-part entry");
+
+	static uint8_t commInterface{};
+	static endpoints_t endpoints{};
+	static const netif_t *netif{nullptr};
+	static volatile bool active_{false};
+	static volatile uint16_t packetFilter_{};
+
+	static const ntbParameters_t ntbParameters
+	{
+		sizeof(ntbParameters_t), ntbFormatsSupported16,
+		ntbSize, datagramAlignment, 0U, datagramAlignment, 0U,
+		ntbSize, datagramAlignment, 0U, datagramAlignment, 0U
+	};
+	static uint32_t ntbInMaxSize{ntbSize};
+	static std::array<uint8_t, 8> pendingInputSize{};
+	static const ntbFormat_t ntbFormat{ntbFormat_t::ntb16};
+
+	static frameQueue_t txQueue{};
+	static ntbHeader_t txHeader{};
+	static std::array<usbMultiPartDesc_t, maxNTBParts> txParts{};
+	static const std::array<uint8_t, datagramAlignment> zeros{};
+	static uint16_t txSequence{};
+	// How many frames from the front of txQueue are in the NTB in flight
+	static uint8_t txInFlight{};
+	static bool txBusy{false};
+	static bool txNeedsZLP{false};
+	static bool txSendingZLP{false};
+	// How many frames the front of txQueue has been waiting to be sent
+	static uint8_t txAge{};
+
+	alignas(uint32_t) static std::array<uint8_t, ntbSize> rxBuffer{};
+	static uint16_t rxOffset{};
+
+	static speedChangeNotification_t speedNotification
+	{
+		{0xA1U, notification_t::connectionSpeedChange, 0U, 0U, 8U}, bitRate, bitRate
+	};
+	static notificationHeader_t connectionNotification{0xA1U, notification_t::networkConnection, 0U, 0U, 0U};
+	static volatile bool linkUp{false};
+	static volatile bool speedPending{false};
+	static volatile bool connectionPending{false};
+	static bool notificationBusy{false};
+
+	static uint16_t alignUp(const uint16_t offset) noexcept
+		{ return uint16_t((offset + datagramAlignment - 1U) & ~(datagramAlignment - 1U)); }
+	static uint16_t headerLength(const uint8_t datagrams) noexcept
+		{ return uint16_t(sizeof(nth16_t) + sizeof(ndp16_t) + (datagrams + 1U) * sizeof(datagramPointer16_t)); }
+
+	/*!
+	 * Packs as many queued frames as fit into an NTB and starts sending it, by pointing the endpoint's
+	 * multi-part table at the header and then each frame's segments in turn. If force is false, the NTB
+	 * is only sent if it's full - that is, no more frames could have been added to it.
+	 */
+	static void sendNTB(const bool force) noexcept
+	{
+		const auto queued{std::min(txQueue.count(), maxDatagrams)};
+		if (txBusy || !queued)
+			return;
+
+		// Work out how many frames fit, placing each datagram after the header at the next alignment
+		uint8_t datagrams{};
+		uint16_t payloadLength{};
+		std::size_t partCount{1U};
+		for (; datagrams < queued; ++datagrams)
+		{
+			const auto &frame{txQueue[datagrams]};
+			const auto offset{alignUp(payloadLength)};
+			if (uint32_t(headerLength(uint8_t(datagrams + 1U)) + offset + frame.length) > ntbInMaxSize ||
+				partCount + 1U + frame.parts > txParts.size())
+				break;
+			payloadLength = uint16_t(offset + frame.length);
+			partCount += 1U + frame.parts;
+		}
+		if (!force && datagrams == txQueue.count() && datagrams < maxDatagrams)
+			return;
+
+		const auto header{headerLength(datagrams)};
+		const auto blockLength{uint16_t(header + payloadLength)};
+		txHeader.nth = {nth16Signature, sizeof(nth16_t), txSequence++, blockLength, sizeof(nth16_t)};
+		txHeader.ndp = {ndp16Signature, uint16_t(header - sizeof(nth16_t)), 0U};
+
+		std::size_t part{};
+		txParts[part++] = {uint8_t(header), &txHeader};
+		auto offset{header};
+		for (uint8_t datagram{}; datagram < datagrams; ++datagram)
+		{
+			const auto &frame{txQueue[datagram]};
+			const auto padding{uint16_t(alignUp(offset) - offset)};
+			if (padding)
+			{
+				txParts[part++] = {uint8_t(padding), zeros.data()};
+				offset = uint16_t(offset + padding);
+			}
+			txHeader.datagrams[datagram] = {offset, frame.length};
+			for (uint8_t segment{}; segment < frame.count; ++segment)
+			{
+				const auto *data{static_cast<const uint8_t *>(frame.segments[segment].data)};
+				auto length{frame.segments[segment].length};
+				while (length)
+				{
+					const auto amount{uint8_t(std::min<uint16_t>(length, UINT8_MAX))};
+					txParts[part++] = {amount, data};
+					data += amount;
+					length = uint16_t(length - amount);
+				}
+			}
+			offset = uint16_t(offset + frame.length);
+		}
+		txHeader.datagrams[datagrams] = {0U, 0U};
+
+		txInFlight = datagrams;
+		txBusy = true;
+		txAge = 0U;
+		// A transfer shorter than the host's NTB size that ends on a full packet needs a ZLP to end it
+		txNeedsZLP = !(blockLength % epBufferSize) && blockLength < ntbInMaxSize;
+		auto &epStatus{epStatusControllerIn[endpoints.dataIn]};
+		epStatus.isMultiPart(true);
+		epStatus.partNumber = 0;
+		epStatus.partsData = {txParts.data(), txParts.data() + part};
+		epStatus.memBuffer = nullptr;
+		epStatus.transferCount = blockLength;
+		writeEP(endpoints.dataIn);
+	}
+
+	static void sendZLP() noexcept
+	{
+		auto &epStatus{epStatusControllerIn[endpoints.dataIn]};
+		txSendingZLP = true;
+		epStatus.isMultiPart(false);
+		epStatus.memBuffer = nullptr;
+		epStatus.transferCount = 0U;
+		writeEP(endpoints.dataIn);
+	}
+
+	// Drops everything queued to send, handing the frames back to the application
+	static void flushTransmit() noexcept
+	{
+		while (txQueue.count())
+		{
+			const auto *const context{txQueue[0].context};
+			txQueue.pop();
+			netif->transmitted(context);
+		}
+		txInFlight = 0U;
+		txBusy = false;
+		txNeedsZLP = false;
+		txSendingZLP = false;
+		txAge = 0U;
+	}
+
+	static void parseNTB(const uint16_t length) noexcept
+	{
+		nth16_t nth{};
+		if (length < sizeof(nth))
+			return;
+		std::memcpy(&nth, rxBuffer.data(), sizeof(nth));
+		if (nth.signature != nth16Signature || nth.headerLength != sizeof(nth16_t))
+			return;
+		const auto blockLength{nth.blockLength ? std::min(nth.blockLength, length) : length};
+
+		// Walk the chain of NDPs, bounding it so a malformed NTB can't loop us forever
+		auto ndpIndex{nth.ndpIndex};
+		for (uint8_t ndpCount{}; ndpIndex && ndpCount < 8U; ++ndpCount)
+		{
+			ndp16_t ndp{};
+			if (ndpIndex % datagramAlignment || ndpIndex + sizeof(ndp) > blockLength)
+				return;
+			std::memcpy(&ndp, rxBuffer.data() + ndpIndex, sizeof(ndp));
+			if (ndp.signature != ndp16Signature || ndp.length < sizeof(ndp16_t) + 2U * sizeof(datagramPointer16_t) ||
+				ndpIndex + ndp.length > blockLength)
+				return;
+
+			const auto end{uint16_t(ndpIndex + ndp.length)};
+			for (auto entry{uint16_t(ndpIndex + sizeof(ndp16_t))}; entry + sizeof(datagramPointer16_t) <= end;
+				entry = uint16_t(entry + sizeof(datagramPointer16_t)))
+			{
+				datagramPointer16_t datagram{};
+				std::memcpy(&datagram, rxBuffer.data() + entry, sizeof(datagram));
+				if (!datagram.index || !datagram.length)
+					break;
+				else if (uint32_t(datagram.index) + datagram.length > blockLength)
+					continue;
+				netif->receive(rxBuffer.data() + datagram.index, datagram.length);
+			}
+			ndpIndex = ndp.nextNdpIndex;
+		}
+	}
+
+	void handleDataOut(const uint8_t) noexcept
+	{
+		auto &epStatus{epStatusControllerOut[endpoints.dataOut]};
+		const auto space{uint16_t(rxBuffer.size() - rxOffset)};
+		epStatus.memBuffer = rxBuffer.data() + rxOffset;
+		// The extra byte of slack keeps the transfer from running down to 0 and the controller
+		// dropping back to NAKing once a packet exactly fills the buffer
+		epStatus.transferCount = uint16_t(space + 1U);
+		readEP(endpoints.dataOut);
+		const auto received{uint16_t(space + 1U - epStatus.transferCount)};
+		rxOffset = uint16_t(rxOffset + received);
+
+		// An NTB ends on a short packet or on reaching the largest size we told the host we take.
+		// The datagrams are all handed on before returning, so the next NTB is NAKed till we're done.
+		if (received < epBufferSize || rxOffset == rxBuffer.size())
+		{
+			if (active_)
+				parseNTB(rxOffset);
+			rxOffset = 0U;
+		}
+	}
+
+	void handleDataIn(const uint8_t) noexcept
+	{
+		if (epStatusControllerIn[endpoints.dataIn].transferCount)
+		{
+			writeEP(endpoints.dataIn);
+			return;
+		}
+		else if (txSendingZLP)
+			txSendingZLP = false;
+		else
+		{
+			for (; txInFlight; --txInFlight)
+			{
+				const auto *const context{txQueue[0].context};
+				txQueue.pop();
+				netif->transmitted(context);
+			}
+			if (txNeedsZLP)
+			{
+				sendZLP();
+				return;
+			}
+		}
+		txBusy = false;
+		// If enough has queued up to fill another NTB, keep going rather than waiting for the next frame
+		sendNTB(false);
+	}
+
+	static void sendNotification(const void *const notification, const uint16_t length) noexcept
+	{
+		auto &epStatus{epStatusControllerIn[endpoints.notification]};
+		notificationBusy = true;
+		epStatus.isMultiPart(false);
+		epStatus.memBuffer = notification;
+		epStatus.transferCount = length;
+		writeEP(endpoints.notification);
+	}
+
+	void handleNotification(const uint8_t endpoint) noexcept
+	{
+		if (epStatusControllerIn[endpoint].transferCount)
+			writeEP(endpoint);
+		else
+			notificationBusy = false;
+	}
+
+	static void tick() noexcept
+	{
+		if (!active_)
+			return;
+
+		if (!notificationBusy)
+		{
+			// The speed goes first so the host knows it by the time the link comes up
+			if (speedPending)
+			{
+				speedPending = false;
+				sendNotification(&speedNotification, sizeof(speedNotification));
+			}
+			else if (connectionPending)
+			{
+				connectionPending = false;
+				connectionNotification.value = linkUp ? 1U : 0U;
+				sendNotification(&connectionNotification, sizeof(connectionNotification));
+			}
+		}
+
+		if (!txBusy && txQueue.count())
+			sendNTB(++txAge >= aggregationTimeout);
+	}
+
+	bool handleSetInterface() noexcept
+	{
+		if (packet.value > 1U)
+			return false;
+		// Either way the NTB state goes back to its defaults
+		flushTransmit();
+		rxOffset = 0U;
+		txSequence = 0U;
+		ntbInMaxSize = ntbSize;
+		active_ = packet.value == 1U;
+		if (active_)
+		{
+			speedPending = linkUp;
+			connectionPending = true;
+		}
+		return true;
+	}
+
+	void initNotification(const uint8_t) noexcept { notificationBusy = false; }
+
+	void initDataOut(const uint8_t) noexcept
+	{
+		rxOffset = 0U;
+		registerSOFHandler(commInterface, tick);
+	}
+
+	void deinitDataOut(const uint8_t) noexcept
+	{
+		unregsiterSOFHandler(commInterface);
+		active_ = false;
+		flushTransmit();
+	}
+
+	static void inputSizeReceived() noexcept
+	{
+		uint32_t size{};
+		std::memcpy(&size, pendingInputSize.data(), sizeof(size));
+		ntbInMaxSize = std::clamp<uint32_t>(size, minimumNTBInSize, ntbSize);
+	}
+
+	answer_t handleNCMRequest(const std::size_t interface) noexcept
+	{
+		const auto &requestType{packet.requestType};
+		if (requestType.recipient() != setupPacket::recipient_t::interface ||
+			requestType.type() != setupPacket::request_t::typeClass ||
+			packet.index != interface)
+			return {response_t::unhandled, nullptr, 0};
+
+		const auto request{static_cast<types::request_t>(packet.request)};
+		const auto dirIn{packet.requestType.dir() == endpointDir_t::controllerIn};
+		switch (request)
+		{
+			case types::request_t::getNTBParameters:
+				if (!dirIn)
+					return {response_t::stall, nullptr, 0};
+				return {response_t::data, &ntbParameters, sizeof(ntbParameters_t)};
+			case types::request_t::getNTBFormat:
+				if (!dirIn)
+					return {response_t::stall, nullptr, 0};
+				return {response_t::data, &ntbFormat, sizeof(ntbFormat_t)};
+			case types::request_t::setNTBFormat:
+				if (dirIn || packet.value != uint16_t(ntbFormat_t::ntb16))
+					return {response_t::stall, nullptr, 0};
+				return {response_t::zeroLength, nullptr, 0};
+			case types::request_t::getNTBInputSize:
+				if (!dirIn)
+					return {response_t::stall, nullptr, 0};
+				return {response_t::data, &ntbInMaxSize, sizeof(ntbInMaxSize)};
+			case types::request_t::setNTBInputSize:
+			{
+				if (dirIn || packet.length != sizeof(uint32_t))
+					return {response_t::stall, nullptr, 0};
+				auto &epStatus{epStatusControllerOut[0]};
+				epStatus.memBuffer = pendingInputSize.data();
+				epStatus.transferCount = sizeof(uint32_t);
+				epStatus.needsArming(true);
+				setupCallback = inputSizeReceived;
+				return {response_t::zeroLength, nullptr, 0};
+			}
+			case types::request_t::setEthernetPacketFilter:
+				if (dirIn)
+					return {response_t::stall, nullptr, 0};
+				packetFilter_ = packet.value;
+				return {response_t::zeroLength, nullptr, 0};
+			default:
+				break;
+		}
+
+		return {response_t::stall, nullptr, 0};
+	}
+
+	bool transmit(const segment_t *const segments, const uint8_t count, const void *const context) noexcept
+	{
+		uint16_t length{};
+		uint8_t parts{};
+		for (uint8_t segment{}; segment < count; ++segment)
+		{
+			length = uint16_t(length + segments[segment].length);
+			parts = uint8_t(parts + (segments[segment].length + UINT8_MAX - 1U) / UINT8_MAX);
+		}
+		if (!active_ || !length || length > maxFrameSize || parts > maxFrameParts)
+			return false;
+		return txQueue.push({segments, context, length, count, parts});
+	}
+
+	void linkState(const bool up) noexcept
+	{
+		linkUp = up;
+		speedPending = up;
+		connectionPending = true;
+	}
+
+	bool active() noexcept { return active_; }
+	uint16_t packetFilter() noexcept { return packetFilter_; }
+
+	void registerHandlers(const uint8_t interface, const uint8_t config, const endpoints_t eps,
+		const netif_t &networkInterface) noexcept
+	{
+		commInterface = interface;
+		endpoints = eps;
+		netif = &networkInterface;
+		speedNotification.header.index = interface;
+		connectionNotification.index = interface;
+		usb::device::registerHandler(interface, config, handleNCMRequest);
+		usb::device::registerAltModeHandler(uint8_t(interface + 1U), config, handleSetInterface);
+		usb::core::registerHandler({eps.notification, endpointDir_t::controllerIn}, config,
+			{initNotification, nullptr, handleNotification});
+		usb::core::registerHandler({eps.dataIn, endpointDir_t::controllerIn}, config,
+			{nullptr, nullptr, handleDataIn});
+		usb::core::registerHandler({eps.dataOut, endpointDir_t::controllerOut}, config,
+			{initDataOut, deinitDataOut, handleDataOut});
+	}
+} // namespace usb::cdc::ncm
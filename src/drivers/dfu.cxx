@@ -1,3 +1,4 @@
+#include <cstring>
 #include "usb/types.hxx"
 #include "usb/core.hxx"
 #include "usb/device.hxx"
@@ -13,10 +14,351 @@ using usb::device::packet;
 namespace usb::dfu
 {
 	static config_t config{};
-	static std::array<uint8_t, flashPageSize> buffer{};
+	// Blocks are received into one buffer while the oldest pending block is programmed from another
+	static std::array<std::array<uint8_t, flashPageSize>, downloadBuffers> buffers{};
+	static std::array<block_t, downloadBuffers> blocks{};
+	// The buffer the oldest pending block is in, and how many blocks are waiting to be programmed
+	static uint8_t blockTail{};
+	static uint8_t blocksPending{};
+
+	// Running estimates, in milliseconds, of how long an erase and a flashBufferSize write take
+	static uint16_t eraseTime{1U};
+	static uint16_t writeTime{1U};
+	static uint16_t massEraseTime{1U};
 
 	static substrate::span<const zone_t> zones{};
 	static flashState_t flashState{};
+	static std::size_t unitsSkipped{};
+
+#if defined(USB_DFU_DELTA) && defined(USB_MEM_SEGMENTED)
+#error "Delta flashing compares blocks against Flash in place, so needs a memory-mapped Flash"
+#endif
+#ifdef USB_DFU_DELTA
+	// Each erase unit is compared against a single block's buffer, so a unit spread over several never matches
+	static_assert(flashPageSize >= flashEraseSize && flashPageSize % flashEraseSize == 0U,
+		"Delta flashing needs the DFU page size to be a whole number of erase units");
+#endif
+
+#if defined(USB_DFU_COMPRESSED) && defined(USB_DFU_DFUSE)
+#error "Compressed downloads are sequential, so can't be combined with DfuSe addressing"
+#endif
+
+#ifdef USB_DFU_DFUSE
+	// Where block 2 goes, and the transfer size later blocks are offset from it by
+	static std::uintptr_t addressPointer{};
+	static std::size_t transferSize{};
+	// A command is a byte, optionally followed by a 32-bit address
+	static std::array<uint8_t, 5> command{};
+	static uint16_t commandLength{};
+	// Set from a command being accepted till GET_STATUS has reported it busy and seen its erase done
+	static bool commandPending{false};
+	constexpr static std::array<dfuseCommand_t, 4> supportedCommands
+	{{
+		dfuseCommand_t::getCommands,
+		dfuseCommand_t::setAddress,
+		dfuseCommand_t::erase,
+		dfuseCommand_t::readUnprotect
+	}};
+#endif
+
+#ifdef USB_DFU_COMPRESSED
+	/*!
+	 * Streaming heatshrink decoder. A 1 bit is followed by an 8-bit literal, and a 0 bit by a back
+	 * reference: the distance back into the window (less 1) in windowBits bits, then the length (less 1)
+	 * in lookaheadBits bits, all most significant bit first. It yields a byte at a time and can stop
+	 * for more input anywhere, including part way through a code.
+	 */
+	struct decoder_t final
+	{
+	private:
+		enum class state_t : uint8_t
+		{
+			tag,
+			literal,
+			index,
+			count,
+			backref
+		};
+
+		constexpr static uint16_t windowMask{(1U << compressionWindowBits) - 1U};
+
+		std::array<uint8_t, 1U << compressionWindowBits> window{};
+		uint16_t head{};
+		state_t state{state_t::tag};
+		uint16_t backrefIndex{};
+		uint16_t backrefCount{};
+
+		const uint8_t *input{nullptr};
+		std::size_t length{};
+		std::size_t offset{};
+		uint8_t current{};
+		uint8_t bitMask{};
+		uint16_t bits{};
+		uint8_t bitCount{};
+
+		// Accumulates bits till there are count of them, returning false if the input ran out first
+		bool readBits(const uint8_t count) noexcept
+		{
+			while (bitCount < count)
+			{
+				if (!bitMask)
+				{
+					if (offset == length)
+						return false;
+					current = input[offset++];
+					bitMask = 0x80U;
+				}
+				bits = uint16_t((bits << 1U) | ((current & bitMask) ? 1U : 0U));
+				bitMask >>= 1U;
+				++bitCount;
+			}
+			return true;
+		}
+
+		uint16_t takeBits() noexcept
+		{
+			const auto value{bits};
+			bits = 0U;
+			bitCount = 0U;
+			return value;
+		}
+
+		uint8_t push(const uint8_t byte) noexcept
+		{
+			window[head & windowMask] = byte;
+			head = uint16_t(head + 1U);
+			return byte;
+		}
+
+	public:
+		void reset() noexcept { *this = {}; }
+
+		void feed(const uint8_t *const data, const std::size_t amount) noexcept
+		{
+			input = data;
+			length = amount;
+			offset = 0U;
+		}
+
+		[[nodiscard]] bool inputConsumed() const noexcept
+			{ return offset == length && !bitMask && state != state_t::backref; }
+
+		// Produces the next byte of output, returning false when more input is needed
+		bool next(uint8_t &byte) noexcept
+		{
+			while (true)
+			{
+				switch (state)
+				{
+					case state_t::tag:
+						if (!readBits(1U))
+							return false;
+						state = takeBits() ? state_t::literal : state_t::index;
+						break;
+					case state_t::literal:
+						if (!readBits(8U))
+							return false;
+						byte = push(uint8_t(takeBits()));
+						state = state_t::tag;
+						return true;
+					case state_t::index:
+						if (!readBits(compressionWindowBits))
+							return false;
+						backrefIndex = uint16_t(takeBits() + 1U);
+						state = state_t::count;
+						break;
+					case state_t::count:
+						if (!readBits(compressionLookaheadBits))
+							return false;
+						backrefCount = uint16_t(takeBits() + 1U);
+						state = state_t::backref;
+						break;
+					case state_t::backref:
+						byte = push(window[(head - backrefIndex) & windowMask]);
+						if (!--backrefCount)
+							state = state_t::tag;
+						return true;
+				}
+			}
+		}
+	};
+
+	// The compressed block as received, which is decompressed into the download buffers as they free up
+	static std::array<uint8_t, flashPageSize> compressedBlock{};
+	static uint16_t compressedLength{};
+	static decoder_t decoder{};
+	// How much decompressed data is in the buffer at the head of the queue
+	static std::size_t fillLength{};
+#endif
+
+#ifdef USB_DFU_VERIFY
+#ifdef USB_MEM_SEGMENTED
+#error "Verification hashes the image back out of Flash, so needs a memory-mapped Flash"
+#endif
+
+#ifdef USB_DFU_VERIFY_CRC32
+	// Reflected CRC-32 (polynomial 0x04C11DB7) a nibble at a time, keeping the table to 64 bytes
+	constexpr static auto crcTable
+	{
+		[]() noexcept
+		{
+			std::array<uint32_t, 16> table{};
+			for (uint32_t nibble{}; nibble < table.size(); ++nibble)
+			{
+				auto crc{nibble};
+				for (uint8_t bit{}; bit < 4U; ++bit)
+					crc = (crc & 1U) ? (crc >> 1U) ^ 0xEDB88320U : crc >> 1U;
+				table[nibble] = crc;
+			}
+			return table;
+		}()
+	};
+
+	struct hasher_t final
+	{
+	private:
+		uint32_t crc{};
+
+	public:
+		void reset() noexcept { crc = 0U; }
+
+		void update(const uint8_t *const data, const std::size_t length) noexcept
+		{
+#ifdef USB_DFU_HARDWARE_CRC
+			crc = crc32(crc, data, length);
+#else
+			crc = ~crc;
+			for (std::size_t i{}; i < length; ++i)
+			{
+				crc ^= data[i];
+				crc = (crc >> 4U) ^ crcTable[crc & 0x0FU];
+				crc = (crc >> 4U) ^ crcTable[crc & 0x0FU];
+			}
+			crc = ~crc;
+#endif
+		}
+
+		void finish(digest_t &digest) const noexcept
+		{
+			for (uint8_t i{}; i < digest.size(); ++i)
+				digest[i] = uint8_t(crc >> (i * 8U));
+		}
+	};
+#else
+	constexpr static std::array<uint32_t, 64> sha256K
+	{{
+		0x428a2f98U, 0x71374491U, 0xb5c0fbcfU, 0xe9b5dba5U, 0x3956c25bU, 0x59f111f1U, 0x923f82a4U, 0xab1c5ed5U,
+		0xd807aa98U, 0x12835b01U, 0x243185beU, 0x550c7dc3U, 0x72be5d74U, 0x80deb1feU, 0x9bdc06a7U, 0xc19bf174U,
+		0xe49b69c1U, 0xefbe4786U, 0x0fc19dc6U, 0x240ca1ccU, 0x2de92c6fU, 0x4a7484aaU, 0x5cb0a9dcU, 0x76f988daU,
+		0x983e5152U, 0xa831c66dU, 0xb00327c8U, 0xbf597fc7U, 0xc6e00bf3U, 0xd5a79147U, 0x06ca6351U, 0x14292967U,
+		0x27b70a85U, 0x2e1b2138U, 0x4d2c6dfcU, 0x53380d13U, 0x650a7354U, 0x766a0abbU, 0x81c2c92eU, 0x92722c85U,
+		0xa2bfe8a1U, 0xa81a664bU, 0xc24b8b70U, 0xc76c51a3U, 0xd192e819U, 0xd6990624U, 0xf40e3585U, 0x106aa070U,
+		0x19a4c116U, 0x1e376c08U, 0x2748774cU, 0x34b0bcb5U, 0x391c0cb3U, 0x4ed8aa4aU, 0x5b9cca4fU, 0x682e6ff3U,
+		0x748f82eeU, 0x78a5636fU, 0x84c87814U, 0x8cc70208U, 0x90befffaU, 0xa4506cebU, 0xbef9a3f7U, 0xc67178f2U
+	}};
+
+	struct hasher_t final
+	{
+	private:
+		std::array<uint32_t, 8> state{};
+		std::array<uint8_t, 64> block{};
+		uint8_t blockLength{};
+		uint64_t length{};
+
+		[[nodiscard]] static uint32_t rotr(const uint32_t value, const uint8_t bits) noexcept
+			{ return (value >> bits) | (value << (32U - bits)); }
+
+		void compress() noexcept
+		{
+			std::array<uint32_t, 16> schedule{};
+			for (uint8_t i{}; i < schedule.size(); ++i)
+				schedule[i] = uint32_t(block[i * 4U] << 24U) | uint32_t(block[i * 4U + 1U] << 16U) |
+					uint32_t(block[i * 4U + 2U] << 8U) | block[i * 4U + 3U];
+
+			auto [a, b, c, d, e, f, g, h] = state;
+			for (uint8_t i{}; i < sha256K.size(); ++i)
+			{
+				// The message schedule is expanded in place, 16 words at a time
+				auto &word{schedule[i & 15U]};
+				if (i >= 16U)
+				{
+					const auto w15{schedule[(i + 1U) & 15U]};
+					const auto w2{schedule[(i + 14U) & 15U]};
+					word += (rotr(w15, 7U) ^ rotr(w15, 18U) ^ (w15 >> 3U)) + schedule[(i + 9U) & 15U] +
+						(rotr(w2, 17U) ^ rotr(w2, 19U) ^ (w2 >> 10U));
+				}
+				const auto t1{h + (rotr(e, 6U) ^ rotr(e, 11U) ^ rotr(e, 25U)) + ((e & f) ^ (~e & g)) +
+					sha256K[i] + word};
+				const auto t2{(rotr(a, 2U) ^ rotr(a, 13U) ^ rotr(a, 22U)) + ((a & b) ^ (a & c) ^ (b & c))};
+				h = g;
+				g = f;
+				f = e;
+				e = d + t1;
+				d = c;
+				c = b;
+				b = a;
+				a = t1 + t2;
+			}
+			state[0] += a;
+			state[1] += b;
+			state[2] += c;
+			state[3] += d;
+			state[4] += e;
+			state[5] += f;
+			state[6] += g;
+			state[7] += h;
+		}
+
+	public:
+		void reset() noexcept
+		{
+			state = {{0x6a09e667U, 0xbb67ae85U, 0x3c6ef372U, 0xa54ff53aU,
+				0x510e527fU, 0x9b05688cU, 0x1f83d9abU, 0x5be0cd19U}};
+			blockLength = 0U;
+			length = 0U;
+		}
+
+		void update(const uint8_t *const data, const std::size_t amount) noexcept
+		{
+			length += amount;
+			for (std::size_t i{}; i < amount; ++i)
+			{
+				block[blockLength++] = data[i];
+				if (blockLength == block.size())
+				{
+					compress();
+					blockLength = 0U;
+				}
+			}
+		}
+
+		void finish(digest_t &digest) noexcept
+		{
+			const auto bits{length * 8U};
+			block[blockLength++] = 0x80U;
+			if (blockLength > block.size() - 8U)
+			{
+				std::fill(block.begin() + blockLength, block.end(), uint8_t{});
+				compress();
+				blockLength = 0U;
+			}
+			std::fill(block.begin() + blockLength, block.end() - 8U, uint8_t{});
+			for (uint8_t i{}; i < 8U; ++i)
+				block[block.size() - 1U - i] = uint8_t(bits >> (i * 8U));
+			compress();
+			for (uint8_t i{}; i < digest.size(); ++i)
+				digest[i] = uint8_t(state[i / 4U] >> (24U - (i % 4U) * 8U));
+		}
+	};
+#endif
+
+	static hasher_t hasher{};
+	// How far into the zone the image has been hashed
+	static std::uintptr_t hashAddr{};
+	// The digest the host gave for the image, if it gave one
+	static digest_t expectedDigest{};
+	static bool haveExpectedDigest{false};
+#endif
 
 	static_assert(sizeof(config_t) == 6);
 
@@ -28,7 +370,7 @@ namespace usb::dfu
 		config.status = dfuStatus_t::ok;
 	}
 
-	static bool handleSetInterface()
+	bool handleSetInterface()
 	{
 		unregsiterSOFHandler(packet.index);
 		if (packet.value >= zones.size())
@@ -38,11 +380,32 @@ namespace usb::dfu
 		config.status = dfuStatus_t::ok;
 
 		const auto &zone{zones[packet.value]};
+		flashState.zone = uint8_t(packet.value);
 		flashState.op = flashOp_t::none;
+		flashState.startAddr = zone.start;
 		flashState.readAddr = zone.start;
 		flashState.eraseAddr = zone.start;
 		flashState.writeAddr = zone.start;
+		flashState.downloadAddr = zone.start;
 		flashState.endAddr = zone.end;
+		flashState.offset = 0;
+		flashState.skipUnit = false;
+		blockTail = 0U;
+		blocksPending = 0U;
+		unitsSkipped = 0U;
+#ifdef USB_DFU_DFUSE
+		addressPointer = zone.start;
+		transferSize = 0U;
+		commandPending = false;
+#endif
+#ifdef USB_DFU_COMPRESSED
+		decoder.reset();
+		fillLength = 0U;
+#endif
+#ifdef USB_DFU_VERIFY
+		hasher.reset();
+		hashAddr = zone.start;
+#endif
 
 		registerSOFHandler(packet.index, tick);
 		return true;
@@ -63,33 +426,438 @@ namespace usb::dfu
 		reboot();
 	}
 
-	void downloadStepDone() noexcept { config.state = dfuState_t::downloadBusy; }
+	static uint8_t blockHead() noexcept { return uint8_t((blockTail + blocksPending) % downloadBuffers); }
+
+	[[nodiscard]] static bool inZone(const std::uintptr_t address, const std::size_t length) noexcept
+	{
+		return address >= flashState.startAddr && address <= flashState.endAddr &&
+			length <= flashState.endAddr - address;
+	}
 
+#ifdef USB_DFU_COMPRESSED
+	// Queues the buffer being decompressed into for programming
+	static bool queueOutput() noexcept
+	{
+		if (!inZone(flashState.downloadAddr, fillLength))
+		{
+			config.state = dfuState_t::error;
+			config.status = dfuStatus_t::address;
+			decoder.reset();
+			fillLength = 0U;
+			return false;
+		}
+		blocks[blockHead()] = {flashState.downloadAddr, fillLength, blockOp_t::write};
+		flashState.downloadAddr += fillLength;
+		fillLength = 0U;
+		++blocksPending;
+		return true;
+	}
+
+	// Decompresses as much of the received block as there are free buffers for
+	static void decompress() noexcept
+	{
+		while (blocksPending < downloadBuffers)
+		{
+			if (fillLength == flashPageSize)
+			{
+				if (!queueOutput())
+					return;
+				continue;
+			}
+			uint8_t byte{};
+			if (!decoder.next(byte))
+				break;
+			buffers[blockHead()][fillLength++] = byte;
+		}
+	}
+#endif
+
+	// Whether the host can send the next block
+	[[nodiscard]] static bool readyForBlock() noexcept
+	{
+#ifdef USB_DFU_COMPRESSED
+		return decoder.inputConsumed();
+#else
+		return blocksPending < downloadBuffers;
+#endif
+	}
+
+	// Queues the block just received for programming
+	static void downloadStepDone() noexcept
+	{
+		config.state = dfuState_t::downloadSync;
+#ifdef USB_DFU_COMPRESSED
+		decoder.feed(compressedBlock.data(), compressedLength);
+		decompress();
+#else
+		++blocksPending;
+#endif
+	}
+
+#ifndef USB_DFU_COMPRESSED
+	// Receives a block into the next free buffer, queuing it for programming once it's all arrived
+	static answer_t receiveBlock(const std::uintptr_t address, const blockOp_t op) noexcept
+	{
+		const auto block{blockHead()};
+		blocks[block] = {address, packet.length, op};
+
+		auto &epStatus{epStatusControllerOut[0]};
+		epStatus.memBuffer = buffers[block].data();
+		epStatus.transferCount = packet.length;
+		epStatus.needsArming(true);
+		config.state = dfuState_t::downloadIdle;
+		setupCallback = downloadStepDone;
+		return {response_t::zeroLength, nullptr, 0};
+	}
+#endif
+
+#ifdef USB_DFU_DFUSE
+	static void commandError() noexcept
+	{
+		commandPending = false;
+		config.state = dfuState_t::error;
+		config.status = dfuStatus_t::target;
+	}
+
+	static void queueCommand(const std::uintptr_t address, const blockOp_t op) noexcept
+	{
+		blocks[blockHead()] = {address, 0U, op};
+		++blocksPending;
+	}
+
+	/*!
+	 * The host expects dfuDNBUSY from the first GET_STATUS after every command, and waits for
+	 * dfuDNLOAD-IDLE before sending anything else, so commandPending holds the state machine in
+	 * dfuDNBUSY till any erase the command queued has completed.
+	 */
+	static void handleDfuSeCommand() noexcept
+	{
+		config.state = dfuState_t::downloadSync;
+		commandPending = true;
+		uint32_t address{};
+		if (commandLength == 5U)
+			address = uint32_t(command[1] | (command[2] << 8U) | (command[3] << 16U) | (uint32_t{command[4]} << 24U));
+
+		switch (static_cast<dfuseCommand_t>(command[0]))
+		{
+			case dfuseCommand_t::setAddress:
+				if (commandLength != 5U || !inZone(address, 0U))
+					return commandError();
+				addressPointer = address;
+				transferSize = 0U;
+				break;
+			case dfuseCommand_t::erase:
+				if (commandLength == 1U)
+					queueCommand(flashState.startAddr, blockOp_t::massErase);
+				else if (commandLength == 5U && inZone(address, 1U))
+				{
+					// Erase the whole erase unit the address falls in
+					const auto unit{(address - flashState.startAddr) / flashEraseSize};
+					queueCommand(flashState.startAddr + unit * flashEraseSize, blockOp_t::erase);
+				}
+				else
+					return commandError();
+				break;
+			case dfuseCommand_t::readUnprotect:
+				readUnprotect();
+				break;
+			default:
+				commandPending = false;
+				config.state = dfuState_t::error;
+				config.status = dfuStatus_t::stalledPacket;
+				break;
+		}
+	}
+
+	/*!
+	 * DfuSe uses the block number to say what a download is: block 0 carries a command, and blocks 2
+	 * and up carry data for addressPointer + (block - 2) * wTransferSize. Every full block is
+	 * wTransferSize long, so the largest block seen gives that. The host erases ahead of its writes.
+	 */
 	static answer_t handleDownload() noexcept
 	{
-		if (packet.length)
+		if (!packet.length)
 		{
-			if (packet.length > buffer.size() ||
-				flashState.eraseAddr + packet.length > flashState.endAddr)
-				return {response_t::stall, nullptr, 0};
+			config.state = dfuState_t::manifestSync;
+			return {response_t::zeroLength, nullptr, 0};
+		}
+		else if (blocksPending == downloadBuffers)
+			return {response_t::stall, nullptr, 0};
 
-			flashState.op = flashOp_t::erase;
-			flashState.offset = 0;
-			flashState.byteCount = packet.length;
+		const auto block{uint16_t(packet.value)};
+		if (!block)
+		{
+			if (packet.length > command.size())
+				return {response_t::stall, nullptr, 0};
+			commandLength = packet.length;
+			auto &epStatus{epStatusControllerOut[0]};
+			epStatus.memBuffer = command.data();
+			epStatus.transferCount = packet.length;
+			epStatus.needsArming(true);
+			config.state = dfuState_t::downloadIdle;
+			setupCallback = handleDfuSeCommand;
+			return {response_t::zeroLength, nullptr, 0};
+		}
+		else if (block == 1U || packet.length > flashPageSize)
+			return {response_t::stall, nullptr, 0};
 
+		transferSize = std::max<std::size_t>(transferSize, packet.length);
+		const auto address{addressPointer + (block - 2U) * transferSize};
+		if (!inZone(address, packet.length))
+			return {response_t::stall, nullptr, 0};
+		return receiveBlock(address, blockOp_t::program);
+	}
+#elif defined(USB_DFU_COMPRESSED)
+	/*!
+	 * Each block is a piece of a heatshrink stream, received whole and then decompressed into the
+	 * download buffers as fast as they're programmed. The host is held off with dfuDNBUSY till all of
+	 * a block has been decompressed.
+	 */
+	static answer_t handleDownload() noexcept
+	{
+		if (packet.length)
+		{
+			if (packet.length > flashPageSize || !decoder.inputConsumed())
+				return {response_t::stall, nullptr, 0};
+			compressedLength = packet.length;
 			auto &epStatus{epStatusControllerOut[0]};
-			epStatus.memBuffer = buffer.data();
+			epStatus.memBuffer = compressedBlock.data();
 			epStatus.transferCount = packet.length;
 			epStatus.needsArming(true);
 			config.state = dfuState_t::downloadIdle;
 			setupCallback = downloadStepDone;
+			return {response_t::zeroLength, nullptr, 0};
 		}
-		else
-			config.state = dfuState_t::manifestSync;
+		// The end of the stream, so program whatever's left over
+		config.state = dfuState_t::manifestSync;
+		// Decompression only fills a buffer when there's one free, so this can always be queued
+		if (fillLength)
+			queueOutput();
 		return {response_t::zeroLength, nullptr, 0};
 	}
+#else
+	static answer_t handleDownload() noexcept
+	{
+		if (packet.length)
+		{
+			// The host only sends a block once GET_STATUS has said there's a buffer free for it
+			if (packet.length > flashPageSize || blocksPending == downloadBuffers ||
+				!inZone(flashState.downloadAddr, packet.length))
+				return {response_t::stall, nullptr, 0};
+
+			const auto address{flashState.downloadAddr};
+			flashState.downloadAddr += packet.length;
+			return receiveBlock(address, blockOp_t::write);
+		}
+		config.state = dfuState_t::manifestSync;
+		return {response_t::zeroLength, nullptr, 0};
+	}
+#endif
+
+	// Estimates how long, in milliseconds, till the oldest blocks given have been programmed
+	static uint32_t pendingTime(const uint8_t count) noexcept
+	{
+		if (!count)
+			return flashState.op == flashOp_t::none ? 0U : 1U;
+		uint32_t time{};
+		auto eraseAddr{flashState.eraseAddr};
+		auto offset{flashState.offset};
+		for (uint8_t i{}; i < count; ++i)
+		{
+			const auto &block{blocks[(blockTail + i) % downloadBuffers]};
+			if (block.op == blockOp_t::erase)
+				time += eraseTime;
+			else if (block.op == blockOp_t::massErase)
+				time += massEraseTime;
+			else
+			{
+				const auto remaining{block.length - offset};
+				const auto blockEnd{block.address + block.length};
+				const auto erases{block.op == blockOp_t::write && eraseAddr < blockEnd ?
+					(blockEnd - eraseAddr + flashEraseSize - 1U) / flashEraseSize : 0U};
+				const auto writes{(remaining + flashBufferSize - 1U) / flashBufferSize};
+				time += uint32_t(erases * eraseTime + writes * writeTime);
+				eraseAddr += erases * flashEraseSize;
+			}
+			offset = 0;
+		}
+		return time;
+	}
+
+	static void pollTimeout(const uint32_t time) noexcept
+	{
+		config.pollTimeout[0] = uint8_t(time);
+		config.pollTimeout[1] = uint8_t(time >> 8U);
+		config.pollTimeout[2] = uint8_t(time >> 16U);
+	}
+
+#ifdef USB_DFU_VERIFY
+#ifndef USB_DFU_DFUSE
+	static void hashTo(const std::uintptr_t address) noexcept
+	{
+		if (address <= hashAddr)
+			return;
+		hasher.update(reinterpret_cast<const uint8_t *>(hashAddr), address - hashAddr);
+		hashAddr = address;
+	}
+#endif
+
+	/*!
+	 * Hashes a block back out of Flash once it's programmed, so a bad write fails verification just
+	 * as bad data from the host does. Sequential downloads hold back their last digestLength bytes as
+	 * they may be the image's trailer; DfuSe data is hashed whole, in the order it was sent.
+	 */
+	static void hashBlock(const block_t &block) noexcept
+	{
+#ifdef USB_DFU_DFUSE
+		if (block.op == blockOp_t::program)
+			hasher.update(reinterpret_cast<const uint8_t *>(block.address), block.length);
+#else
+		const auto end{block.address + block.length};
+		if (end - flashState.startAddr > digestLength)
+			hashTo(end - digestLength);
+#endif
+	}
 
-	static answer_t handleDFURequest(const std::size_t interface) noexcept
+	/*!
+	 * Checks the image against the digest the host gave, or failing that against its trailer. DfuSe
+	 * images have no end to find a trailer at, so are only checked when the host gives a digest.
+	 */
+	[[nodiscard]] static bool imageValid() noexcept
+	{
+		const uint8_t *expected{expectedDigest.data()};
+#ifdef USB_DFU_DFUSE
+		if (!haveExpectedDigest)
+			return true;
+#else
+		const auto end{flashState.downloadAddr};
+		if (haveExpectedDigest)
+			hashTo(end);
+		else if (end - flashState.startAddr < digestLength)
+			return false;
+		else
+			expected = reinterpret_cast<const uint8_t *>(end - digestLength);
+#endif
+		digest_t digest{};
+		hasher.finish(digest);
+		return !std::memcmp(digest.data(), expected, digestLength);
+	}
+
+	// Verifies the image just manifested, readying the hash for whatever the host sends next
+	static void verifyImage() noexcept
+	{
+		if (!imageValid())
+		{
+			config.state = dfuState_t::error;
+			config.status = dfuStatus_t::verify;
+		}
+		hasher.reset();
+		hashAddr = flashState.downloadAddr;
+		haveExpectedDigest = false;
+	}
+#endif
+
+	/*!
+	 * While there's a buffer free the host can send the next block straight away, overlapping its
+	 * reception with programming the last. Otherwise it's told to come back when the estimates say the
+	 * oldest block will be done, rather than polling flat out.
+	 */
+	static void updateStatus() noexcept
+	{
+		pollTimeout(0U);
+		switch (config.state)
+		{
+			case dfuState_t::downloadSync:
+#ifdef USB_DFU_DFUSE
+				if (commandPending)
+				{
+					config.state = dfuState_t::downloadBusy;
+					pollTimeout(pendingTime(blocksPending));
+					break;
+				}
+#endif
+				if (readyForBlock())
+				{
+					config.state = dfuState_t::downloadIdle;
+					break;
+				}
+				config.state = dfuState_t::downloadBusy;
+				[[fallthrough]];
+			case dfuState_t::downloadBusy:
+#ifdef USB_DFU_DFUSE
+				if (commandPending)
+				{
+					if (!blocksPending && flashState.op == flashOp_t::none)
+					{
+						commandPending = false;
+						config.state = dfuState_t::downloadIdle;
+					}
+					else
+						pollTimeout(pendingTime(blocksPending));
+					break;
+				}
+#endif
+				pollTimeout(pendingTime(1U));
+				break;
+			case dfuState_t::manifestSync:
+				config.state = dfuState_t::manifest;
+				pollTimeout(pendingTime(blocksPending));
+				break;
+			case dfuState_t::manifest:
+				// Manifestation is done once the last of the blocks has been programmed
+				if (!blocksPending && flashState.op == flashOp_t::none)
+				{
+					config.state = dfuState_t::dfuIdle;
+#ifdef USB_DFU_VERIFY
+					verifyImage();
+#endif
+				}
+				else
+					pollTimeout(pendingTime(blocksPending));
+				break;
+			default:
+				break;
+		}
+	}
+
+	/*!
+	 * Uploads are served straight out of the zone rather than bounced through the download buffer, so
+	 * wLength is only limited by the control transfer. A short (or zero length) reply tells the host
+	 * it has reached the end of the zone.
+	 */
+	static answer_t handleUpload() noexcept
+	{
+		// Don't hand back Flash that's still being programmed
+		if ((config.state != dfuState_t::dfuIdle && config.state != dfuState_t::uploadIdle) || blocksPending)
+			return {response_t::stall, nullptr, 0};
+
+#ifdef USB_DFU_DFUSE
+		// DfuSe block 0 lists the commands supported, and blocks 2 and up read from the address pointer
+		const auto block{uint16_t(packet.value)};
+		if (!block)
+		{
+			config.state = dfuState_t::dfuIdle;
+			return {response_t::data, supportedCommands.data(), uint16_t(supportedCommands.size())};
+		}
+		else if (block == 1U)
+			return {response_t::stall, nullptr, 0};
+		const auto offset{std::uintptr_t{block - 2U} * packet.length};
+		if (offset > flashState.endAddr - addressPointer)
+			return {response_t::stall, nullptr, 0};
+		flashState.readAddr = addressPointer + offset;
+#else
+		// A new upload always starts from the beginning of the zone
+		if (config.state == dfuState_t::dfuIdle)
+			flashState.readAddr = flashState.startAddr;
+#endif
+		const auto address{flashState.readAddr};
+		const auto amount{uint16_t(std::min<std::uintptr_t>(packet.length, flashState.endAddr - address))};
+		flashState.readAddr += amount;
+		config.state = amount == packet.length ? dfuState_t::uploadIdle : dfuState_t::dfuIdle;
+		return {response_t::data, reinterpret_cast<const void *>(address), amount, memory_t::flash};
+	}
+
+	answer_t handleDFURequest(const std::size_t interface) noexcept
 	{
 		const auto &requestType{packet.requestType};
 		if (requestType.recipient() != setupPacket::recipient_t::interface ||
@@ -110,22 +878,13 @@ namespace usb::dfu
 					return {response_t::stall, nullptr, 0};
 				return handleDownload();
 			case types::request_t::upload:
-				if (packet.requestType.dir() == endpointDir_t::controllerOut ||
-					packet.length > buffer.size() ||
-					flashState.readAddr + packet.length > flashState.endAddr)
+				if (packet.requestType.dir() == endpointDir_t::controllerOut)
 					return {response_t::stall, nullptr, 0};
-				std::memcpy(buffer.data(), reinterpret_cast<void *>(flashState.readAddr), packet.length);
-				flashState.readAddr += packet.length;
-				return {response_t::data, buffer.data(), packet.length};
+				return handleUpload();
 			case types::request_t::getStatus:
 				if (packet.requestType.dir() == endpointDir_t::controllerOut)
 					return {response_t::stall, nullptr, 0};
-				if (config.state == dfuState_t::downloadSync)
-					config.state = dfuState_t::downloadIdle;
-				else if (config.state == dfuState_t::manifestSync)
-					config.state = dfuState_t::manifest;
-				else if (config.state == dfuState_t::manifest)
-					config.state = dfuState_t::dfuIdle;
+				updateStatus();
 				return {response_t::data, &config, sizeof(config)};
 			case types::request_t::clearStatus:
 				if (packet.requestType.dir() == endpointDir_t::controllerIn)
@@ -143,45 +902,201 @@ namespace usb::dfu
 			case types::request_t::abort:
 				if (packet.requestType.dir() == endpointDir_t::controllerIn)
 					return {response_t::stall, nullptr, 0};
+				// Blocks already acknowledged stay queued, the host having been told they were accepted
 				config.state = dfuState_t::dfuIdle;
+#ifdef USB_DFU_DFUSE
+				commandPending = false;
+#endif
 				return {response_t::zeroLength, nullptr, 0};
 		}
 
 		return {response_t::stall, nullptr, 0};
 	}
 
-	void tick() noexcept
+	static void updateEstimate(uint16_t &estimate, const uint16_t sample) noexcept
+		{ estimate = uint16_t((estimate * 3U + sample + 3U) / 4U); }
+
+	// The block's been fully programmed, so its buffer is free for the host to refill
+	static void retireBlock() noexcept
 	{
-		if (flashState.op == flashOp_t::none || flashBusy())
+#ifdef USB_DFU_VERIFY
+		hashBlock(blocks[blockTail]);
+#endif
+		flashState.offset = 0;
+		blockTail = uint8_t((blockTail + 1U) % downloadBuffers);
+		--blocksPending;
+#ifdef USB_DFU_COMPRESSED
+		decompress();
+#endif
+#ifdef USB_DFU_DFUSE
+		// A command only leaves dfuDNBUSY through GET_STATUS
+		if (commandPending)
 			return;
-		else if (flashState.op == flashOp_t::erase)
+#endif
+		if (config.state == dfuState_t::downloadBusy && readyForBlock())
+			config.state = dfuState_t::downloadSync;
+	}
+
+	// Called as the last operation issued completes, to time it and retire the block it finished
+	static void operationDone() noexcept
+	{
+		const auto elapsed{uint16_t((frameNumber() - flashState.opStart) & 0x07FFU)};
+		if (flashState.op == flashOp_t::erase)
+			updateEstimate(eraseTime, elapsed);
+		else if (flashState.op == flashOp_t::massErase)
+			updateEstimate(massEraseTime, elapsed);
+		else if (flashState.op == flashOp_t::write)
+			updateEstimate(writeTime, elapsed);
+		flashState.op = flashOp_t::none;
+		// Erase commands are done in one operation, data blocks once the last of their data is written
+		if (blocksPending)
 		{
-			if (flashState.eraseAddr < flashState.writeAddr + flashState.byteCount)
-			{
-				erase(flashState.eraseAddr);
-				flashState.eraseAddr += flashEraseSize;
-			}
-			else if (flashState.endAddr >= flashState.writeAddr + flashState.byteCount)
-				flashState.op = flashOp_t::write;
+			const auto &block{blocks[blockTail]};
+			if (block.op == blockOp_t::erase || block.op == blockOp_t::massErase ||
+				flashState.offset == block.length)
+				retireBlock();
 		}
-		if (flashState.op == flashOp_t::write && config.state == dfuState_t::downloadBusy)
+	}
+
+	static void startOperation(const flashOp_t op) noexcept
+	{
+		flashState.opStart = frameNumber();
+		flashState.op = op;
+	}
+
+	/*!
+	 * With delta flashing, an erase unit the block completely covers is left alone if Flash already
+	 * holds exactly what the block would put there. Units the block only partly covers are always
+	 * erased, as the rest of their data is either not here yet or not part of the image.
+	 */
+	[[nodiscard]] static bool unitUnchanged([[maybe_unused]] const uint8_t *const data,
+		[[maybe_unused]] const std::size_t available) noexcept
+	{
+#ifdef USB_DFU_DELTA
+		return available >= flashEraseSize &&
+			!std::memcmp(data, reinterpret_cast<const void *>(flashState.eraseAddr), flashEraseSize);
+#else
+		return false;
+#endif
+	}
+
+	/*!
+	 * Works through the oldest pending block an erase unit at a time: each unit is erased (or skipped)
+	 * and then the block's data for it written in flashBufferSize chunks. Skipped work takes no time, so
+	 * this carries on till it has issued one real operation, returning true, or run out of blocks.
+	 */
+	static bool issueOperation() noexcept
+	{
+		while (blocksPending)
 		{
-			if (flashState.offset == flashState.byteCount)
+			const auto &block{blocks[blockTail]};
+#ifdef USB_DFU_DFUSE
+			if (block.op == blockOp_t::erase)
 			{
-				flashState.op = flashOp_t::none;
-				flashState.offset = 0;
-				flashState.byteCount = 0;
-				config.state = dfuState_t::downloadSync;
+				startOperation(flashOp_t::erase);
+				erase(block.address);
+				return true;
 			}
-			else
+			else if (block.op == blockOp_t::massErase)
+			{
+				startOperation(flashOp_t::massErase);
+				massErase(zones[flashState.zone]);
+				return true;
+			}
+#endif
+			const auto length{block.length};
+			if (flashState.offset == length)
 			{
-				const auto amount{std::min(flashState.byteCount - flashState.offset, flashBufferSize)};
-				write(flashState.writeAddr, amount, buffer.data() + flashState.offset);
+				retireBlock();
+				continue;
+			}
+
+			const auto *const data{buffers[blockTail].data() + flashState.offset};
+			if (block.op == blockOp_t::program)
+			{
+				const auto amount{std::min(length - flashState.offset, flashBufferSize)};
+				startOperation(flashOp_t::write);
+				write(block.address + flashState.offset, amount, data);
 				flashState.offset += amount;
-				flashState.writeAddr += amount;
+				return true;
+			}
+			else if (flashState.writeAddr >= flashState.eraseAddr)
+			{
+				flashState.skipUnit = unitUnchanged(data, length - flashState.offset);
+				if (flashState.skipUnit)
+					++unitsSkipped;
+				else
+				{
+					startOperation(flashOp_t::erase);
+					erase(flashState.eraseAddr);
+				}
+				flashState.eraseAddr += flashEraseSize;
+				if (flashState.skipUnit)
+					continue;
+				return true;
 			}
+
+			const auto amount{std::min({length - flashState.offset, flashBufferSize,
+				std::size_t(flashState.eraseAddr - flashState.writeAddr)})};
+			if (!flashState.skipUnit)
+			{
+				startOperation(flashOp_t::write);
+				write(flashState.writeAddr, amount, data);
+			}
+			flashState.offset += amount;
+			flashState.writeAddr += amount;
+			if (!flashState.skipUnit)
+				return true;
 		}
+		return false;
+	}
+
+	/*!
+	 * Runs the Flash state machine, retiring the operation that's just finished and issuing the next.
+	 * With a time budget set this keeps waiting on Flash and issuing operations till the budget's
+	 * spent, so parts that finish a write in microseconds aren't held to one operation per pass. No
+	 * new operation is issued once it is, even when Flash never reports itself busy.
+	 */
+	static void process() noexcept
+	{
+#if USB_DFU_FLASH_BUDGET
+		const auto start{timestamp()};
+#endif
+		while (true)
+		{
+			if (flashBusy())
+			{
+#if USB_DFU_FLASH_BUDGET
+				if (timestamp() - start < flashBudget)
+					continue;
+#endif
+				return;
+			}
+			if (flashState.op != flashOp_t::none)
+				operationDone();
+#if USB_DFU_FLASH_BUDGET
+			// Flash that finishes before write() or erase() returns never looks busy, so check here too
+			if (timestamp() - start >= flashBudget)
+				return;
+#endif
+			if (!issueOperation() || !flashBudget)
+				return;
+		}
+	}
+
+	// SOF keeps the state machine going when nothing else is driving it
+	void tick() noexcept { process(); }
+	void flashReady() noexcept { process(); }
+
+	std::size_t eraseUnitsSkipped() noexcept { return unitsSkipped; }
+
+#ifdef USB_DFU_VERIFY
+	void expectDigest(const digest_t &digest) noexcept
+	{
+		expectedDigest = digest;
+		haveExpectedDigest = true;
 	}
+#endif
 
 	void registerHandlers(const substrate::span<const zone_t> flashZones,
 		const uint8_t interface, const uint8_t config) noexcept
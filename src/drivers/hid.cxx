@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include <array>
+#include <cstring>
+#include "usb/types.hxx"
+#include "usb/core.hxx"
+#include "usb/device.hxx"
+#include "usb/descriptors.hxx"
+#include "usb/drivers/hid.hxx"
+
+using namespace usb::constants;
+using namespace usb::core;
+using namespace usb::device;
+using namespace usb::types;
+using usb::descriptors::usbDescriptor_t;
+using usb::device::packet;
+
+namespace usb::hid
+{
+	// An idle rate tick is 4ms, which is 4 frames at full speed
+	constexpr static uint8_t framesPerIdleTick{4U};
+
+	static uint8_t hidInterface{};
+	static uint8_t hidEndpoint{};
+	static const void *reportDescriptor_{nullptr};
+	static uint16_t reportDescriptorLength_{};
+	static uint8_t reportLength_{};
+	static reportHandler_t reportHandler_{nullptr};
+
+	static std::array<std::array<uint8_t, epBufferSize>, 2> reports{};
+	// Which of the two report buffers holds the latest report, and how many have been submitted
+	static volatile uint8_t currentReport{};
+	static volatile uint8_t reportSequence{};
+
+	// The sequence number of the report armed in the endpoint, and of the last one the host took
+	static uint8_t armedSequence{};
+	static uint8_t sentSequence{};
+	static bool reportArmed{false};
+	static uint16_t framesSinceReport{};
+
+	static protocol_t protocol_{protocol_t::report};
+	static uint8_t idleRate_{};
+
+	static std::array<uint8_t, epBufferSize> outputReport{};
+	static setupPacket::report_t outputReportInfo{};
+	static uint16_t outputReportLength{};
+
+	static void armReport() noexcept
+	{
+		auto &epStatus{epStatusControllerIn[hidEndpoint]};
+		const uint8_t sequence{reportSequence};
+		epStatus.isMultiPart(false);
+		epStatus.memBuffer = reports[currentReport].data();
+		epStatus.transferCount = reportLength_;
+		// Reports are never more than a packet, so this copies the whole thing into the endpoint
+		writeEP(hidEndpoint);
+		armedSequence = sequence;
+		reportArmed = true;
+		framesSinceReport = 0U;
+	}
+
+	void handleReportSent(const uint8_t) noexcept
+	{
+		reportArmed = false;
+		sentSequence = armedSequence;
+		// If a newer report came in while that one was waiting, put it straight in the endpoint for the next poll
+		if (reportSequence != sentSequence)
+			armReport();
+	}
+
+	static void tick() noexcept
+	{
+		if (reportArmed)
+		{
+			// If the armed report's gone stale before the host polled for it, swap in the latest one
+			if (reportSequence != armedSequence && writeEPBusy(hidEndpoint))
+			{
+				flushWriteEP(hidEndpoint);
+				armReport();
+			}
+			return;
+		}
+
+		if (reportSequence != sentSequence)
+			armReport();
+		// Unchanged reports only get resent once the idle period has elapsed, if there is one
+		else if (idleRate_ && ++framesSinceReport >= uint16_t(idleRate_ * framesPerIdleTick))
+			armReport();
+	}
+
+	void initEndpoint(const uint8_t) noexcept
+	{
+		reportArmed = false;
+		sentSequence = reportSequence;
+		framesSinceReport = 0U;
+		protocol_ = protocol_t::report;
+		registerSOFHandler(hidInterface, tick);
+	}
+
+	void deinitEndpoint(const uint8_t) noexcept { unregsiterSOFHandler(hidInterface); }
+
+	static void outputReportReceived() noexcept
+	{
+		if (reportHandler_)
+			reportHandler_(outputReportInfo.type, outputReportInfo.index, outputReport.data(), outputReportLength);
+	}
+
+	static answer_t handleGetDescriptor() noexcept
+	{
+		if (packet.requestType.dir() == endpointDir_t::controllerOut)
+			return {response_t::stall, nullptr, 0};
+		const auto descriptor{packet.value.asDescriptor()};
+		if (descriptor.type != usbDescriptor_t::report || descriptor.index)
+			return {response_t::stall, nullptr, 0};
+		return {response_t::data, reportDescriptor_, reportDescriptorLength_, memory_t::flash};
+	}
+
+	static answer_t handleSetReport() noexcept
+	{
+		const auto report{packet.value.asReport()};
+		if (packet.requestType.dir() == endpointDir_t::controllerIn ||
+			report.type == setupPacket::reportType_t::input ||
+			!packet.length || packet.length > outputReport.size())
+			return {response_t::stall, nullptr, 0};
+		outputReportInfo = report;
+		outputReportLength = packet.length;
+		auto &epStatus{epStatusControllerOut[0]};
+		epStatus.memBuffer = outputReport.data();
+		epStatus.transferCount = packet.length;
+		epStatus.needsArming(true);
+		setupCallback = outputReportReceived;
+		return {response_t::zeroLength, nullptr, 0};
+	}
+
+	answer_t handleHIDRequest(const std::size_t interface) noexcept
+	{
+		const auto &requestType{packet.requestType};
+		if (requestType.recipient() != setupPacket::recipient_t::interface || packet.index != interface)
+			return {response_t::unhandled, nullptr, 0};
+		if (requestType.type() == setupPacket::request_t::typeStandard)
+		{
+			if (packet.request == types::request_t::getDescriptor)
+				return handleGetDescriptor();
+			return {response_t::unhandled, nullptr, 0};
+		}
+		else if (requestType.type() != setupPacket::request_t::typeClass)
+			return {response_t::unhandled, nullptr, 0};
+
+		const auto request{static_cast<hid::request_t>(packet.request)};
+		switch (request)
+		{
+			case hid::request_t::getReport:
+				if (packet.requestType.dir() == endpointDir_t::controllerOut ||
+					packet.value.asReport().type != setupPacket::reportType_t::input)
+					return {response_t::stall, nullptr, 0};
+				return {response_t::data, reports[currentReport].data(), reportLength_};
+			case hid::request_t::setReport:
+				return handleSetReport();
+			case hid::request_t::getIdle:
+				if (packet.requestType.dir() == endpointDir_t::controllerOut)
+					return {response_t::stall, nullptr, 0};
+				return {response_t::data, &idleRate_, 1};
+			case hid::request_t::setIdle:
+				if (packet.requestType.dir() == endpointDir_t::controllerIn)
+					return {response_t::stall, nullptr, 0};
+				// The duration is the upper byte of wValue
+				idleRate_ = uint8_t(packet.value >> 8U);
+				framesSinceReport = 0U;
+				return {response_t::zeroLength, nullptr, 0};
+			case hid::request_t::getProtocol:
+				if (packet.requestType.dir() == endpointDir_t::controllerOut)
+					return {response_t::stall, nullptr, 0};
+				return {response_t::data, &protocol_, 1};
+			case hid::request_t::setProtocol:
+				if (packet.requestType.dir() == endpointDir_t::controllerIn || packet.value > 1U)
+					return {response_t::stall, nullptr, 0};
+				protocol_ = static_cast<protocol_t>(uint16_t(packet.value));
+				return {response_t::zeroLength, nullptr, 0};
+		}
+
+		return {response_t::stall, nullptr, 0};
+	}
+
+	uint8_t *nextReport() noexcept { return reports[currentReport ^ 1U].data(); }
+
+	void submitReport() noexcept
+	{
+		// Publishing is a single byte store, so the interrupt only ever sees a complete report
+		__atomic_signal_fence(__ATOMIC_RELEASE);
+		currentReport = uint8_t(currentReport ^ 1U);
+		reportSequence = uint8_t(reportSequence + 1U);
+	}
+
+	void submitReport(const void *const report) noexcept
+	{
+		std::memcpy(nextReport(), report, reportLength_);
+		submitReport();
+	}
+
+	protocol_t protocol() noexcept { return protocol_; }
+	uint8_t idleRate() noexcept { return idleRate_; }
+
+	void registerHandlers(const uint8_t interface, const uint8_t config, const uint8_t endpoint,
+		const void *const reportDescriptor, const uint16_t reportDescriptorLength, const uint8_t reportLength,
+		const reportHandler_t reportHandler) noexcept
+	{
+		hidInterface = interface;
+		hidEndpoint = endpoint;
+		reportDescriptor_ = reportDescriptor;
+		reportDescriptorLength_ = reportDescriptorLength;
+		reportLength_ = reportLength > epBufferSize ? epBufferSize : reportLength;
+		reportHandler_ = reportHandler;
+		usb::device::registerHandler(interface, config, handleHIDRequest);
+		usb::core::registerHandler({endpoint, endpointDir_t::controllerIn}, config,
+			{initEndpoint, deinitEndpoint, handleReportSent});
+	}
+} // namespace usb::hid
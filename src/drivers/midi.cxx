@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include <array>
+#include <algorithm>
+#include "usb/types.hxx"
+#include "usb/core.hxx"
+#include "usb/drivers/midi.hxx"
+
+using namespace usb::constants;
+using namespace usb::core;
+using namespace usb::types;
+using usb::descriptors::usbMultiPartDesc_t;
+
+namespace usb::midi
+{
+	constexpr static uint8_t eventsPerPacket{epBufferSize / sizeof(event_t)};
+
+	static uint8_t midiInterface{};
+	static uint8_t endpointIn{};
+	static uint8_t endpointOut{};
+	static eventHandler_t eventHandler{nullptr};
+
+	// Single producer, single consumer ring of events - the free-running 8-bit indices are always atomic
+	static std::array<event_t, queueDepth> events{};
+	static volatile uint8_t head{};
+	static volatile uint8_t tail{};
+
+	// Used to send a packet's worth of events that wraps round the end of the ring as one packet
+	static std::array<usbMultiPartDesc_t, 2> parts{};
+	static uint8_t inFlight{};
+	static volatile bool busy{false};
+	// Set while the configuration holding the IN endpoint is active, so nothing is written to it before then
+	static volatile bool active{false};
+
+	static std::array<event_t, eventsPerPacket> received{};
+
+	static uint8_t queued() noexcept { return uint8_t(head - tail); }
+
+	/*!
+	 * Sends as many queued events as fit in a packet straight out of the ring. Unless flush is set, this
+	 * only sends full packets so dense bursts of events are packed together.
+	 */
+	static void transmit(const bool flush) noexcept
+	{
+		const auto count{queued()};
+		if (!active || busy || !count || (count < eventsPerPacket && !flush))
+			return;
+
+		const auto amount{std::min(count, eventsPerPacket)};
+		const auto start{uint8_t(tail & (queueDepth - 1U))};
+		const auto contiguous{std::min(amount, uint8_t(queueDepth - start))};
+		auto &epStatus{epStatusControllerIn[endpointIn]};
+		if (contiguous == amount)
+		{
+			epStatus.isMultiPart(false);
+			epStatus.memBuffer = &events[start];
+		}
+		else
+		{
+			parts[0] = {uint8_t(contiguous * sizeof(event_t)), &events[start]};
+			parts[1] = {uint8_t((amount - contiguous) * sizeof(event_t)), &events[0]};
+			epStatus.isMultiPart(true);
+			epStatus.partNumber = 0;
+			epStatus.partsData = {parts.data(), parts.data() + parts.size()};
+			epStatus.memBuffer = nullptr;
+		}
+		inFlight = amount;
+		busy = true;
+		epStatus.transferCount = uint16_t(amount * sizeof(event_t));
+		writeEP(endpointIn);
+	}
+
+	void handleDataIn(const uint8_t) noexcept
+	{
+		if (epStatusControllerIn[endpointIn].transferCount)
+		{
+			writeEP(endpointIn);
+			return;
+		}
+		__atomic_signal_fence(__ATOMIC_ACQUIRE);
+		tail = uint8_t(tail + inFlight);
+		inFlight = 0U;
+		busy = false;
+		// Every packet is its own transfer, so full packets can chain straight on without a ZLP
+		transmit(false);
+	}
+
+	void handleDataOut(const uint8_t) noexcept
+	{
+		auto &epStatus{epStatusControllerOut[endpointOut]};
+		// The extra byte of slack keeps the controller from dropping back to NAKing on a full packet
+		const auto space{uint16_t(sizeof(received) + 1U)};
+		epStatus.memBuffer = received.data();
+		epStatus.transferCount = space;
+		readEP(endpointOut);
+		const auto count{uint16_t((space - epStatus.transferCount) / sizeof(event_t))};
+		if (!eventHandler)
+			return;
+		for (uint16_t i{}; i < count; ++i)
+		{
+			// Hosts pad packets out with empty events
+			if (received[i].header || received[i].midi0)
+				eventHandler(received[i]);
+		}
+	}
+
+	// Flush any partial packet at the frame boundary, bounding each event's latency to a frame
+	static void tick() noexcept { transmit(true); }
+
+	void initDataIn(const uint8_t) noexcept
+	{
+		inFlight = 0U;
+		busy = false;
+		active = true;
+		registerSOFHandler(midiInterface, tick);
+	}
+
+	void deinitDataIn(const uint8_t) noexcept
+	{
+		active = false;
+		unregsiterSOFHandler(midiInterface);
+	}
+
+	/*!
+	 * Called once new events are in the ring to send a full packet's worth straight away if the IN endpoint
+	 * is idle. The interrupt is masked so this can't race handleDataIn() or the SOF flush starting a packet.
+	 */
+	static void kick() noexcept
+	{
+		if (busy || queued() < eventsPerPacket)
+			return;
+		const irqMask_t mask{};
+		transmit(false);
+	}
+
+	static bool push(const event_t *const newEvents, const uint16_t count) noexcept
+	{
+		if (count > uint16_t(queueDepth - queued()))
+			return false;
+		auto index{head};
+		for (uint16_t i{}; i < count; ++i, ++index)
+			events[index & (queueDepth - 1U)] = newEvents[i];
+		__atomic_signal_fence(__ATOMIC_RELEASE);
+		head = index;
+		kick();
+		return true;
+	}
+
+	bool send(const event_t &event) noexcept { return push(&event, 1U); }
+
+	bool sendSysEx(const uint8_t cable, const uint8_t *const message, const uint16_t length) noexcept
+	{
+		// The message goes 3 bytes to an event, with the last event saying how many bytes it holds
+		const auto count{uint16_t((length + 2U) / 3U)};
+		if (!length || count > uint16_t(queueDepth - queued()))
+			return false;
+		auto index{head};
+		for (uint16_t offset{}; offset < length; offset = uint16_t(offset + 3U), ++index)
+		{
+			const auto remaining{uint16_t(length - offset)};
+			const auto codeIndex
+			{
+				[&]() noexcept -> codeIndex_t
+				{
+					if (remaining > 3U)
+						return codeIndex_t::sysExStart;
+					else if (remaining == 3U)
+						return codeIndex_t::sysExEnd3;
+					else if (remaining == 2U)
+						return codeIndex_t::sysExEnd2;
+					return codeIndex_t::sysExEnd1;
+				}()
+			};
+			events[index & (queueDepth - 1U)] =
+			{
+				uint8_t((cable << 4U) | uint8_t(codeIndex)),
+				message[offset],
+				remaining > 1U ? message[offset + 1U] : uint8_t{},
+				remaining > 2U ? message[offset + 2U] : uint8_t{}
+			};
+		}
+		__atomic_signal_fence(__ATOMIC_RELEASE);
+		head = index;
+		kick();
+		return true;
+	}
+
+	uint8_t pending() noexcept { return queued(); }
+
+	void registerHandlers(const uint8_t interface, const uint8_t config, const uint8_t epIn, const uint8_t epOut,
+		const eventHandler_t handler) noexcept
+	{
+		midiInterface = interface;
+		endpointIn = epIn;
+		endpointOut = epOut;
+		eventHandler = handler;
+		usb::core::registerHandler({epIn, endpointDir_t::controllerIn}, config,
+			{initDataIn, deinitDataIn, handleDataIn});
+		usb::core::registerHandler({epOut, endpointDir_t::controllerOut}, config,
+			{nullptr, nullptr, handleDataOut});
+	}
+} // namespace usb::midi
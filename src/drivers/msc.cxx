@@ -0,0 +1,620 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include <array>
+#include <cstring>
+#include <algorithm>
+#include "usb/types.hxx"
+#include "usb/core.hxx"
+#include "usb/device.hxx"
+#include "usb/drivers/msc.hxx"
+#include "usb/drivers/mscTypes.hxx"
+
+using namespace usb::constants;
+using namespace usb::core;
+using namespace usb::device;
+using namespace usb::types;
+using namespace usb::msc::types;
+using usb::device::packet;
+
+namespace usb::msc
+{
+	static_assert(blockSize % epBufferSize == 0, "The MSC block size must be a multiple of the endpoint buffer size");
+
+	enum class phase_t : uint8_t
+	{
+		command,
+		dataIn,
+		dataOut,
+		status
+	};
+
+	// Where the data for the current data phase comes from or goes to
+	enum class data_t : uint8_t
+	{
+		response,
+		blocks,
+		padding
+	};
+
+	/*!
+	 * Block transfers run through two buffers so the storage and USB can work at the same time - while
+	 * one buffer is being sent or received over USB, the other is being read or written by the storage.
+	 * usbSlot is the buffer USB is working on or will work on next, and deviceSlot the same for the
+	 * storage; ready counts the buffers waiting to be handed from one side to the other.
+	 */
+	struct pipeline_t final
+	{
+		uint32_t nextBlock;
+		// Blocks left to go through the storage, and left to go over USB
+		uint32_t deviceBlocks;
+		uint32_t usbBlocks;
+		uint16_t offset;
+		uint8_t usbSlot;
+		uint8_t deviceSlot;
+		uint8_t ready;
+		bool usbActive;
+		bool deviceActive;
+	};
+
+	static uint8_t mscInterface{};
+	static endpoints_t endpoints{};
+	static const blockDevice_t *device{nullptr};
+	static const inquiry_t *inquiry{nullptr};
+	static volatile bool present{true};
+	static uint8_t maxLUN{0U};
+
+	static std::array<uint8_t, epBufferSize> packetBuffer{};
+	static commandBlockWrapper_t cbw{};
+	static commandStatusWrapper_t csw{cswSignature, 0U, 0U, cswStatus_t::passed};
+	static std::array<uint8_t, 36> response{};
+	static const std::array<uint8_t, epBufferSize> zeros{};
+	static std::array<std::array<uint8_t, blockSize>, 2> buffers{};
+
+	static phase_t phase{phase_t::command};
+	static data_t data{data_t::response};
+	static pipeline_t pipeline{};
+	// How much of the data phase the host asked for is left, and how much of that is padding or discarded
+	static uint32_t dataRemaining{};
+	static uint32_t padRemaining{};
+	static bool lastPacketFull{false};
+	// Set when an OUT packet arrived that we can't take yet, so it's being left to NAK
+	static bool outBlocked{false};
+
+	static senseKey_t senseKey{senseKey_t::noSense};
+	static additionalSense_t additionalSense{additionalSense_t::none};
+
+	static void receive() noexcept;
+
+	static uint16_t readBE16(const uint8_t *const value) noexcept
+		{ return uint16_t((uint16_t(value[0]) << 8U) | value[1]); }
+
+	static uint32_t readBE32(const uint8_t *const value) noexcept
+	{
+		return (uint32_t(value[0]) << 24U) | (uint32_t(value[1]) << 16U) |
+			(uint32_t(value[2]) << 8U) | uint32_t(value[3]);
+	}
+
+	static void writeBE32(uint8_t *const buffer, const uint32_t value) noexcept
+	{
+		buffer[0] = uint8_t(value >> 24U);
+		buffer[1] = uint8_t(value >> 16U);
+		buffer[2] = uint8_t(value >> 8U);
+		buffer[3] = uint8_t(value);
+	}
+
+	static void fail(const senseKey_t key, const additionalSense_t sense) noexcept
+	{
+		senseKey = key;
+		additionalSense = sense;
+		csw.status = cswStatus_t::failed;
+	}
+
+	static void sendPacket(const void *const buffer, const uint16_t length) noexcept
+	{
+		auto &epStatus{epStatusControllerIn[endpoints.dataIn]};
+		epStatus.isMultiPart(false);
+		epStatus.memBuffer = buffer;
+		epStatus.transferCount = length;
+		lastPacketFull = length >= epBufferSize;
+		writeEP(endpoints.dataIn);
+	}
+
+	static void continuePacket() noexcept
+	{
+		auto &epStatus{epStatusControllerIn[endpoints.dataIn]};
+		lastPacketFull = epStatus.transferCount >= epBufferSize;
+		writeEP(endpoints.dataIn);
+	}
+
+	static void sendStatus() noexcept
+	{
+		csw.dataResidue = dataRemaining;
+		phase = phase_t::status;
+		sendPacket(&csw, sizeof(csw));
+	}
+
+	static void sendPadding() noexcept
+	{
+		const auto amount{uint16_t(std::min<uint32_t>(padRemaining, epBufferSize))};
+		padRemaining -= amount;
+		sendPacket(zeros.data(), amount);
+	}
+
+	// Ends the data phase early, padding out or throwing away whatever the host still expects to move
+	static void abortData() noexcept
+	{
+		padRemaining = dataRemaining;
+		data = data_t::padding;
+		if (!padRemaining)
+			sendStatus();
+		else if (cbw.flags & cbwDirectionIn)
+		{
+			phase = phase_t::dataIn;
+			// If a block is still going out, the padding follows on once it's done
+			if (!pipeline.usbActive)
+				sendPadding();
+		}
+		else
+			phase = phase_t::dataOut;
+	}
+
+	/*!
+	 * Sends a response of length bytes, cut down to the command's allocation length. If the host expects
+	 * less than that (Hi < Di) or no data at all (Hn < Di), or the wrong direction (Ho <> Di), the CSW
+	 * reports a phase error so the host does a reset recovery, with the residue covering whatever wasn't sent.
+	 */
+	static void respond(const uint16_t length, const uint16_t allocation = UINT16_MAX) noexcept
+	{
+		const auto expected{std::min(length, allocation)};
+		if (!expected)
+			return abortData();
+		else if (!(cbw.flags & cbwDirectionIn))
+		{
+			csw.status = cswStatus_t::phaseError;
+			return abortData();
+		}
+		else if (expected > dataRemaining)
+			csw.status = cswStatus_t::phaseError;
+		const auto amount{uint16_t(std::min<uint32_t>(expected, dataRemaining))};
+		if (!amount)
+			return sendStatus();
+		phase = phase_t::dataIn;
+		data = data_t::response;
+		dataRemaining -= amount;
+		sendPacket(response.data(), amount);
+	}
+
+	static void sendBlock() noexcept
+	{
+		pipeline.usbActive = true;
+		--pipeline.ready;
+		dataRemaining -= blockSize;
+		sendPacket(buffers[pipeline.usbSlot].data(), blockSize);
+	}
+
+	static void pumpRead() noexcept
+	{
+		while (true)
+		{
+			if (pipeline.deviceActive)
+			{
+				if (device->busy())
+					break;
+				pipeline.deviceActive = false;
+				pipeline.deviceSlot ^= 1U;
+				++pipeline.ready;
+			}
+			if (!pipeline.usbActive && pipeline.ready)
+				sendBlock();
+			// Start reading the next block into whichever buffer is free
+			if (pipeline.deviceBlocks && pipeline.ready + (pipeline.usbActive ? 1U : 0U) < 2U)
+			{
+				if (!device->read(pipeline.nextBlock, buffers[pipeline.deviceSlot].data()))
+				{
+					fail(senseKey_t::mediumError, additionalSense_t::unrecoveredReadError);
+					pipeline.deviceBlocks = 0U;
+					pipeline.usbBlocks = pipeline.ready + (pipeline.usbActive ? 1U : 0U);
+					if (!pipeline.usbBlocks)
+						abortData();
+					return;
+				}
+				++pipeline.nextBlock;
+				--pipeline.deviceBlocks;
+				pipeline.deviceActive = true;
+				continue;
+			}
+			break;
+		}
+	}
+
+	static void pumpWrite() noexcept
+	{
+		while (true)
+		{
+			if (pipeline.deviceActive)
+			{
+				if (device->busy())
+					break;
+				pipeline.deviceActive = false;
+				pipeline.deviceSlot ^= 1U;
+				--pipeline.deviceBlocks;
+			}
+			// Commit the next filled buffer while USB carries on filling the other, but never more
+			// blocks than the command covers
+			if (pipeline.ready && pipeline.deviceBlocks)
+			{
+				if (!device->write(pipeline.nextBlock, buffers[pipeline.deviceSlot].data()))
+				{
+					fail(senseKey_t::mediumError, additionalSense_t::writeFault);
+					pipeline = {};
+					// Surplus already being thrown away carries on being, else the rest of the data phase goes too
+					if (data != data_t::padding)
+						abortData();
+					else if (!padRemaining)
+						sendStatus();
+					return;
+				}
+				++pipeline.nextBlock;
+				--pipeline.ready;
+				pipeline.deviceActive = true;
+				continue;
+			}
+			break;
+		}
+
+		if (!pipeline.deviceBlocks)
+		{
+			// If surplus data is already being thrown away, the status goes once the last of it has been
+			if (data == data_t::padding)
+			{
+				if (!padRemaining)
+					sendStatus();
+			}
+			// Everything's committed, so anything more the host sends is surplus
+			else if (dataRemaining)
+				abortData();
+			else
+				sendStatus();
+		}
+		else if (outBlocked && pipeline.ready + (pipeline.deviceActive ? 1U : 0U) < 2U)
+			receive();
+	}
+
+	static bool checkRange(const uint32_t block, const uint32_t count) noexcept
+	{
+		if (!present)
+		{
+			fail(senseKey_t::notReady, additionalSense_t::mediumNotPresent);
+			return false;
+		}
+		else if (block >= device->blockCount || count > device->blockCount - block)
+		{
+			fail(senseKey_t::illegalRequest, additionalSense_t::lbaOutOfRange);
+			return false;
+		}
+		return true;
+	}
+
+	static void startRead() noexcept
+	{
+		const auto block{readBE32(cbw.command.data() + 2U)};
+		const auto count{uint32_t(readBE16(cbw.command.data() + 7U))};
+		if (!checkRange(block, count) || !count)
+			return abortData();
+		else if (!(cbw.flags & cbwDirectionIn))
+		{
+			csw.status = cswStatus_t::phaseError;
+			return abortData();
+		}
+		// Never move more blocks than the host asked for data, and if that's fewer than the command
+		// asks for (Hi < Di) send what fits then report a phase error
+		const auto blocks{std::min(count, dataRemaining / blockSize)};
+		if (blocks != count)
+			csw.status = cswStatus_t::phaseError;
+		if (!blocks)
+			return abortData();
+		pipeline = {block, blocks, blocks, 0U, 0U, 0U, 0U, false, false};
+		phase = phase_t::dataIn;
+		data = data_t::blocks;
+		pumpRead();
+	}
+
+	static void startWrite() noexcept
+	{
+		const auto block{readBE32(cbw.command.data() + 2U)};
+		const auto count{uint32_t(readBE16(cbw.command.data() + 7U))};
+		if (!checkRange(block, count) || !count)
+			return abortData();
+		else if (cbw.flags & cbwDirectionIn)
+		{
+			csw.status = cswStatus_t::phaseError;
+			return abortData();
+		}
+		else if (device->writeProtected)
+		{
+			fail(senseKey_t::dataProtect, additionalSense_t::writeProtected);
+			return abortData();
+		}
+		// As for reads, a host sending less than the command says (Ho < Do) gets a phase error
+		const auto blocks{std::min(count, dataRemaining / blockSize)};
+		if (blocks != count)
+			csw.status = cswStatus_t::phaseError;
+		if (!blocks)
+			return abortData();
+		pipeline = {block, blocks, blocks, 0U, 0U, 0U, 0U, false, false};
+		phase = phase_t::dataOut;
+		data = data_t::blocks;
+		if (outBlocked)
+			receive();
+	}
+
+	static void handleCommand() noexcept
+	{
+		csw.tag = cbw.tag;
+		csw.status = cswStatus_t::passed;
+		dataRemaining = cbw.dataTransferLength;
+		response.fill(0U);
+
+		const auto command{static_cast<scsiCommand_t>(cbw.command[0])};
+		switch (command)
+		{
+			case scsiCommand_t::testUnitReady:
+				if (!present)
+					fail(senseKey_t::notReady, additionalSense_t::mediumNotPresent);
+				return abortData();
+			case scsiCommand_t::requestSense:
+				// Fixed format sense data
+				response[0] = 0x70U;
+				response[2] = uint8_t(senseKey);
+				response[7] = 10U;
+				response[12] = uint8_t(additionalSense);
+				response[13] = uint8_t(uint16_t(additionalSense) >> 8U);
+				senseKey = senseKey_t::noSense;
+				additionalSense = additionalSense_t::none;
+				return respond(18U, cbw.command[4]);
+			case scsiCommand_t::inquiry:
+				// Removable direct access block device, SPC-2
+				response[1] = 0x80U;
+				response[2] = 0x04U;
+				response[3] = 0x02U;
+				response[4] = 31U;
+				std::memcpy(response.data() + 8U, inquiry->vendor.data(), inquiry->vendor.size());
+				std::memcpy(response.data() + 16U, inquiry->product.data(), inquiry->product.size());
+				std::memcpy(response.data() + 32U, inquiry->revision.data(), inquiry->revision.size());
+				return respond(36U, readBE16(cbw.command.data() + 3U));
+			case scsiCommand_t::modeSense6:
+				response[0] = 3U;
+				response[2] = device->writeProtected ? 0x80U : 0x00U;
+				return respond(4U, cbw.command[4]);
+			case scsiCommand_t::modeSense10:
+				response[1] = 6U;
+				response[3] = device->writeProtected ? 0x80U : 0x00U;
+				return respond(8U, readBE16(cbw.command.data() + 7U));
+			case scsiCommand_t::readFormatCapacities:
+				response[3] = 8U;
+				writeBE32(response.data() + 4U, device->blockCount);
+				// Formatted media, then the 24-bit block length
+				writeBE32(response.data() + 8U, 0x02000000U | blockSize);
+				return respond(12U, readBE16(cbw.command.data() + 7U));
+			case scsiCommand_t::readCapacity10:
+				if (!present)
+				{
+					fail(senseKey_t::notReady, additionalSense_t::mediumNotPresent);
+					return abortData();
+				}
+				writeBE32(response.data(), device->blockCount - 1U);
+				writeBE32(response.data() + 4U, blockSize);
+				return respond(8U);
+			case scsiCommand_t::read10:
+				return startRead();
+			case scsiCommand_t::write10:
+				return startWrite();
+			case scsiCommand_t::startStopUnit:
+			case scsiCommand_t::preventAllowMediumRemoval:
+			case scsiCommand_t::synchronizeCache10:
+			case scsiCommand_t::verify10:
+				return abortData();
+		}
+		fail(senseKey_t::illegalRequest, additionalSense_t::invalidCommand);
+		abortData();
+	}
+
+	static uint16_t readPacket(void *const buffer, const uint16_t space) noexcept
+	{
+		auto &epStatus{epStatusControllerOut[endpoints.dataOut]};
+		epStatus.memBuffer = buffer;
+		// The extra byte of slack keeps the transfer from running down to 0 and the controller
+		// dropping back to NAKing once a packet exactly fills the space
+		epStatus.transferCount = uint16_t(space + 1U);
+		readEP(endpoints.dataOut);
+		return uint16_t(space + 1U - epStatus.transferCount);
+	}
+
+	static void receiveCommand() noexcept
+	{
+		const auto received{readPacket(packetBuffer.data(), uint16_t(packetBuffer.size()))};
+		std::memcpy(&cbw, packetBuffer.data(), sizeof(cbw));
+		if (received != sizeof(cbw) || cbw.signature != cbwSignature || cbw.lun > maxLUN)
+		{
+			// Not a valid CBW, so the host has to do a reset recovery - the endpoints stay halted through
+			// any CLEAR_FEATURE until it sends a Bulk-Only Mass Storage Reset (BOT 6.6.1)
+			wedgeEP({endpoints.dataIn, endpointDir_t::controllerIn});
+			wedgeEP({endpoints.dataOut, endpointDir_t::controllerOut});
+			return;
+		}
+		handleCommand();
+	}
+
+	void receive() noexcept
+	{
+		outBlocked = false;
+		if (phase == phase_t::command)
+			return receiveCommand();
+		else if (phase != phase_t::dataOut)
+		{
+			outBlocked = true;
+			return;
+		}
+
+		// Once every block the command covers is in, whatever else the host sends is surplus (Ho > Do)
+		if (data == data_t::blocks && !pipeline.usbBlocks)
+		{
+			padRemaining = dataRemaining;
+			data = data_t::padding;
+		}
+
+		if (data == data_t::padding)
+		{
+			const auto received{readPacket(packetBuffer.data(), uint16_t(packetBuffer.size()))};
+			padRemaining -= std::min<uint32_t>(received, padRemaining);
+			// Blocks still being committed send the status themselves when they're done
+			if (!padRemaining && !pipeline.deviceBlocks)
+				sendStatus();
+			return;
+		}
+
+		// Both buffers are full or being committed, so leave the host waiting
+		if (pipeline.ready + (pipeline.deviceActive ? 1U : 0U) == 2U)
+		{
+			outBlocked = true;
+			return;
+		}
+		const auto received{readPacket(buffers[pipeline.usbSlot].data() + pipeline.offset,
+			uint16_t(blockSize - pipeline.offset))};
+		pipeline.offset = uint16_t(pipeline.offset + received);
+		dataRemaining -= std::min<uint32_t>(received, dataRemaining);
+		if (pipeline.offset == blockSize)
+		{
+			pipeline.offset = 0U;
+			pipeline.usbSlot ^= 1U;
+			++pipeline.ready;
+			--pipeline.usbBlocks;
+			pumpWrite();
+		}
+	}
+
+	void handleDataOut(const uint8_t) noexcept { receive(); }
+
+	void handleDataIn(const uint8_t) noexcept
+	{
+		if (epStatusControllerIn[endpoints.dataIn].transferCount)
+			return continuePacket();
+
+		if (phase == phase_t::status)
+		{
+			phase = phase_t::command;
+			// Pick up any CBW that arrived while we were finishing up
+			if (outBlocked)
+				receive();
+			return;
+		}
+		else if (phase != phase_t::dataIn)
+			return;
+
+		if (data == data_t::blocks)
+		{
+			pipeline.usbActive = false;
+			pipeline.usbSlot ^= 1U;
+			if (--pipeline.usbBlocks)
+				return pumpRead();
+			// If a read failed part way or was cut short by the host, pad out what's left of the transfer
+			if (csw.status != cswStatus_t::passed)
+				return abortData();
+		}
+		else if (data == data_t::padding && padRemaining)
+			return sendPadding();
+
+		// If the data phase ended short on a full packet, the host needs a ZLP to know it's over
+		if (dataRemaining && lastPacketFull && data != data_t::padding)
+		{
+			data = data_t::padding;
+			padRemaining = 0U;
+			return sendPacket(zeros.data(), 0U);
+		}
+		sendStatus();
+	}
+
+	static void tick() noexcept
+	{
+		if (phase == phase_t::dataIn && data == data_t::blocks)
+			pumpRead();
+		else if (phase == phase_t::dataOut && (data == data_t::blocks || pipeline.deviceBlocks))
+			pumpWrite();
+		else if (outBlocked)
+			receive();
+	}
+
+	static void reset() noexcept
+	{
+		phase = phase_t::command;
+		pipeline = {};
+		dataRemaining = 0U;
+		padRemaining = 0U;
+		outBlocked = false;
+	}
+
+	void initEndpoint(const uint8_t) noexcept
+	{
+		reset();
+		registerSOFHandler(mscInterface, tick);
+	}
+
+	void deinitEndpoint(const uint8_t) noexcept { unregsiterSOFHandler(mscInterface); }
+
+	answer_t handleMSCRequest(const std::size_t interface) noexcept
+	{
+		const auto &requestType{packet.requestType};
+		if (requestType.recipient() != setupPacket::recipient_t::interface ||
+			requestType.type() != setupPacket::request_t::typeClass ||
+			packet.index != interface)
+			return {response_t::unhandled, nullptr, 0};
+
+		const auto request{static_cast<types::request_t>(packet.request)};
+		switch (request)
+		{
+			case types::request_t::getMaxLUN:
+				if (packet.requestType.dir() == endpointDir_t::controllerOut || packet.value)
+					return {response_t::stall, nullptr, 0};
+				return {response_t::data, &maxLUN, 1};
+			case types::request_t::reset:
+				if (packet.requestType.dir() == endpointDir_t::controllerIn || packet.value || packet.length)
+					return {response_t::stall, nullptr, 0};
+				reset();
+				// Leave the endpoints halted, but let the CLEAR_FEATUREs that finish the recovery through
+				unwedgeEP({endpoints.dataIn, endpointDir_t::controllerIn});
+				unwedgeEP({endpoints.dataOut, endpointDir_t::controllerOut});
+				return {response_t::zeroLength, nullptr, 0};
+		}
+
+		return {response_t::stall, nullptr, 0};
+	}
+
+	void mediumPresent(const bool state) noexcept
+	{
+		present = state;
+		if (!state)
+		{
+			senseKey = senseKey_t::notReady;
+			additionalSense = additionalSense_t::mediumNotPresent;
+		}
+		else
+		{
+			// Let the host know it needs to re-read the medium
+			senseKey = senseKey_t::unitAttention;
+			additionalSense = additionalSense_t::none;
+		}
+	}
+
+	void registerHandlers(const uint8_t interface, const uint8_t config, const endpoints_t eps,
+		const blockDevice_t &blockDevice, const inquiry_t &inquiryData) noexcept
+	{
+		mscInterface = interface;
+		endpoints = eps;
+		device = &blockDevice;
+		inquiry = &inquiryData;
+		usb::device::registerHandler(interface, config, handleMSCRequest);
+		usb::core::registerHandler({eps.dataIn, endpointDir_t::controllerIn}, config,
+			{nullptr, nullptr, handleDataIn});
+		usb::core::registerHandler({eps.dataOut, endpointDir_t::controllerOut}, config,
+			{initEndpoint, deinitEndpoint, handleDataOut});
+	}
+} // namespace usb::msc
@@ -0,0 +1,354 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include <array>
+#include <cstring>
+#include <algorithm>
+#include "usb/types.hxx"
+#include "usb/core.hxx"
+#include "usb/device.hxx"
+#include "usb/drivers/uvc.hxx"
+
+using namespace usb::constants;
+using namespace usb::core;
+using namespace usb::device;
+using namespace usb::types;
+using namespace usb::uvc::types;
+using usb::descriptors::usbMultiPartDesc_t;
+using usb::device::packet;
+
+namespace usb::uvc
+{
+	static_assert(payloadSize % epBufferSize == 0, "The UVC payload size must be a multiple of the endpoint buffer size");
+
+	// timestamp() counts in microseconds
+	constexpr static uint32_t clockFrequency{1000000U};
+	// The header, then the frame data split to fit multi-part entries, which are at most 255 bytes long
+	constexpr static std::size_t maxPayloadParts{1U + (payloadSize + UINT8_MAX - 1U) / UINT8_MAX};
+
+	struct frame_t final
+	{
+		const uint8_t *data;
+		uint32_t length;
+		uint32_t presentationTime;
+	};
+
+	// Single producer, single consumer queue of frames - the free-running 8-bit indices are always atomic
+	struct frameQueue_t final
+	{
+	private:
+		std::array<frame_t, frameQueueDepth> frames{};
+		volatile uint8_t head{};
+		volatile uint8_t tail{};
+
+	public:
+		[[nodiscard]] uint8_t count() const noexcept { return uint8_t(head - tail); }
+		[[nodiscard]] bool empty() const noexcept { return head == tail; }
+		[[nodiscard]] bool full() const noexcept { return count() == frameQueueDepth; }
+		[[nodiscard]] const frame_t &front() const noexcept { return frames[tail & (frameQueueDepth - 1U)]; }
+
+		bool push(const frame_t &frame) noexcept
+		{
+			if (full())
+				return false;
+			frames[head & (frameQueueDepth - 1U)] = frame;
+			__atomic_signal_fence(__ATOMIC_RELEASE);
+			head = uint8_t(head + 1U);
+			return true;
+		}
+
+		void pop() noexcept
+		{
+			__atomic_signal_fence(__ATOMIC_ACQUIRE);
+			tail = uint8_t(tail + 1U);
+		}
+
+		void clear() noexcept { tail = head; }
+	};
+
+	static uint8_t streamInterface{};
+	static uint8_t endpoint{};
+	static format_t format{};
+	static headerFields_t headerFields{headerFields_t::none};
+
+	static probeCommit_t probe{};
+	static probeCommit_t pendingProbe{};
+	static volatile bool streaming_{false};
+
+	static frameQueue_t frames{};
+	static payloadHeader_t header{};
+	static std::array<usbMultiPartDesc_t, maxPayloadParts> parts{};
+	// How far through the frame at the front of the queue we are, and how much of it the payload in flight holds
+	static uint32_t frameOffset{};
+	static uint16_t payloadData{};
+	static uint8_t frameID{};
+	static bool busy{false};
+	static bool needsZLP{false};
+	static bool sendingZLP{false};
+	// Counts SOFs for the SCR field's 11-bit frame counter
+	static uint16_t sofCounter{};
+
+	static uint8_t headerLength() noexcept
+	{
+		switch (headerFields)
+		{
+			case headerFields_t::none:
+				return 2U;
+			case headerFields_t::presentationTime:
+				return 6U;
+			case headerFields_t::presentationAndSourceTime:
+				break;
+		}
+		return sizeof(payloadHeader_t);
+	}
+
+	static probeCommit_t defaultProbe() noexcept
+	{
+		probeCommit_t result{};
+		result.formatIndex = format.formatIndex;
+		result.frameIndex = format.frameIndex;
+		result.frameInterval = format.frameInterval;
+		result.maxVideoFrameSize = format.maxFrameSize;
+		result.maxPayloadTransferSize = payloadSize;
+		result.clockFrequency = clockFrequency;
+		// Payloads carry both the frame ID and end of frame bits
+		result.framingInfo = 0x03U;
+		result.preferedVersion = 1U;
+		result.minVersion = 1U;
+		result.maxVersion = 1U;
+		return result;
+	}
+
+	// Takes what the host asked for but holds it to the one format and payload size we offer
+	static probeCommit_t negotiate(const probeCommit_t &request) noexcept
+	{
+		auto result{defaultProbe()};
+		result.hint = request.hint;
+		result.keyFrameRate = request.keyFrameRate;
+		result.pFrameRate = request.pFrameRate;
+		result.compQuality = request.compQuality;
+		result.compWindowSize = request.compWindowSize;
+		return result;
+	}
+
+	/*!
+	 * Starts sending the next payload of the frame at the front of the queue. The payload is gathered
+	 * through the endpoint's multi-part table from the header followed by the frame data in place.
+	 */
+	static void sendPayload() noexcept
+	{
+		if (busy || !streaming_ || frames.empty())
+			return;
+		const auto &frame{frames.front()};
+		const auto length{headerLength()};
+		payloadData = uint16_t(std::min<uint32_t>(frame.length - frameOffset, payloadSize - length));
+		const auto lastPayload{frameOffset + payloadData == frame.length};
+
+		header.length = length;
+		header.info = uint8_t(headerEndOfHeader | frameID | (lastPayload ? headerEndOfFrame : 0U));
+		if (headerFields != headerFields_t::none)
+		{
+			header.info |= headerPTS;
+			header.presentationTime = frame.presentationTime;
+		}
+		if (headerFields == headerFields_t::presentationAndSourceTime)
+		{
+			header.info |= headerSCR;
+			header.sourceTime = timestamp();
+			header.sofCounter = uint16_t(sofCounter & 0x07FFU);
+		}
+
+		std::size_t part{};
+		parts[part++] = {length, &header};
+		const auto *data{frame.data + frameOffset};
+		for (auto remaining{payloadData}; remaining; )
+		{
+			const auto amount{uint8_t(std::min<uint16_t>(remaining, UINT8_MAX))};
+			parts[part++] = {amount, data};
+			data += amount;
+			remaining = uint16_t(remaining - amount);
+		}
+
+		const auto transferLength{uint16_t(length + payloadData)};
+		// A payload shorter than the negotiated maximum that ends on a full packet needs a ZLP to end it
+		needsZLP = !(transferLength % epBufferSize) && transferLength < payloadSize;
+		busy = true;
+		auto &epStatus{epStatusControllerIn[endpoint]};
+		epStatus.isMultiPart(true);
+		epStatus.partNumber = 0;
+		epStatus.partsData = {parts.data(), parts.data() + part};
+		epStatus.memBuffer = nullptr;
+		epStatus.transferCount = transferLength;
+		writeEP(endpoint);
+	}
+
+	static void sendZLP() noexcept
+	{
+		auto &epStatus{epStatusControllerIn[endpoint]};
+		sendingZLP = true;
+		epStatus.isMultiPart(false);
+		epStatus.memBuffer = nullptr;
+		epStatus.transferCount = 0U;
+		writeEP(endpoint);
+	}
+
+	void handleDataIn(const uint8_t) noexcept
+	{
+		// A completion for a payload stopStreaming() already threw away
+		if (!busy)
+			return;
+		else if (epStatusControllerIn[endpoint].transferCount)
+		{
+			writeEP(endpoint);
+			return;
+		}
+		else if (sendingZLP)
+			sendingZLP = false;
+		else
+		{
+			frameOffset += payloadData;
+			payloadData = 0U;
+			if (frameOffset == frames.front().length)
+			{
+				// The frame's done, so hand its buffer back and flip the frame ID for the next one
+				frames.pop();
+				frameOffset = 0U;
+				frameID ^= headerFrameID;
+			}
+			if (needsZLP)
+			{
+				sendZLP();
+				return;
+			}
+		}
+		busy = false;
+		sendPayload();
+	}
+
+	static void tick() noexcept
+	{
+		++sofCounter;
+		// Frames queued while we were idle get picked up here, after which payloads chain on completion
+		sendPayload();
+	}
+
+	static void stopStreaming() noexcept
+	{
+		streaming_ = false;
+		// Drop any payload part way out so nothing more is read from the frames being handed back
+		if (busy)
+			flushWriteEP(endpoint);
+		auto &epStatus{epStatusControllerIn[endpoint]};
+		epStatus.isMultiPart(false);
+		epStatus.memBuffer = nullptr;
+		epStatus.transferCount = 0U;
+		frames.clear();
+		frameOffset = 0U;
+		payloadData = 0U;
+		busy = false;
+		needsZLP = false;
+		sendingZLP = false;
+	}
+
+	static void probeReceived() noexcept { probe = negotiate(pendingProbe); }
+
+	static void commitReceived() noexcept
+	{
+		probe = negotiate(pendingProbe);
+		frameID = 0U;
+		streaming_ = true;
+	}
+
+	answer_t handleUVCRequest(const std::size_t interface) noexcept
+	{
+		const auto &requestType{packet.requestType};
+		if (requestType.recipient() != setupPacket::recipient_t::interface ||
+			requestType.type() != setupPacket::request_t::typeClass ||
+			packet.index != interface)
+			return {response_t::unhandled, nullptr, 0};
+
+		const auto control{static_cast<streamingControl_t>(uint16_t(packet.value) >> 8U)};
+		if (control != streamingControl_t::probe && control != streamingControl_t::commit)
+			return {response_t::stall, nullptr, 0};
+
+		static probeCommit_t response{};
+		static uint16_t length{};
+		static uint8_t info{};
+		const auto request{static_cast<types::request_t>(packet.request)};
+		switch (request)
+		{
+			case types::request_t::setCur:
+			{
+				if (packet.length > sizeof(probeCommit_t))
+					return {response_t::stall, nullptr, 0};
+				// UVC 1.0 hosts send the shorter structure, so start from what we have for the rest of it
+				pendingProbe = probe;
+				auto &epStatus{epStatusControllerOut[0]};
+				epStatus.memBuffer = &pendingProbe;
+				epStatus.transferCount = packet.length;
+				epStatus.needsArming(true);
+				setupCallback = control == streamingControl_t::probe ? probeReceived : commitReceived;
+				return {response_t::zeroLength, nullptr, 0};
+			}
+			case types::request_t::getCur:
+				response = probe;
+				return {response_t::data, &response, sizeof(probeCommit_t)};
+			case types::request_t::getMin:
+			case types::request_t::getMax:
+			case types::request_t::getDef:
+				response = defaultProbe();
+				return {response_t::data, &response, sizeof(probeCommit_t)};
+			case types::request_t::getLen:
+				length = sizeof(probeCommit_t);
+				return {response_t::data, &length, sizeof(length)};
+			case types::request_t::getInfo:
+				info = infoSupportsGet | infoSupportsSet;
+				return {response_t::data, &info, sizeof(info)};
+			default:
+				break;
+		}
+
+		return {response_t::stall, nullptr, 0};
+	}
+
+	// Hosts stop a bulk stream by selecting the (only) alternate setting again
+	bool handleSetInterface() noexcept
+	{
+		stopStreaming();
+		return !packet.value;
+	}
+
+	void initEndpoint(const uint8_t) noexcept
+	{
+		stopStreaming();
+		probe = defaultProbe();
+		registerSOFHandler(streamInterface, tick);
+	}
+
+	void deinitEndpoint(const uint8_t) noexcept
+	{
+		unregsiterSOFHandler(streamInterface);
+		stopStreaming();
+	}
+
+	bool submitFrame(const void *const frame, const uint32_t length, const uint32_t presentationTime) noexcept
+	{
+		if (!length)
+			return false;
+		return frames.push({static_cast<const uint8_t *>(frame), length, presentationTime});
+	}
+
+	uint8_t pendingFrames() noexcept { return frames.count(); }
+	bool streaming() noexcept { return streaming_; }
+
+	void registerHandlers(const uint8_t interface, const uint8_t config, const uint8_t ep,
+		const format_t &streamFormat, const headerFields_t fields) noexcept
+	{
+		streamInterface = interface;
+		endpoint = ep;
+		format = streamFormat;
+		headerFields = fields;
+		usb::device::registerHandler(interface, config, handleUVCRequest);
+		usb::device::registerAltModeHandler(interface, config, handleSetInterface);
+		usb::core::registerHandler({ep, endpointDir_t::controllerIn}, config,
+			{initEndpoint, deinitEndpoint, handleDataIn});
+	}
+} // namespace usb::uvc
@@ -0,0 +1,345 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include <array>
+#include <utility>
+#include "usb/types.hxx"
+#include "usb/core.hxx"
+#include "usb/drivers/vendorBulk.hxx"
+
+using namespace usb::constants;
+using namespace usb::core;
+using namespace usb::types;
+
+namespace usb::vendor::bulk
+{
+	// Full speed SOFs arrive once a millisecond, so this many frames makes up a second for the rate counters
+	constexpr static uint16_t framesPerSecond{1000U};
+
+	// Single producer, single consumer queue of buffers - the free-running 8-bit indices are always atomic
+	template<typename entry_t> struct queue_t final
+	{
+	private:
+		std::array<entry_t, queueDepth> buffers{};
+		volatile uint8_t head{};
+		volatile uint8_t tail{};
+
+	public:
+		[[nodiscard]] uint8_t count() const noexcept { return uint8_t(head - tail); }
+		[[nodiscard]] bool empty() const noexcept { return head == tail; }
+		[[nodiscard]] bool full() const noexcept { return count() == queueDepth; }
+		[[nodiscard]] const entry_t &front() const noexcept { return buffers[tail & (queueDepth - 1U)]; }
+
+		bool push(const entry_t buffer) noexcept
+		{
+			if (full())
+				return false;
+			buffers[head & (queueDepth - 1U)] = buffer;
+			__atomic_signal_fence(__ATOMIC_RELEASE);
+			head = uint8_t(head + 1U);
+			return true;
+		}
+
+		void pop() noexcept
+		{
+			__atomic_signal_fence(__ATOMIC_ACQUIRE);
+			tail = uint8_t(tail + 1U);
+		}
+	};
+
+	struct stream_t final
+	{
+		uint8_t interface{};
+		endpoints_t endpoints{};
+
+		// Whether each endpoint is part of the active configuration
+		bool inActive{false};
+		bool outActive{false};
+
+		// Buffers to send, the front of which is the one in flight
+		queue_t<inBuffer_t> inQueue{};
+		volatile bool inBusy{false};
+		// Whether the last buffer sent ended on a full packet, and so needs a ZLP if nothing follows it
+		bool inNeedsZLP{false};
+		bool inSendingZLP{false};
+
+		// Empty buffers waiting to be received into, and buffers filled waiting for the application
+		queue_t<buffer_t> outFree{};
+		queue_t<buffer_t> outFilled{};
+		buffer_t outCurrent{};
+		bool outArmed{false};
+		// Set when an OUT packet arrived with no buffer to put it in, so it's being left to NAK
+		bool outBlocked{false};
+
+		volatile uint32_t bytesIn{};
+		volatile uint32_t bytesOut{};
+		volatile uint32_t rateIn{};
+		volatile uint32_t rateOut{};
+		uint32_t lastBytesIn{};
+		uint32_t lastBytesOut{};
+		uint16_t frames{};
+	};
+
+	static std::array<stream_t, streamCount> streams{};
+	// Maps endpoint numbers back to the streams they belong to
+	static std::array<uint8_t, endpointCount> inStreams{};
+	static std::array<uint8_t, endpointCount> outStreams{};
+
+	static void startIn(stream_t &stream) noexcept
+	{
+		if (stream.inBusy)
+			return;
+		auto &epStatus{epStatusControllerIn[stream.endpoints.dataIn]};
+		epStatus.isMultiPart(false);
+		if (!stream.inQueue.empty())
+		{
+			const auto &buffer{stream.inQueue.front()};
+			epStatus.memBuffer = buffer.data;
+			epStatus.transferCount = buffer.length;
+		}
+		else if (stream.inNeedsZLP)
+		{
+			epStatus.memBuffer = nullptr;
+			epStatus.transferCount = 0U;
+			stream.inNeedsZLP = false;
+			stream.inSendingZLP = true;
+		}
+		else
+			return;
+		stream.inBusy = true;
+		const auto before{epStatus.transferCount};
+		writeEP(stream.endpoints.dataIn);
+		stream.bytesIn = stream.bytesIn + uint16_t(before - epStatus.transferCount);
+	}
+
+	void handleIn(const uint8_t endpoint) noexcept
+	{
+		auto &stream{streams[inStreams[endpoint]]};
+		auto &epStatus{epStatusControllerIn[endpoint]};
+		// Keep going with the current buffer till it's all been sent
+		if (epStatus.transferCount)
+		{
+			const auto before{epStatus.transferCount};
+			writeEP(endpoint);
+			stream.bytesIn = stream.bytesIn + uint16_t(before - epStatus.transferCount);
+			return;
+		}
+
+		stream.inBusy = false;
+		// A ZLP has nothing queued behind it to retire
+		if (stream.inSendingZLP)
+		{
+			stream.inSendingZLP = false;
+			return;
+		}
+		const auto length{stream.inQueue.front().length};
+		stream.inQueue.pop();
+		stream.inNeedsZLP = length && !(length % epBufferSize);
+		// Keep the endpoint primed straight from the next queued buffer, any ZLP waits for the next frame
+		if (!stream.inQueue.empty())
+			startIn(stream);
+	}
+
+	static bool armOut(stream_t &stream) noexcept
+	{
+		// Only take a buffer if there will be somewhere to hand it back to once it's filled
+		if (stream.outFree.empty() || stream.outFilled.full())
+			return false;
+		stream.outCurrent = stream.outFree.front();
+		stream.outFree.pop();
+		auto &epStatus{epStatusControllerOut[stream.endpoints.dataOut]};
+		epStatus.memBuffer = stream.outCurrent.data;
+		// The extra byte of slack keeps the transfer from ever running down to 0 and the controller
+		// dropping back to NAKing when a buffer fills exactly
+		epStatus.transferCount = uint16_t(stream.outCurrent.length + 1U);
+		stream.outCurrent.length = 0U;
+		stream.outArmed = true;
+		return true;
+	}
+
+	static void receive(stream_t &stream) noexcept
+	{
+		if (!stream.outArmed && !armOut(stream))
+		{
+			// Leaving the packet in the endpoint makes the controller NAK the host till we have a buffer for it
+			stream.outBlocked = true;
+			return;
+		}
+		stream.outBlocked = false;
+
+		auto &epStatus{epStatusControllerOut[stream.endpoints.dataOut]};
+		const auto before{epStatus.transferCount};
+		readEP(stream.endpoints.dataOut);
+		const auto received{uint16_t(before - epStatus.transferCount)};
+		stream.outCurrent.length = uint16_t(stream.outCurrent.length + received);
+		stream.bytesOut = stream.bytesOut + received;
+		// A short packet ends the transfer, as does running out of room for a full one
+		if (received < epBufferSize || epStatus.transferCount <= epBufferSize)
+		{
+			stream.outFilled.push(stream.outCurrent);
+			stream.outArmed = false;
+			// Re-arm straight into the next free buffer so the host never has to wait on us
+			armOut(stream);
+		}
+	}
+
+	void handleOut(const uint8_t endpoint) noexcept { receive(streams[outStreams[endpoint]]); }
+
+	static void tick(stream_t &stream) noexcept
+	{
+		if (stream.inActive && !stream.inBusy)
+			startIn(stream);
+		if (stream.outActive && stream.outBlocked)
+			receive(stream);
+
+		if (++stream.frames == framesPerSecond)
+		{
+			const uint32_t bytesIn{stream.bytesIn};
+			const uint32_t bytesOut{stream.bytesOut};
+			stream.rateIn = bytesIn - stream.lastBytesIn;
+			stream.rateOut = bytesOut - stream.lastBytesOut;
+			stream.lastBytesIn = bytesIn;
+			stream.lastBytesOut = bytesOut;
+			stream.frames = 0U;
+		}
+	}
+
+	static bool interfaceActive(const uint8_t interface) noexcept
+	{
+		for (const auto &stream : streams)
+		{
+			if (stream.interface == interface && (stream.inActive || stream.outActive))
+				return true;
+		}
+		return false;
+	}
+
+	/*!
+	 * Each interface only gets the one SOF handler, and they don't get told which interface they're for,
+	 * so give each interface its own that ticks every active stream on it
+	 */
+	template<uint8_t interface> static void tick() noexcept
+	{
+		for (auto &stream : streams)
+		{
+			if (stream.interface == interface && (stream.inActive || stream.outActive))
+				tick(stream);
+		}
+	}
+
+	template<size_t... interfaces> constexpr static auto makeTickHandlers(std::index_sequence<interfaces...>)
+		{ return std::array<sofHandler_t, interfaceCount>{{tick<uint8_t(interfaces)>...}}; }
+	constexpr static auto tickHandlers{makeTickHandlers(std::make_index_sequence<interfaceCount>{})};
+
+	void initIn(const uint8_t endpoint) noexcept
+	{
+		auto &stream{streams[inStreams[endpoint]]};
+		stream.inBusy = false;
+		stream.inNeedsZLP = false;
+		stream.inSendingZLP = false;
+		stream.inActive = true;
+		registerSOFHandler(stream.interface, tickHandlers[stream.interface]);
+	}
+
+	void initOut(const uint8_t endpoint) noexcept
+	{
+		auto &stream{streams[outStreams[endpoint]]};
+		stream.outBlocked = false;
+		// Hand any partially filled buffer back so the application doesn't lose track of it
+		if (stream.outArmed)
+			stream.outFilled.push(stream.outCurrent);
+		stream.outArmed = false;
+		armOut(stream);
+		stream.outActive = true;
+		registerSOFHandler(stream.interface, tickHandlers[stream.interface]);
+	}
+
+	// The interface's SOF handler has to stay for as long as any of its other streams still need it
+	void deinitIn(const uint8_t endpoint) noexcept
+	{
+		auto &stream{streams[inStreams[endpoint]]};
+		stream.inActive = false;
+		if (!interfaceActive(stream.interface))
+			unregsiterSOFHandler(stream.interface);
+	}
+
+	void deinitOut(const uint8_t endpoint) noexcept
+	{
+		auto &stream{streams[outStreams[endpoint]]};
+		stream.outActive = false;
+		if (!interfaceActive(stream.interface))
+			unregsiterSOFHandler(stream.interface);
+	}
+
+	bool submitIn(const uint8_t stream, const void *const data, const uint16_t length) noexcept
+	{
+		if (stream >= streamCount)
+			return false;
+		auto &state{streams[stream]};
+		if (!state.inQueue.push({static_cast<const uint8_t *>(data), length}))
+			return false;
+		// Kick an idle endpoint off now rather than waiting for the next SOF
+		if (!state.inBusy)
+		{
+			const irqMask_t mask{};
+			if (state.inActive && !state.inBusy)
+				startIn(state);
+		}
+		return true;
+	}
+
+	uint8_t pendingIn(const uint8_t stream) noexcept
+	{
+		if (stream >= streamCount)
+			return 0U;
+		return streams[stream].inQueue.count();
+	}
+
+	bool supplyOut(const uint8_t stream, void *const data, const uint16_t size) noexcept
+	{
+		// Leave room for the byte of slack armOut() adds to the transfer
+		if (stream >= streamCount || size < epBufferSize || size == UINT16_MAX)
+			return false;
+		return streams[stream].outFree.push({static_cast<uint8_t *>(data), size});
+	}
+
+	bool receiveOut(const uint8_t stream, buffer_t &buffer) noexcept
+	{
+		if (stream >= streamCount)
+			return false;
+		auto &filled{streams[stream].outFilled};
+		if (filled.empty())
+			return false;
+		buffer = filled.front();
+		filled.pop();
+		return true;
+	}
+
+	stats_t stats(const uint8_t stream) noexcept
+	{
+		if (stream >= streamCount)
+			return {};
+		const auto &state{streams[stream]};
+		return {state.bytesIn, state.bytesOut, state.rateIn, state.rateOut};
+	}
+
+	void registerHandlers(const uint8_t stream, const uint8_t interface, const uint8_t config,
+		const endpoints_t endpoints) noexcept
+	{
+		if (stream >= streamCount)
+			return;
+		auto &state{streams[stream]};
+		state.interface = interface;
+		state.endpoints = endpoints;
+		if (endpoints.dataIn && endpoints.dataIn < endpointCount)
+		{
+			inStreams[endpoints.dataIn] = stream;
+			usb::core::registerHandler({endpoints.dataIn, endpointDir_t::controllerIn}, config,
+				{initIn, deinitIn, handleIn});
+		}
+		if (endpoints.dataOut && endpoints.dataOut < endpointCount)
+		{
+			outStreams[endpoints.dataOut] = stream;
+			usb::core::registerHandler({endpoints.dataOut, endpointDir_t::controllerOut}, config,
+				{initOut, deinitOut, handleOut});
+		}
+	}
+} // namespace usb::vendor::bulk
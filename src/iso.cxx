@@ -0,0 +1,422 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include <array>
+#include <algorithm>
+#include "usb/types.hxx"
+#include "usb/core.hxx"
+#include "usb/internal/core.hxx"
+#include "usb/device.hxx"
+#include "usb/iso.hxx"
+
+using namespace usb::constants;
+using namespace usb::core;
+using namespace usb::types;
+using usb::core::internal::frameCounter;
+using usb::device::packet;
+
+namespace usb::iso
+{
+	static_assert(streamCount >= 1U && streamCount <= 8U, "The isochronous engine supports 1 to 8 streams");
+
+	enum class kind_t : uint8_t
+	{
+		unused,
+		source,
+		sink,
+		feedback
+	};
+
+	struct stream_t final
+	{
+		kind_t kind{kind_t::unused};
+		uint8_t interface{};
+		uint8_t endpoint{};
+		fillHandler_t fill{nullptr};
+		drainHandler_t drain{nullptr};
+
+		std::array<std::array<uint8_t, packetSize>, 2> buffers{};
+		std::array<uint16_t, 2> lengths{};
+		// The endpoint's wMaxPacketSize
+		uint16_t maxPacketSize{};
+		// Which buffer is being filled (IN) or received into (OUT)
+		uint8_t back{};
+		// Whether the back buffer holds a frame's worth of data
+		bool ready{false};
+		// Whether the packet sent at the last SOF is still waiting on the host
+		bool busy{false};
+		bool active{false};
+		// Set on the first OUT packet so the frames before the host starts sending are not counted as missed
+		bool primed{false};
+
+		// How many frames the packet size pattern repeats over, and how far through it we are. Feedback
+		// streams use phase to count through their refresh period instead.
+		uint8_t pattern{1U};
+		uint16_t phase{};
+
+		// Feedback is sent every 2^refresh frames
+		uint8_t refresh{};
+		bool counting{false};
+		uint32_t samples{};
+		uint32_t value{};
+
+		statistics_t statistics{};
+
+		[[nodiscard]] endpointDir_t dir() const noexcept
+			{ return kind == kind_t::sink ? endpointDir_t::controllerOut : endpointDir_t::controllerIn; }
+	};
+
+	static std::array<stream_t, streamCount> streams{};
+	// The SOF handler is shared by all the streams' interfaces, so this makes sure it runs once a frame
+	static uint16_t lastFrame{};
+
+	static stream_t *findStream(const uint8_t endpoint, const endpointDir_t dir) noexcept
+	{
+		for (auto &stream : streams)
+		{
+			if (stream.kind != kind_t::unused && stream.endpoint == endpoint && stream.dir() == dir)
+				return &stream;
+		}
+		return nullptr;
+	}
+
+	static void sendPacket(stream_t &stream, const void *const data, const uint16_t length) noexcept
+	{
+		auto &epStatus{epStatusControllerIn[stream.endpoint]};
+		epStatus.isMultiPart(false);
+		epStatus.memBuffer = length ? data : nullptr;
+		epStatus.transferCount = length;
+		stream.busy = true;
+		writeEP(stream.endpoint);
+	}
+
+	static void refill(stream_t &stream) noexcept
+	{
+		uint16_t length{stream.maxPacketSize};
+		stream.ready = stream.fill && stream.fill(stream.buffers[stream.back].data(), length);
+		stream.lengths[stream.back] = std::min(length, stream.maxPacketSize);
+	}
+
+	static void tickSource(stream_t &stream) noexcept
+	{
+		if (stream.busy)
+		{
+			// The host never collected the last frame's packet, so drop it rather than send it a frame late
+			++stream.statistics.missed;
+			flushWriteEP(stream.endpoint);
+		}
+		if (stream.ready)
+			sendPacket(stream, stream.buffers[stream.back].data(), stream.lengths[stream.back]);
+		else
+		{
+			// Keep the stream's timing by sending an empty packet in place of the data that isn't there
+			++stream.statistics.late;
+			sendPacket(stream, nullptr, 0U);
+		}
+		stream.back ^= 1U;
+		refill(stream);
+	}
+
+	static void tickSink(stream_t &stream) noexcept
+	{
+		if (!stream.ready)
+		{
+			if (stream.primed)
+				++stream.statistics.missed;
+			return;
+		}
+		const auto front{stream.back};
+		stream.back ^= 1U;
+		stream.ready = false;
+		if (stream.drain)
+			stream.drain(stream.buffers[front].data(), stream.lengths[front]);
+	}
+
+	static void tickFeedback(stream_t &stream) noexcept
+	{
+		if (++stream.phase != (1U << stream.refresh))
+			return;
+		stream.phase = 0U;
+		if (stream.counting)
+		{
+			// Samples counted over 2^refresh frames, shifted into 10.14 samples per frame
+			stream.value = (stream.samples << 14U) >> stream.refresh;
+			stream.samples = 0U;
+		}
+		if (stream.busy)
+		{
+			++stream.statistics.missed;
+			flushWriteEP(stream.endpoint);
+		}
+		auto &buffer{stream.buffers[0]};
+		buffer[0] = uint8_t(stream.value);
+		buffer[1] = uint8_t(stream.value >> 8U);
+		buffer[2] = uint8_t(stream.value >> 16U);
+		sendPacket(stream, buffer.data(), 3U);
+	}
+
+	static void tick() noexcept
+	{
+		const uint16_t frame{frameCounter};
+		if (frame == lastFrame)
+			return;
+		lastFrame = frame;
+
+		for (auto &stream : streams)
+		{
+			if (!stream.active)
+				continue;
+			if (stream.kind != kind_t::feedback && ++stream.phase >= stream.pattern)
+				stream.phase = 0U;
+			switch (stream.kind)
+			{
+				case kind_t::source:
+					tickSource(stream);
+					break;
+				case kind_t::sink:
+					tickSink(stream);
+					break;
+				case kind_t::feedback:
+					tickFeedback(stream);
+					break;
+				case kind_t::unused:
+					break;
+			}
+		}
+	}
+
+	static void start(stream_t &stream) noexcept
+	{
+		stream.back = 0U;
+		stream.ready = false;
+		stream.busy = false;
+		stream.primed = false;
+		// Sources and sinks wrap phase round to 0 at the first SOF, making that the start of the pattern
+		stream.phase = stream.kind == kind_t::feedback ? 0U : uint16_t(stream.pattern - 1U);
+		stream.samples = 0U;
+		stream.active = true;
+		// Sources have their first frame ready for the first SOF
+		if (stream.kind == kind_t::source)
+			refill(stream);
+	}
+
+	static void stop(stream_t &stream) noexcept
+	{
+		stream.active = false;
+		if (stream.dir() == endpointDir_t::controllerIn && stream.busy)
+			flushWriteEP(stream.endpoint);
+		stream.busy = false;
+		stream.ready = false;
+	}
+
+	bool handleSetInterface() noexcept
+	{
+		const auto interface{uint8_t(packet.index)};
+		const auto running{uint16_t(packet.value) != 0U};
+		for (auto &stream : streams)
+		{
+			if (stream.kind == kind_t::unused || stream.interface != interface)
+				continue;
+			if (running)
+				start(stream);
+			else
+				stop(stream);
+		}
+		return true;
+	}
+
+	void handleDataIn(const uint8_t endpoint) noexcept
+	{
+		auto *const stream{findStream(endpoint, endpointDir_t::controllerIn)};
+		if (!stream || !stream->busy)
+			return;
+		if (epStatusControllerIn[endpoint].transferCount)
+		{
+			writeEP(endpoint);
+			return;
+		}
+		stream->busy = false;
+		++stream->statistics.frames;
+	}
+
+	void handleDataOut(const uint8_t endpoint) noexcept
+	{
+		auto *const stream{findStream(endpoint, endpointDir_t::controllerOut)};
+		if (!stream)
+			return;
+		auto &epStatus{epStatusControllerOut[endpoint]};
+		// The extra byte of slack keeps the controller from dropping back to NAKing on a full packet
+		const auto space{uint16_t(stream->maxPacketSize + 1U)};
+		epStatus.memBuffer = stream->buffers[stream->back].data();
+		epStatus.transferCount = space;
+		readEP(endpoint);
+		if (!stream->active)
+			return;
+		// A second packet in the same frame means the first never got handed over
+		if (stream->ready)
+			++stream->statistics.late;
+		stream->lengths[stream->back] = uint16_t(space - epStatus.transferCount);
+		stream->ready = true;
+		stream->primed = true;
+		++stream->statistics.frames;
+	}
+
+	void initEndpoint(const uint8_t endpoint) noexcept
+	{
+		for (auto &stream : streams)
+		{
+			if (stream.kind != kind_t::unused && stream.endpoint == endpoint)
+			{
+				stream.active = false;
+				registerSOFHandler(stream.interface, tick);
+			}
+		}
+	}
+
+	void deinitEndpoint(const uint8_t endpoint) noexcept
+	{
+		for (auto &stream : streams)
+		{
+			if (stream.kind != kind_t::unused && stream.endpoint == endpoint)
+			{
+				stop(stream);
+				unregsiterSOFHandler(stream.interface);
+			}
+		}
+	}
+
+	static stream_t *allocate(const uint8_t interface, const uint8_t config, const uint8_t endpoint,
+		const kind_t kind) noexcept
+	{
+		if (!endpoint || endpoint >= endpointCount)
+			return nullptr;
+		const auto dir{kind == kind_t::sink ? endpointDir_t::controllerOut : endpointDir_t::controllerIn};
+		auto *stream{findStream(endpoint, dir)};
+		if (!stream)
+		{
+			for (auto &candidate : streams)
+			{
+				if (candidate.kind == kind_t::unused)
+				{
+					stream = &candidate;
+					break;
+				}
+			}
+		}
+		if (!stream)
+			return nullptr;
+
+		*stream = {};
+		stream->kind = kind;
+		stream->interface = interface;
+		stream->endpoint = endpoint;
+		usb::device::registerAltModeHandler(interface, config, handleSetInterface);
+		if (dir == endpointDir_t::controllerIn)
+			usb::core::registerHandler({endpoint, dir}, config, {initEndpoint, deinitEndpoint, handleDataIn});
+		else
+			usb::core::registerHandler({endpoint, dir}, config, {initEndpoint, deinitEndpoint, handleDataOut});
+		return stream;
+	}
+
+	bool registerSource(const uint8_t interface, const uint8_t config, const uint8_t endpoint,
+		const uint16_t maxPacketSize, const fillHandler_t fill, const uint8_t patternFrames) noexcept
+	{
+		if (!maxPacketSize || maxPacketSize > packetSize)
+			return false;
+		auto *const stream{allocate(interface, config, endpoint, kind_t::source)};
+		if (!stream)
+			return false;
+		stream->maxPacketSize = maxPacketSize;
+		stream->fill = fill;
+		stream->pattern = patternFrames ? patternFrames : 1U;
+		return true;
+	}
+
+	bool registerSink(const uint8_t interface, const uint8_t config, const uint8_t endpoint,
+		const uint16_t maxPacketSize, const drainHandler_t drain, const uint8_t patternFrames) noexcept
+	{
+		if (!maxPacketSize || maxPacketSize > packetSize)
+			return false;
+		auto *const stream{allocate(interface, config, endpoint, kind_t::sink)};
+		if (!stream)
+			return false;
+		stream->maxPacketSize = maxPacketSize;
+		stream->drain = drain;
+		stream->pattern = patternFrames ? patternFrames : 1U;
+		return true;
+	}
+
+	bool registerFeedback(const uint8_t interface, const uint8_t config, const uint8_t endpoint,
+		const uint8_t refresh, const uint32_t sampleRate) noexcept
+	{
+		// Full-speed feedback periods run from 2 to 512 frames
+		if (refresh < 1U || refresh > 9U)
+			return false;
+		auto *const stream{allocate(interface, config, endpoint, kind_t::feedback)};
+		if (!stream)
+			return false;
+		stream->refresh = refresh;
+		stream->value = feedbackFor(sampleRate);
+		return true;
+	}
+
+	void feedbackSamples(const uint8_t endpoint, const uint16_t samples) noexcept
+	{
+		auto *const stream{findStream(endpoint, endpointDir_t::controllerIn)};
+		if (!stream || stream->kind != kind_t::feedback)
+			return;
+		stream->counting = true;
+		stream->samples += samples;
+	}
+
+	void feedbackValue(const uint8_t endpoint, const uint32_t value) noexcept
+	{
+		auto *const stream{findStream(endpoint, endpointDir_t::controllerIn)};
+		if (!stream || stream->kind != kind_t::feedback)
+			return;
+		stream->counting = false;
+		stream->value = value & 0x00FFFFFFU;
+	}
+
+	statistics_t statistics(const usbEP_t endpoint) noexcept
+	{
+		const auto *const stream{findStream(endpoint.endpoint(), endpoint.dir())};
+		return stream ? stream->statistics : statistics_t{};
+	}
+
+	void resetStatistics(const usbEP_t endpoint) noexcept
+	{
+		auto *const stream{findStream(endpoint.endpoint(), endpoint.dir())};
+		if (stream)
+			stream->statistics = {};
+	}
+
+	bool active(const usbEP_t endpoint) noexcept
+	{
+		const auto *const stream{findStream(endpoint.endpoint(), endpoint.dir())};
+		return stream && stream->active;
+	}
+
+	namespace internal
+	{
+		answer_t handleSyncFrame() noexcept
+		{
+			if (packet.requestType.dir() == endpointDir_t::controllerOut ||
+				packet.requestType.recipient() != setupPacket::recipient_t::endpoint ||
+				packet.length != 2U)
+				return {response_t::stall, nullptr, 0};
+
+			const auto address{uint8_t(packet.index)};
+			const auto dir{static_cast<endpointDir_t>(address & 0x80U)};
+			const auto *const stream{findStream(uint8_t(address & 0x0FU), dir)};
+			if (!stream || !stream->active || stream->kind == kind_t::feedback)
+				return {response_t::stall, nullptr, 0};
+
+			// The frame the stream's current packet size pattern started in, which has to be given in the
+			// host's frame numbering - so this can't be answered without the controller's frame number
+			static uint16_t frame{};
+			if (!usb::core::internal::busFrameNumber(frame))
+				return {response_t::stall, nullptr, 0};
+			frame = uint16_t((frame - stream->phase) & 0x07FFU);
+			return {response_t::data, &frame, sizeof(frame)};
+		}
+	} // namespace internal
+} // namespace usb::iso
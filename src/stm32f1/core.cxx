@@ -3,6 +3,8 @@
 #include "usb/internal/core.hxx"
 #include "usb/platforms/stm32f1/core.hxx"
 #include "usb/device.hxx"
+#include "usb/trace.hxx"
+#include "usb/capture.hxx"
 #include <substrate/index_sequence>
 
 /*!
@@ -33,6 +35,10 @@ namespace usb::core
 			{ return reinterpret_cast<volatile uint16_t *>(stm32::packetBufferBase + (address << 1U)); }
 	} // namespace internal
 
+	// Endpoints, a bit each, that had a packet loaded or a read armed while halted, to restore on unhalting
+	static uint8_t haltedTXPending{};
+	static uint8_t haltedRXArmed{};
+
 	void init() noexcept
 	{
 		// Enable the clocks for the USB peripheral
@@ -116,6 +122,10 @@ namespace usb::core
 		usbState = deviceState_t::attached;
 		usbCtrl.ctrl |= vals::usb::controlSOFItrEn | vals::usb::controlCorrectXferItrEn | vals::usb::controlWakeupItrEn;
 		usb::device::activeConfig = 0;
+#ifdef USB_REMOTE_WAKEUP
+		remoteWakeupEnabled = false;
+#endif
+		trace::record(trace::event_t::reset, 0U, 0U);
 	}
 
 	void resetEPs(const epReset_t what) noexcept
@@ -164,12 +174,17 @@ namespace usb::core
 
 			if (direction == endpointDir_t::controllerIn)
 			{
+				haltedTXPending &= uint8_t(~(1U << endpointNumber));
+#ifdef USB_ISOCHRONOUS
+				isoPacketSizes[endpointNumber] = type == usbEndpointType_t::isochronous ? bufferLength : 0U;
+#endif
 				epBufferCtrl.txAddress = (sizeof(stm32::usbEPTable_t) >> 1U) + bufferAddress;
 				vals::usb::epCtrlSetDataToggleTX(endpointNumber, false);
 				vals::usb::epCtrlStatusUpdateTX(endpointNumber, vals::usb::epCtrlTXNack);
 			}
 			else
 			{
+				haltedRXArmed &= uint8_t(~(1U << endpointNumber));
 				epBufferCtrl.rxAddress = (sizeof(stm32::usbEPTable_t) >> 1U) + bufferAddress;
 				epBufferCtrl.rxCount = vals::usb::rxBufferSize(bufferLength);
 				vals::usb::epCtrlSetDataToggleRX(endpointNumber, false);
@@ -185,8 +200,24 @@ namespace usb::core
 		usbCtrl.ctrl &= ~vals::usb::controlForceSuspend;
 		// Switch over the interrupt source being used
 		usbCtrl.ctrl = (usbCtrl.ctrl & ~vals::usb::controlWakeupItrEn) | vals::usb::controlSuspendItrEn;
+		trace::record(trace::event_t::resume, 0U, 0U);
 	}
 
+#ifdef USB_REMOTE_WAKEUP
+	void internal::signalResume() noexcept
+	{
+		// CNTR.RESUME, which the platform constants don't name
+		constexpr uint16_t controlResume{1U << 4U};
+		// Bring the controller out of low power mode and forced suspend before driving resume (K)
+		usbCtrl.ctrl &= ~(vals::usb::controlLowPowerMode | vals::usb::controlForceSuspend);
+		usbCtrl.ctrl |= controlResume;
+		holdResume();
+		usbCtrl.ctrl &= uint16_t(~controlResume);
+		usbSuspended = false;
+		usbCtrl.ctrl = (usbCtrl.ctrl & ~vals::usb::controlWakeupItrEn) | vals::usb::controlSuspendItrEn;
+	}
+#endif
+
 	void suspend() noexcept
 	{
 		// Suspend the controller, setting it in low power mode
@@ -194,6 +225,10 @@ namespace usb::core
 		// Switch over the interrupt source being used
 		usbCtrl.ctrl = (usbCtrl.ctrl & ~vals::usb::controlSuspendItrEn) | vals::usb::controlWakeupItrEn;
 		usbSuspended = true;
+#ifdef USB_REMOTE_WAKEUP
+		suspendTime = timestamp();
+#endif
+		trace::record(trace::event_t::suspend, 0U, 0U);
 	}
 
 	const void *sendData(volatile uint16_t *const usbBuffer, const void *const progBuffer, const uint16_t length) noexcept
@@ -253,10 +288,21 @@ namespace usb::core
 		};
 		epStatus.transferCount -= readCount;
 		// Grab the data associated with this transfer
-		epStatus.memBuffer = recvData(internal::epBufferPtr(epBufferCtrl.rxAddress), epStatus.memBuffer, readCount);
+		auto *const buffer{epStatus.memBuffer};
+		epStatus.memBuffer = recvData(internal::epBufferPtr(epBufferCtrl.rxAddress), buffer, readCount);
+		capture::packetOut(endpoint, buffer, readCount);
 		// Tell the controller we're done with the data
 		if (endpoint == 0U && usbCtrlState == ctrlState_t::statusRX)
 			vals::usb::epCtrlSetDataToggleRX(0U, true);
+		// Arming a halted endpoint would silently take it out of STALL, so remember to do it on unhalting
+		if (epStatus.halted())
+		{
+			if (epStatus.transferCount || endpoint == 0U)
+				haltedRXArmed |= uint8_t(1U << endpoint);
+			else
+				haltedRXArmed &= uint8_t(~(1U << endpoint));
+			return !epStatus.transferCount;
+		}
 		if (epStatus.transferCount || endpoint == 0U)
 			vals::usb::epCtrlStatusUpdateRX(endpoint, vals::usb::epCtrlRXValid);
 		else
@@ -343,26 +389,38 @@ namespace usb::core
 		auto &epBufferCtrl{internal::epBufferCtrlFor(endpoint)};
 		const auto sendCount
 		{
-			[&]() noexcept -> uint8_t
+			[&]() noexcept -> uint16_t
 			{
 				// Bounds sanity and then adjust how much is left to transfer
-				if (epStatus.transferCount < epBufferSize)
-					return uint8_t(epStatus.transferCount);
-				return epBufferSize;
+				const auto packetSize{packetSizeIn(endpoint)};
+				if (epStatus.transferCount < packetSize)
+					return epStatus.transferCount;
+				return packetSize;
 			}()
 		};
 		epStatus.transferCount -= sendCount;
 
 		if (!epStatus.isMultiPart())
-			epStatus.memBuffer = sendData(internal::epBufferPtr(epBufferCtrl.txAddress), epStatus.memBuffer, sendCount);
+		{
+			const auto *const buffer{epStatus.memBuffer};
+			epStatus.memBuffer = sendData(internal::epBufferPtr(epBufferCtrl.txAddress), buffer, sendCount);
+			capture::packetIn(endpoint, buffer, sendCount);
+		}
 		else
-			writeEPMultipart(endpoint, sendCount);
+		{
+			// Multi-part transfers only go over endpoints whose packets are at most epBufferSize
+			writeEPMultipart(endpoint, uint8_t(sendCount));
+			capture::packetIn(endpoint, nullptr, sendCount);
+		}
 
 		// Mark the buffer as ready to send
 		epBufferCtrl.txCount = sendCount;
 		if (endpoint == 0U && usbCtrlState == ctrlState_t::statusTX)
 			vals::usb::epCtrlSetDataToggleTX(0U, true);
-		vals::usb::epCtrlStatusUpdateTX(endpoint, vals::usb::epCtrlTXValid);
+		if (!epStatus.halted())
+			vals::usb::epCtrlStatusUpdateTX(endpoint, vals::usb::epCtrlTXValid);
+		else
+			haltedTXPending |= uint8_t(1U << endpoint);
 		return !epStatus.transferCount;
 	}
 
@@ -385,6 +443,78 @@ namespace usb::core
 		vals::usb::epCtrlStatusUpdateTX(endpoint, vals::usb::epCtrlTXStall);
 	}
 
+	/*!
+	 * STALL replaces whatever state the endpoint was in, so note whether it had a packet waiting to go
+	 * or a read armed. Once unstalled, each side goes back to that, or NAKs till the next writeEP()
+	 * or readEP() arms it.
+	 */
+	void internal::setEPStall(const usbEP_t endpoint, const bool stall) noexcept
+	{
+		const auto number{endpoint.endpoint()};
+		const auto mask{uint8_t(1U << number)};
+		const auto epCtrlStat{usbCtrl.epCtrlStat[number]};
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+		{
+			if (stall)
+			{
+				if ((epCtrlStat & vals::usb::epCtrlTXMask) == vals::usb::epCtrlTXValid)
+					haltedTXPending |= mask;
+				vals::usb::epCtrlStatusUpdateTX(number, vals::usb::epCtrlTXStall);
+				return;
+			}
+			const auto pending{haltedTXPending & mask};
+			haltedTXPending &= uint8_t(~mask);
+			vals::usb::epCtrlStatusUpdateTX(number, pending ? vals::usb::epCtrlTXValid : vals::usb::epCtrlTXNack);
+		}
+		else
+		{
+			if (stall)
+			{
+				if ((epCtrlStat & vals::usb::epCtrlRXMask) == vals::usb::epCtrlRXValid)
+					haltedRXArmed |= mask;
+				vals::usb::epCtrlStatusUpdateRX(number, vals::usb::epCtrlRXStall);
+				return;
+			}
+			const auto armed{haltedRXArmed & mask};
+			haltedRXArmed &= uint8_t(~mask);
+			vals::usb::epCtrlStatusUpdateRX(number, armed ? vals::usb::epCtrlRXValid : vals::usb::epCtrlRXNack);
+		}
+	}
+
+	void internal::resetEPDataToggle(const usbEP_t endpoint) noexcept
+	{
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+			vals::usb::epCtrlSetDataToggleTX(endpoint.endpoint(), false);
+		else
+			vals::usb::epCtrlSetDataToggleRX(endpoint.endpoint(), false);
+	}
+
+	void internal::setIRQMasked(const bool masked) noexcept
+	{
+		if (masked)
+			nvic.disableInterrupt(vals::irqs::usbLowPriority);
+		else
+			nvic.enableInterrupt(vals::irqs::usbLowPriority);
+	}
+
+	bool internal::busFrameNumber(uint16_t &frame) noexcept
+	{
+		// USB_FNR, which the register map doesn't name, sits at offset 0x48 from the controller's base
+		constexpr uintptr_t frameOffset{0x48U};
+		const auto &frameReg{*reinterpret_cast<const volatile uint16_t *>(
+			reinterpret_cast<uintptr_t>(&usbCtrl) + frameOffset)};
+		// FNR.FN, bits 10:0
+		frame = uint16_t(frameReg & 0x07FFU);
+		return true;
+	}
+
+	void flushWriteEP(const uint8_t endpoint) noexcept
+	{
+		// Disarm the endpoint - the packet buffer gets overwritten by the next writeEP() anyway
+		if (endpoint != 0U)
+			vals::usb::epCtrlStatusUpdateTX(endpoint, vals::usb::epCtrlTXNack);
+	}
+
 	void processEndpoint(const uint8_t endpoint) noexcept
 	{
 		// If we're EP0, go through the control endpoint machinary
@@ -450,6 +580,7 @@ namespace usb::core
 		{
 			usbCtrl.ctrl |= vals::usb::controlSuspendItrEn;
 			usbState = deviceState_t::powered;
+			trace::deviceState(usbState);
 		}
 
 		if (status & vals::usb::itrStatusWakeup)
@@ -461,6 +592,7 @@ namespace usb::core
 		{
 			reset();
 			usbState = deviceState_t::waiting;
+			trace::deviceState(usbState);
 			return;
 		}
 
@@ -473,13 +605,7 @@ namespace usb::core
 			return;
 
 		if (status & vals::usb::itrStatusSOF)
-		{
-			for (const auto &handler : sofHandlers)
-			{
-				if (handler)
-					handler();
-			}
-		}
+			handleSOF();
 
 		if (status & vals::usb::itrStatusCorrectXfer)
 			processEndpoints();
@@ -1,8 +1,10 @@
 // SPDX-License-Identifier: BSD-3-Clause
+#include <algorithm>
 #include "usb/platform.hxx"
 #include "usb/internal/core.hxx"
 #include "usb/platforms/stm32f1/core.hxx"
 #include "usb/internal/device.hxx"
+#include "usb/trace.hxx"
 
 using namespace usb::constants;
 using namespace usb::types;
@@ -13,14 +15,110 @@ using namespace usb::device::internal;
 
 namespace usb::device
 {
-	void setupEndpoint(const usbEndpointDescriptor_t &endpoint, uint16_t &startAddress)
+	/*!
+	 * Packet memory is handed out once per configuration, each endpoint getting room for the largest packet
+	 * size any alternate setting gives it. This lets SET_INTERFACE reprogram an endpoint in place without
+	 * moving the buffers of endpoints belonging to other interfaces, which may have transfers in flight.
+	 */
+	static std::array<uint16_t, endpointCount> txBufferAddress{};
+	static std::array<uint16_t, endpointCount> rxBufferAddress{};
+
+	// Calls function with each non-control endpoint in the active configuration, and the interface
+	// and alternate setting it belongs to
+	template<typename function_t> static void forEachEndpoint(const function_t &function) noexcept
 	{
-		if (endpoint.endpointType == usbEndpointType_t::control)
-			return;
+		uint8_t interface{};
+		uint8_t alternate{};
+		const auto descriptors{configDescriptors[activeConfig - 1U]};
+		for (const auto &part : descriptors)
+		{
+			const auto *const descriptor{static_cast<const std::byte *>(part.descriptor)};
+			usbDescriptor_t type{usbDescriptor_t::invalid};
+			memcpy(&type, descriptor + 1, 1);
+			if (type == usbDescriptor_t::interface)
+			{
+				const auto interfaceDescriptor{*static_cast<const usbInterfaceDescriptor_t *>(part.descriptor)};
+				interface = interfaceDescriptor.interfaceNumber;
+				alternate = interfaceDescriptor.alternateSetting;
+			}
+			else if (type == usbDescriptor_t::endpoint)
+			{
+				const auto endpoint{*static_cast<const usbEndpointDescriptor_t *>(part.descriptor)};
+				if (endpoint.endpointType != usbEndpointType_t::control)
+					function(endpoint, interface, alternate);
+			}
+		}
+	}
 
-		usb::core::internal::setupEndpoint(endpoint.endpointAddress, endpoint.endpointType, startAddress,
+	static bool hasAlternate(const uint8_t interface, const uint8_t alternate) noexcept
+	{
+		const auto descriptors{configDescriptors[activeConfig - 1U]};
+		for (const auto &part : descriptors)
+		{
+			const auto *const descriptor{static_cast<const std::byte *>(part.descriptor)};
+			usbDescriptor_t type{usbDescriptor_t::invalid};
+			memcpy(&type, descriptor + 1, 1);
+			if (type != usbDescriptor_t::interface)
+				continue;
+			const auto interfaceDescriptor{*static_cast<const usbInterfaceDescriptor_t *>(part.descriptor)};
+			if (interfaceDescriptor.interfaceNumber == interface && interfaceDescriptor.alternateSetting == alternate)
+				return true;
+		}
+		return false;
+	}
+
+	static usbEP_t endpointFor(const usbEndpointDescriptor_t &endpoint) noexcept
+	{
+		return
+		{
+			uint8_t(endpoint.endpointAddress & vals::usb::endpointDirMask),
+			static_cast<endpointDir_t>(endpoint.endpointAddress & ~vals::usb::endpointDirMask)
+		};
+	}
+
+	static void allocateBuffers() noexcept
+	{
+		std::array<uint16_t, endpointCount> txSize{};
+		std::array<uint16_t, endpointCount> rxSize{};
+		forEachEndpoint([&](const usbEndpointDescriptor_t &endpoint, const uint8_t, const uint8_t) noexcept
+		{
+			const auto ep{endpointFor(endpoint)};
+			auto &size{ep.dir() == endpointDir_t::controllerIn ? txSize[ep.endpoint()] : rxSize[ep.endpoint()]};
+			size = std::max(size, endpoint.maxPacketSize);
+		});
+
+		// EP0 consumes the first epBufferSize chunk of USB RAM after the endpoint table.
+		uint16_t startAddress{epBufferSize};
+		for (uint8_t endpoint{1U}; endpoint < endpointCount; ++endpoint)
+		{
+			txBufferAddress[endpoint] = startAddress;
+			startAddress += txSize[endpoint];
+			rxBufferAddress[endpoint] = startAddress;
+			startAddress += rxSize[endpoint];
+		}
+	}
+
+	void setupEndpoint(const usbEndpointDescriptor_t &endpoint)
+	{
+		const auto ep{endpointFor(endpoint)};
+		const auto bufferAddress
+		{
+			ep.dir() == endpointDir_t::controllerIn ? txBufferAddress[ep.endpoint()] : rxBufferAddress[ep.endpoint()]
+		};
+		// This also puts the endpoint's data toggle back to DATA0
+		usb::core::internal::setupEndpoint(endpoint.endpointAddress, endpoint.endpointType, bufferAddress,
 			endpoint.maxPacketSize);
-		startAddress += endpoint.maxPacketSize;
+	}
+
+	static void teardownEndpoint(const usbEndpointDescriptor_t &endpoint) noexcept
+	{
+		const auto ep{endpointFor(endpoint)};
+		usb::core::deinitHandler(ep);
+		if (ep.dir() == endpointDir_t::controllerIn)
+			vals::usb::epCtrlStatusUpdateTX(ep.endpoint(), vals::usb::epCtrlTXDisabled);
+		else
+			vals::usb::epCtrlStatusUpdateRX(ep.endpoint(), vals::usb::epCtrlRXDisabled);
+		usb::core::common::resetEP(ep);
 	}
 
 	namespace internal
@@ -36,28 +134,47 @@ namespace usb::device
 			activeConfig = config;
 
 			if (activeConfig == 0)
+			{
 				usbState = deviceState_t::addressed;
+				trace::deviceState(usbState);
+			}
 			else
 			{
-				// EP0 consumes the first epBufferSize chunk of USB RAM after the endpoint table.
-				uint16_t startAddress{epBufferSize};
-
-				const auto descriptors{configDescriptors[activeConfig - 1U]};
-				for (const auto &part : descriptors)
+				allocateBuffers();
+				// Only the default alternate settings' endpoints come up, SET_INTERFACE handles the rest
+				forEachEndpoint([](const usbEndpointDescriptor_t &endpoint, const uint8_t, const uint8_t alternate)
 				{
-					const auto *const descriptor{static_cast<const std::byte *>(part.descriptor)};
-					usbDescriptor_t type{usbDescriptor_t::invalid};
-					memcpy(&type, descriptor + 1, 1);
-					if (type == usbDescriptor_t::endpoint)
-					{
-						const auto endpoint{*static_cast<const usbEndpointDescriptor_t *>(part.descriptor)};
-						setupEndpoint(endpoint, startAddress);
-					}
-				}
-				usb::core::initHandlers();
+					if (alternate != 0U)
+						return;
+					setupEndpoint(endpoint);
+					usb::core::initHandler(endpointFor(endpoint));
+				});
 			}
 			return true;
 		}
+
+		bool handleSetInterface() noexcept
+		{
+			const auto interface{uint8_t(packet.index)};
+			const auto current{alternateModes[activeConfig - 1U][interface]};
+			const auto requested{uint8_t(packet.value)};
+			if (!hasAlternate(interface, requested))
+				return false;
+
+			forEachEndpoint([&](const usbEndpointDescriptor_t &endpoint, const uint8_t owner, const uint8_t alternate)
+			{
+				if (owner == interface && alternate == current)
+					teardownEndpoint(endpoint);
+			});
+			forEachEndpoint([&](const usbEndpointDescriptor_t &endpoint, const uint8_t owner, const uint8_t alternate)
+			{
+				if (owner != interface || alternate != requested)
+					return;
+				setupEndpoint(endpoint);
+				usb::core::initHandler(endpointFor(endpoint));
+			});
+			return true;
+		}
 	} // namespace internal
 
 	void handleControlPacket() noexcept
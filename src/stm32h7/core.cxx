@@ -1,5 +1,7 @@
 // SPDX-License-Identifier: BSD-3-Clause
 #include "usb/platform.hxx"
+#include "usb/internal/core.hxx"
+#include "usb/trace.hxx"
 #include "usb/platforms/stm32h7/core.hxx"
 
 /*!
@@ -75,10 +77,120 @@ namespace usb::core
 		// Restart the PHY clock
 
 		usb1HS.globalRxFIFOSize = dwc2::rxFIFOSize;
-		// Unmask interrupts for TX and RX
 		usb1HS.globalAHBConfig = dwc2::globalAHBConfigGlobalIntUnmask;
-		usb1HS.globalItrMask = dwc2::globalItrSOF | dwc2::globalItrRxFIFONonEmpty | dwc2::globalItrUSBSuspend |
-			dwc2::globalItrUSBReset | dwc2::globalItrEnumDone | dwc2::globalItrInEndpoint |
-			dwc2::globalItrOutEndpoint | dwc2::globalItrDisconnected | dwc2::globalItrWakeupDetected;
+		// Only unmask what handleIRQ() services - the RX FIFO level interrupt in particular stays asserted
+		// until the FIFO is read, so leaving it unmasked with nothing to drain it would spin in the handler
+		usb1HS.globalItrMask = dwc2::globalItrSOF | dwc2::globalItrUSBSuspend | dwc2::globalItrUSBReset |
+			dwc2::globalItrWakeupDetected;
+
+#ifdef USB_LPM
+		// ACK LPM tokens, gating the PHY clock in L1 and suspending the PHY when the host's BESL gives
+		// enough time to bring it back up
+		usb1HS.globalLPMConfig = dwc2::globalLPMConfigEnable | dwc2::globalLPMConfigAck |
+			dwc2::globalLPMConfigBESLEnable | dwc2::globalLPMConfigL1ShallowSleepEnable |
+			dwc2::globalLPMConfigL1DeepSleepEnable | dwc2::globalLPMConfigBESLThreshold(usb::constants::lpmDeepBESL);
+		usb1HS.globalItrMask |= dwc2::globalItrLPM;
+#endif
+	}
+
+#ifdef USB_LPM
+	static void enterL1() noexcept
+	{
+		const auto lpmConfig{usb1HS.globalLPMConfig};
+		if (!(lpmConfig & dwc2::globalLPMConfigSleepStatus))
+			return;
+		internal::enterL1(uint8_t((lpmConfig & dwc2::globalLPMConfigBESLMask) >> dwc2::globalLPMConfigBESLShift));
+	}
+
+	static void exitL1() noexcept
+	{
+		// Undo any clock gating the application did on the way into L1 before handing back to it
+		usb1HS.powerClockGateCtrl &= ~(dwc2::powerClockGateCtrlStopPHYClock | dwc2::powerClockGateCtrlGateHClock);
+		internal::exitL1();
+	}
+#endif
+
+	/*!
+	 * Only bus reset, suspend and resume, SOF and the link power management events are serviced here so
+	 * far, the rest of device mode is still to be brought up on this backend
+	 */
+	void handleIRQ() noexcept
+	{
+		const auto status{usb1HS.globalItrStatus & usb1HS.globalItrMask};
+		if (status & dwc2::globalItrUSBReset)
+		{
+			usb1HS.globalItrStatus = dwc2::globalItrUSBReset;
+			internal::usbSuspended = false;
+#ifdef USB_REMOTE_WAKEUP
+			internal::remoteWakeupEnabled = false;
+#endif
+			trace::record(trace::event_t::reset, 0U, 0U);
+		}
+#ifdef USB_LPM
+		if (status & dwc2::globalItrLPM)
+		{
+			usb1HS.globalItrStatus = dwc2::globalItrLPM;
+			enterL1();
+		}
+#endif
+		// The core raises the wakeup interrupt both on leaving L1 (having cleared the sleep status) and
+		// on the host resuming the bus from suspend
+		if (status & dwc2::globalItrWakeupDetected)
+		{
+			usb1HS.globalItrStatus = dwc2::globalItrWakeupDetected;
+#ifdef USB_LPM
+			if (internal::usbSleeping)
+				exitL1();
+#endif
+			// L1 isn't suspend, so only one of these can be the case
+			if (internal::usbSuspended)
+			{
+				usb1HS.powerClockGateCtrl &= ~(dwc2::powerClockGateCtrlStopPHYClock |
+					dwc2::powerClockGateCtrlGateHClock);
+				internal::usbSuspended = false;
+				trace::record(trace::event_t::resume, 0U, 0U);
+			}
+		}
+		if (status & dwc2::globalItrUSBSuspend)
+		{
+			usb1HS.globalItrStatus = dwc2::globalItrUSBSuspend;
+			internal::usbSuspended = true;
+#ifdef USB_REMOTE_WAKEUP
+			internal::suspendTime = timestamp();
+#endif
+			trace::record(trace::event_t::suspend, 0U, 0U);
+		}
+		if (status & dwc2::globalItrSOF)
+		{
+			usb1HS.globalItrStatus = dwc2::globalItrSOF;
+			internal::handleSOF();
+		}
+	}
+
+	void internal::setIRQMasked(const bool masked) noexcept
+	{
+		if (masked)
+			usb1HS.globalAHBConfig &= ~dwc2::globalAHBConfigGlobalIntUnmask;
+		else
+			usb1HS.globalAHBConfig |= dwc2::globalAHBConfigGlobalIntUnmask;
+	}
+
+	bool internal::busFrameNumber(uint16_t &frame) noexcept
+	{
+		frame = uint16_t(((usb1HS.deviceStatus & dwc2::deviceStatusFrameNumberMask) >>
+			dwc2::deviceStatusFrameNumberShift) & 0x07FFU);
+		return true;
+	}
+
+#ifdef USB_REMOTE_WAKEUP
+	void internal::signalResume() noexcept
+	{
+		// Ungate the PHY and AHB clocks so the core can drive resume (K) onto the bus
+		usb1HS.powerClockGateCtrl &= ~(dwc2::powerClockGateCtrlStopPHYClock | dwc2::powerClockGateCtrlGateHClock);
+		usb1HS.deviceCtrl |= dwc2::deviceCtrlRemoteWakeupSignal;
+		internal::holdResume();
+		usb1HS.deviceCtrl &= ~dwc2::deviceCtrlRemoteWakeupSignal;
+		internal::usbSuspended = false;
 	}
+#endif
 } // namespace usb::core
@@ -2,6 +2,8 @@
 #include "usb/platform.hxx"
 #include "usb/internal/core.hxx"
 #include "usb/device.hxx"
+#include "usb/trace.hxx"
+#include "usb/capture.hxx"
 #include <substrate/indexed_iterator>
 #include <substrate/index_sequence>
 
@@ -149,6 +151,10 @@ namespace usb::core
 		usbCtrl.rxIntEnable &= vals::usb::rxItrEnableMask;
 		usbCtrl.txIntEnable |= vals::usb::txItrEnableEP0;
 		usb::device::activeConfig = 0;
+#ifdef USB_REMOTE_WAKEUP
+		remoteWakeupEnabled = false;
+#endif
+		trace::record(trace::event_t::reset, 0U, 0U);
 	}
 
 	void resetEPs(const epReset_t what) noexcept
@@ -165,6 +171,7 @@ namespace usb::core
 		usbCtrl.power |= vals::usb::powerSoftConnect;
 		usbCtrl.intEnable |= vals::usb::itrEnableDeviceReset;
 		usbState = deviceState_t::detached;
+		trace::deviceState(usbState);
 	}
 
 	void wakeup() noexcept
@@ -176,35 +183,53 @@ namespace usb::core
 		usbCtrl.power &= uint8_t(~vals::usb::powerResume);
 		usbCtrl.intEnable &= uint8_t(~vals::usb::itrEnableResume);
 		usbCtrl.intEnable |= vals::usb::itrEnableSuspend;
+		trace::record(trace::event_t::resume, 0U, 0U);
 	}
 
+#ifdef USB_REMOTE_WAKEUP
+	void internal::signalResume() noexcept
+	{
+		// Drive resume (K) onto the bus, which the host then takes over and continues
+		usbCtrl.power |= vals::usb::powerResume;
+		holdResume();
+		usbCtrl.power &= uint8_t(~vals::usb::powerResume);
+		usbSuspended = false;
+		usbCtrl.intEnable &= uint8_t(~vals::usb::itrEnableResume);
+		usbCtrl.intEnable |= vals::usb::itrEnableSuspend;
+	}
+#endif
+
 	void suspend() noexcept
 	{
 		usbCtrl.intEnable &= uint8_t(~vals::usb::itrEnableSuspend);
 		usbCtrl.intEnable |= vals::usb::itrEnableResume;
 		usbCtrl.power |= vals::usb::powerSuspend;
 		usbSuspended = true;
+#ifdef USB_REMOTE_WAKEUP
+		suspendTime = timestamp();
+#endif
+		trace::record(trace::event_t::suspend, 0U, 0U);
 	}
 
-	const uint8_t *sendData(const uint8_t ep, const uint8_t *const buffer, const uint8_t length) noexcept
+	const uint8_t *sendData(const uint8_t ep, const uint8_t *const buffer, const uint16_t length) noexcept
 	{
 		// Copy the data to tranmit from the user buffer
-		for (uint8_t i{}; i < (length & 0xFCU); i += 4U)
+		for (uint16_t i{}; i < (length & 0xFFFCU); i += 4U)
 			writeFIFO_t<uint32_t>{}(usbCtrl.epFIFO[ep], buffer + i);
 		if (length & 0x02U)
-			writeFIFO_t<uint16_t>{}(usbCtrl.epFIFO[ep], buffer + (length & 0xFEU) - 2U);
+			writeFIFO_t<uint16_t>{}(usbCtrl.epFIFO[ep], buffer + (length & 0xFFFEU) - 2U);
 		if (length & 0x01U)
 			writeFIFO_t<uint8_t>{}(usbCtrl.epFIFO[ep], buffer + length - 1U);
 		return buffer + length;
 	}
 
-	uint8_t *recvData(const uint8_t ep, uint8_t *const buffer, const uint8_t length) noexcept
+	uint8_t *recvData(const uint8_t ep, uint8_t *const buffer, const uint16_t length) noexcept
 	{
 		// Copy the received data to the user buffer
-		for (uint8_t i{}; i < (length & 0xFCU); i += 4U)
+		for (uint16_t i{}; i < (length & 0xFFFCU); i += 4U)
 			readFIFO_t<uint32_t>{}(usbCtrl.epFIFO[ep], buffer + i);
 		if (length & 0x02U)
-			readFIFO_t<uint16_t>{}(usbCtrl.epFIFO[ep], buffer + (length & 0xFEU) - 2U);
+			readFIFO_t<uint16_t>{}(usbCtrl.epFIFO[ep], buffer + (length & 0xFFFEU) - 2U);
 		if (length & 0x01U)
 			readFIFO_t<uint8_t>{}(usbCtrl.epFIFO[ep], buffer + length - 1U);
 		return buffer + length;
@@ -237,7 +262,9 @@ namespace usb::core
 			}()
 		};
 		epStatus.transferCount -= readCount;
-		epStatus.memBuffer = recvData(endpoint, static_cast<uint8_t *>(epStatus.memBuffer), uint8_t(readCount));
+		auto *const buffer{static_cast<uint8_t *>(epStatus.memBuffer)};
+		epStatus.memBuffer = recvData(endpoint, buffer, readCount);
+		capture::packetOut(endpoint, buffer, readCount);
 		// Mark the FIFO contents as done with
 		if (endpoint == 0U)
 		{
@@ -278,11 +305,19 @@ namespace usb::core
 				}()
 			};
 			sendAmount -= partAmount;
+			// How many bytes do we need to completely fill the leftovers buffer
+			const auto diffAmount{uint8_t(leftoverBytes.size() - leftoverCount)};
+			// If we have bytes left over from the previous loop and this chunk can't fill them out
+			if (leftoverCount && partAmount < diffAmount)
+			{
+				// Just add the chunk to the leftovers
+				std::memcpy(leftoverBytes.data() + leftoverCount, epStatus.memBuffer, partAmount);
+				epStatus.memBuffer = static_cast<const uint8_t *>(epStatus.memBuffer) + partAmount;
+				leftoverCount = uint8_t(leftoverCount + partAmount);
+			}
 			// If we have bytes left over from the previous loop
-			if (leftoverCount)
+			else if (leftoverCount)
 			{
-				// How many bytes do we need to completely fill the leftovers buffer
-				const auto diffAmount{uint8_t(leftoverBytes.size() - leftoverCount)};
 				// Copy that in and queue it from the front of the new chunk
 				std::memcpy(leftoverBytes.data() + leftoverCount, epStatus.memBuffer, diffAmount);
 				sendData(endpoint, leftoverBytes.data(), leftoverBytes.size());
@@ -291,7 +326,7 @@ namespace usb::core
 				// in queueing only amounts divisable-by-4
 				const auto remainder{uint8_t((partAmount - diffAmount) & 0x03U)};
 				// Queue as much as we can
-				epStatus.memBuffer = sendData(0, static_cast<const uint8_t *>(epStatus.memBuffer) + diffAmount,
+				epStatus.memBuffer = sendData(endpoint, static_cast<const uint8_t *>(epStatus.memBuffer) + diffAmount,
 					uint8_t((partAmount - diffAmount) - remainder)) + remainder;
 				// And copy any new leftovers to the leftovers buffer.
 				std::memcpy(leftoverBytes.data(),
@@ -333,20 +368,29 @@ namespace usb::core
 		auto &epStatus{epStatusControllerIn[endpoint]};
 		const auto sendCount
 		{
-			[&]() noexcept -> uint8_t
+			[&]() noexcept -> uint16_t
 			{
 				// Bounds sanity and then adjust how much is left to transfer
-				if (epStatus.transferCount < epBufferSize)
-					return uint8_t(epStatus.transferCount);
-				return epBufferSize;
+				const auto packetSize{packetSizeIn(endpoint)};
+				if (epStatus.transferCount < packetSize)
+					return epStatus.transferCount;
+				return packetSize;
 			}()
 		};
 		epStatus.transferCount -= sendCount;
 
 		if (!epStatus.isMultiPart())
-			epStatus.memBuffer = sendData(endpoint, static_cast<const uint8_t *>(epStatus.memBuffer), sendCount);
+		{
+			const auto *const buffer{static_cast<const uint8_t *>(epStatus.memBuffer)};
+			epStatus.memBuffer = sendData(endpoint, buffer, sendCount);
+			capture::packetIn(endpoint, buffer, sendCount);
+		}
 		else
-			writeEPMultipart(endpoint, sendCount);
+		{
+			// Multi-part transfers only go over endpoints whose packets are at most epBufferSize
+			writeEPMultipart(endpoint, uint8_t(sendCount));
+			capture::packetIn(endpoint, nullptr, sendCount);
+		}
 
 		// Mark the FIFO contents as done with
 		if (endpoint == 0U)
@@ -390,6 +434,58 @@ namespace usb::core
 			usbCtrl.epCtrls[endpoint - 1U].rxStatusCtrlL |= vals::usb::epStatusCtrlLStall;
 	}
 
+	// The STALL and CLRDT bits sit in different places in USBTXCSRLn and USBRXCSRLn
+	constexpr static uint8_t txStatusCtrlLStall{0x10U};
+	constexpr static uint8_t txStatusCtrlLClearDataToggle{0x40U};
+	constexpr static uint8_t rxStatusCtrlLStall{0x20U};
+	constexpr static uint8_t rxStatusCtrlLClearDataToggle{0x80U};
+
+	void internal::setEPStall(const usbEP_t endpoint, const bool stall) noexcept
+	{
+		auto &epCtrl{usbCtrl.epCtrls[endpoint.endpoint() - 1U]};
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+		{
+			if (stall)
+				epCtrl.txStatusCtrlL |= txStatusCtrlLStall;
+			else
+				epCtrl.txStatusCtrlL &= uint8_t(~(txStatusCtrlLStall | vals::usb::epStatusCtrlLStalled));
+		}
+		else
+		{
+			if (stall)
+				epCtrl.rxStatusCtrlL |= rxStatusCtrlLStall;
+			else
+				epCtrl.rxStatusCtrlL &= uint8_t(~(rxStatusCtrlLStall | vals::usb::epStatusCtrlLStalled));
+		}
+	}
+
+	void internal::resetEPDataToggle(const usbEP_t endpoint) noexcept
+	{
+		auto &epCtrl{usbCtrl.epCtrls[endpoint.endpoint() - 1U]};
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+			epCtrl.txStatusCtrlL |= txStatusCtrlLClearDataToggle;
+		else
+			epCtrl.rxStatusCtrlL |= rxStatusCtrlLClearDataToggle;
+	}
+
+	void internal::setIRQMasked(const bool masked) noexcept
+	{
+		if (masked)
+			nvic.disableInterrupt(44);
+		else
+			nvic.enableInterrupt(44);
+	}
+
+	bool internal::busFrameNumber(uint16_t &frame) noexcept
+	{
+		// USBFRAME, which the register map doesn't name, sits at offset 0x00C from the controller's base
+		constexpr uintptr_t frameOffset{0x00CU};
+		const auto &frameReg{*reinterpret_cast<const volatile uint16_t *>(
+			reinterpret_cast<uintptr_t>(&usbCtrl) + frameOffset)};
+		frame = uint16_t(frameReg & 0x07FFU);
+		return true;
+	}
+
 	void flushWriteEP(const uint8_t endpoint) noexcept
 	{
 		if (endpoint != 0)
@@ -454,6 +550,7 @@ namespace usb::core
 		{
 			usbCtrl.intEnable |= vals::usb::itrEnableSuspend;
 			usbState = deviceState_t::powered;
+			trace::deviceState(usbState);
 		}
 
 		if (status & vals::usb::itrStatusResume)
@@ -465,6 +562,7 @@ namespace usb::core
 		{
 			reset();
 			usbState = deviceState_t::waiting;
+			trace::deviceState(usbState);
 			return;
 		}
 
@@ -477,13 +575,7 @@ namespace usb::core
 			return;
 
 		if (status & vals::usb::itrStatusSOF)
-		{
-			for (const auto &handler : sofHandlers)
-			{
-				if (handler)
-					handler();
-			}
-		}
+			handleSOF();
 		if (!rxStatus && !txStatus)
 			return;
 
@@ -1,7 +1,9 @@
 // SPDX-License-Identifier: BSD-3-Clause
+#include <algorithm>
 #include "usb/platform.hxx"
 #include "usb/internal/core.hxx"
 #include "usb/internal/device.hxx"
+#include "usb/trace.hxx"
 
 using namespace usb::constants;
 using namespace usb::types;
@@ -12,11 +14,91 @@ using namespace usb::device::internal;
 
 namespace usb::device
 {
-	void setupEndpoint(const usbEndpointDescriptor_t &endpoint, uint16_t &startAddress)
+	/*!
+	 * FIFO space is handed out once per configuration, each endpoint getting room for the largest packet size
+	 * any alternate setting gives it. This lets SET_INTERFACE reprogram an endpoint in place without moving
+	 * the FIFOs of endpoints belonging to other interfaces, which may have transfers in flight.
+	 */
+	static std::array<uint16_t, endpointCount> txFIFOAddress{};
+	static std::array<uint16_t, endpointCount> rxFIFOAddress{};
+
+	// Calls function with each non-control endpoint in the active configuration, and the interface
+	// and alternate setting it belongs to
+	template<typename function_t> static void forEachEndpoint(const function_t &function) noexcept
+	{
+		uint8_t interface{};
+		uint8_t alternate{};
+		const auto descriptors{configDescriptors[activeConfig - 1U]};
+		for (const auto &part : descriptors)
+		{
+			const auto *const descriptor{static_cast<const std::byte *>(part.descriptor)};
+			usbDescriptor_t type{usbDescriptor_t::invalid};
+			memcpy(&type, descriptor + 1, 1);
+			if (type == usbDescriptor_t::interface)
+			{
+				const auto interfaceDescriptor{*static_cast<const usbInterfaceDescriptor_t *>(part.descriptor)};
+				interface = interfaceDescriptor.interfaceNumber;
+				alternate = interfaceDescriptor.alternateSetting;
+			}
+			else if (type == usbDescriptor_t::endpoint)
+			{
+				const auto endpoint{*static_cast<const usbEndpointDescriptor_t *>(part.descriptor)};
+				if (endpoint.endpointType != usbEndpointType_t::control)
+					function(endpoint, interface, alternate);
+			}
+		}
+	}
+
+	static bool hasAlternate(const uint8_t interface, const uint8_t alternate) noexcept
 	{
-		if (endpoint.endpointType == usbEndpointType_t::control)
-			return;
+		const auto descriptors{configDescriptors[activeConfig - 1U]};
+		for (const auto &part : descriptors)
+		{
+			const auto *const descriptor{static_cast<const std::byte *>(part.descriptor)};
+			usbDescriptor_t type{usbDescriptor_t::invalid};
+			memcpy(&type, descriptor + 1, 1);
+			if (type != usbDescriptor_t::interface)
+				continue;
+			const auto interfaceDescriptor{*static_cast<const usbInterfaceDescriptor_t *>(part.descriptor)};
+			if (interfaceDescriptor.interfaceNumber == interface && interfaceDescriptor.alternateSetting == alternate)
+				return true;
+		}
+		return false;
+	}
+
+	static usbEP_t endpointFor(const usbEndpointDescriptor_t &endpoint) noexcept
+	{
+		return
+		{
+			uint8_t(endpoint.endpointAddress & vals::usb::endpointDirMask),
+			static_cast<endpointDir_t>(endpoint.endpointAddress & ~vals::usb::endpointDirMask)
+		};
+	}
+
+	static void allocateFIFOs() noexcept
+	{
+		std::array<uint16_t, endpointCount> txSize{};
+		std::array<uint16_t, endpointCount> rxSize{};
+		forEachEndpoint([&](const usbEndpointDescriptor_t &endpoint, const uint8_t, const uint8_t) noexcept
+		{
+			const auto ep{endpointFor(endpoint)};
+			auto &size{ep.dir() == endpointDir_t::controllerIn ? txSize[ep.endpoint()] : rxSize[ep.endpoint()]};
+			size = std::max(size, endpoint.maxPacketSize);
+		});
+
+		// EP0 consumes the first 256 bytes of USB RAM.
+		uint16_t startAddress{256};
+		for (uint8_t endpoint{1U}; endpoint < endpointCount; ++endpoint)
+		{
+			txFIFOAddress[endpoint] = startAddress;
+			startAddress += uint16_t(txSize[endpoint] * 2U);
+			rxFIFOAddress[endpoint] = startAddress;
+			startAddress += uint16_t(rxSize[endpoint] * 2U);
+		}
+	}
 
+	void setupEndpoint(const usbEndpointDescriptor_t &endpoint)
+	{
 		const auto direction{static_cast<endpointDir_t>(endpoint.endpointAddress & ~vals::usb::endpointDirMask)};
 		const auto endpointNumber{uint8_t(endpoint.endpointAddress & vals::usb::endpointDirMask)};
 		usbCtrl.epIndex = endpointNumber;
@@ -39,8 +121,12 @@ namespace usb::device
 			};
 			epCtrl.txStatusCtrlH = (epCtrl.txStatusCtrlH & vals::usb::epTxStatusCtrlHMask) | statusCtrlH;
 			epCtrl.txDataMax = endpoint.maxPacketSize;
+#ifdef USB_ISOCHRONOUS
+			isoPacketSizes[endpointNumber] =
+				endpoint.endpointType == usbEndpointType_t::isochronous ? endpoint.maxPacketSize : 0U;
+#endif
 			usbCtrl.txFIFOSize = vals::usb::fifoMapMaxSize(endpoint.maxPacketSize, vals::usb::fifoSizeDoubleBuffered);
-			usbCtrl.txFIFOAddr = vals::usb::fifoAddr(startAddress);
+			usbCtrl.txFIFOAddr = vals::usb::fifoAddr(txFIFOAddress[endpointNumber]);
 			usbCtrl.txIntEnable |= uint16_t(1U << endpointNumber);
 		}
 		else
@@ -49,10 +135,31 @@ namespace usb::device
 			epCtrl.rxStatusCtrlH = (epCtrl.rxStatusCtrlH & vals::usb::epRxStatusCtrlHMask);
 			epCtrl.rxDataMax = endpoint.maxPacketSize;
 			usbCtrl.rxFIFOSize = vals::usb::fifoMapMaxSize(endpoint.maxPacketSize, vals::usb::fifoSizeDoubleBuffered);
-			usbCtrl.rxFIFOAddr = vals::usb::fifoAddr(startAddress);
+			usbCtrl.rxFIFOAddr = vals::usb::fifoAddr(rxFIFOAddress[endpointNumber]);
 			usbCtrl.rxIntEnable |= uint16_t(1U << endpointNumber);
 		}
-		startAddress += uint16_t(endpoint.maxPacketSize * 2U);
+	}
+
+	static void teardownEndpoint(const usbEndpointDescriptor_t &endpoint) noexcept
+	{
+		const auto ep{endpointFor(endpoint)};
+		const auto endpointNumber{ep.endpoint()};
+		usb::core::deinitHandler(ep);
+		auto &epCtrl{usbCtrl.epCtrls[endpointNumber - 1U]};
+		if (ep.dir() == endpointDir_t::controllerIn)
+		{
+			usbCtrl.txIntEnable &= uint16_t(~(1U << endpointNumber));
+			flushWriteEP(endpointNumber);
+		}
+		else
+		{
+			usbCtrl.rxIntEnable &= uint16_t(~(1U << endpointNumber));
+			// Drop anything still sitting in either half of the double buffered FIFO
+			while (epCtrl.rxStatusCtrlL & vals::usb::epStatusCtrlLRxReady)
+				epCtrl.rxStatusCtrlL &= uint8_t(~vals::usb::epStatusCtrlLRxReady);
+		}
+		setEPStall(ep, false);
+		usb::core::common::resetEP(ep);
 	}
 
 	namespace internal
@@ -68,31 +175,54 @@ namespace usb::device
 			activeConfig = config;
 
 			if (activeConfig == 0)
+			{
 				usbState = deviceState_t::addressed;
+				trace::deviceState(usbState);
+			}
 			else
 			{
-				// EP0 consumes the first 256 bytes of USB RAM.
-				uint16_t startAddress{256};
 				usbCtrl.txIntEnable &= vals::usb::txItrEnableMask;
 				usbCtrl.rxIntEnable &= vals::usb::rxItrEnableMask;
 				usbCtrl.txIntEnable |= vals::usb::txItrEnableEP0;
 
-				const auto descriptors{configDescriptors[activeConfig - 1U]};
-				for (const auto &part : descriptors)
+				allocateFIFOs();
+				// Only the default alternate settings' endpoints come up, SET_INTERFACE handles the rest
+				forEachEndpoint([](const usbEndpointDescriptor_t &endpoint, const uint8_t, const uint8_t alternate)
 				{
-					const auto *const descriptor{static_cast<const std::byte *>(part.descriptor)};
-					usbDescriptor_t type{usbDescriptor_t::invalid};
-					memcpy(&type, descriptor + 1, 1);
-					if (type == usbDescriptor_t::endpoint)
-					{
-						const auto endpoint{*static_cast<const usbEndpointDescriptor_t *>(part.descriptor)};
-						setupEndpoint(endpoint, startAddress);
-					}
-				}
-				usb::core::initHandlers();
+					if (alternate != 0U)
+						return;
+					setupEndpoint(endpoint);
+					usb::core::initHandler(endpointFor(endpoint));
+				});
 			}
 			return true;
 		}
+
+		bool handleSetInterface() noexcept
+		{
+			const auto interface{uint8_t(packet.index)};
+			const auto current{alternateModes[activeConfig - 1U][interface]};
+			const auto requested{uint8_t(packet.value)};
+
+			if (!hasAlternate(interface, requested))
+				return false;
+
+			forEachEndpoint([&](const usbEndpointDescriptor_t &endpoint, const uint8_t owner, const uint8_t alternate)
+			{
+				if (owner == interface && alternate == current)
+					teardownEndpoint(endpoint);
+			});
+			forEachEndpoint([&](const usbEndpointDescriptor_t &endpoint, const uint8_t owner, const uint8_t alternate)
+			{
+				if (owner != interface || alternate != requested)
+					return;
+				const auto ep{endpointFor(endpoint)};
+				setupEndpoint(endpoint);
+				resetEPDataToggle(ep);
+				usb::core::initHandler(ep);
+			});
+			return true;
+		}
 	} // namespace internal
 
 	void handleControlPacket() noexcept
@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: BSD-3-Clause
+#include "usb/core.hxx"
+#include "usb/trace.hxx"
+
+namespace usb::trace
+{
+	ring_t ring{ringMagic, traceEntries, 0U, {}};
+	static uint16_t tail{};
+	static uint16_t droppedCount{};
+
+	constexpr static uint16_t entryMask{traceEntries - 1U};
+
+	void record(const event_t event, const uint8_t endpoint, const uint16_t payload) noexcept
+	{
+		// We are the only writer, so there is nothing to contend with - fill the record then publish it
+		const uint16_t head{ring.head};
+		ring.records[head & entryMask] = {usb::core::timestamp(), event, endpoint, payload};
+		__atomic_signal_fence(__ATOMIC_RELEASE);
+		ring.head = uint16_t(head + 1U);
+	}
+
+	/*!
+	 * The head index may be wider than the machine word, so re-read it till we get a stable
+	 * value - the writer only ever moves it forward so this terminates as soon as it isn't
+	 * interrupted by a write part way through.
+	 */
+	static uint16_t currentHead() noexcept
+	{
+		uint16_t head{ring.head};
+		while (true)
+		{
+			const uint16_t check{ring.head};
+			if (check == head)
+				return head;
+			head = check;
+		}
+	}
+
+	bool read(record_t &record) noexcept
+	{
+		while (true)
+		{
+			const auto head{currentHead()};
+			if (head == tail)
+				return false;
+			// If the writer has lapped us, skip forward to the oldest record still in the ring
+			if (uint16_t(head - tail) > traceEntries)
+			{
+				droppedCount = uint16_t(droppedCount + uint16_t(head - tail) - traceEntries);
+				tail = uint16_t(head - traceEntries);
+			}
+			__atomic_signal_fence(__ATOMIC_ACQUIRE);
+			record = ring.records[tail & entryMask];
+			__atomic_signal_fence(__ATOMIC_ACQUIRE);
+			// If the writer got to this slot while we were copying it out, the copy is torn - try again
+			if (uint16_t(currentHead() - tail) > traceEntries)
+				continue;
+			++tail;
+			return true;
+		}
+	}
+
+	uint16_t dropped() noexcept { return droppedCount; }
+} // namespace usb::trace
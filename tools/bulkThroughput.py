@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+from argparse import ArgumentParser
+from sys import exit, stderr
+from threading import Thread, Event
+from time import monotonic
+
+try:
+	import usb.core
+	import usb.util
+except ImportError:
+	print('Error: this tool needs pyusb (and libusb) installed', file = stderr)
+	exit(1)
+
+parser = ArgumentParser(
+	description = 'Measures sustained bulk throughput against a device running dragonUSB\'s vendor-bulk driver. ' +
+		'The device firmware must keep the stream fed (IN) and drained (OUT) for the numbers to be meaningful',
+	allow_abbrev = False
+)
+parser.add_argument('--vid', type = lambda value: int(value, 16), required = True, help = 'Vendor ID of the device, in hex')
+parser.add_argument('--pid', type = lambda value: int(value, 16), required = True, help = 'Product ID of the device, in hex')
+parser.add_argument('--interface', type = int, default = 0, help = 'Interface number the stream is registered against')
+parser.add_argument('--in-ep', type = int, default = None, dest = 'inEndpoint',
+	help = 'Number of the stream\'s bulk IN endpoint, to measure device to host throughput')
+parser.add_argument('--out-ep', type = int, default = None, dest = 'outEndpoint',
+	help = 'Number of the stream\'s bulk OUT endpoint, to measure host to device throughput')
+parser.add_argument('--size', type = int, default = 16384, help = 'How many bytes to move per transfer')
+parser.add_argument('--seconds', type = float, default = 10.0, help = 'How long to run the test for')
+parser.add_argument('--timeout', type = int, default = 1000, help = 'Per-transfer timeout in milliseconds')
+args = parser.parse_args()
+
+if args.inEndpoint is None and args.outEndpoint is None:
+	parser.error('at least one of --in-ep and --out-ep must be given')
+
+class Counter:
+	def __init__(self, name):
+		self.name = name
+		self.bytes = 0
+		self.errors = 0
+
+def runIn(device, counter, stop):
+	endpoint = 0x80 | args.inEndpoint
+	buffer = usb.util.create_buffer(args.size)
+	while not stop.is_set():
+		try:
+			counter.bytes += device.read(endpoint, buffer, args.timeout)
+		except usb.core.USBTimeoutError:
+			counter.errors += 1
+
+def runOut(device, counter, stop):
+	endpoint = args.outEndpoint
+	data = bytes(range(256)) * (args.size // 256) + bytes(range(args.size % 256))
+	while not stop.is_set():
+		try:
+			counter.bytes += device.write(endpoint, data, args.timeout)
+		except usb.core.USBTimeoutError:
+			counter.errors += 1
+
+def formatRate(count, seconds):
+	return f'{count / seconds / 1000:9.1f}kB/s'
+
+device = usb.core.find(idVendor = args.vid, idProduct = args.pid)
+if device is None:
+	print(f'Error: could not find device {args.vid:04x}:{args.pid:04x}', file = stderr)
+	exit(1)
+
+try:
+	if device.is_kernel_driver_active(args.interface):
+		device.detach_kernel_driver(args.interface)
+except (NotImplementedError, usb.core.USBError):
+	pass
+usb.util.claim_interface(device, args.interface)
+
+stop = Event()
+counters = []
+threads = []
+if args.inEndpoint is not None:
+	counters.append(Counter('IN'))
+	threads.append(Thread(target = runIn, args = (device, counters[-1], stop), daemon = True))
+if args.outEndpoint is not None:
+	counters.append(Counter('OUT'))
+	threads.append(Thread(target = runOut, args = (device, counters[-1], stop), daemon = True))
+
+start = monotonic()
+for thread in threads:
+	thread.start()
+
+try:
+	lastTime = start
+	lastBytes = [0] * len(counters)
+	while monotonic() - start < args.seconds:
+		stop.wait(1.0)
+		now = monotonic()
+		rates = []
+		for index, counter in enumerate(counters):
+			count = counter.bytes
+			rates.append(f'{counter.name} {formatRate(count - lastBytes[index], now - lastTime)}')
+			lastBytes[index] = count
+		lastTime = now
+		print(f'{now - start:6.1f}s ' + '  '.join(rates))
+except KeyboardInterrupt:
+	pass
+
+stop.set()
+for thread in threads:
+	thread.join()
+elapsed = monotonic() - start
+usb.util.release_interface(device, args.interface)
+
+print('Totals:')
+for counter in counters:
+	print(f'{counter.name:>4} {counter.bytes:>12} bytes {formatRate(counter.bytes, elapsed)} ' +
+		f'({counter.errors} timeouts)')
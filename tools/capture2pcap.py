@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+from argparse import ArgumentParser
+from pathlib import Path
+from struct import Struct
+from sys import exit, stderr
+
+parser = ArgumentParser(
+	description = 'Converts a binary dump of dragonUSB\'s packet capture buffer (usb::capture::buffer) into a ' +
+		'usbmon (DLT_USB_LINUX_MMAPPED) pcap that Wireshark can read',
+	allow_abbrev = False
+)
+parser.add_argument('dump', type = Path, metavar = 'dumpFile',
+	help = 'Binary dump of usb::capture::buffer, eg from gdb\'s `dump binary value capture.bin usb::capture::buffer`')
+parser.add_argument('pcap', type = Path, metavar = 'pcapFile', help = 'Where to write the resulting pcap')
+parser.add_argument('--bus', type = int, default = 1, help = 'USB bus number to report the packets on')
+parser.add_argument('--device', type = int, default = 1,
+	help = 'Device address to report the packets against, use the host\'s to line up with a host capture')
+parser.add_argument('--offset', type = float, default = 0.0,
+	help = 'Seconds to add to the device timestamps to align them with a host capture')
+parser.add_argument('--endpoint-type', action = 'append', default = [], metavar = 'EP=TYPE', dest = 'endpointTypes',
+	help = 'Transfer type of a non-control endpoint, one of bulk, interrupt or isochronous (defaults to bulk)')
+args = parser.parse_args()
+
+bufferHeader = Struct('<IHHHH')
+recordHeader = Struct('<IBBH')
+bufferMagic = 0x50414355
+
+pcapHeader = Struct('<IHHiIII')
+pcapRecord = Struct('<IIII')
+usbmonHeader = Struct('<QBBBBHbbqiiII8siiII')
+linkTypeUSBLinuxMMapped = 220
+
+# These must be kept in sync with usb::capture::kind_t and usb::capture::kindNoData
+kindSetup = 0
+kindControllerOut = 1
+kindControllerIn = 2
+kindNoData = 0x80
+
+transferTypes = {'isochronous': 0, 'interrupt': 1, 'control': 2, 'bulk': 3}
+
+def parseEndpointTypes():
+	types = {0: transferTypes['control']}
+	for mapping in args.endpointTypes:
+		endpoint, _, kind = mapping.partition('=')
+		if kind not in transferTypes or not endpoint.isdigit():
+			raise ValueError(f'invalid endpoint type mapping \'{mapping}\'')
+		types[int(endpoint)] = transferTypes[kind]
+	return types
+
+def readRecords(data):
+	if len(data) < bufferHeader.size:
+		raise ValueError('dump is too short to contain a capture buffer')
+	magic, size, prefixLength, used, dropped = bufferHeader.unpack_from(data, 0)
+	if magic != bufferMagic:
+		raise ValueError(f'bad capture buffer magic {magic:#010x}, is this really a dump of usb::capture::buffer?')
+	if used > size or len(data) < bufferHeader.size + used:
+		raise ValueError('dump is truncated or corrupt')
+	if dropped:
+		print(f'Warning: {dropped} packets were dropped as the capture buffer filled', file = stderr)
+
+	offset = bufferHeader.size
+	end = offset + used
+	while offset < end:
+		timestamp, endpoint, kind, length = recordHeader.unpack_from(data, offset)
+		offset += recordHeader.size
+		captured = 0 if kind & kindNoData else min(length, prefixLength)
+		kind &= ~kindNoData
+		if offset + captured > end:
+			raise ValueError('capture buffer contains a truncated record')
+		payload = data[offset:offset + captured]
+		offset += captured
+		yield timestamp, endpoint, kind, length, payload
+
+def unwrapTimestamps(records):
+	# The device timestamps are a free-running 32-bit microsecond counter, so undo the wrapping
+	epoch = 0
+	lastTimestamp = None
+	for timestamp, *rest in records:
+		if lastTimestamp is not None and timestamp < lastTimestamp:
+			epoch += 1 << 32
+		lastTimestamp = timestamp
+		yield (epoch + timestamp, *rest)
+
+def makePacket(urbID, microseconds, endpoint, kind, length, payload, endpointTypes):
+	number = endpoint & 0x0F
+	transferType = endpointTypes.get(number, transferTypes['bulk'])
+	seconds, micros = divmod(int(args.offset * 1000000) + microseconds, 1000000)
+	if kind == kindSetup:
+		# Setup packets become URB submissions on EP0 in whichever direction the request is for
+		setup = bytes(payload[:8]).ljust(8, b'\0')
+		direction = setup[0] & 0x80
+		requestLength = int.from_bytes(setup[6:8], 'little')
+		header = usbmonHeader.pack(urbID, ord('S'), transferType, direction, args.device, args.bus, 0, ord('<'),
+			seconds, micros, -115, requestLength, 0, setup, 0, 0, 0, 0)
+		return header
+	elif kind == kindControllerOut:
+		# Data the host sent us shows up in its URB submissions
+		eventType = ord('S')
+		direction = 0x00
+	else:
+		# Data we sent the host shows up in its URB completions
+		eventType = ord('C')
+		direction = 0x80
+	flagData = 0 if payload else ord('>' if eventType == ord('S') else '<')
+	header = usbmonHeader.pack(urbID, eventType, transferType, direction | number, args.device, args.bus,
+		ord('-'), flagData, seconds, micros, 0, length, len(payload), bytes(8), 0, 0, 0, 0)
+	return header + bytes(payload)
+
+try:
+	endpointTypes = parseEndpointTypes()
+	records = list(unwrapTimestamps(readRecords(args.dump.read_bytes())))
+except (OSError, ValueError) as error:
+	print(f'Error: {error}', file = stderr)
+	exit(1)
+
+with args.pcap.open('wb') as file:
+	file.write(pcapHeader.pack(0xA1B2C3D4, 2, 4, 0, 0, 65535, linkTypeUSBLinuxMMapped))
+	for urbID, (timestamp, endpoint, kind, length, payload) in enumerate(records, start = 1):
+		packet = makePacket(urbID, timestamp, endpoint, kind, length, payload, endpointTypes)
+		seconds, micros = divmod(int(args.offset * 1000000) + timestamp, 1000000)
+		file.write(pcapRecord.pack(seconds, micros, len(packet), len(packet)))
+		file.write(packet)
+print(f'Wrote {len(records)} packets to {args.pcap}')
@@ -0,0 +1,300 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/*
+ * Host side harness for dfuBench.py, which builds it once per Flash geometry being measured. It runs
+ * the DFU driver against a simulated host doing what dfu-util does (DNLOAD, then GETSTATUS till the
+ * device is ready for more, sleeping for bwPollTimeout while it's busy) and a simulated Flash with
+ * fixed erase and write latencies, all on a virtual microsecond clock.
+ *
+ * Usage: dfuBench eraseLatency writeLatency controlRate completionIRQ size...
+ * Latencies are in microseconds (writeLatency per flashBufferSize chunk), controlRate is how many
+ * bytes of control transfer data the bus moves per frame, and completionIRQ is 1 to have the Flash
+ * completion call flashReady() rather than leaving the driver to notice at SOF. One line of JSON is
+ * printed per image size.
+ */
+#include <array>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "../src/drivers/dfu.cxx"
+
+using usb::types::answer_t;
+using usb::types::response_t;
+
+namespace usb::core
+{
+	std::array<usb::types::usbEPStatus_t<const void>, endpointCount> epStatusControllerIn{};
+	std::array<usb::types::usbEPStatus_t<void>, endpointCount> epStatusControllerOut{};
+	static sofHandler_t sofHandler{nullptr};
+} // namespace usb::core
+
+namespace usb::device
+{
+	usb::types::setupPacket_t packet{};
+	callback_t setupCallback{nullptr};
+	static controlHandler_t controlHandler{nullptr};
+	static altModeHandler_t altModeHandler{nullptr};
+} // namespace usb::device
+
+namespace bench
+{
+	constexpr static uint32_t frameLength{1000U};
+
+	static uint64_t now{};
+	static uint32_t eraseLatency{};
+	static uint32_t writeLatency{};
+	static uint32_t controlRate{};
+	static bool completionIRQ{};
+
+	static std::vector<uint8_t> flash{};
+	static uint64_t lastFrame{};
+	static uint64_t busyUntil{};
+	static bool operationPending{};
+	// When the Flash last went idle, and when it was last given something to do after going idle
+	static uint64_t idleSince{};
+	static uint64_t workSince{};
+
+	struct results_t final
+	{
+		uint64_t busTime;
+		uint64_t pollTime;
+		uint64_t pollLost;
+		uint64_t frameWait;
+		uint32_t requests;
+		uint32_t polls;
+		uint32_t erases;
+		uint32_t writes;
+	};
+	static results_t results{};
+
+	static void operationStarted(const uint32_t latency) noexcept
+	{
+		// Time the Flash sat idle with work waiting for the driver to get round to issuing it
+		const auto readyAt{std::max(idleSince, workSince)};
+		if (now > readyAt)
+			results.frameWait += now - readyAt;
+		busyUntil = now + latency;
+		operationPending = true;
+	}
+
+	static bool operationComplete() noexcept
+	{
+		if (!operationPending || now < busyUntil)
+			return false;
+		operationPending = false;
+		idleSince = busyUntil;
+		return true;
+	}
+
+	/*!
+	 * Advances the clock, delivering SOFs and (optionally) Flash completion interrupts on the way. Time
+	 * the driver spends polling Flash moves the clock on without delivering anything, so an SOF that
+	 * comes due then is taken late, once the driver returns, as the interrupt controller would.
+	 */
+	static void advance(const uint64_t time) noexcept
+	{
+		const auto target{now + time};
+		while (now < target)
+		{
+			auto next{std::min(target, (now / frameLength + 1U) * frameLength)};
+			if (operationPending && busyUntil > now && busyUntil < next)
+				next = busyUntil;
+			now = next;
+			if (operationComplete() && completionIRQ)
+				usb::dfu::flashReady();
+			if (now / frameLength != lastFrame)
+			{
+				lastFrame = now / frameLength;
+				if (usb::core::sofHandler)
+					usb::core::sofHandler();
+			}
+		}
+	}
+
+	static void setup(const uint8_t requestType, const uint8_t request, const uint16_t value, const uint16_t length)
+	{
+		const std::array<uint8_t, 8> data
+		{
+			requestType, request, uint8_t(value), uint8_t(value >> 8U), 0U, 0U,
+			uint8_t(length), uint8_t(length >> 8U)
+		};
+		std::memcpy(&usb::device::packet, data.data(), data.size());
+		usb::device::setupCallback = nullptr;
+	}
+
+	// Control transfers start on a frame boundary and then move controlRate bytes a frame
+	static uint64_t transferTime(const uint16_t length) noexcept
+	{
+		const auto start{(now + frameLength - 1U) / frameLength * frameLength};
+		return start - now + uint64_t{length} * frameLength / controlRate + 1U;
+	}
+
+	static answer_t request(const uint8_t requestType, const uint8_t request, const uint16_t value,
+		const uint8_t *const data, const uint16_t length)
+	{
+		setup(requestType, request, value, length);
+		const auto answer{usb::device::controlHandler(0U)};
+		const auto time{transferTime(length)};
+		results.busTime += uint64_t{length} * frameLength / controlRate;
+		++results.requests;
+		advance(time);
+		if (data && std::get<0>(answer) != response_t::stall)
+		{
+			std::memcpy(usb::core::epStatusControllerOut[0].memBuffer, data, length);
+			if (usb::device::setupCallback)
+				usb::device::setupCallback();
+		}
+		return answer;
+	}
+
+	static usb::dfu::types::dfuState_t getStatus()
+	{
+		const auto answer{request(0xA1U, uint8_t(usb::dfu::types::request_t::getStatus), 0U, nullptr, 6U)};
+		const auto &status{*static_cast<const usb::dfu::types::config_t *>(std::get<1>(answer))};
+		++results.polls;
+		const auto timeout{uint32_t(status.pollTimeout[0] | (status.pollTimeout[1] << 8U) |
+			(status.pollTimeout[2] << 16U))};
+		const auto state{status.state};
+		const auto sleepStart{now};
+		// Find out when, during the sleep, the device could have taken the next block
+		uint64_t readyAt{};
+		const auto sleepEnd{now + uint64_t{timeout} * frameLength};
+		while (now < sleepEnd)
+		{
+			if (!readyAt && state == usb::dfu::types::dfuState_t::downloadBusy && usb::dfu::readyForBlock())
+				readyAt = now;
+			advance(std::min<uint64_t>(frameLength / 10U, sleepEnd - now));
+		}
+		results.pollTime += now - sleepStart;
+		if (readyAt)
+			results.pollLost += now - readyAt;
+		return state;
+	}
+
+	static bool download(const std::vector<uint8_t> &image)
+	{
+		using usb::dfu::types::dfuState_t;
+		uint16_t block{};
+		for (std::size_t offset{}; offset < image.size(); offset += usb::dfu::flashPageSize, ++block)
+		{
+			const auto length{uint16_t(std::min(usb::dfu::flashPageSize, image.size() - offset))};
+			const auto flashStarved{!usb::dfu::blocksPending && !operationPending};
+			if (std::get<0>(request(0x21U, uint8_t(usb::dfu::types::request_t::download), block,
+					image.data() + offset, length)) == response_t::stall)
+				return false;
+			if (flashStarved)
+				workSince = now;
+			while (true)
+			{
+				const auto state{getStatus()};
+				if (state == dfuState_t::downloadIdle)
+					break;
+				else if (state != dfuState_t::downloadBusy && state != dfuState_t::downloadSync)
+					return false;
+			}
+		}
+		request(0x21U, uint8_t(usb::dfu::types::request_t::download), block, nullptr, 0U);
+		while (true)
+		{
+			const auto state{getStatus()};
+			if (state == dfuState_t::dfuIdle)
+				return true;
+			else if (state != dfuState_t::manifest && state != dfuState_t::manifestSync)
+				return false;
+		}
+	}
+
+	static void run(const std::size_t size)
+	{
+		flash.assign(size + usb::dfu::flashEraseSize, 0xFFU);
+		const auto base{reinterpret_cast<std::uintptr_t>(flash.data())};
+		const std::array<usb::dfu::zone_t, 1> zones{{{base, base + flash.size()}}};
+		usb::dfu::registerHandlers(zones, 0U, 1U);
+
+		std::vector<uint8_t> image(size);
+		for (std::size_t i{}; i < size; ++i)
+			image[i] = uint8_t((i * 7U) ^ (i >> 8U));
+
+		now = 0U;
+		lastFrame = 0U;
+		busyUntil = 0U;
+		operationPending = false;
+		idleSince = 0U;
+		workSince = 0U;
+		results = {};
+		setup(0x01U, 11U, 0U, 0U);
+		usb::device::altModeHandler();
+		const auto ok{download(image) && !std::memcmp(flash.data(), image.data(), size)};
+
+		std::printf("{\"size\": %zu, \"ok\": %s, \"time\": %llu, \"busTime\": %llu, \"pollTime\": %llu, "
+			"\"pollLost\": %llu, \"frameWait\": %llu, \"requests\": %u, \"polls\": %u, \"erases\": %u, "
+			"\"writes\": %u}\n", size, ok ? "true" : "false", static_cast<unsigned long long>(now),
+			static_cast<unsigned long long>(results.busTime), static_cast<unsigned long long>(results.pollTime),
+			static_cast<unsigned long long>(results.pollLost), static_cast<unsigned long long>(results.frameWait),
+			results.requests, results.polls, results.erases, results.writes);
+	}
+} // namespace bench
+
+namespace usb::core
+{
+	void registerSOFHandler(uint16_t, const sofHandler_t handler) noexcept { sofHandler = handler; }
+	void unregsiterSOFHandler(uint16_t) noexcept { sofHandler = nullptr; }
+	uint16_t frameNumber() noexcept { return uint16_t((bench::now / bench::frameLength) & 0x07FFU); }
+	uint32_t timestamp() noexcept { return uint32_t(bench::now); }
+	void detach() noexcept { }
+} // namespace usb::core
+
+namespace usb::device
+{
+	void registerHandler(uint8_t, uint8_t, const controlHandler_t handler) noexcept { controlHandler = handler; }
+	void registerAltModeHandler(uint8_t, uint8_t, const altModeHandler_t handler) noexcept
+		{ altModeHandler = handler; }
+} // namespace usb::device
+
+namespace usb::dfu
+{
+	void reboot() noexcept { std::abort(); }
+
+	void erase(const std::uintptr_t address) noexcept
+	{
+		bench::operationStarted(bench::eraseLatency);
+		++bench::results.erases;
+		std::memset(reinterpret_cast<void *>(address), 0xFF, flashEraseSize);
+	}
+
+	void write(const std::uintptr_t address, const std::size_t count, const uint8_t *const buffer) noexcept
+	{
+		bench::operationStarted(uint32_t(uint64_t{bench::writeLatency} * count / flashBufferSize));
+		++bench::results.writes;
+		std::memcpy(reinterpret_cast<void *>(address), buffer, count);
+	}
+
+	// Polling the Flash controller isn't free: each look costs a microsecond
+	bool flashBusy() noexcept
+	{
+		if (!bench::operationPending)
+			return false;
+		++bench::now;
+		bench::operationComplete();
+		return bench::operationPending;
+	}
+} // namespace usb::dfu
+
+int main(int argc, char **argv)
+{
+	if (argc < 6)
+	{
+		std::fprintf(stderr, "Usage: %s eraseLatency writeLatency controlRate completionIRQ size...\n", argv[0]);
+		return 2;
+	}
+	bench::eraseLatency = uint32_t(std::strtoul(argv[1], nullptr, 10));
+	bench::writeLatency = uint32_t(std::strtoul(argv[2], nullptr, 10));
+	bench::controlRate = uint32_t(std::strtoul(argv[3], nullptr, 10));
+	bench::completionIRQ = std::strtoul(argv[4], nullptr, 10) != 0U;
+	if (!bench::controlRate)
+		return 2;
+	for (int arg{5}; arg < argc; ++arg)
+		bench::run(std::strtoul(argv[arg], nullptr, 10));
+	return 0;
+}
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+from argparse import ArgumentParser
+from itertools import product
+from json import loads, dump, load
+from pathlib import Path
+from subprocess import run, PIPE
+from sys import exit, stderr
+from tempfile import TemporaryDirectory
+
+toolsDir = Path(__file__).resolve().parent
+rootDir = toolsDir.parent
+
+parser = ArgumentParser(
+	description = 'Measures end to end DFU update time by running dragonUSB\'s DFU driver on the host against a ' +
+		'simulated dfu-util and a simulated Flash. The driver is built once per Flash geometry in the sweep',
+	allow_abbrev = False
+)
+parser.add_argument('--sizes', type = int, nargs = '+', default = [16384, 65536, 262144],
+	help = 'Image sizes, in bytes, to time the download of')
+parser.add_argument('--page-sizes', type = int, nargs = '+', default = [1024], dest = 'pageSizes',
+	help = 'dfuFlashPageSize values to sweep, which is also the DNLOAD block size used')
+parser.add_argument('--buffer-sizes', type = int, nargs = '+', default = [256], dest = 'bufferSizes',
+	help = 'dfuFlashBufferSize values to sweep')
+parser.add_argument('--erase-sizes', type = int, nargs = '+', default = [1024], dest = 'eraseSizes',
+	help = 'dfuFlashEraseSize values to sweep')
+parser.add_argument('--download-buffers', type = int, nargs = '+', default = [2], dest = 'downloadBuffers',
+	help = 'dfuDownloadBuffers values to sweep')
+parser.add_argument('--flash-budget', type = int, default = 0, dest = 'flashBudget',
+	help = 'dfuFlashBudget, in microseconds')
+parser.add_argument('--erase-latency', type = int, default = 20000, dest = 'eraseLatency',
+	help = 'How long the simulated Flash takes to erase an erase unit, in microseconds')
+parser.add_argument('--write-latency', type = int, default = 2000, dest = 'writeLatency',
+	help = 'How long the simulated Flash takes to write a flashBufferSize chunk, in microseconds')
+parser.add_argument('--control-rate', type = int, default = 1024, dest = 'controlRate',
+	help = 'How many bytes of control transfer data the bus moves per 1ms frame')
+parser.add_argument('--completion-irq', action = 'store_true', dest = 'completionIRQ',
+	help = 'Have the Flash completion interrupt call flashReady() rather than waiting on SOF')
+parser.add_argument('--substrate', type = Path, default = rootDir / 'deps' / 'substrate',
+	help = 'Where the substrate subproject is (see `meson subprojects download`)')
+parser.add_argument('--cxx', default = 'c++', help = 'Host C++ compiler to build the harness with')
+parser.add_argument('--save', type = Path, default = None, help = 'Write the results out as JSON to this file')
+parser.add_argument('--baseline', type = Path, default = None,
+	help = 'Compare against results previously saved with --save, failing if any update got slower')
+parser.add_argument('--tolerance', type = float, default = 2.0,
+	help = 'How many percent slower than the baseline an update may be before it counts as a regression')
+args = parser.parse_args()
+
+# The driver doesn't touch the platform, so the platform headers it pulls in can be left empty
+platformHeaders = ('platform.hxx', 'constants.hxx')
+
+def build(buildDir, pageSize, bufferSize, eraseSize, downloadBuffers):
+	binary = buildDir / f'dfuBench-{pageSize}-{bufferSize}-{eraseSize}-{downloadBuffers}'
+	command = [
+		args.cxx, '-std=c++17', '-O2', '-o', str(binary), str(toolsDir / 'dfuBench.cxx'),
+		f'-I{rootDir / "include"}', f'-I{buildDir}', f'-I{args.substrate}',
+		'-DTM4C123GH6PM', '-DUSB_INTERFACES=1', '-DUSB_ENDPOINTS=1', '-DUSB_BUFFER_SIZE=64',
+		'-DUSB_CONFIG_DESCRIPTORS=1', '-DUSB_INTERFACE_DESCRIPTORS=1', '-DUSB_ENDPOINT_DESCRIPTORS=1',
+		'-DUSB_STRINGS=1',
+		f'-DUSB_DFU_FLASH_PAGE_SIZE={pageSize}',
+		f'-DUSB_DFU_FLASH_BUFFER_SIZE={bufferSize}',
+		f'-DUSB_DFU_FLASH_ERASE_SIZE={eraseSize}',
+		f'-DUSB_DFU_DOWNLOAD_BUFFERS={downloadBuffers}',
+		f'-DUSB_DFU_FLASH_BUDGET={args.flashBudget}',
+	]
+	result = run(command, stdout = PIPE, stderr = PIPE, text = True)
+	if result.returncode != 0:
+		print(f'Error: failed to build the harness for page {pageSize}, buffer {bufferSize}, erase {eraseSize}',
+			file = stderr)
+		print(result.stderr, file = stderr)
+		return None
+	return binary
+
+def measure(binary):
+	command = [
+		str(binary), str(args.eraseLatency), str(args.writeLatency), str(args.controlRate),
+		'1' if args.completionIRQ else '0'
+	] + [str(size) for size in args.sizes]
+	result = run(command, stdout = PIPE, text = True, check = True)
+	return [loads(line) for line in result.stdout.splitlines()]
+
+def configName(result):
+	return f'{result["pageSize"]}/{result["bufferSize"]}/{result["eraseSize"]}x{result["downloadBuffers"]}'
+
+def milliseconds(microseconds):
+	return f'{microseconds / 1000:9.1f}'
+
+results = []
+with TemporaryDirectory() as buildDir:
+	buildDir = Path(buildDir)
+	(buildDir / 'tm4c123gh6pm').mkdir()
+	for header in platformHeaders:
+		(buildDir / 'tm4c123gh6pm' / header).touch()
+
+	sweep = product(args.pageSizes, args.bufferSizes, args.eraseSizes, args.downloadBuffers)
+	for pageSize, bufferSize, eraseSize, downloadBuffers in sweep:
+		binary = build(buildDir, pageSize, bufferSize, eraseSize, downloadBuffers)
+		if binary is None:
+			exit(1)
+		for result in measure(binary):
+			result.update(pageSize = pageSize, bufferSize = bufferSize, eraseSize = eraseSize,
+				downloadBuffers = downloadBuffers)
+			results.append(result)
+
+print(f'{"page/buffer/erase":>20} {"size":>8} {"total ms":>9} {"kB/s":>7} {"bus %":>6} {"poll ms":>9} ' +
+	f'{"lost ms":>9} {"frame ms":>9} {"polls":>6}')
+failed = False
+for result in results:
+	time = result['time']
+	print(f'{configName(result):>20} {result["size"]:>8} {milliseconds(time)} ' +
+		f'{result["size"] / time * 1000:7.1f} {result["busTime"] / time * 100:6.1f} ' +
+		f'{milliseconds(result["pollTime"])} {milliseconds(result["pollLost"])} ' +
+		f'{milliseconds(result["frameWait"])} {result["polls"]:>6}' + ('' if result['ok'] else '  FAILED'))
+	failed |= not result['ok']
+
+if args.save is not None:
+	with args.save.open('w') as file:
+		dump({'settings': vars(args) | {'substrate': None, 'save': None, 'baseline': None}, 'results': results},
+			file, indent = '\t')
+
+if args.baseline is not None:
+	with args.baseline.open('r') as file:
+		baseline = {(configName(result), result['size']): result for result in load(file)['results']}
+	for result in results:
+		previous = baseline.get((configName(result), result['size']))
+		if previous is None:
+			continue
+		change = (result['time'] - previous['time']) / previous['time'] * 100
+		if change > args.tolerance:
+			print(f'Regression: {configName(result)} size {result["size"]} took {change:.1f}% longer ' +
+				f'({milliseconds(previous["time"]).strip()}ms -> {milliseconds(result["time"]).strip()}ms)')
+			failed = True
+
+exit(1 if failed else 0)
@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+from argparse import ArgumentParser
+from json import loads, dump, load
+from pathlib import Path
+from subprocess import run, PIPE
+from sys import exit, stderr
+from tempfile import TemporaryDirectory
+
+toolsDir = Path(__file__).resolve().parent
+rootDir = toolsDir.parent
+crossFilesDir = rootDir / 'cross-files'
+
+chips = ('tm4c123gh6pm', 'stm32f1', 'stm32h7', 'atxmega256a3u')
+
+parser = ArgumentParser(
+	description = 'Cross-builds dragonUSB for each chip through the files in cross-files/ and reports its size ' +
+		'only: the .text, .data and .bss of every object file, along with the code size of the functions given. ' +
+		'Nothing is run, so this doesn\'t measure cycle counts or any other run time cost',
+	allow_abbrev = False
+)
+parser.add_argument('--chips', nargs = '+', default = list(chips), choices = chips, help = 'Which chips to build for')
+parser.add_argument('--avr-toolchain', default = 'system', choices = ['system', 'cxc'], dest = 'avrToolchain',
+	help = 'Which of the avr-*.meson toolchain cross-files to layer under avr.meson')
+parser.add_argument('--interfaces', type = int, default = 2, help = 'The reference build\'s interfaces option')
+parser.add_argument('--endpoints', type = int, default = 3, help = 'The reference build\'s endpoints option')
+parser.add_argument('--drivers', nargs = '*', default = ['cdc-acm'], help = 'The reference build\'s drivers option')
+parser.add_argument('--option', action = 'append', default = [], dest = 'options', metavar = 'NAME=VALUE',
+	help = 'Any further option to set on the reference build, which may be given more than once')
+parser.add_argument('--functions', nargs = '+', default = ['usb::core::handleIRQ()'],
+	help = 'Functions, as demangled by nm, whose code size (in bytes, not cycles) to track')
+parser.add_argument('--save', type = Path, default = None, help = 'Write the results out as JSON to this file')
+parser.add_argument('--baseline', type = Path, default = None,
+	help = 'Compare against results previously saved with --save, failing if anything grew')
+parser.add_argument('--tolerance', type = int, default = 0,
+	help = 'How many bytes a section or function may grow by before it counts as a regression')
+args = parser.parse_args()
+
+sections = ('text', 'data', 'bss')
+
+def crossFiles(chip):
+	if chip.startswith('atxmega'):
+		return [crossFilesDir / f'avr-{args.avrToolchain}.meson', crossFilesDir / 'avr.meson']
+	return [crossFilesDir / 'arm-none-eabi.meson']
+
+def build(buildDir, chip):
+	command = ['meson', 'setup', str(buildDir), str(rootDir)]
+	for crossFile in crossFiles(chip):
+		command += ['--cross-file', str(crossFile)]
+	command += [
+		f'-Dchip={chip}', f'-Dinterfaces={args.interfaces}', f'-Dendpoints={args.endpoints}',
+		f'-Ddrivers={",".join(args.drivers)}',
+		# LTO leaves the object files holding compiler IR rather than code, so they can't be measured
+		'-Db_lto=false',
+	] + [f'-D{option}' for option in args.options]
+	for step in (command, ['meson', 'compile', '-C', str(buildDir)]):
+		result = run(step, stdout = PIPE, stderr = PIPE, text = True)
+		if result.returncode != 0:
+			print(f'Error: failed to build the reference library for {chip}', file = stderr)
+			print(result.stdout, result.stderr, file = stderr)
+			return None
+	# Find the rest of the toolchain from the C++ compiler the cross-files selected
+	compilers = loads(run(['meson', 'introspect', '--compilers', str(buildDir)], stdout = PIPE, text = True,
+		check = True).stdout)
+	compiler = compilers['host']['cpp']['exelist'][0]
+	if not compiler.endswith('g++'):
+		print(f'Error: can\'t work out the binutils to go with {compiler}', file = stderr)
+		return None
+	library = next(buildDir.glob('**/libdragonUSB.a'))
+	return library, compiler[:-len('g++')]
+
+def objectSizes(library, toolPrefix):
+	result = run([f'{toolPrefix}size', '--format=berkeley', str(library)], stdout = PIPE, text = True, check = True)
+	objects = {}
+	# Each line is text, data, bss, dec, hex then the object's name followed by "(ex <archive>)"
+	for line in result.stdout.splitlines()[1:]:
+		fields = line.split(maxsplit = 5)
+		if len(fields) < 6:
+			continue
+		name = fields[5].split(' (ex ')[0]
+		objects[name] = dict(zip(sections, (int(size) for size in fields[:3])))
+	return objects
+
+def functionSizes(library, toolPrefix):
+	result = run([f'{toolPrefix}nm', '--print-size', '--demangle', str(library)], stdout = PIPE, text = True,
+		check = True)
+	functions = {}
+	for line in result.stdout.splitlines():
+		fields = line.split(maxsplit = 3)
+		if len(fields) == 4 and fields[2] in 'tT' and fields[3] in args.functions:
+			functions[fields[3]] = functions.get(fields[3], 0) + int(fields[1], 16)
+	return functions
+
+results = {}
+failed = False
+with TemporaryDirectory() as buildDir:
+	buildDir = Path(buildDir)
+	for chip in args.chips:
+		built = build(buildDir / chip, chip)
+		if built is None:
+			failed = True
+			continue
+		library, toolPrefix = built
+		results[chip] = {
+			'objects': objectSizes(library, toolPrefix),
+			'functions': functionSizes(library, toolPrefix),
+		}
+
+for chip, result in results.items():
+	print(f'{chip}:')
+	print(f'{"object":>40} {"text":>8} {"data":>8} {"bss":>8}')
+	totals = dict.fromkeys(sections, 0)
+	for name, sizes in sorted(result['objects'].items()):
+		print(f'{name:>40} ' + ' '.join(f'{sizes[section]:>8}' for section in sections))
+		for section in sections:
+			totals[section] += sizes[section]
+	print(f'{"total":>40} ' + ' '.join(f'{totals[section]:>8}' for section in sections))
+	for function in args.functions:
+		if function in result['functions']:
+			print(f'{function:>40} {result["functions"][function]:>8} bytes')
+		else:
+			print(f'{function:>40} {"missing":>8}')
+	print()
+
+if args.save is not None:
+	with args.save.open('w') as file:
+		dump({'settings': vars(args) | {'save': None, 'baseline': None}, 'results': results}, file, indent = '\t')
+
+def checkGrowth(what, previous, current):
+	growth = current - previous
+	if growth > args.tolerance:
+		print(f'Regression: {what} grew by {growth} bytes ({previous} -> {current})')
+		return True
+	return False
+
+if args.baseline is not None:
+	with args.baseline.open('r') as file:
+		baseline = load(file)['results']
+	for chip, result in results.items():
+		previous = baseline.get(chip)
+		if previous is None:
+			continue
+		for name, sizes in result['objects'].items():
+			previousSizes = previous['objects'].get(name)
+			if previousSizes is None:
+				continue
+			for section in sections:
+				failed |= checkGrowth(f'{chip} {name} .{section}', previousSizes[section], sizes[section])
+		for function, size in result['functions'].items():
+			previousSize = previous['functions'].get(function)
+			if previousSize is not None:
+				failed |= checkGrowth(f'{chip} {function}', previousSize, size)
+
+exit(1 if failed else 0)
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+from argparse import ArgumentParser
+from pathlib import Path
+from subprocess import run, PIPE
+from sys import exit, stderr
+from tempfile import TemporaryDirectory
+
+toolsDir = Path(__file__).resolve().parent
+rootDir = toolsDir.parent
+
+# The options every harness is built with, standing in for the ones meson would pass
+commonDefines = {
+	'TM4C123GH6PM': None, 'USB_INTERFACES': 2, 'USB_ENDPOINTS': 3, 'USB_BUFFER_SIZE': 64,
+	'USB_CONFIG_DESCRIPTORS': 1, 'USB_INTERFACE_DESCRIPTORS': 2, 'USB_ENDPOINT_DESCRIPTORS': 3, 'USB_STRINGS': 1,
+}
+
+# Each test's harness, and the driver options to build it with - once per entry in the list
+tests = {
+	'ncmLoopback': [
+		{'USB_NCM_NTB_SIZE': 2048, 'USB_NCM_MAX_DATAGRAMS': 8, 'USB_NCM_AGGREGATION_TIMEOUT': 1},
+		{'USB_NCM_NTB_SIZE': 16384, 'USB_NCM_MAX_DATAGRAMS': 16, 'USB_NCM_AGGREGATION_TIMEOUT': 4},
+	],
+	'isoStreams': [
+		{'USB_ISOCHRONOUS': None, 'USB_ISO_STREAMS': 3, 'USB_ISO_PACKET_SIZE': 192},
+	],
+	'mscRamDisk': [
+		{'USB_MSC_BLOCK_SIZE': 512},
+	],
+}
+
+parser = ArgumentParser(
+	description = 'Builds and runs the host side driver tests, each of which runs one of dragonUSB\'s drivers ' +
+		'against a simulated host and checks what comes out',
+	allow_abbrev = False
+)
+parser.add_argument('--tests', nargs = '+', default = list(tests), choices = list(tests), help = 'Which tests to run')
+parser.add_argument('--substrate', type = Path, default = rootDir / 'deps' / 'substrate',
+	help = 'Where the substrate subproject is (see `meson subprojects download`)')
+parser.add_argument('--cxx', default = 'c++', help = 'Host C++ compiler to build the harnesses with')
+args = parser.parse_args()
+
+# The drivers don't touch the platform, so the platform headers they pull in can be left empty
+platformHeaders = ('platform.hxx', 'constants.hxx')
+
+def describe(defines):
+	return ', '.join(f'{name}={value}' for name, value in defines.items())
+
+def build(buildDir, test, variant, defines):
+	binary = buildDir / f'{test}-{variant}'
+	command = [
+		args.cxx, '-std=c++17', '-O2', '-Wall', '-Wextra', '-o', str(binary), str(toolsDir / f'{test}.cxx'),
+		f'-I{rootDir / "include"}', f'-I{buildDir}', f'-I{args.substrate}',
+	] + [f'-D{name}' if value is None else f'-D{name}={value}' for name, value in (commonDefines | defines).items()]
+	result = run(command, stdout = PIPE, stderr = PIPE, text = True)
+	if result.returncode != 0:
+		print(f'Error: failed to build {test} with {describe(defines)}', file = stderr)
+		print(result.stderr, file = stderr)
+		return None
+	return binary
+
+failed = False
+with TemporaryDirectory() as buildDir:
+	buildDir = Path(buildDir)
+	(buildDir / 'tm4c123gh6pm').mkdir()
+	for header in platformHeaders:
+		(buildDir / 'tm4c123gh6pm' / header).touch()
+
+	for test in args.tests:
+		for variant, defines in enumerate(tests[test]):
+			binary = build(buildDir, test, variant, defines)
+			result = None if binary is None else run([str(binary)], stdout = PIPE, stderr = PIPE, text = True)
+			passed = result is not None and result.returncode == 0
+			print(f'{test} ({describe(defines)}): {"passed" if passed else "FAILED"}')
+			if result is not None and not passed:
+				print(result.stdout, result.stderr, end = '')
+			failed |= not passed
+
+exit(1 if failed else 0)
@@ -0,0 +1,379 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/*
+ * Host side test of the isochronous engine, built and run by hostTests.py. A simulated host runs a
+ * source, a sink and a feedback endpoint frame by frame, collecting and sending packets - bigger than
+ * the endpoint buffer size, as audio needs - around each SOF, and checks what each carries along
+ * with the missed and late frame counts - both in steady state and when the host or the application
+ * misses a frame - the 10.14 feedback value, and the frame numbers answered to SYNCH_FRAME.
+ *
+ * Usage: isoStreams
+ * Prints one line per check that fails and exits non-zero if any did.
+ */
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "../src/iso.cxx"
+
+namespace usb::core
+{
+	std::array<usb::types::usbEPStatus_t<const void>, endpointCount> epStatusControllerIn{};
+	std::array<usb::types::usbEPStatus_t<void>, endpointCount> epStatusControllerOut{};
+	static sofHandler_t sofHandler{nullptr};
+	static std::array<handler_t, endpointCount> inHandlers{};
+	static std::array<handler_t, endpointCount> outHandlers{};
+
+	namespace internal
+	{
+		volatile uint16_t frameCounter{};
+		std::array<uint16_t, endpointCount> isoPacketSizes{};
+	} // namespace internal
+} // namespace usb::core
+
+namespace usb::device
+{
+	usb::types::setupPacket_t packet{};
+	static altModeHandler_t altModeHandler{nullptr};
+} // namespace usb::device
+
+namespace test
+{
+	using usb::types::usbEP_t;
+	using usb::types::endpointDir_t;
+
+	constexpr static uint8_t interface{1U};
+	constexpr static uint8_t sourceEP{1U};
+	constexpr static uint8_t sinkEP{1U};
+	constexpr static uint8_t feedbackEP{2U};
+	static const usbEP_t source{sourceEP, endpointDir_t::controllerIn};
+	static const usbEP_t sink{sinkEP, endpointDir_t::controllerOut};
+	static const usbEP_t feedback{feedbackEP, endpointDir_t::controllerIn};
+	// Room for 48kHz 16-bit stereo, so packets are bigger than the endpoint buffer size
+	constexpr static uint16_t maxPacketSize{192U};
+
+	static uint32_t failures{};
+
+	static void check(const bool ok, const char *const what) noexcept
+	{
+		if (ok)
+			return;
+		std::printf("FAIL: %s\n", what);
+		++failures;
+	}
+
+	// The host's frame number, which starts somewhere other than where the engine's count does
+	static uint16_t hostFrame{0x07F0U};
+	static bool haveFrameNumber{true};
+
+	// The packet written to each IN endpoint that the host is yet to collect
+	static std::array<std::vector<uint8_t>, usb::constants::endpointCount> inPackets{};
+	static std::array<bool, usb::constants::endpointCount> inPending{};
+	static std::array<uint32_t, usb::constants::endpointCount> flushes{};
+	// The packet the host is sending on the OUT endpoint
+	static std::vector<uint8_t> outPacket{};
+
+	// The source sends 44.1kHz 16-bit stereo: 44 sample frames with a 45 sample one every patternFrames
+	constexpr static uint8_t patternFrames{10U};
+	static uint32_t filled{};
+	static bool fillReady{true};
+	static std::vector<std::vector<uint8_t>> sourceFrames{};
+
+	static bool fill(void *const buffer, uint16_t &length)
+	{
+		if (!fillReady)
+			return false;
+		length = filled % patternFrames == patternFrames - 1U ? 180U : 176U;
+		auto *const data{static_cast<uint8_t *>(buffer)};
+		for (uint16_t i{}; i < length; ++i)
+			data[i] = uint8_t(filled * 5U + i);
+		sourceFrames.emplace_back(data, data + length);
+		++filled;
+		return true;
+	}
+
+	static std::vector<std::vector<uint8_t>> drained{};
+
+	static void drain(const void *const buffer, const uint16_t length)
+	{
+		const auto *const data{static_cast<const uint8_t *>(buffer)};
+		drained.emplace_back(data, data + length);
+	}
+
+	static void request(const std::array<uint8_t, 8> &setup)
+		{ std::memcpy(&usb::device::packet, setup.data(), setup.size()); }
+
+	static bool setInterface(const uint8_t alternate)
+	{
+		request({0x01U, 11U, alternate, 0U, interface, 0U, 0U, 0U});
+		return usb::device::altModeHandler();
+	}
+
+	static void sof()
+	{
+		usb::core::internal::frameCounter = uint16_t(usb::core::internal::frameCounter + 1U);
+		hostFrame = uint16_t((hostFrame + 1U) & 0x07FFU);
+		if (usb::core::sofHandler)
+			usb::core::sofHandler();
+	}
+
+	// Collects the packet waiting on an IN endpoint, as the host would, returning it
+	static std::vector<uint8_t> collect(const uint8_t endpoint)
+	{
+		if (!inPending[endpoint])
+			return {};
+		inPending[endpoint] = false;
+		usb::core::inHandlers[endpoint].handlePacket(endpoint);
+		return inPackets[endpoint];
+	}
+
+	static void send(const std::vector<uint8_t> &data)
+	{
+		outPacket = data;
+		usb::core::outHandlers[sinkEP].handlePacket(sinkEP);
+	}
+
+	static uint32_t feedbackFrom(const std::vector<uint8_t> &data)
+	{
+		if (data.size() != 3U)
+			return UINT32_MAX;
+		return uint32_t(data[0] | (data[1] << 8U) | (data[2] << 16U));
+	}
+
+	static void testSource()
+	{
+		std::printf("source\n");
+		// The first frame is filled as the stream starts, ready to go at the first SOF
+		check(sourceFrames.size() == 1U, "the source wasn't primed with its first frame on starting");
+		std::vector<std::vector<uint8_t>> collected{};
+		for (uint8_t frame{}; frame < 25U; ++frame)
+		{
+			sof();
+			check(inPending[sourceEP], "no packet was queued for the source at SOF");
+			collected.push_back(collect(sourceEP));
+		}
+		check(collected.size() == 25U &&
+			std::equal(collected.begin(), collected.end(), sourceFrames.begin()),
+			"the packets sent don't match the frames filled, in order");
+		auto stats{usb::iso::statistics(source)};
+		check(stats.frames == 25U && !stats.missed && !stats.late, "steady state source statistics wrong");
+
+		// The host skipping a frame leaves the packet uncollected, which is dropped rather than sent late
+		sof();
+		sof();
+		stats = usb::iso::statistics(source);
+		check(stats.missed == 1U && flushes[sourceEP] == 1U, "an uncollected packet wasn't counted and dropped");
+		check(collect(sourceEP) == sourceFrames[26], "the frame after a missed one wasn't sent on time");
+
+		// The application not having a frame ready sends an empty packet one SOF on
+		fillReady = false;
+		sof();
+		collect(sourceEP);
+		fillReady = true;
+		sof();
+		check(collect(sourceEP).empty(), "a frame that wasn't ready didn't go out as an empty packet");
+		stats = usb::iso::statistics(source);
+		check(stats.late == 1U && stats.missed == 1U, "a frame that wasn't ready wasn't counted late");
+		// Each SOF refills for the next, so the frame sent is the one before the last filled
+		sof();
+		check(sourceFrames.size() == 30U && collect(sourceEP) == sourceFrames[28],
+			"the source didn't pick back up after a late frame");
+	}
+
+	static void testSink()
+	{
+		std::printf("sink\n");
+		// Frames before the host first sends aren't missed
+		sof();
+		sof();
+		check(!usb::iso::statistics(sink).missed, "frames before the host started sending counted as missed");
+
+		std::vector<std::vector<uint8_t>> sent{};
+		for (uint8_t frame{}; frame < 20U; ++frame)
+		{
+			const auto length{frame % 2U ? maxPacketSize : std::size_t(1U + frame * 9U)};
+			sent.push_back(std::vector<uint8_t>(length, uint8_t(frame * 3U)));
+			send(sent.back());
+			sof();
+		}
+		check(drained == sent, "the packets drained don't match those the host sent, in order");
+		auto stats{usb::iso::statistics(sink)};
+		check(stats.frames == 20U && !stats.missed && !stats.late, "steady state sink statistics wrong");
+
+		// A frame with no packet is missed, and a second packet in one frame overwrites the first
+		sof();
+		send({1U, 2U, 3U});
+		send({4U, 5U});
+		sof();
+		stats = usb::iso::statistics(sink);
+		check(stats.missed == 1U, "a frame without a packet wasn't counted missed");
+		check(stats.late == 1U, "an overwritten packet wasn't counted late");
+		check(drained.size() == 21U && drained.back() == std::vector<uint8_t>{4U, 5U},
+			"the newer of two packets in a frame wasn't the one drained");
+	}
+
+	static void testFeedback()
+	{
+		std::printf("feedback\n");
+		// With refresh 3, feedback goes every 8 frames, starting as the nominal rate
+		for (uint8_t frame{}; frame < 7U; ++frame)
+		{
+			sof();
+			check(!inPending[feedbackEP], "feedback sent before its refresh period was up");
+		}
+		sof();
+		check(feedbackFrom(collect(feedbackEP)) == usb::iso::feedbackFor(48000U),
+			"the first feedback value wasn't the nominal rate in 10.14");
+		check(usb::iso::feedbackFor(44100U) == 0x0B0666U, "feedbackFor() doesn't give 10.14 samples per frame");
+
+		// 48 samples a frame plus one over the period is 48.125 samples per frame
+		for (uint8_t frame{}; frame < 8U; ++frame)
+		{
+			usb::iso::feedbackSamples(feedbackEP, frame ? 48U : 49U);
+			sof();
+		}
+		check(feedbackFrom(collect(feedbackEP)) == (48U << 14U) + (1U << 11U),
+			"the measured feedback value is wrong");
+
+		usb::iso::feedbackValue(feedbackEP, 0x0C0123U);
+		for (uint8_t frame{}; frame < 8U; ++frame)
+			sof();
+		check(feedbackFrom(collect(feedbackEP)) == 0x0C0123U, "the feedback value set wasn't sent");
+
+		// Not collecting a feedback packet before the next is due counts it missed
+		for (uint8_t frame{}; frame < 16U; ++frame)
+			sof();
+		check(usb::iso::statistics(feedback).missed == 1U, "an uncollected feedback packet wasn't counted missed");
+		collect(feedbackEP);
+	}
+
+	static void testSyncFrame()
+	{
+		std::printf("SYNCH_FRAME\n");
+		// Restart the stream so the pattern's first frame is known in the host's numbering
+		check(setInterface(0U) && setInterface(1U), "restarting the streams failed");
+		sof();
+		collect(sourceEP);
+		const auto patternStart{hostFrame};
+		for (uint8_t frame{}; frame < 64U; ++frame)
+		{
+			request({0x82U, 12U, 0U, 0U, sourceEP | 0x80U, 0U, 2U, 0U});
+			const auto answer{usb::iso::internal::handleSyncFrame()};
+			const auto sinceStart{uint16_t((hostFrame - patternStart) & 0x07FFU)};
+			const auto expected{uint16_t((hostFrame - sinceStart % patternFrames) & 0x07FFU)};
+			const auto ok{std::get<0>(answer) == usb::types::response_t::data && std::get<2>(answer) == 2U &&
+				*static_cast<const uint16_t *>(std::get<1>(answer)) == expected};
+			check(ok, "SYNCH_FRAME didn't answer the host frame the current pattern started in");
+			if (!ok)
+				break;
+			sof();
+			collect(sourceEP);
+		}
+
+		request({0x82U, 12U, 0U, 0U, feedbackEP | 0x80U, 0U, 2U, 0U});
+		check(std::get<0>(usb::iso::internal::handleSyncFrame()) == usb::types::response_t::stall,
+			"SYNCH_FRAME to a feedback endpoint wasn't stalled");
+		haveFrameNumber = false;
+		request({0x82U, 12U, 0U, 0U, sourceEP | 0x80U, 0U, 2U, 0U});
+		check(std::get<0>(usb::iso::internal::handleSyncFrame()) == usb::types::response_t::stall,
+			"SYNCH_FRAME wasn't stalled without the controller's frame number");
+		haveFrameNumber = true;
+	}
+} // namespace test
+
+namespace usb::core
+{
+	void registerHandler(const usbEP_t ep, uint8_t, const handler_t handler) noexcept
+	{
+		if (ep.dir() == endpointDir_t::controllerIn)
+			inHandlers[ep.endpoint()] = handler;
+		else
+			outHandlers[ep.endpoint()] = handler;
+	}
+
+	void registerSOFHandler(uint16_t, const sofHandler_t handler) noexcept { sofHandler = handler; }
+	void unregsiterSOFHandler(uint16_t) noexcept { sofHandler = nullptr; }
+
+	bool writeEP(const uint8_t endpoint) noexcept
+	{
+		auto &epStatus{epStatusControllerIn[endpoint]};
+		test::check(!test::inPending[endpoint], "writeEP() called with the last packet still waiting to go");
+		// Transfers go a packet at a time, as the platform code sends them
+		const auto amount{std::min(epStatus.transferCount, internal::packetSizeIn(endpoint))};
+		const auto *const data{static_cast<const uint8_t *>(epStatus.memBuffer)};
+		test::inPackets[endpoint].assign(data, data + amount);
+		epStatus.memBuffer = data + amount;
+		epStatus.transferCount = uint16_t(epStatus.transferCount - amount);
+		test::inPending[endpoint] = true;
+		return true;
+	}
+
+	void flushWriteEP(const uint8_t endpoint) noexcept
+	{
+		test::inPending[endpoint] = false;
+		++test::flushes[endpoint];
+	}
+
+	bool readEP(const uint8_t endpoint) noexcept
+	{
+		auto &epStatus{epStatusControllerOut[endpoint]};
+		const auto count{std::min<std::size_t>(test::outPacket.size(), epStatus.transferCount)};
+		std::memcpy(epStatus.memBuffer, test::outPacket.data(), count);
+		epStatus.transferCount = uint16_t(epStatus.transferCount - count);
+		return !epStatus.transferCount;
+	}
+
+	bool internal::busFrameNumber(uint16_t &frame) noexcept
+	{
+		frame = test::hostFrame;
+		return test::haveFrameNumber;
+	}
+} // namespace usb::core
+
+namespace usb::device
+{
+	void registerAltModeHandler(uint8_t, uint8_t, const altModeHandler_t handler) noexcept
+		{ altModeHandler = handler; }
+} // namespace usb::device
+
+int main(int, char **)
+{
+	using namespace test;
+	check(!usb::iso::registerSource(interface, 1U, sourceEP, usb::iso::packetSize + 1U, fill, patternFrames),
+		"a source with packets bigger than the stream buffers was accepted");
+	check(usb::iso::registerSource(interface, 1U, sourceEP, maxPacketSize, fill, patternFrames),
+		"registering the source failed");
+	check(usb::iso::registerSink(interface, 1U, sinkEP, maxPacketSize, drain), "registering the sink failed");
+	check(usb::iso::registerFeedback(interface, 1U, feedbackEP, 3U, 48000U), "registering feedback failed");
+	check(!usb::iso::registerFeedback(interface, 1U, feedbackEP, 10U, 48000U),
+		"a feedback period longer than full speed allows was accepted");
+	// As the platform code does setting the endpoints up from their descriptors
+	usb::core::internal::isoPacketSizes[sourceEP] = maxPacketSize;
+	usb::core::internal::isoPacketSizes[feedbackEP] = 3U;
+	for (const auto endpoint : {sourceEP, feedbackEP})
+		usb::core::inHandlers[endpoint].init(endpoint);
+	usb::core::outHandlers[sinkEP].init(sinkEP);
+
+	// Nothing runs on the zero bandwidth alternate setting
+	sof();
+	check(!inPending[sourceEP] && !usb::iso::active(source), "the source ran on alternate setting 0");
+	check(setInterface(1U), "SET_INTERFACE to alternate setting 1 refused");
+	check(usb::iso::active(source) && usb::iso::active(sink) && usb::iso::active(feedback),
+		"the streams didn't start on alternate setting 1");
+
+	testSource();
+	// Each test leaves the other streams running, so start each from clean statistics
+	usb::iso::resetStatistics(sink);
+	drained.clear();
+	testSink();
+	for (const auto endpoint : {source, sink, feedback})
+		usb::iso::resetStatistics(endpoint);
+	// Line feedback back up with the start of its refresh period
+	check(setInterface(0U) && setInterface(1U), "restarting the streams failed");
+	collect(sourceEP);
+	testFeedback();
+	testSyncFrame();
+
+	if (failures)
+		std::printf("%u checks failed\n", failures);
+	return failures ? 1 : 0;
+}
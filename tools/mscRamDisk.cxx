@@ -0,0 +1,502 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/*
+ * Host side test of the Mass Storage driver's Bulk-Only Transport, built and run by hostTests.py. The
+ * driver is given a RAM disk, optionally slow enough that the block pipeline has to wait on it, and a
+ * simulated host runs commands through it a packet at a time, checking the data that moves, each CSW's
+ * tag, status and residue - including for the cases where the host and device disagree on the data
+ * phase - and that an invalid CBW keeps the endpoints halted until a Bulk-Only Mass Storage Reset.
+ *
+ * Usage: mscRamDisk
+ * Prints one line per check that fails and exits non-zero if any did.
+ */
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "../src/drivers/msc.cxx"
+
+namespace usb::core
+{
+	std::array<usb::types::usbEPStatus_t<const void>, endpointCount> epStatusControllerIn{};
+	std::array<usb::types::usbEPStatus_t<void>, endpointCount> epStatusControllerOut{};
+	static sofHandler_t sofHandler{nullptr};
+	static std::array<handler_t, endpointCount> inHandlers{};
+	static std::array<handler_t, endpointCount> outHandlers{};
+} // namespace usb::core
+
+namespace usb::device
+{
+	usb::types::setupPacket_t packet{};
+	static controlHandler_t controlHandler{nullptr};
+} // namespace usb::device
+
+namespace test
+{
+	using usb::types::usbEP_t;
+	using usb::types::endpointDir_t;
+	using usb::constants::epBufferSize;
+	using usb::msc::blockSize;
+	using usb::msc::types::cswStatus_t;
+	using usb::msc::types::scsiCommand_t;
+
+	constexpr static uint8_t interface{0U};
+	constexpr static usb::msc::endpoints_t endpoints{1U, 1U};
+	static const usbEP_t dataIn{endpoints.dataIn, endpointDir_t::controllerIn};
+	static const usbEP_t dataOut{endpoints.dataOut, endpointDir_t::controllerOut};
+	// How many SOFs the host waits for the device to move before giving up on a transfer
+	constexpr static uint32_t timeout{1000U};
+
+	static uint32_t failures{};
+
+	static void check(const bool ok, const char *const what) noexcept
+	{
+		if (ok)
+			return;
+		std::printf("FAIL: %s\n", what);
+		++failures;
+	}
+
+	// The packet written to the IN endpoint that the host is yet to collect
+	static std::vector<uint8_t> inPacket{};
+	static bool inPending{false};
+	// The packet the host is sending on the OUT endpoint, held till the driver reads it
+	static std::vector<uint8_t> outPacket{};
+	static bool outPending{false};
+
+	constexpr static uint32_t blockCount{32U};
+	static std::array<std::array<uint8_t, blockSize>, blockCount> disk{};
+	// How many times busy() says the disk is still working after each read or write starts
+	static uint8_t diskDelay{};
+	static uint8_t diskBusy{};
+
+	static bool diskRead(const uint32_t block, uint8_t *const buffer)
+	{
+		check(!diskBusy, "a read was started with the last read or write still in progress");
+		if (block >= blockCount)
+			return false;
+		std::memcpy(buffer, disk[block].data(), blockSize);
+		diskBusy = diskDelay;
+		return true;
+	}
+
+	static bool diskWrite(const uint32_t block, const uint8_t *const buffer)
+	{
+		check(!diskBusy, "a write was started with the last read or write still in progress");
+		if (block >= blockCount)
+			return false;
+		std::memcpy(disk[block].data(), buffer, blockSize);
+		diskBusy = diskDelay;
+		return true;
+	}
+
+	static bool diskBusyCheck()
+	{
+		if (!diskBusy)
+			return false;
+		--diskBusy;
+		return true;
+	}
+
+	constexpr static usb::msc::blockDevice_t device{diskRead, diskWrite, diskBusyCheck, blockCount, false};
+	constexpr static usb::msc::inquiry_t inquiry
+	{
+		{{'d', 'r', 'a', 'g', 'o', 'n', ' ', ' '}},
+		{{'R', 'A', 'M', ' ', 'd', 'i', 's', 'k', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '}},
+		{{'1', '.', '0', ' '}}
+	};
+
+	static void sof()
+	{
+		if (usb::core::sofHandler)
+			usb::core::sofHandler();
+	}
+
+	// Sends a packet on the OUT endpoint, waiting for the driver to take it, false if it's halted or never does
+	static bool send(const std::vector<uint8_t> &data)
+	{
+		if (usb::core::epStatusControllerOut[endpoints.dataOut].halted())
+			return false;
+		outPacket = data;
+		outPending = true;
+		usb::core::outHandlers[endpoints.dataOut].handlePacket(endpoints.dataOut);
+		for (uint32_t frame{}; outPending && frame < timeout; ++frame)
+			sof();
+		return !outPending;
+	}
+
+	// Collects the next packet from the IN endpoint, false if it's halted or none turns up
+	static bool collect(std::vector<uint8_t> &data)
+	{
+		for (uint32_t frame{}; !inPending && frame < timeout; ++frame)
+		{
+			if (usb::core::epStatusControllerIn[endpoints.dataIn].halted())
+				return false;
+			sof();
+		}
+		if (!inPending)
+			return false;
+		data = inPacket;
+		inPending = false;
+		usb::core::inHandlers[endpoints.dataIn].handlePacket(endpoints.dataIn);
+		return true;
+	}
+
+	static void request(const std::array<uint8_t, 8> &setup)
+		{ std::memcpy(&usb::device::packet, setup.data(), setup.size()); }
+
+	// As device.cxx handles CLEAR_FEATURE(ENDPOINT_HALT)
+	static void clearFeature(const usbEP_t endpoint)
+	{
+		if (!usb::core::epWedged(endpoint))
+			usb::core::clearHaltEP(endpoint);
+	}
+
+	static bool massStorageReset()
+	{
+		request({0x21U, 0xFFU, 0U, 0U, interface, 0U, 0U, 0U});
+		return std::get<0>(usb::device::controlHandler(interface)) == usb::types::response_t::zeroLength;
+	}
+
+	struct status_t final
+	{
+		bool valid;
+		uint32_t residue;
+		cswStatus_t status;
+	};
+
+	static uint32_t nextTag{0x1000U};
+
+	static std::vector<uint8_t> commandBlock(const uint32_t tag, const uint32_t length, const bool in,
+		const std::vector<uint8_t> &command)
+	{
+		std::vector<uint8_t> cbw(31U);
+		const std::array<uint32_t, 3> header{{usb::msc::types::cbwSignature, tag, length}};
+		std::memcpy(cbw.data(), header.data(), sizeof(header));
+		cbw[12] = in ? usb::msc::types::cbwDirectionIn : 0U;
+		cbw[14] = uint8_t(command.size());
+		std::memcpy(cbw.data() + 15U, command.data(), command.size());
+		return cbw;
+	}
+
+	/*!
+	 * Runs a command through the transport as the host would: the CBW, then a data phase of length bytes
+	 * in the direction given - sending outData, or collecting into inData till the host has all it asked
+	 * for or a short packet ends it early - then the CSW, which is checked to match the CBW.
+	 */
+	static status_t transact(const std::vector<uint8_t> &command, const uint32_t length, const bool in,
+		const std::vector<uint8_t> &outData, std::vector<uint8_t> &inData)
+	{
+		const auto tag{nextTag++};
+		inData.clear();
+		if (!send(commandBlock(tag, length, in, command)))
+			return {false, 0U, cswStatus_t::passed};
+		if (length && in)
+		{
+			std::vector<uint8_t> data{};
+			while (inData.size() < length)
+			{
+				if (!collect(data))
+					return {false, 0U, cswStatus_t::passed};
+				inData.insert(inData.end(), data.begin(), data.end());
+				if (data.size() < epBufferSize)
+					break;
+			}
+			check(inData.size() <= length, "the device sent more data than the host asked for");
+		}
+		else if (length)
+		{
+			for (std::size_t offset{}; offset < length; offset += epBufferSize)
+			{
+				const auto amount{std::min<std::size_t>(length - offset, epBufferSize)};
+				const auto packet{outData.begin() + std::ptrdiff_t(offset)};
+				if (!send({packet, packet + std::ptrdiff_t(amount)}))
+					return {false, 0U, cswStatus_t::passed};
+			}
+		}
+
+		std::vector<uint8_t> packet{};
+		if (!collect(packet) || packet.size() != 13U)
+			return {false, 0U, cswStatus_t::passed};
+		std::array<uint32_t, 3> header{};
+		std::memcpy(header.data(), packet.data(), sizeof(header));
+		check(header[0] == usb::msc::types::cswSignature, "the CSW had the wrong signature");
+		check(header[1] == tag, "the CSW's tag didn't match its CBW's");
+		return {true, header[2], static_cast<cswStatus_t>(packet[12])};
+	}
+
+	static std::vector<uint8_t> blockCommand(const scsiCommand_t command, const uint32_t block, const uint16_t count)
+	{
+		return {uint8_t(command), 0U, uint8_t(block >> 24U), uint8_t(block >> 16U), uint8_t(block >> 8U),
+			uint8_t(block), 0U, uint8_t(count >> 8U), uint8_t(count), 0U};
+	}
+
+	static std::vector<uint8_t> pattern(const uint32_t length, const uint8_t seed)
+	{
+		std::vector<uint8_t> data(length);
+		for (uint32_t i{}; i < length; ++i)
+			data[i] = uint8_t(seed + i * 7U + (i >> 8U));
+		return data;
+	}
+
+	static bool diskHolds(const uint32_t block, const std::vector<uint8_t> &data)
+	{
+		for (uint32_t offset{}; offset < data.size(); offset += blockSize)
+		{
+			if (std::memcmp(disk[block + offset / blockSize].data(), data.data() + offset, blockSize))
+				return false;
+		}
+		return true;
+	}
+
+	static void testInquiry()
+	{
+		std::vector<uint8_t> data{};
+		auto status{transact({uint8_t(scsiCommand_t::inquiry), 0U, 0U, 0U, 36U, 0U}, 36U, true, {}, data)};
+		check(status.valid && status.status == cswStatus_t::passed && !status.residue,
+			"INQUIRY didn't complete with a passed CSW");
+		check(data.size() == 36U && !std::memcmp(data.data() + 8U, inquiry.vendor.data(), inquiry.vendor.size()) &&
+			!std::memcmp(data.data() + 16U, inquiry.product.data(), inquiry.product.size()),
+			"INQUIRY's response didn't carry the vendor and product");
+
+		// A host asking for more than the allocation length gets the allocation length and a residue
+		status = transact({uint8_t(scsiCommand_t::inquiry), 0U, 0U, 0U, 8U, 0U}, 36U, true, {}, data);
+		check(status.valid && status.status == cswStatus_t::passed && status.residue == 28U && data.size() == 8U,
+			"INQUIRY didn't stop at its allocation length (Hi > Di)");
+		// One asking for less than the allocation length says gets a phase error (Hi < Di)
+		status = transact({uint8_t(scsiCommand_t::inquiry), 0U, 0U, 0U, 36U, 0U}, 24U, true, {}, data);
+		check(status.valid && status.status == cswStatus_t::phaseError && !status.residue && data.size() == 24U,
+			"INQUIRY with less room than its allocation length didn't report a phase error (Hi < Di)");
+		// As does one expecting no data (Hn < Di), or to send it (Ho <> Di)
+		status = transact({uint8_t(scsiCommand_t::inquiry), 0U, 0U, 0U, 36U, 0U}, 0U, true, {}, data);
+		check(status.valid && status.status == cswStatus_t::phaseError && !status.residue,
+			"INQUIRY expecting no data didn't report a phase error (Hn < Di)");
+		status = transact({uint8_t(scsiCommand_t::inquiry), 0U, 0U, 0U, 36U, 0U}, 36U, false,
+			std::vector<uint8_t>(36U), data);
+		check(status.valid && status.status == cswStatus_t::phaseError && status.residue == 36U,
+			"INQUIRY with a host to device data phase didn't report a phase error (Ho <> Di)");
+	}
+
+	static void testCapacity()
+	{
+		std::vector<uint8_t> data{};
+		const auto status{transact({uint8_t(scsiCommand_t::readCapacity10), 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U},
+			8U, true, {}, data)};
+		check(status.valid && status.status == cswStatus_t::passed && data.size() == 8U &&
+			data[3] == blockCount - 1U && data[6] == uint8_t(blockSize >> 8U) && data[7] == uint8_t(blockSize),
+			"READ CAPACITY didn't report the disk's geometry");
+		check(transact({uint8_t(scsiCommand_t::testUnitReady), 0U, 0U, 0U, 0U, 0U}, 0U, false, {}, data).status ==
+			cswStatus_t::passed, "TEST UNIT READY didn't pass");
+	}
+
+	static void testReadWrite()
+	{
+		std::vector<uint8_t> data{};
+		for (const auto delay : {uint8_t{0U}, uint8_t{3U}})
+		{
+			diskDelay = delay;
+			const auto written{pattern(6U * blockSize, uint8_t(delay + 1U))};
+			auto status{transact(blockCommand(scsiCommand_t::write10, 3U, 6U), uint32_t(written.size()), false,
+				written, data)};
+			check(status.valid && status.status == cswStatus_t::passed && !status.residue,
+				"WRITE(10) didn't complete with a passed CSW");
+			check(diskHolds(3U, written), "WRITE(10) didn't put the data on the disk");
+
+			status = transact(blockCommand(scsiCommand_t::read10, 3U, 6U), uint32_t(written.size()), true, {}, data);
+			check(status.valid && status.status == cswStatus_t::passed && !status.residue && data == written,
+				"READ(10) didn't read back what was written");
+		}
+		diskDelay = 0U;
+
+		// A host allowing for more data than the command moves gets a ZLP after the last full packet
+		const auto expected{pattern(blockSize, 0x55U)};
+		disk[9] = {};
+		std::memcpy(disk[9].data(), expected.data(), blockSize);
+		auto status{transact(blockCommand(scsiCommand_t::read10, 9U, 1U), 2U * blockSize, true, {}, data)};
+		check(status.valid && status.status == cswStatus_t::passed && status.residue == blockSize && data == expected,
+			"READ(10) with room to spare didn't end early with the right residue (Hi > Di)");
+
+		// Less room than the command needs moves the whole blocks that fit, then a phase error (Hi < Di)
+		const auto hostLength{uint32_t(2U * blockSize + 100U)};
+		status = transact(blockCommand(scsiCommand_t::read10, 3U, 4U), hostLength, true, {}, data);
+		check(status.valid && status.status == cswStatus_t::phaseError && status.residue == hostLength - 2U * blockSize,
+			"READ(10) with less room than it needs didn't report a phase error and residue (Hi < Di)");
+		check(data.size() == hostLength && diskHolds(3U, {data.begin(), data.begin() + 2U * blockSize}),
+			"READ(10) with less room than it needs didn't send the blocks that fit");
+
+		// Sending less than the command says writes the whole blocks sent, then a phase error (Ho < Do)
+		const auto before{disk[12]};
+		const auto sent{pattern(2U * blockSize, 0xA0U)};
+		status = transact(blockCommand(scsiCommand_t::write10, 10U, 3U), uint32_t(sent.size()), false, sent, data);
+		check(status.valid && status.status == cswStatus_t::phaseError && !status.residue,
+			"WRITE(10) with less data than it needs didn't report a phase error (Ho < Do)");
+		check(diskHolds(10U, sent) && disk[12] == before,
+			"WRITE(10) with less data than it needs wrote the wrong blocks");
+
+		// Sending more than the command says writes only its blocks, discarding the rest (Ho > Do) - with a
+		// slow disk too, so the surplus arrives while the last block is still being committed
+		for (const auto delay : {uint8_t{0U}, uint8_t{20U}})
+		{
+			diskDelay = delay;
+			const auto after{disk[21]};
+			const auto surplus{pattern(2U * blockSize, uint8_t(0xC0U + delay))};
+			status = transact(blockCommand(scsiCommand_t::write10, 20U, 1U), uint32_t(surplus.size()), false,
+				surplus, data);
+			check(status.valid && status.status == cswStatus_t::passed && status.residue == blockSize,
+				"WRITE(10) with more data than it needs didn't pass with the surplus as residue (Ho > Do)");
+			check(diskHolds(20U, {surplus.begin(), surplus.begin() + blockSize}) && disk[21] == after,
+				"WRITE(10) with more data than it needs wrote past the blocks it covers");
+		}
+		diskDelay = 0U;
+
+		// Reading with a host to device data phase is a phase error, with none of the data used (Ho <> Di)
+		status = transact(blockCommand(scsiCommand_t::read10, 3U, 1U), blockSize, false,
+			std::vector<uint8_t>(blockSize), data);
+		check(status.valid && status.status == cswStatus_t::phaseError && status.residue == blockSize,
+			"READ(10) with a host to device data phase didn't report a phase error (Ho <> Di)");
+
+		// Reading past the end fails, and REQUEST SENSE says why
+		status = transact(blockCommand(scsiCommand_t::read10, blockCount - 1U, 2U), 2U * blockSize, true, {}, data);
+		check(status.valid && status.status == cswStatus_t::failed && status.residue == 2U * blockSize,
+			"READ(10) past the end of the disk didn't fail");
+		status = transact({uint8_t(scsiCommand_t::requestSense), 0U, 0U, 0U, 18U, 0U}, 18U, true, {}, data);
+		check(status.valid && status.status == cswStatus_t::passed && data.size() == 18U &&
+			data[2] == uint8_t(usb::msc::types::senseKey_t::illegalRequest) &&
+			data[12] == uint8_t(usb::msc::types::additionalSense_t::lbaOutOfRange),
+			"REQUEST SENSE didn't report the out of range read");
+	}
+
+	static void testResetRecovery()
+	{
+		auto cbw{commandBlock(nextTag++, 0U, false, {uint8_t(scsiCommand_t::testUnitReady), 0U, 0U, 0U, 0U, 0U})};
+		cbw[0] ^= 0xFFU;
+		check(send(cbw), "the invalid CBW wasn't taken");
+		check(usb::core::epHalted(dataIn) && usb::core::epHalted(dataOut),
+			"an invalid CBW didn't halt both bulk endpoints");
+
+		// CLEAR_FEATURE alone mustn't let the host carry on (BOT 6.6.1)
+		clearFeature(dataIn);
+		clearFeature(dataOut);
+		check(usb::core::epHalted(dataIn) && usb::core::epHalted(dataOut),
+			"CLEAR_FEATURE unhalted the endpoints before a Bulk-Only Mass Storage Reset");
+		std::vector<uint8_t> data{};
+		check(!transact({uint8_t(scsiCommand_t::testUnitReady), 0U, 0U, 0U, 0U, 0U}, 0U, false, {}, data).valid,
+			"a command went through before the reset recovery was done");
+
+		// The reset leaves them halted, but now the CLEAR_FEATUREs finish the recovery
+		check(massStorageReset(), "the Bulk-Only Mass Storage Reset was refused");
+		check(usb::core::epHalted(dataIn) && usb::core::epHalted(dataOut),
+			"the Bulk-Only Mass Storage Reset unhalted the endpoints by itself");
+		clearFeature(dataIn);
+		clearFeature(dataOut);
+		check(!usb::core::epHalted(dataIn) && !usb::core::epHalted(dataOut),
+			"CLEAR_FEATURE after the reset didn't unhalt the endpoints");
+		const auto status{transact({uint8_t(scsiCommand_t::testUnitReady), 0U, 0U, 0U, 0U, 0U}, 0U, false, {}, data)};
+		check(status.valid && status.status == cswStatus_t::passed, "commands didn't work after the reset recovery");
+	}
+} // namespace test
+
+namespace usb::core
+{
+	void registerHandler(const usbEP_t ep, uint8_t, const handler_t handler) noexcept
+	{
+		if (ep.dir() == endpointDir_t::controllerIn)
+			inHandlers[ep.endpoint()] = handler;
+		else
+			outHandlers[ep.endpoint()] = handler;
+	}
+
+	void registerSOFHandler(uint16_t, const sofHandler_t handler) noexcept { sofHandler = handler; }
+	void unregsiterSOFHandler(uint16_t) noexcept { sofHandler = nullptr; }
+
+	bool writeEP(const uint8_t endpoint) noexcept
+	{
+		auto &epStatus{epStatusControllerIn[endpoint]};
+		test::check(!test::inPending, "writeEP() called with the last packet still waiting to go");
+		const auto amount{std::min<uint16_t>(epStatus.transferCount, epBufferSize)};
+		const auto *const data{static_cast<const uint8_t *>(epStatus.memBuffer)};
+		test::inPacket.assign(data, data + amount);
+		epStatus.memBuffer = data + amount;
+		epStatus.transferCount = uint16_t(epStatus.transferCount - amount);
+		test::inPending = true;
+		return true;
+	}
+
+	bool readEP(const uint8_t endpoint) noexcept
+	{
+		auto &epStatus{epStatusControllerOut[endpoint]};
+		test::check(test::outPending, "readEP() called with no packet waiting");
+		const auto count{std::min<std::size_t>(test::outPacket.size(), epStatus.transferCount)};
+		std::memcpy(epStatus.memBuffer, test::outPacket.data(), count);
+		epStatus.memBuffer = static_cast<uint8_t *>(epStatus.memBuffer) + count;
+		epStatus.transferCount = uint16_t(epStatus.transferCount - count);
+		test::outPending = false;
+		return !epStatus.transferCount;
+	}
+
+	// These track the halt and wedge as core.cxx does, with the controller's STALL left to send() and collect()
+	void clearHaltEP(const usbEP_t endpoint) noexcept
+	{
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+			epStatusControllerIn[endpoint.endpoint()].halted(false);
+		else
+			epStatusControllerOut[endpoint.endpoint()].halted(false);
+		unwedgeEP(endpoint);
+	}
+
+	bool epHalted(const usbEP_t endpoint) noexcept
+	{
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+			return epStatusControllerIn[endpoint.endpoint()].halted();
+		return epStatusControllerOut[endpoint.endpoint()].halted();
+	}
+
+	void wedgeEP(const usbEP_t endpoint) noexcept
+	{
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+		{
+			epStatusControllerIn[endpoint.endpoint()].halted(true);
+			epStatusControllerIn[endpoint.endpoint()].wedged(true);
+		}
+		else
+		{
+			epStatusControllerOut[endpoint.endpoint()].halted(true);
+			epStatusControllerOut[endpoint.endpoint()].wedged(true);
+		}
+	}
+
+	void unwedgeEP(const usbEP_t endpoint) noexcept
+	{
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+			epStatusControllerIn[endpoint.endpoint()].wedged(false);
+		else
+			epStatusControllerOut[endpoint.endpoint()].wedged(false);
+	}
+
+	bool epWedged(const usbEP_t endpoint) noexcept
+	{
+		if (endpoint.dir() == endpointDir_t::controllerIn)
+			return epStatusControllerIn[endpoint.endpoint()].wedged();
+		return epStatusControllerOut[endpoint.endpoint()].wedged();
+	}
+} // namespace usb::core
+
+namespace usb::device
+{
+	void registerHandler(uint8_t, uint8_t, const controlHandler_t handler) noexcept { controlHandler = handler; }
+} // namespace usb::device
+
+int main(int, char **)
+{
+	using namespace test;
+	usb::msc::registerHandlers(interface, 1U, endpoints, device, inquiry);
+	usb::core::outHandlers[endpoints.dataOut].init(endpoints.dataOut);
+
+	testInquiry();
+	testCapacity();
+	testReadWrite();
+	testResetRecovery();
+
+	if (failures)
+		std::printf("%u checks failed\n", failures);
+	return failures ? 1 : 0;
+}
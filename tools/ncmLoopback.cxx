@@ -0,0 +1,404 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/*
+ * Host side test of the CDC-NCM driver, built and run by hostTests.py. The driver is given a loopback
+ * netif that transmits every frame it receives straight back, and a simulated host sends it NTBs a
+ * packet at a time then unpacks the NTBs that come back, checking every frame arrives intact and in
+ * order, NTBs are sequenced, and transfers that end on a full packet are ended with a ZLP.
+ *
+ * Usage: ncmLoopback
+ * Prints one line per check that fails and exits non-zero if any did.
+ */
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "../src/drivers/cdcNCM.cxx"
+
+namespace usb::core
+{
+	std::array<usb::types::usbEPStatus_t<const void>, endpointCount> epStatusControllerIn{};
+	std::array<usb::types::usbEPStatus_t<void>, endpointCount> epStatusControllerOut{};
+	static sofHandler_t sofHandler{nullptr};
+	static std::array<handler_t, endpointCount> inHandlers{};
+	static std::array<handler_t, endpointCount> outHandlers{};
+} // namespace usb::core
+
+namespace usb::device
+{
+	usb::types::setupPacket_t packet{};
+	callback_t setupCallback{nullptr};
+	static altModeHandler_t altModeHandler{nullptr};
+} // namespace usb::device
+
+namespace test
+{
+	using namespace usb::cdc::ncm::types;
+
+	constexpr static usb::cdc::ncm::endpoints_t endpoints{1U, 2U, 2U};
+	constexpr static uint16_t packetSize{usb::constants::epBufferSize};
+
+	static uint32_t failures{};
+
+	static void check(const bool ok, const char *const what) noexcept
+	{
+		if (ok)
+			return;
+		std::printf("FAIL: %s\n", what);
+		++failures;
+	}
+
+	// The packet written to each IN endpoint that the host is yet to collect
+	static std::array<std::vector<uint8_t>, usb::constants::endpointCount> inPackets{};
+	static std::array<bool, usb::constants::endpointCount> inPending{};
+	// The packet the host is sending on the OUT endpoint
+	static std::vector<uint8_t> outPacket{};
+
+	// Frames the loopback netif has handed to the driver to send, held till transmitted() says they're done
+	struct loopedFrame_t final
+	{
+		std::vector<uint8_t> data;
+		usb::cdc::ncm::segment_t segments[3];
+		bool inUse;
+	};
+	static std::array<loopedFrame_t, 32> loopedFrames{};
+	static uint32_t framesRejected{};
+	static uint32_t framesReturned{};
+
+	// Split each frame over up to three segments, one longer than a multi-part entry, to exercise the part splitting
+	static void loopbackReceive(const uint8_t *const frame, const uint16_t length)
+	{
+		for (auto &looped : loopedFrames)
+		{
+			if (looped.inUse)
+				continue;
+			looped.data.assign(frame, frame + length);
+			const auto first{uint16_t(std::min<uint16_t>(length, 14U))};
+			const auto second{uint16_t(std::min<uint16_t>(uint16_t(length - first), 300U))};
+			looped.segments[0] = {looped.data.data(), first};
+			looped.segments[1] = {looped.data.data() + first, second};
+			looped.segments[2] = {looped.data.data() + first + second, uint16_t(length - first - second)};
+			const auto count{uint8_t(looped.segments[2].length ? 3U : looped.segments[1].length ? 2U : 1U)};
+			if (usb::cdc::ncm::transmit(looped.segments, count, &looped))
+				looped.inUse = true;
+			else
+				++framesRejected;
+			return;
+		}
+		++framesRejected;
+	}
+
+	static void loopbackTransmitted(const void *const context)
+	{
+		auto &looped{*static_cast<loopedFrame_t *>(const_cast<void *>(context))};
+		check(looped.inUse, "transmitted() handed back a frame that wasn't in flight");
+		looped.inUse = false;
+		++framesReturned;
+	}
+
+	constexpr static usb::cdc::ncm::netif_t loopback{loopbackReceive, loopbackTransmitted};
+
+	static std::vector<uint8_t> makeFrame(const uint16_t length, const uint8_t seed)
+	{
+		std::vector<uint8_t> frame(length);
+		for (uint16_t i{}; i < length; ++i)
+			frame[i] = uint8_t(seed + i * 13U + (i >> 8U));
+		return frame;
+	}
+
+	static void put16(std::vector<uint8_t> &buffer, const std::size_t offset, const uint16_t value)
+	{
+		buffer[offset] = uint8_t(value);
+		buffer[offset + 1U] = uint8_t(value >> 8U);
+	}
+
+	static void put32(std::vector<uint8_t> &buffer, const std::size_t offset, const uint32_t value)
+	{
+		put16(buffer, offset, uint16_t(value));
+		put16(buffer, offset + 2U, uint16_t(value >> 16U));
+	}
+
+	static uint16_t get16(const std::vector<uint8_t> &buffer, const std::size_t offset)
+		{ return uint16_t(buffer[offset] | (buffer[offset + 1U] << 8U)); }
+	static uint32_t get32(const std::vector<uint8_t> &buffer, const std::size_t offset)
+		{ return get16(buffer, offset) | (uint32_t{get16(buffer, offset + 2U)} << 16U); }
+
+	// Builds an NTB as a host would, with the NDP at the end after the datagrams
+	static std::vector<uint8_t> makeNTB(const std::vector<std::vector<uint8_t>> &frames, const uint16_t sequence)
+	{
+		std::vector<uint8_t> ntb(sizeof(nth16_t));
+		std::vector<std::pair<uint16_t, uint16_t>> datagrams{};
+		for (const auto &frame : frames)
+		{
+			ntb.resize((ntb.size() + 3U) & ~std::size_t{3U});
+			datagrams.emplace_back(uint16_t(ntb.size()), uint16_t(frame.size()));
+			ntb.insert(ntb.end(), frame.begin(), frame.end());
+		}
+		ntb.resize((ntb.size() + 3U) & ~std::size_t{3U});
+		const auto ndpIndex{uint16_t(ntb.size())};
+		const auto ndpLength{uint16_t(sizeof(ndp16_t) + (datagrams.size() + 1U) * sizeof(datagramPointer16_t))};
+		ntb.resize(ntb.size() + ndpLength);
+		put32(ntb, ndpIndex, ndp16Signature);
+		put16(ntb, ndpIndex + 4U, ndpLength);
+		put16(ntb, ndpIndex + 6U, 0U);
+		for (std::size_t datagram{}; datagram < datagrams.size(); ++datagram)
+		{
+			put16(ntb, ndpIndex + 8U + datagram * 4U, datagrams[datagram].first);
+			put16(ntb, ndpIndex + 10U + datagram * 4U, datagrams[datagram].second);
+		}
+		put32(ntb, 0U, nth16Signature);
+		put16(ntb, 4U, sizeof(nth16_t));
+		put16(ntb, 6U, sequence);
+		put16(ntb, 8U, uint16_t(ntb.size()));
+		put16(ntb, 10U, ndpIndex);
+		return ntb;
+	}
+
+	// Sends an NTB to the device a packet at a time, ending it with a ZLP if it's a whole number of packets
+	static void sendNTB(const std::vector<uint8_t> &ntb)
+	{
+		std::size_t offset{};
+		do
+		{
+			const auto length{std::min<std::size_t>(ntb.size() - offset, packetSize)};
+			outPacket.assign(ntb.begin() + std::ptrdiff_t(offset), ntb.begin() + std::ptrdiff_t(offset + length));
+			offset += length;
+			usb::core::outHandlers[endpoints.dataOut].handlePacket(endpoints.dataOut);
+			if (length < packetSize)
+				break;
+		}
+		while (offset <= ntb.size() && offset < usb::cdc::ncm::ntbSize);
+	}
+
+	// The IN transfers the host has received on the data endpoint so far, and the one being received
+	static std::vector<std::vector<uint8_t>> received{};
+	static std::vector<uint8_t> receiving{};
+	static uint32_t zlps{};
+
+	// Collects the packets waiting on the IN endpoints, as the host would, and tells the driver they went
+	static bool collect()
+	{
+		bool moved{false};
+		for (const auto endpoint : {endpoints.notification, endpoints.dataIn})
+		{
+			if (!inPending[endpoint])
+				continue;
+			inPending[endpoint] = false;
+			moved = true;
+			const auto packet{inPackets[endpoint]};
+			if (endpoint == endpoints.dataIn)
+			{
+				receiving.insert(receiving.end(), packet.begin(), packet.end());
+				if (packet.size() < packetSize)
+				{
+					if (packet.empty())
+						++zlps;
+					if (!receiving.empty())
+						received.push_back(receiving);
+					receiving.clear();
+				}
+			}
+			usb::core::inHandlers[endpoint].handlePacket(endpoint);
+		}
+		return moved;
+	}
+
+	static void run(const uint32_t frames)
+	{
+		for (uint32_t frame{}; frame < frames; ++frame)
+		{
+			while (collect())
+				continue;
+			if (usb::core::sofHandler)
+				usb::core::sofHandler();
+		}
+		while (collect())
+			continue;
+	}
+
+	// Unpacks the NTBs received, checking their framing, and returns the frames they held
+	static std::vector<std::vector<uint8_t>> unpack(uint16_t &sequence)
+	{
+		std::vector<std::vector<uint8_t>> frames{};
+		for (const auto &ntb : received)
+		{
+			if (ntb.size() < sizeof(nth16_t) + sizeof(ndp16_t))
+			{
+				check(false, "received a transfer too short to be an NTB");
+				continue;
+			}
+			check(get32(ntb, 0U) == nth16Signature, "NTH signature wrong");
+			check(get16(ntb, 4U) == sizeof(nth16_t), "NTH header length wrong");
+			check(get16(ntb, 6U) == sequence++, "NTB sequence numbers out of order");
+			check(get16(ntb, 8U) == ntb.size(), "NTH block length doesn't match the transfer");
+			const auto ndpIndex{get16(ntb, 10U)};
+			check(ndpIndex % 4U == 0U && ndpIndex + sizeof(ndp16_t) <= ntb.size(), "NDP misplaced");
+			check(get32(ntb, ndpIndex) == ndp16Signature, "NDP signature wrong");
+			for (auto entry{std::size_t(ndpIndex + sizeof(ndp16_t))}; entry + 4U <= ntb.size(); entry += 4U)
+			{
+				const auto index{get16(ntb, entry)};
+				const auto length{get16(ntb, entry + 2U)};
+				if (!index || !length)
+					break;
+				check(index % 4U == 0U, "datagram not aligned");
+				check(std::size_t{index} + length <= ntb.size(), "datagram runs off the end of the NTB");
+				if (std::size_t{index} + length <= ntb.size())
+					frames.emplace_back(ntb.begin() + index, ntb.begin() + index + length);
+			}
+		}
+		return frames;
+	}
+
+	// SET_INTERFACE on the data interface, as the core would hand it to the driver
+	static bool setInterface(const uint8_t alternate)
+	{
+		const std::array<uint8_t, 8> data{0x01U, 11U, alternate, 0U, 1U, 0U, 0U, 0U};
+		std::memcpy(&usb::device::packet, data.data(), data.size());
+		return usb::device::altModeHandler();
+	}
+
+	static void reset()
+	{
+		received.clear();
+		receiving.clear();
+		zlps = 0U;
+		framesRejected = 0U;
+		framesReturned = 0U;
+	}
+
+	// Round trips the frames given, sent as NTBs of the sizes given, and checks they all come back
+	static void roundTrip(const char *const name, const std::vector<std::vector<uint8_t>> &frames,
+		const std::vector<std::size_t> &ntbFrames, uint16_t &outSequence, uint16_t &inSequence)
+	{
+		std::printf("%s\n", name);
+		reset();
+		std::size_t sent{};
+		for (const auto count : ntbFrames)
+		{
+			sendNTB(makeNTB({frames.begin() + std::ptrdiff_t(sent),
+				frames.begin() + std::ptrdiff_t(sent + count)}, outSequence++));
+			sent += count;
+			run(1U);
+		}
+		run(usb::cdc::ncm::aggregationTimeout + 4U);
+		check(!framesRejected, "the driver refused a frame");
+		check(framesReturned == frames.size(), "not every frame was handed back through transmitted()");
+		check(receiving.empty(), "an IN transfer was left unterminated");
+		const auto returned{unpack(inSequence)};
+		check(returned == frames, "the frames that came back don't match those sent");
+	}
+} // namespace test
+
+namespace usb::core
+{
+	void registerHandler(const usbEP_t ep, uint8_t, const handler_t handler) noexcept
+	{
+		if (ep.dir() == endpointDir_t::controllerIn)
+			inHandlers[ep.endpoint()] = handler;
+		else
+			outHandlers[ep.endpoint()] = handler;
+	}
+
+	void registerSOFHandler(uint16_t, const sofHandler_t handler) noexcept { sofHandler = handler; }
+	void unregsiterSOFHandler(uint16_t) noexcept { sofHandler = nullptr; }
+
+	// Walks multi-part tables the way the platform writers do, a part at a time from partNumber
+	bool writeEP(const uint8_t endpoint) noexcept
+	{
+		auto &epStatus{epStatusControllerIn[endpoint]};
+		auto &packet{test::inPackets[endpoint]};
+		test::check(!test::inPending[endpoint], "writeEP() called with the last packet still waiting to go");
+		const auto sendCount{std::min(epStatus.transferCount, test::packetSize)};
+		packet.clear();
+		if (!epStatus.isMultiPart())
+		{
+			const auto *const data{static_cast<const uint8_t *>(epStatus.memBuffer)};
+			if (sendCount)
+				packet.assign(data, data + sendCount);
+			epStatus.memBuffer = data + sendCount;
+		}
+		else
+		{
+			if (!epStatus.memBuffer)
+				epStatus.memBuffer = epStatus.partsData.part(0).descriptor;
+			while (packet.size() < sendCount)
+			{
+				const auto &part{epStatus.partsData.part(epStatus.partNumber)};
+				const auto *const begin{static_cast<const uint8_t *>(part.descriptor)};
+				const auto *data{static_cast<const uint8_t *>(epStatus.memBuffer)};
+				const auto amount{std::min<std::size_t>(part.length - std::size_t(data - begin),
+					sendCount - packet.size())};
+				packet.insert(packet.end(), data, data + amount);
+				data += amount;
+				epStatus.memBuffer = data;
+				if (std::size_t(data - begin) == part.length && epStatus.partNumber + 1 < epStatus.partsData.count())
+					epStatus.memBuffer = epStatus.partsData.part(++epStatus.partNumber).descriptor;
+			}
+			if (epStatus.transferCount == sendCount)
+				epStatus.isMultiPart(false);
+		}
+		epStatus.transferCount = uint16_t(epStatus.transferCount - sendCount);
+		test::inPending[endpoint] = true;
+		return !epStatus.transferCount;
+	}
+
+	bool readEP(const uint8_t endpoint) noexcept
+	{
+		auto &epStatus{epStatusControllerOut[endpoint]};
+		const auto count{std::min<std::size_t>(test::outPacket.size(), epStatus.transferCount)};
+		std::memcpy(epStatus.memBuffer, test::outPacket.data(), count);
+		epStatus.memBuffer = static_cast<uint8_t *>(epStatus.memBuffer) + count;
+		epStatus.transferCount = uint16_t(epStatus.transferCount - count);
+		return !epStatus.transferCount;
+	}
+} // namespace usb::core
+
+namespace usb::device
+{
+	void registerHandler(uint8_t, uint8_t, controlHandler_t) noexcept { }
+	void registerAltModeHandler(uint8_t, uint8_t, const altModeHandler_t handler) noexcept
+		{ altModeHandler = handler; }
+} // namespace usb::device
+
+int main(int, char **)
+{
+	using namespace test;
+	usb::cdc::ncm::registerHandlers(0U, 1U, endpoints, loopback);
+
+	// Nothing may be sent till the host selects the data interface's alternate setting 1
+	check(!usb::cdc::ncm::transmit(loopedFrames[0].segments, 1U, nullptr), "transmit() took a frame while inactive");
+	check(setInterface(1U), "SET_INTERFACE to alternate setting 1 refused");
+	usb::core::inHandlers[endpoints.notification].init(endpoints.notification);
+	usb::core::outHandlers[endpoints.dataOut].init(endpoints.dataOut);
+	usb::cdc::ncm::linkState(true);
+	run(4U);
+
+	uint16_t outSequence{};
+	uint16_t inSequence{};
+	roundTrip("single frame", {makeFrame(60U, 1U)}, {1U}, outSequence, inSequence);
+
+	// A 28 byte header and a 36 byte frame make exactly one packet, which must be followed by a ZLP
+	roundTrip("NTB of a whole number of packets", {makeFrame(36U, 2U)}, {1U}, outSequence, inSequence);
+	check(zlps == 1U, "an NTB ending on a full packet wasn't ended with a ZLP");
+
+	roundTrip("mixed sizes in one NTB", {makeFrame(60U, 3U), makeFrame(1514U, 4U), makeFrame(255U, 5U),
+		makeFrame(61U, 6U)}, {4U}, outSequence, inSequence);
+
+	// More frames than fit in one NTB, arriving across several host NTBs, must be spread over as many as needed
+	std::vector<std::vector<uint8_t>> many{};
+	for (uint8_t frame{}; frame < usb::cdc::ncm::maxDatagrams * 2U + 1U; ++frame)
+		many.push_back(makeFrame(uint16_t(60U + frame * 7U), frame));
+	roundTrip("more frames than maxDatagrams", many, {many.size() / 2U, many.size() - many.size() / 2U},
+		outSequence, inSequence);
+
+	// Dropping back to alternate setting 0 must hand back anything still queued
+	std::printf("deactivation\n");
+	reset();
+	sendNTB(makeNTB({makeFrame(100U, 7U)}, outSequence++));
+	check(setInterface(0U), "SET_INTERFACE to alternate setting 0 refused");
+	check(framesReturned == 1U, "frames queued when the interface was disabled weren't handed back");
+	check(!usb::cdc::ncm::active(), "the driver still reports itself active after alternate setting 0");
+
+	if (failures)
+		std::printf("%u checks failed\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: BSD-3-Clause
+from argparse import ArgumentParser
+from pathlib import Path
+from struct import Struct
+from sys import exit, stderr
+
+parser = ArgumentParser(
+	description = 'Decodes a binary dump of dragonUSB\'s event trace ring (usb::trace::ring) into a timeline',
+	allow_abbrev = False
+)
+parser.add_argument('dump', type = Path, metavar = 'dumpFile',
+	help = 'Binary dump of usb::trace::ring, eg from gdb\'s `dump binary value trace.bin usb::trace::ring`')
+parser.add_argument('--all', action = 'store_true', dest = 'showAll',
+	help = 'Show every record in the ring, even if it has not yet been written to')
+args = parser.parse_args()
+
+header = Struct('<IHH')
+record = Struct('<IBBH')
+ringMagic = 0x43525455
+
+# These must be kept in sync with usb::types::deviceState_t, usb::types::ctrlState_t and usb::trace::event_t
+deviceStates = ('detached', 'attached', 'powered', 'waiting', 'addressing', 'addressed', 'configured')
+ctrlStates = ('idle', 'wait', 'dataTX', 'dataRX', 'statusTX', 'statusRX')
+events = {
+	0x01: 'deviceState',
+	0x02: 'ctrlState',
+	0x03: 'setupPacket',
+	0x04: 'needsArming',
+	0x05: 'stall',
+	0x06: 'setupCallback',
+	0x07: 'reset',
+	0x08: 'suspend',
+	0x09: 'resume',
+	0x0A: 'setConfiguration',
+	0x0B: 'setInterface',
+	0x0C: 'remoteWakeup',
+	0x0D: 'linkSleep',
+	0x0E: 'linkWake',
+}
+requests = ('GET_STATUS', 'CLEAR_FEATURE', 'req2', 'SET_FEATURE', 'req4', 'SET_ADDRESS', 'GET_DESCRIPTOR',
+	'SET_DESCRIPTOR', 'GET_CONFIGURATION', 'SET_CONFIGURATION', 'GET_INTERFACE', 'SET_INTERFACE', 'SYNCH_FRAME')
+requestTypes = ('standard', 'class', 'vendor', 'reserved')
+recipients = ('device', 'interface', 'endpoint', 'other')
+
+def lookup(table, value):
+	if value < len(table):
+		return table[value]
+	return f'<unknown {value}>'
+
+def decodeEndpoint(endpoint):
+	direction = 'IN' if endpoint & 0x80 else 'OUT'
+	return f'EP{endpoint & 0x0F} {direction}'
+
+def decodePayload(event, payload):
+	if event == 'deviceState':
+		return lookup(deviceStates, payload)
+	elif event == 'ctrlState':
+		return lookup(ctrlStates, payload)
+	elif event == 'setupPacket':
+		requestType = payload & 0xFF
+		request = payload >> 8
+		direction = 'IN' if requestType & 0x80 else 'OUT'
+		kind = requestTypes[(requestType >> 5) & 0x03]
+		recipient = lookup(recipients, requestType & 0x1F)
+		name = lookup(requests, request) if kind == 'standard' else f'request {request}'
+		return f'{direction} {kind} {recipient} {name}'
+	elif event in ('needsArming', 'stall'):
+		return 'true' if payload else 'false'
+	elif event == 'setConfiguration':
+		return f'config {payload}'
+	elif event == 'setInterface':
+		return f'interface {payload & 0xFF} alt {payload >> 8}'
+	elif event == 'remoteWakeup':
+		return f'bus resumed after {payload * 10}us'
+	elif event == 'linkSleep':
+		return f'L1, BESL {payload}'
+	return ''
+
+def readRing(data):
+	if len(data) < header.size:
+		raise ValueError('dump is too short to contain a trace ring')
+	magic, entries, head = header.unpack_from(data, 0)
+	if magic != ringMagic:
+		raise ValueError(f'bad trace ring magic {magic:#010x}, is this really a dump of usb::trace::ring?')
+	if len(data) < header.size + entries * record.size:
+		raise ValueError(f'dump is truncated, expected {entries} records')
+	records = [record.unpack_from(data, header.size + index * record.size) for index in range(entries)]
+	return entries, head, records
+
+def timeline(entries, head, records):
+	# head is the free-running count of records written, so work out which is the oldest still in the ring
+	count = entries if args.showAll else min(head, entries)
+	first = (head - count) & 0xFFFF
+	for index in range(count):
+		yield records[(first + index) % entries]
+
+try:
+	entries, head, records = readRing(args.dump.read_bytes())
+except (OSError, ValueError) as error:
+	print(f'Error: {error}', file = stderr)
+	exit(1)
+
+print(f'{head} records written, ring holds {entries}')
+lastTimestamp = None
+for timestamp, eventID, endpoint, payload in timeline(entries, head, records):
+	event = events.get(eventID, f'<unknown event {eventID}>')
+	# Timestamps are a free-running 32-bit microsecond counter, so account for it wrapping
+	delta = 0 if lastTimestamp is None else (timestamp - lastTimestamp) & 0xFFFFFFFF
+	lastTimestamp = timestamp
+	print(f'{timestamp:>10}us (+{delta:>8}us) {decodeEndpoint(endpoint):<8} {event:<16} ' +
+		decodePayload(event, payload))